@@ -0,0 +1,104 @@
+#ifndef BENCHUTILS_HPP
+#define BENCHUTILS_HPP
+
+#include <benchmark/benchmark.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <random>
+#include <vector>
+
+/*
+    LatencyRecorder class:
+
+    Google Benchmark only reports the mean time per iteration. This helper keeps the latency 
+    of every measured operation (of one thread) and exports some percentiles as counters of 
+    the benchmark, averaged over the threads of the run.
+*/
+
+class LatencyRecorder
+{
+  public:
+
+    explicit LatencyRecorder(std::size_t expected = 1 << 20)
+    {
+        m_samples.reserve(expected);
+    }
+
+    // Measure the latency of one operation and return its result
+    template <typename Operation>
+    auto measure(Operation&& operation) -> decltype(operation())
+    {
+        auto start = std::chrono::steady_clock::now();
+        auto result = operation();
+        auto stop = std::chrono::steady_clock::now();
+        m_samples.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(stop - start).count());
+        return result;
+    }
+
+    // Add the p50, p99 and p99.9 latencies (in nanoseconds) to the counters of the benchmark
+    void report(benchmark::State& state)
+    {
+        if(m_samples.empty())
+        {
+            return;
+        }
+        std::sort(m_samples.begin(), m_samples.end());
+        state.counters["p50_ns"] = benchmark::Counter(percentile(0.50), benchmark::Counter::kAvgThreads);
+        state.counters["p99_ns"] = benchmark::Counter(percentile(0.99), benchmark::Counter::kAvgThreads);
+        state.counters["p999_ns"] = benchmark::Counter(percentile(0.999), benchmark::Counter::kAvgThreads);
+    }
+
+  private:
+
+    double percentile(double p) const
+    {
+        std::size_t index = static_cast<std::size_t>(p * (m_samples.size() - 1));
+        return static_cast<double>(m_samples[index]);
+    }
+
+    std::vector<std::int64_t> m_samples;
+};
+
+/*
+    ZipfGenerator class:
+
+    Random account numbers from 0 to n-1 following a Zipf distribution: the account k is chosen
+    with a probability proportional to 1/(k+1)^s. With s around 1, a few accounts receive most
+    of the operations (hot spots), as in real banks. With s = 0 it is uniform.
+*/
+
+class ZipfGenerator
+{
+  public:
+
+    ZipfGenerator(int n, double s, std::uint32_t seed = 1234)
+        : m_random(seed), m_cdf(n)
+    {
+        double sum = 0;
+        for(int k = 0; k < n; ++k)
+        {
+            sum += 1.0 / std::pow(k + 1, s);
+            m_cdf[k] = sum;
+        }
+        for(auto& value : m_cdf)
+        {
+            value /= sum;
+        }
+    }
+
+    int operator()()
+    {
+        double p = std::uniform_real_distribution<double>(0.0, 1.0)(m_random);
+        auto it = std::lower_bound(m_cdf.begin(), m_cdf.end(), p);
+        return it == m_cdf.end() ? static_cast<int>(m_cdf.size()) - 1 : static_cast<int>(it - m_cdf.begin());
+    }
+
+  private:
+
+    std::mt19937 m_random;
+    std::vector<double> m_cdf;
+};
+
+#endif
@@ -0,0 +1,293 @@
+#include <benchmark/benchmark.h>
+#include <gmock/gmock.h>
+#include "AtmMachine.hpp"
+#include "BasicAtmMachine.hpp"
+#include "BenchUtils.hpp"
+#include "InMemoryBankServer.hpp"
+#include "LedgerRecovery.hpp"
+#include "MockBankServer.hpp"
+#include "WithdrawLedger.hpp"
+#include <atomic>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+using ::testing::NiceMock;
+using ::testing::Invoke;
+using ::testing::_;
+
+//--------------------------------------------------------------------------------------------------
+// BACKENDS
+//
+// Every backend is shared by all the threads of a benchmark run. The accounts with a negative
+// number have no money, so they are used for the insufficient-funds path.
+namespace
+{
+    const int accounts_per_thread = 1024;
+    const int rich_balance = INT_MAX / 2;
+
+    // Every call to the mock counts as a round-trip with the server
+    std::atomic<long> mock_round_trips(0);
+
+    MockBankServer& mock_backend()
+    {
+        static NiceMock<MockBankServer>* mock_bankserver = []()
+        {
+            auto mock = new NiceMock<MockBankServer>();
+            ON_CALL(*mock, Connect).WillByDefault(Invoke([]() { mock_round_trips++; }));
+            ON_CALL(*mock, Disconnect).WillByDefault(Invoke([]() { mock_round_trips++; }));
+            ON_CALL(*mock, Debit).WillByDefault(Invoke([](int, int) { mock_round_trips++; }));
+            ON_CALL(*mock, GetBalance).WillByDefault(Invoke([](int account_number) 
+            { 
+                mock_round_trips++;
+                return account_number < 0 ? 0 : rich_balance; 
+            }));
+            // It lives until the end of the program
+            ::testing::Mock::AllowLeak(mock);
+            return mock;
+        }();
+        return *mock_bankserver;
+    }
+
+    InMemoryBankServer& in_memory_backend()
+    {
+        static InMemoryBankServer bankserver(1 << 20);
+        return bankserver;
+    }
+
+    // Account used by the iteration i of a thread: every thread has its own set of accounts
+    int account_for(const benchmark::State& state, long i, bool rich)
+    {
+        int account_number = state.thread_index() * accounts_per_thread + static_cast<int>(i % accounts_per_thread);
+        return rich ? account_number : -account_number - 1;
+    }
+
+    void fill_in_memory_backend(const benchmark::State& state)
+    {
+        if(state.thread_index() == 0)
+        {
+            for(int account_number = 0; account_number < state.threads() * accounts_per_thread; ++account_number)
+            {
+                in_memory_backend().OpenAccount(account_number, rich_balance);
+                in_memory_backend().OpenAccount(-account_number - 1, 0);
+            }
+        }
+    }
+}
+
+//--------------------------------------------------------------------------------------------------
+// SINGLE WITHDRAWALS: throughput (items_per_second) and latency percentiles
+//
+// Arg 1 = success path, Arg 0 = insufficient-funds path
+static void BM_Withdraw_Mock(benchmark::State& state)
+{
+    const bool rich = state.range(0) != 0;
+    AtmMachine atm_machine(&mock_backend());
+    LatencyRecorder latencies;
+    if(state.thread_index() == 0)
+    {
+        mock_round_trips = 0;
+    }
+
+    long i = 0;
+    for(auto _ : state)
+    {
+        int account_number = account_for(state, i++, rich);
+        bool result = latencies.measure([&]() { return atm_machine.withdraw(account_number, 1); });
+        benchmark::DoNotOptimize(result);
+    }
+
+    state.SetItemsProcessed(state.iterations());
+    latencies.report(state);
+    if(state.thread_index() == 0)
+    {
+        state.counters["round_trips_per_withdrawal"] = 
+            benchmark::Counter(static_cast<double>(mock_round_trips.load()) / (state.iterations() * state.threads()));
+    }
+}
+BENCHMARK(BM_Withdraw_Mock)->Arg(1)->Arg(0)->ThreadRange(1, 8)->UseRealTime();
+
+static void BM_Withdraw_InMemory(benchmark::State& state)
+{
+    const bool rich = state.range(0) != 0;
+    fill_in_memory_backend(state);
+    AtmMachine atm_machine(&in_memory_backend());
+    LatencyRecorder latencies;
+
+    long i = 0;
+    for(auto _ : state)
+    {
+        int account_number = account_for(state, i++, rich);
+        bool result = latencies.measure([&]() { return atm_machine.withdraw(account_number, 1); });
+        benchmark::DoNotOptimize(result);
+    }
+
+    state.SetItemsProcessed(state.iterations());
+    latencies.report(state);
+}
+BENCHMARK(BM_Withdraw_InMemory)->Arg(1)->Arg(0)->ThreadRange(1, 8)->UseRealTime();
+
+// All the threads withdrawing from the same (hot) account
+static void BM_Withdraw_InMemory_HotAccount(benchmark::State& state)
+{
+    if(state.thread_index() == 0)
+    {
+        in_memory_backend().OpenAccount(1234, rich_balance);
+    }
+    AtmMachine atm_machine(&in_memory_backend());
+    LatencyRecorder latencies;
+
+    for(auto _ : state)
+    {
+        bool result = latencies.measure([&]() { return atm_machine.withdraw(1234, 1); });
+        benchmark::DoNotOptimize(result);
+    }
+
+    state.SetItemsProcessed(state.iterations());
+    latencies.report(state);
+}
+BENCHMARK(BM_Withdraw_InMemory_HotAccount)->ThreadRange(1, 8)->UseRealTime();
+
+// The same single-thread success path, but with the backend bound at compile time
+static void BM_BasicWithdraw_InMemory(benchmark::State& state)
+{
+    fill_in_memory_backend(state);
+    BasicAtmMachine<InMemoryBankServer> atm_machine(&in_memory_backend());
+
+    long i = 0;
+    for(auto _ : state)
+    {
+        bool result = atm_machine.withdraw(account_for(state, i++, true), 1);
+        benchmark::DoNotOptimize(result);
+    }
+
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_BasicWithdraw_InMemory);
+
+//--------------------------------------------------------------------------------------------------
+// BATCHED WITHDRAWALS: one session for Arg withdrawals
+static void BM_WithdrawBatch_Mock(benchmark::State& state)
+{
+    AtmMachine atm_machine(&mock_backend());
+    std::vector<WithdrawRequest> requests(state.range(0), WithdrawRequest{1234, 1});
+    mock_round_trips = 0;
+
+    for(auto _ : state)
+    {
+        auto results = atm_machine.withdraw_batch(requests);
+        benchmark::DoNotOptimize(results);
+    }
+
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+    state.counters["round_trips_per_withdrawal"] = 
+        benchmark::Counter(static_cast<double>(mock_round_trips.load()) / (state.iterations() * state.range(0)));
+}
+BENCHMARK(BM_WithdrawBatch_Mock)->RangeMultiplier(16)->Range(1, 256);
+
+static void BM_WithdrawBatch_InMemory(benchmark::State& state)
+{
+    fill_in_memory_backend(state);
+    AtmMachine atm_machine(&in_memory_backend());
+    std::vector<WithdrawRequest> requests;
+    for(long i = 0; i < state.range(0); ++i)
+    {
+        requests.push_back(WithdrawRequest{account_for(state, i, true), 1});
+    }
+
+    for(auto _ : state)
+    {
+        auto results = atm_machine.withdraw_batch(requests);
+        benchmark::DoNotOptimize(results);
+    }
+
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_WithdrawBatch_InMemory)->RangeMultiplier(16)->Range(1, 256);
+
+//--------------------------------------------------------------------------------------------------
+// LEDGER: appends of withdraw outcomes from Arg threads, with the group commit working behind
+static void BM_LedgerAppend(benchmark::State& state)
+{
+    static WithdrawLedger* ledger = nullptr;
+    if(state.thread_index() == 0)
+    {
+        const char* tmp = std::getenv("TMPDIR");
+        ledger = new WithdrawLedger(std::string(tmp ? tmp : "/tmp") + "/atm_bench.ledger");
+    }
+
+    // The loop starts when all the threads are ready, so the ledger is already created
+    for(auto _ : state)
+    {
+        auto sequence = ledger->append(LedgerOperation::Withdraw, 1234, 1, 0, WithdrawOutcome::Success);
+        benchmark::DoNotOptimize(sequence);
+    }
+
+    state.SetItemsProcessed(state.iterations());
+    if(state.thread_index() == 0)
+    {
+        state.counters["commits"] = benchmark::Counter(static_cast<double>(ledger->commits()));
+        std::string directory = ledger->directory();
+        delete ledger;
+        ledger = nullptr;
+
+        // The next run starts with an empty ledger
+        LedgerScanner scanner(directory);
+        for(const auto& segment : scanner.segments())
+        {
+            std::remove(segment.c_str());
+        }
+    }
+}
+BENCHMARK(BM_LedgerAppend)->ThreadRange(1, 8)->UseRealTime();
+
+// RECOVERY: startup time against the size of the ledger (Arg records, after a snapshot of
+// 1024 accounts), replayed by Arg threads
+static void BM_Recovery(benchmark::State& state)
+{
+    const char* tmp = std::getenv("TMPDIR");
+    const std::string directory = std::string(tmp ? tmp : "/tmp") + "/atm_bench.recovery";
+    const int records = static_cast<int>(state.range(0));
+    {
+        InMemoryBankServer bankserver;
+        for(int account = 0; account < 1024; ++account)
+        {
+            bankserver.OpenAccount(account, rich_balance);
+        }
+        WithdrawLedger ledger(directory, 1 << 16);
+        LedgerRecovery(directory).snapshot(bankserver, 0);
+        for(int i = 0; i < records; ++i)
+        {
+            ledger.append(LedgerOperation::Withdraw, i % 1024, 1, 0, WithdrawOutcome::Success);
+        }
+    }
+
+    LedgerRecovery recovery(directory, static_cast<std::size_t>(state.range(1)));
+    LedgerRecovery::Report report = LedgerRecovery::Report();
+    for(auto _ : state)
+    {
+        InMemoryBankServer bankserver;
+        report = recovery.recover(bankserver);
+        benchmark::DoNotOptimize(report);
+    }
+
+    state.SetItemsProcessed(state.iterations() * records);
+    state.counters["ledger_MB"] = benchmark::Counter(static_cast<double>(report.ledger_bytes) / (1 << 20));
+    state.counters["segments"] = benchmark::Counter(static_cast<double>(report.segments));
+
+    // The next run starts with an empty ledger
+    for(const auto& snapshot : recovery.snapshots())
+    {
+        std::remove(snapshot.c_str());
+    }
+    LedgerScanner scanner(directory);
+    for(const auto& segment : scanner.segments())
+    {
+        std::remove(segment.c_str());
+    }
+}
+BENCHMARK(BM_Recovery)->ArgsProduct({{1 << 16, 1 << 20, 1 << 22}, {1, 4}})->UseRealTime()->Unit(benchmark::kMillisecond);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,109 @@
+#include <benchmark/benchmark.h>
+#include "AccountLocks.hpp"
+#include "BenchUtils.hpp"
+#include "InMemoryBankServer.hpp"
+#include "TransferEngine.hpp"
+#include <algorithm>
+#include <climits>
+#include <vector>
+
+//--------------------------------------------------------------------------------------------------
+// ACCOUNTS
+//
+// The transfers are between 10000 accounts with a lot of money, chosen uniformly (distribution
+// 0) or with a Zipf distribution (distribution 1: a few hot accounts are in most of them).
+namespace
+{
+    const int accounts = 10000;
+    const int rich_balance = INT_MAX / 2;
+
+    InMemoryBankServer& in_memory_backend()
+    {
+        static InMemoryBankServer bankserver(1 << 16);
+        static bool filled = []()
+        {
+            for(int account_number = 0; account_number < accounts; ++account_number)
+            {
+                bankserver.OpenAccount(account_number, rich_balance);
+            }
+            return true;
+        }();
+        (void)filled;
+        return bankserver;
+    }
+
+    // Shared by all the engines of a run, as in a real process
+    AccountLocks& account_locks()
+    {
+        static AccountLocks locks(4096);
+        return locks;
+    }
+
+    std::vector<TransferRequest> make_transfers(std::size_t count, bool zipf, std::uint32_t seed)
+    {
+        ZipfGenerator account(accounts, zipf ? 1.0 : 0.0, seed);
+        std::vector<TransferRequest> requests;
+        while(requests.size() < count)
+        {
+            int from = account();
+            int to = account();
+            if(from != to)
+            {
+                requests.push_back(TransferRequest{from, to, 1, 0});
+            }
+        }
+        return requests;
+    }
+}
+
+//--------------------------------------------------------------------------------------------------
+// BATCHES: 1024 transfers per batch, run by Arg(1) workers
+static void BM_TransferBatch_InMemory(benchmark::State& state)
+{
+    const bool zipf = state.range(0) != 0;
+    std::vector<BankServer*> sessions(state.range(1), &in_memory_backend());
+    TransferEngine transfer_engine(sessions, &account_locks());
+    auto requests = make_transfers(1024, zipf, 1234);
+
+    for(auto _ : state)
+    {
+        auto results = transfer_engine.transfer_batch(requests);
+        benchmark::DoNotOptimize(results);
+    }
+
+    auto waves = transfer_engine.plan_waves(requests);
+    state.SetItemsProcessed(state.iterations() * requests.size());
+    state.counters["waves"] = benchmark::Counter(static_cast<double>(*std::max_element(waves.begin(), waves.end()) + 1));
+}
+BENCHMARK(BM_TransferBatch_InMemory)
+    ->ArgNames({"zipf", "workers"})
+    ->ArgsProduct({{0, 1}, {1, 2, 4, 8}})
+    ->UseRealTime();
+
+//--------------------------------------------------------------------------------------------------
+// SINGLE TRANSFERS: every thread has its own engine, all of them with the same account locks.
+// The hot spots of the Zipf distribution make the threads wait for each other.
+static void BM_Transfer_InMemory(benchmark::State& state)
+{
+    const bool zipf = state.range(0) != 0;
+    TransferEngine transfer_engine({&in_memory_backend()}, &account_locks());
+    auto requests = make_transfers(1 << 16, zipf, 1234 + state.thread_index());
+    LatencyRecorder latencies;
+
+    std::size_t i = 0;
+    for(auto _ : state)
+    {
+        const TransferRequest& request = requests[i++ % requests.size()];
+        bool result = latencies.measure([&]()
+        {
+            return transfer_engine.transfer(request.from_account_number, request.to_account_number, request.value);
+        });
+        benchmark::DoNotOptimize(result);
+    }
+
+    state.SetItemsProcessed(state.iterations());
+    latencies.report(state);
+}
+BENCHMARK(BM_Transfer_InMemory)->ArgName("zipf")->Arg(0)->Arg(1)->ThreadRange(1, 8)->UseRealTime();
+
+BENCHMARK_MAIN();
@@ -0,0 +1,56 @@
+#ifndef ACCOUNTLOCKS_HPP
+#define ACCOUNTLOCKS_HPP
+
+#include <cstddef>
+#include <memory>
+#include <mutex>
+
+/*
+    AccountLocks class:
+
+    A striped table of mutexes to serialize the operations on the same account.
+
+    Every account number is mapped (hashed) to one of the stripes, so two operations on the
+    same account always take the same mutex, while operations on different accounts most
+    likely take different ones and can run in parallel. The number of stripes is fixed, so
+    the memory does not grow with the number of accounts.
+
+    Notice that: It must be shared by all the AtmMachine objects that work over the same
+    accounts (for example, all the ATM front-ends of the process), otherwise they would not
+    see the locks of each other.
+*/
+
+class AccountLocks
+{
+  public:
+
+    // The number of stripes is rounded up to a power of two
+    explicit AccountLocks(std::size_t stripes = 256);
+
+    AccountLocks(const AccountLocks&) = delete;
+    AccountLocks& operator=(const AccountLocks&) = delete;
+
+    // Index of the stripe used by an account
+    std::size_t stripe_of(int account_number) const;
+
+    // Mutex of a stripe, and mutex used by an account
+    std::mutex& stripe(std::size_t index) { return m_stripes[index].mutex; }
+    std::mutex& lock_for(int account_number) { return stripe(stripe_of(account_number)); }
+
+    std::size_t stripes() const { return m_mask + 1; }
+
+  private:
+
+    // Every mutex in its own cache line, so the threads working on different stripes
+    // don't fight for the same line (false sharing)
+    struct Stripe
+    {
+        std::mutex mutex;
+        char padding[64];
+    };
+
+    std::unique_ptr<Stripe[]> m_stripes;
+    std::size_t m_mask;
+};
+
+#endif
@@ -0,0 +1,36 @@
+#ifndef ASYNCBANKSERVER_HPP
+#define ASYNCBANKSERVER_HPP
+
+#include <exception>
+#include <functional>
+
+/*
+    AsyncBankOperations class:
+
+    Optional capability of a BankServer: asynchronous versions of GetBalance() and Debit().
+
+    The calls return immediately, and the result is given later (maybe in another thread, and 
+    not necessarily in the same order the calls were done) to a completion callback. If the 
+    operation fails, the callback receives the exception (error is not null).
+
+    It allows an AtmMachine to have many withdrawals in flight over the same session instead
+    of waiting for every round-trip (check AtmMachine::withdraw_async()).
+
+    Notice that: Like ConditionalDebit, it is not a BankServer itself. An asynchronous backend
+    inherits from both classes (Connect() and Disconnect() are still synchronous), and the 
+    clients check if it is available with a dynamic_cast.
+*/
+
+class AsyncBankOperations
+{
+  public:
+
+    using BalanceCallback = std::function<void(std::exception_ptr error, int balance)>;
+    using DebitCallback = std::function<void(std::exception_ptr error)>;
+
+    virtual ~AsyncBankOperations() {};
+    virtual void GetBalanceAsync(int account_number, BalanceCallback on_balance) = 0;
+    virtual void DebitAsync(int account_number, int value, DebitCallback on_debit) = 0;
+};
+
+#endif
@@ -0,0 +1,78 @@
+#ifndef ASYNCWITHDRAWPIPELINE_HPP
+#define ASYNCWITHDRAWPIPELINE_HPP
+
+#include "AsyncBankServer.hpp"
+#include "BasicAtmMachine.hpp"
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+/*
+    AsyncWithdrawPipeline class:
+
+    The state machine behind AtmMachine::withdraw_async(). It is not meant to be used directly.
+
+    It keeps up to max_in_flight withdrawals in flight over an already opened session:
+
+        GetBalanceAsync() --> (enough balance?) --> DebitAsync() --> withdrawal finished
+
+    and every time one finishes, the next one is started. Two withdrawals of the same account 
+    are never in flight at the same time (the second one waits until the first one finishes), 
+    so both can't pass the balance check with the same balance.
+
+    When the last withdrawal finishes, the session is closed (close_session) and on_done is
+    called, in the thread that completed the last operation.
+*/
+
+class AsyncWithdrawPipeline : public std::enable_shared_from_this<AsyncWithdrawPipeline>
+{
+  public:
+
+    using WithdrawCallback = std::function<void(std::size_t index, bool result, std::exception_ptr error)>;
+    using DoneCallback = std::function<void(std::exception_ptr error)>;
+    using CloseSession = std::function<void()>;
+
+    static void start(AsyncBankOperations* bankserver, 
+                      std::vector<WithdrawRequest> requests,
+                      std::size_t max_in_flight,
+                      WithdrawCallback on_withdraw, 
+                      DoneCallback on_done,
+                      CloseSession close_session);
+
+  private:
+
+    AsyncWithdrawPipeline(AsyncBankOperations* bankserver, 
+                          std::vector<WithdrawRequest> requests,
+                          std::size_t max_in_flight,
+                          WithdrawCallback on_withdraw, 
+                          DoneCallback on_done,
+                          CloseSession close_session);
+
+    void pump();
+    void issue(std::size_t index);
+    void on_balance(std::size_t index, std::exception_ptr error, int balance);
+    void finish(std::size_t index, bool result, std::exception_ptr error);
+    void close();
+
+    AsyncBankOperations* m_bankserver;
+    std::vector<WithdrawRequest> m_requests;
+    std::size_t m_max_in_flight;
+    WithdrawCallback m_on_withdraw;
+    DoneCallback m_on_done;
+    CloseSession m_close_session;
+
+    std::mutex m_mutex;
+    std::deque<std::size_t> m_ready;                                // Can be started now
+    std::unordered_map<int, std::deque<std::size_t>> m_waiting;     // Waiting for the same account
+    std::size_t m_in_flight;
+    std::size_t m_finished;
+    bool m_pumping;
+    bool m_pump_again;
+};
+
+#endif
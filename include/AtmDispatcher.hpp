@@ -0,0 +1,129 @@
+#ifndef ATMDISPATCHER_HPP
+#define ATMDISPATCHER_HPP
+
+#include "AccountLocks.hpp"
+#include "AtmMachine.hpp"
+#include "BankServer.hpp"
+#include "BankServerSessionPool.hpp"
+#include "MpmcRingBuffer.hpp"
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*
+    AtmDispatcher class:
+
+    Runs the withdrawals requested by many threads (for example, the network threads) in a pool
+    of worker threads, instead of every thread calling AtmMachine::withdraw() by itself.
+
+        * Every worker owns one BankServer session (one of the BankServer objects given in the
+          constructor), opened once when the worker starts and closed when it stops.
+        * Every worker has its own bounded lock-free queue (MpmcRingBuffer). A request goes to 
+          the queue of the worker of its account, so the same account is usually served by the 
+          same worker.
+        * When a worker has nothing to do, it steals requests from the queues of the others, so
+          the work is balanced even if most of the requests are for a few accounts.
+        * Back-pressure: try_submit() fails if the queues are full, submit() waits for room.
+        * Completion: a callback (called in the worker thread) or a std::future.
+
+    Notice that: Because of the work stealing, two workers can process the same account at the
+    same time, so the workers always use account locks (the given ones, or their own).
+*/
+
+class AtmDispatcher
+{
+  public:
+
+    using Callback = std::function<void(bool result, std::exception_ptr error)>;
+
+    // Counters of the dispatcher
+    struct Stats
+    {
+        std::uint64_t completed;
+        std::uint64_t stolen;       // Processed by a worker that was not the one of the account
+        std::uint64_t rejected;     // try_submit() calls that failed because of back-pressure
+    };
+
+    AtmDispatcher(const std::vector<BankServer*>& sessions, 
+                  std::size_t queue_capacity = 1024, 
+                  AccountLocks* account_locks = nullptr);
+
+    // It processes all the queued requests before returning
+    ~AtmDispatcher();
+
+    AtmDispatcher(const AtmDispatcher&) = delete;
+    AtmDispatcher& operator=(const AtmDispatcher&) = delete;
+
+    // Queue a withdrawal. It returns false if there is no room (or if the dispatcher is stopped)
+    bool try_submit(int account_number, int value, Callback on_done);
+
+    // Queue a withdrawal, waiting for room if the queues are full
+    void submit(int account_number, int value, Callback on_done);
+    std::future<bool> submit(int account_number, int value);
+
+    // Process all the queued requests and stop the workers. No more requests are accepted.
+    void stop();
+
+    std::size_t workers() const { return m_workers.size(); }
+    Stats stats() const;
+
+  private:
+
+    struct Request
+    {
+        int account_number;
+        int value;
+        Callback on_done;
+    };
+
+    // Counts a try_submit() or submit() in progress, so stop() can wait for it
+    struct Submitting
+    {
+        explicit Submitting(std::atomic<int>& count) : count(count) { count.fetch_add(1); }
+        ~Submitting() { count.fetch_sub(1); }
+        std::atomic<int>& count;
+    };
+
+    struct Worker
+    {
+        Worker(BankServer* session, std::size_t queue_capacity, AccountLocks* account_locks)
+            : pool({session}), atm_machine(&pool, account_locks), queue(queue_capacity)
+        {
+        }
+
+        BankServerSessionPool pool;     // Only one session: it is leased without reconnecting
+        AtmMachine atm_machine;
+        MpmcRingBuffer<Request> queue;
+        std::thread thread;
+    };
+
+    std::size_t worker_of(int account_number) const;
+    bool push(Request&& request);
+    bool pop(std::size_t worker, Request& request);
+    void run(std::size_t worker);
+
+    std::unique_ptr<AccountLocks> m_own_account_locks;
+    std::vector<std::unique_ptr<Worker>> m_workers;
+
+    std::atomic<bool> m_stopping;
+    std::atomic<int> m_submitting;
+    std::atomic<long> m_queued;     // It can be -1 for a moment (popped before counted)
+    std::atomic<std::uint64_t> m_completed;
+    std::atomic<std::uint64_t> m_stolen;
+    std::atomic<std::uint64_t> m_rejected;
+
+    // Only used to sleep the idle workers
+    std::mutex m_idle_mutex;
+    std::condition_variable m_idle;
+    std::atomic<int> m_sleeping;
+};
+
+#endif
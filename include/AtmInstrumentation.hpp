@@ -0,0 +1,213 @@
+#ifndef ATMINSTRUMENTATION_HPP
+#define ATMINSTRUMENTATION_HPP
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <vector>
+
+// Compile-time switch of the instrumentation (CMake option ATM_ENABLE_INSTRUMENTATION).
+// When it is 0, the recording points in AtmMachine are removed by the preprocessor.
+#ifndef ATM_INSTRUMENTATION
+#define ATM_INSTRUMENTATION 1
+#endif
+
+// The operations that are measured: the BankServer calls done by AtmMachine and the whole withdraw
+enum class AtmOperation
+{
+    Connect,
+    Disconnect,
+    GetBalance,
+    Debit,
+    TryDebit,
+    DoubleTransaction,
+    Credit,
+    Withdraw,
+    Count
+};
+
+// The results of the withdrawals
+enum class WithdrawOutcome
+{
+    Success,
+    InsufficientFunds,
+    Error,
+    Count
+};
+
+const char* to_string(AtmOperation operation);
+const char* to_string(WithdrawOutcome outcome);
+
+/*
+    LatencyHistogram class:
+
+    A log-linear (HDR-style) histogram of latencies in nanoseconds: every power of two is 
+    divided in 8 linear buckets, so any value is recorded with a relative error under 12.5%, 
+    from 1 ns to ~18 minutes, in a fixed and small number of buckets.
+
+    record() is lock-free (relaxed atomic increments). The percentiles are computed from a
+    snapshot (HistogramSnapshot).
+*/
+
+struct HistogramSnapshot
+{
+    std::vector<std::uint64_t> buckets;
+    std::uint64_t count;
+    std::uint64_t sum_ns;
+    std::uint64_t max_ns;
+
+    // Latency under which there are the p fraction (0.0 to 1.0) of the values
+    std::uint64_t percentile(double p) const;
+    double mean() const { return count == 0 ? 0.0 : static_cast<double>(sum_ns) / count; }
+
+    void merge(const HistogramSnapshot& other);
+};
+
+class LatencyHistogram
+{
+  public:
+
+    static const std::size_t sub_buckets = 8;
+    static const std::size_t max_magnitude = 40;
+    static const std::size_t bucket_count = (max_magnitude - 2) * sub_buckets;
+
+    LatencyHistogram();
+
+    void record(std::uint64_t latency_ns);
+    HistogramSnapshot snapshot() const;
+
+    static std::size_t bucket_of(std::uint64_t latency_ns);
+    static std::uint64_t lower_bound_of(std::size_t bucket);
+
+  private:
+
+    std::array<std::atomic<std::uint64_t>, bucket_count> m_buckets;
+    std::atomic<std::uint64_t> m_count;
+    std::atomic<std::uint64_t> m_sum_ns;
+    std::atomic<std::uint64_t> m_max_ns;
+};
+
+/*
+    InstrumentationSnapshot struct:
+
+    A copy of all the histograms and counters of an AtmInstrumentation at some moment.
+    export_text() writes it as a table (one line per operation, and the outcome counters).
+*/
+
+struct InstrumentationSnapshot
+{
+    std::array<HistogramSnapshot, static_cast<std::size_t>(AtmOperation::Count)> operations;
+    std::array<std::uint64_t, static_cast<std::size_t>(WithdrawOutcome::Count)> outcomes;
+
+    const HistogramSnapshot& operator[](AtmOperation operation) const 
+    { 
+        return operations[static_cast<std::size_t>(operation)]; 
+    }
+    std::uint64_t operator[](WithdrawOutcome outcome) const 
+    { 
+        return outcomes[static_cast<std::size_t>(outcome)]; 
+    }
+
+    void export_text(std::ostream& out) const;
+};
+
+/*
+    AtmInstrumentation class:
+
+    Latency histograms for every AtmOperation and counters for every WithdrawOutcome, to see 
+    where the time of AtmMachine::withdraw goes. Give it to an AtmMachine with 
+    set_instrumentation() (it can be shared by many AtmMachine objects).
+
+    To be cheap when it is enabled, the records are not shared by all the threads: there are 
+    some shards (one cache-line aligned buffer of histograms and counters each), and every 
+    thread always writes in the same shard with relaxed atomic operations. No locks are used.
+    snapshot() merges all the shards.
+
+    Notice that: With ATM_INSTRUMENTATION = 0 the class still exists, but AtmMachine never 
+    records anything in it (the recording code is not even compiled).
+*/
+
+class AtmInstrumentation
+{
+  public:
+
+    explicit AtmInstrumentation(std::size_t shards = 16);
+
+    AtmInstrumentation(const AtmInstrumentation&) = delete;
+    AtmInstrumentation& operator=(const AtmInstrumentation&) = delete;
+
+    void record(AtmOperation operation, std::uint64_t latency_ns);
+    void count(WithdrawOutcome outcome);
+
+    InstrumentationSnapshot snapshot() const;
+
+  private:
+
+    struct Shard
+    {
+        std::array<LatencyHistogram, static_cast<std::size_t>(AtmOperation::Count)> operations;
+        std::array<std::atomic<std::uint64_t>, static_cast<std::size_t>(WithdrawOutcome::Count)> outcomes;
+        char padding[64];
+    };
+
+    Shard& shard();
+
+    std::vector<std::unique_ptr<Shard>> m_shards;
+};
+
+/*
+    AtmScopedTimer class:
+
+    Records the time from its construction to its destruction as the latency of an operation.
+    It does nothing (it does not even read the clock) if there is no instrumentation.
+*/
+
+class AtmScopedTimer
+{
+  public:
+
+    AtmScopedTimer(AtmInstrumentation* instrumentation, AtmOperation operation)
+        : m_instrumentation(instrumentation), m_operation(operation)
+    {
+        if(m_instrumentation)
+        {
+            m_start = std::chrono::steady_clock::now();
+        }
+    }
+
+    ~AtmScopedTimer()
+    {
+        if(m_instrumentation)
+        {
+            auto latency = std::chrono::steady_clock::now() - m_start;
+            m_instrumentation->record(m_operation, 
+                static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(latency).count()));
+        }
+    }
+
+    AtmScopedTimer(const AtmScopedTimer&) = delete;
+    AtmScopedTimer& operator=(const AtmScopedTimer&) = delete;
+
+  private:
+
+    AtmInstrumentation* m_instrumentation;
+    AtmOperation m_operation;
+    std::chrono::steady_clock::time_point m_start;
+};
+
+// Recording points. They are removed entirely when the instrumentation is disabled.
+#if ATM_INSTRUMENTATION
+#define ATM_TIME_SCOPE(instrumentation, operation) \
+    AtmScopedTimer atm_scoped_timer_(instrumentation, operation)
+#define ATM_COUNT_OUTCOME(instrumentation, outcome) \
+    do { if(instrumentation) { (instrumentation)->count(outcome); } } while(0)
+#else
+#define ATM_TIME_SCOPE(instrumentation, operation)
+#define ATM_COUNT_OUTCOME(instrumentation, outcome) do {} while(0)
+#endif
+
+#endif
@@ -1,7 +1,17 @@
 #ifndef ATMMACHINE_HPP
 #define ATMMACHINE_HPP
 
+#include "AccountLocks.hpp"
+#include "AsyncWithdrawPipeline.hpp"
+#include "AtmInstrumentation.hpp"
 #include "BankServer.hpp"
+#include "BankServerSessionPool.hpp"
+#include "BankSession.hpp"
+#include "BasicAtmMachine.hpp"
+#include "WithdrawDedupTable.hpp"
+#include "WithdrawLedger.hpp"
+#include <cstdint>
+#include <vector>
 
 /*
     AtmMachine class:
@@ -11,6 +21,8 @@
     It uses BankServer as an injected dependency, in Dependency Injection 
     (https://en.wikipedia.org/wiki/Dependency_injection) terminology, AtmMachine 
     is a client of the BankServer service.
+
+    Notice that: It is the type-erased (virtual dispatch) version of BasicAtmMachine.
 */
 
 class AtmMachine
@@ -23,17 +35,140 @@ class AtmMachine
     // I will can use (receive) it in my AtmMachine, because I will be receiving a Child Class
     // object in a Base class pointer and, due to all the functions are (pure) virtual in the base 
     // class, the AtmMachine will be calling to the child member functions.
-    AtmMachine(BankServer* bankserver);
+    //
+    // Optionally, it can receive a table of account locks shared by all the ATMs of the process.
+    // Then the balance check and the debit of a withdrawal are done holding the lock of the account,
+    // so two concurrent withdrawals from the same account can't both pass the balance check.
+    AtmMachine(BankServer* bankserver, AccountLocks* account_locks = nullptr);
+
+    // Constructor receiving a pool of sessions instead of a single bankserver.
+    // In this case, the AtmMachine does not call Connect()/Disconnect() for each withdrawal, it
+    // leases an already connected session from the pool and gives it back when it finishes.
+    AtmMachine(BankServerSessionPool* pool, AccountLocks* account_locks = nullptr);
 
     // Function to get money using the ATM. 
     // It returns true if it was OK. Otherwise return false
     // Notice that: It is using multiple function of BankServer and in a specific order 
+    // (or just TryDebit() if the server supports the ConditionalDebit capability)
+    // If a call throws, the exception is thrown to the caller, but the session is still closed
+    // (Disconnect() is always called after a successful Connect(), check BankSession).
     bool withdraw(int account_number, int value);
 
+    // Function to get money paying a fee for it.
+    // The withdrawal and the fee are two debits of the same account, but they are sent to the
+    // server in a single DoubleTransaction() call (one round-trip less than two Debit() calls).
+    // If the server rejects the DoubleTransaction() (TransactionRejected), it falls back to two 
+    // Debit() calls. It returns true if the balance covered both of them (and both were done). 
+    // Otherwise return false (and nothing is debited).
+    bool withdraw_with_fee(int account_number, int value, int fee);
+
+    // Function to move money from one account to another one, optionally paying a fee.
+    // The source account is debited with the value and the fee in a single DoubleTransaction() 
+    // call (with the same fallback as withdraw_with_fee()), and then the destination account is
+    // credited with the value. It returns false (and nothing is moved) if the balance of the 
+    // source account does not cover the value plus the fee.
+    // Notice that: If Credit() fails the source account is already debited. The exception is 
+    // thrown to the caller, who has to retry the credit.
+    bool transfer(int from_account_number, int to_account_number, int value, int fee = 0);
+
+    // Idempotent versions of withdraw() and withdraw_with_fee(), for the callers that retry a 
+    // withdrawal when it throws. Every withdrawal has a request id, chosen by the caller (the 
+    // same one in all the retries), and its outcome is kept in the dedup table:
+    //    * A retry of a request that was already done returns the same result, without any 
+    //      server call. Also if the previous attempt threw after the debit (for example, in the
+    //      Disconnect()): the money was taken, so the retry returns true instead of taking it again.
+    //    * A retry of a request that threw before the debit (for example, in the Connect()) does 
+    //      the withdrawal.
+    //    * A retry of a request that is still in progress, or that threw in the debit call itself
+    //      (the server may or may not have done it), throws WithdrawOutcomeUnknown.
+    // Notice that: It needs a dedup table (set_dedup_table()), shared by all the ATMs that can
+    // receive the retries of the same requests.
+    bool withdraw_once(std::uint64_t request_id, int account_number, int value);
+    bool withdraw_with_fee_once(std::uint64_t request_id, int account_number, int value, int fee);
+
+    // Function to process several withdrawals at once.
+    // It opens a single session (one Connect() and one Disconnect()) for the whole batch, so the
+    // connection cost is paid once instead of once per withdrawal. The requests are processed in
+    // order and the returned vector holds the withdraw() result of each one (same index).
+    // An empty batch does not open any session.
+    std::vector<bool> withdraw_batch(const std::vector<WithdrawRequest>& requests);
+
+    // Callbacks of withdraw_async(): the result of every withdrawal (with its index in the 
+    // requests), and the end of the whole group (after closing the session)
+    using WithdrawCallback = AsyncWithdrawPipeline::WithdrawCallback;
+    using WithdrawDoneCallback = AsyncWithdrawPipeline::DoneCallback;
+
+    // Function to process several withdrawals without waiting for every server round-trip.
+    // If the server supports the AsyncBankOperations capability, it opens one session and keeps
+    // up to max_in_flight withdrawals in flight over it (the withdrawals of the same account are
+    // still done one after the other). It returns as soon as they are started, and the results
+    // are given to on_withdraw as they arrive (in any order). When all of them are finished, 
+    // the session is closed and on_done is called.
+    // If the server is not asynchronous, the withdrawals are done as in withdraw_batch() and the
+    // callbacks are called before returning. The same happens with account locks or a ledger: 
+    // they can't be held across asynchronous completions, so the withdrawals are done one after
+    // the other holding the lock of each account (safe against the other ATMs sharing the locks)
+    // and recording each one in a ledger change (safe against the ledger snapshots).
+    // Notice that: An exception in Connect() is thrown directly by withdraw_async().
+    void withdraw_async(const std::vector<WithdrawRequest>& requests, 
+                        WithdrawCallback on_withdraw, 
+                        WithdrawDoneCallback on_done, 
+                        std::size_t max_in_flight = 16);
+
+    // Optional instrumentation: latency of every BankServer call and of every withdraw, and 
+    // counters of the withdraw outcomes. nullptr (the default) disables it.
+    // Notice that: It only records something if the library was compiled with ATM_INSTRUMENTATION.
+    void set_instrumentation(AtmInstrumentation* instrumentation);
+
+    // The table of request outcomes used by withdraw_once() and withdraw_with_fee_once()
+    void set_dedup_table(WithdrawDedupTable* dedup_table);
+
+    // Optional ledger: the outcome of every withdrawal (success, insufficient funds or error) is
+    // appended to it, and the two sides of every transfer() (TransferOut and TransferIn). Every
+    // balance change and its records are one LedgerChange, so WithdrawLedger::quiesce() never 
+    // sees a change applied but not recorded. nullptr (the default) disables it.
+    // Notice that: The withdrawals don't wait for the disk, the records are made durable by the
+    // group commit of the ledger (WithdrawLedger::wait_durable() waits for them). A retry of
+    // withdraw_once() answered from the dedup table is not appended again. A failure of the 
+    // ledger never changes the result of a withdrawal: the record is lost and counted in 
+    // WithdrawLedger::append_errors().
+    void set_ledger(WithdrawLedger* ledger);
+
   private:
 
+    // Runs an operation with an opened session (a lease of the pool, or a BankSession of the 
+    // bankserver), giving it the BankServer to use. It returns the result of the operation.
+    // The session is closed (or the lease given back) also if the operation throws.
+    template <class Operation>
+    auto with_session(Operation operation);
+
+    // Lease of a session of the pool (with its latency recorded as a Connect())
+    BankServerSessionPool::Lease acquire_session();
+
+    // Balance check and debit of one withdrawal. The session must be already opened.
+    bool withdraw_connected(BankServer& bankserver, int account_number, int value);
+    bool withdraw_step(BankServer& bankserver, int account_number, int value, 
+                       atm_detail::DebitProgress* progress = nullptr);
+
+    // Runs a withdrawal step counting its outcome in the instrumentation, and appending it to 
+    // the ledger
+    template <class Step>
+    bool record_outcome(LedgerOperation operation, int account_number, int value, int fee, Step step);
+
+    // Appends a record to the ledger, if there is one (its failures are only counted)
+    void append_to_ledger(LedgerOperation operation, int account_number, int value, int fee, WithdrawOutcome outcome);
+
+    // Runs a withdrawal step only once per request id (check withdraw_once())
+    template <class Step>
+    bool run_once(std::uint64_t request_id, Step step);
+
     BankServer* m_bankserver;
+    BankServerSessionPool* m_pool;
+    AccountLocks* m_account_locks;
+    AtmInstrumentation* m_instrumentation;
+    WithdrawDedupTable* m_dedup_table;
+    WithdrawLedger* m_ledger;
 };
 
 
-#endif
\ No newline at end of file
+#endif
@@ -1,6 +1,9 @@
 #ifndef BANKSERVER_HPP
 #define BANKSERVER_HPP
 
+#include <stdexcept>
+#include <string>
+
 /*
     BankServer class: 
     
@@ -25,4 +28,80 @@ class BankServer
     virtual int GetBalance(int account_number) const = 0;
 };
 
-#endif
\ No newline at end of file
+/*
+    TransactionRejected class:
+
+    Exception that a BankServer throws when it refuses an operation without applying any part of 
+    it (for example, a server that does not allow DoubleTransaction() for some accounts).
+
+    Notice that: It is different from any other error (a timeout, a lost connection...), in which
+    case the client does not know if the operation was applied or not. After a TransactionRejected
+    the client can safely retry it in a different way.
+*/
+
+class TransactionRejected : public std::runtime_error
+{
+  public:
+
+    explicit TransactionRejected(const std::string& what) : std::runtime_error(what) {}
+};
+
+/*
+    TryDebitResult struct:
+
+    Result of a conditional debit: if it was done (ok) and the balance after the operation
+    (if it was not done, it is the current balance).
+*/
+
+struct TryDebitResult
+{
+    bool ok;
+    int new_balance;
+};
+
+/*
+    ConditionalDebit class:
+
+    Optional capability of a BankServer: a debit that is only done if the balance covers it,
+    checked and applied by the server in a single (atomic) operation.
+
+    It saves one round-trip per withdrawal (GetBalance + Debit become one call) and it removes 
+    the race window between the check and the debit.
+
+    Notice that: It is not a BankServer itself. A backend supporting it inherits from both
+    classes, and the clients (like AtmMachine) get it with conditional_debit_of(). Backends that
+    only implement BankServer keep working as before.
+
+    The decorators (CachingBankServer, ShardedBankServer...) also inherit it and forward 
+    TryDebit() to the server they wrap, but they only have the capability (HasConditionalDebit())
+    if that server has it. Otherwise their clients fall back to GetBalance() and Debit().
+*/
+
+class ConditionalDebit
+{
+  public:
+
+    virtual ~ConditionalDebit() {};
+    virtual TryDebitResult TryDebit(int account_number, int value) = 0;
+    virtual bool HasConditionalDebit() const { return true; }
+};
+
+// The ConditionalDebit capability of a server, or nullptr if it does not have it
+inline ConditionalDebit* conditional_debit_of(BankServer* bankserver)
+{
+    auto conditional_debit = dynamic_cast<ConditionalDebit*>(bankserver);
+    return conditional_debit && conditional_debit->HasConditionalDebit() ? conditional_debit : nullptr;
+}
+
+// The same for a decorator forwarding TryDebit(): it throws if the wrapped server can't do it
+inline ConditionalDebit& wrapped_conditional_debit(BankServer* bankserver)
+{
+    auto conditional_debit = conditional_debit_of(bankserver);
+    if(!conditional_debit)
+    {
+        throw std::logic_error("TryDebit(): the wrapped server does not have the ConditionalDebit capability");
+    }
+    return *conditional_debit;
+}
+
+#endif
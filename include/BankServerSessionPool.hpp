@@ -0,0 +1,113 @@
+#ifndef BANKSERVERSESSIONPOOL_HPP
+#define BANKSERVERSESSIONPOOL_HPP
+
+#include "BankServer.hpp"
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+/*
+    BankServerSessionPool class:
+
+    Keeps a bounded set of live BankServer sessions, so the Connect() cost is paid once per 
+    pool warm-up instead of once per withdrawal.
+
+    Each BankServer object given to the pool is one connection (one session). The pool does not
+    own them, it only calls Connect()/Disconnect() on them:
+
+        * Sessions are connected lazily, the first time they are leased (or in warm_up()).
+        * Sessions are leased through RAII Lease handles, that give them back to the pool when
+          they are destroyed.
+        * Idle sessions are health-checked (if a health check was provided) before being leased
+          again, and reconnected if the check fails.
+        * A Lease can be invalidated (for example, after an exception coming from the server), 
+          then the session is disconnected and it will be reconnected the next time it is leased.
+        * The destructor disconnects all the live sessions.
+
+    Notice that: The BankServer interface does not change at all, so MockBankServer objects can
+    be pooled as any other BankServer.
+*/
+
+class BankServerSessionPool
+{
+  public:
+
+    // Function to check if an idle (already connected) session is still alive
+    using HealthCheck = std::function<bool(BankServer&)>;
+
+    // RAII handle of a leased session. It is movable but not copyable.
+    class Lease
+    {
+      public:
+        Lease();
+        Lease(Lease&& other);
+        Lease& operator=(Lease&& other);
+        Lease(const Lease&) = delete;
+        Lease& operator=(const Lease&) = delete;
+        ~Lease();
+
+        BankServer* get() const { return m_bankserver; }
+        BankServer* operator->() const { return m_bankserver; }
+        BankServer& operator*() const { return *m_bankserver; }
+        explicit operator bool() const { return m_bankserver != nullptr; }
+
+        // Mark the session as broken: it will be disconnected when it is given back
+        void invalidate() { m_valid = false; }
+
+        // Give the session back to the pool before the destruction of the handle
+        void release();
+
+      private:
+        friend class BankServerSessionPool;
+        Lease(BankServerSessionPool* pool, std::size_t slot, BankServer* bankserver);
+
+        BankServerSessionPool* m_pool;
+        std::size_t m_slot;
+        BankServer* m_bankserver;
+        bool m_valid;
+    };
+
+    BankServerSessionPool(const std::vector<BankServer*>& connections, HealthCheck health_check = nullptr);
+    ~BankServerSessionPool();
+
+    BankServerSessionPool(const BankServerSessionPool&) = delete;
+    BankServerSessionPool& operator=(const BankServerSessionPool&) = delete;
+
+    // Lease a session. It waits until one of them is free.
+    Lease acquire();
+
+    // Lease a session if one of them is free. Otherwise it returns an empty Lease.
+    Lease try_acquire();
+
+    // Connect all the sessions that are not connected yet
+    void warm_up();
+
+    // Number of sessions managed by the pool
+    std::size_t size() const { return m_slots.size(); }
+
+    // Number of sessions that are currently connected
+    std::size_t live() const;
+
+  private:
+
+    struct Slot
+    {
+        BankServer* bankserver;
+        bool connected;
+        bool leased;
+        bool used;      // It has been leased at least once since it was connected
+    };
+
+    Lease lease_locked(std::unique_lock<std::mutex>& lock);
+    void prepare(Slot& slot);
+    void give_back(std::size_t slot, bool valid);
+
+    std::vector<Slot> m_slots;
+    HealthCheck m_health_check;
+    mutable std::mutex m_mutex;
+    std::condition_variable m_free;
+};
+
+#endif
@@ -0,0 +1,176 @@
+#ifndef BANKSERVERTRACE_HPP
+#define BANKSERVERTRACE_HPP
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+/*
+    BankServer traces:
+
+    A trace is a binary file with all the BankServer calls done by a client (for example, by an
+    AtmMachine in production), to reproduce the same load later (check TraceReplayer).
+
+    Format: a TraceHeader and then one TraceRecord per call, in the order they were finished. 
+    All the records have the same size and there is no record count in the header (it is given 
+    by the size of the file), so:
+
+        * The file can be memory-mapped and used directly as an array of records (TraceReader).
+        * A trace of a process that crashed is still readable (an incomplete last record is
+          ignored).
+
+    Notice that: The integers are stored in the byte order of the machine that recorded it.
+*/
+
+// The BankServer functions
+enum class TraceMethod : std::uint8_t
+{
+    Connect,
+    Disconnect,
+    Credit,
+    Debit,
+    DoubleTransaction,
+    GetBalance,
+    TryDebit
+};
+
+const char* to_string(TraceMethod method);
+
+struct TraceHeader
+{
+    char magic[8];                  // "ATMTRACE"
+    std::uint32_t version;
+    std::uint32_t record_size;
+    std::uint64_t reserved[2];
+};
+
+struct TraceRecord
+{
+    std::uint64_t start_ns;         // since the beginning of the recording
+    std::uint32_t duration_ns;      // saturated to 4.29s
+    TraceMethod method;
+    std::uint8_t failed;            // 1 if the call threw an exception
+    std::uint16_t reserved;
+    std::int32_t account_number;
+    std::int32_t value1;
+    std::int32_t value2;
+    std::int32_t result;            // returned value (0 for the void functions, 1 for a TryDebit done)
+};
+
+static_assert(sizeof(TraceHeader) == 32, "The trace header must be 32 bytes");
+static_assert(sizeof(TraceRecord) == 32, "A trace record must be 32 bytes");
+
+/*
+    TraceWriteError class:
+
+    Exception thrown by a TraceWriter when a block of records could not be written to the file.
+    The records of the block that did not reach the file are dropped (they are not kept for the
+    next flush, which would fail the same way), and dropped() gives how many of them.
+*/
+
+class TraceWriteError : public std::runtime_error
+{
+  public:
+
+    explicit TraceWriteError(std::size_t dropped)
+        : std::runtime_error("TraceWriter: write error, " + std::to_string(dropped) + " records dropped"),
+          m_dropped(dropped)
+    {
+    }
+
+    std::size_t dropped() const { return m_dropped; }
+
+  private:
+
+    std::size_t m_dropped;
+};
+
+/*
+    TraceWriter class:
+
+    Creates a trace file and appends records to it. The records are buffered and written in 
+    blocks (and when it is destroyed). It can be used from several threads.
+
+    Notice that: A write error loses the whole block being written, not only the last record:
+    write() and flush() throw a TraceWriteError with the number of dropped records.
+*/
+
+class TraceWriter
+{
+  public:
+
+    explicit TraceWriter(const std::string& path, std::size_t buffered_records = 4096);
+    ~TraceWriter();
+
+    TraceWriter(const TraceWriter&) = delete;
+    TraceWriter& operator=(const TraceWriter&) = delete;
+
+    // Nanoseconds since the trace was created (the time base of the records)
+    std::uint64_t now_ns() const;
+
+    void write(const TraceRecord& record);
+
+    // Write the buffered records to the file
+    void flush();
+
+    // Number of records written (or buffered) until now, without the dropped ones
+    std::size_t records() const;
+
+    // Number of records dropped by the write errors
+    std::size_t dropped() const;
+
+  private:
+
+    void flush_locked();
+
+    std::FILE* m_file;
+    const std::chrono::steady_clock::time_point m_start;
+    const std::size_t m_buffered_records;
+
+    mutable std::mutex m_mutex;
+    std::vector<TraceRecord> m_buffer;
+    std::size_t m_records;
+    std::size_t m_dropped;
+};
+
+/*
+    TraceReader class:
+
+    Opens a trace file memory-mapped (read only). The records are not copied nor parsed: the 
+    reader is just a view of the file as an array of TraceRecord.
+*/
+
+class TraceReader
+{
+  public:
+
+    explicit TraceReader(const std::string& path);
+    ~TraceReader();
+
+    TraceReader(TraceReader&& other) noexcept;
+    TraceReader& operator=(TraceReader&& other) noexcept;
+    TraceReader(const TraceReader&) = delete;
+    TraceReader& operator=(const TraceReader&) = delete;
+
+    std::size_t size() const { return m_size; }
+    bool empty() const { return m_size == 0; }
+    const TraceRecord& operator[](std::size_t i) const { return m_records[i]; }
+    const TraceRecord* begin() const { return m_records; }
+    const TraceRecord* end() const { return m_records + m_size; }
+
+  private:
+
+    void unmap();
+
+    void* m_mapping;
+    std::size_t m_mapping_size;
+    const TraceRecord* m_records;
+    std::size_t m_size;
+};
+
+#endif
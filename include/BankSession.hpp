@@ -0,0 +1,90 @@
+#ifndef BANKSESSION_HPP
+#define BANKSESSION_HPP
+
+#include "AtmInstrumentation.hpp"
+#include "BankServer.hpp"
+
+/*
+    BasicBankSession class:
+
+    RAII guard of a session with a bank server: the constructor calls Connect() and the
+    destructor calls Disconnect(). So the session is closed on every path out of a withdrawal,
+    also when GetBalance() or Debit() throw (otherwise the connection is leaked, and under a
+    sustained error rate the backend runs out of connection slots).
+
+        * close() is the normal way to end the session: it calls Disconnect() and its exceptions
+          are thrown to the caller.
+        * The destructor calls Disconnect() only if close() was not called, and it swallows
+          the exceptions (it usually runs because another exception is being thrown).
+        * If Connect() throws there is no session, so Disconnect() is not called.
+        * It can be moved (for example, to the callback that closes the session later), not
+          copied.
+
+    Notice that: It is a template (like BasicAtmMachine) so it also works with backends that don't
+    inherit from BankServer. BankSession is the one for the BankServer interface.
+*/
+
+template <class Backend>
+class BasicBankSession
+{
+  public:
+
+    // Opens the session. The latencies of Connect() and Disconnect() are recorded in the
+    // instrumentation, if any.
+    explicit BasicBankSession(Backend* bankserver, AtmInstrumentation* instrumentation = nullptr)
+        : m_bankserver(bankserver), m_instrumentation(instrumentation)
+    {
+        ATM_TIME_SCOPE(m_instrumentation, AtmOperation::Connect);
+        m_bankserver->Connect();
+    }
+
+    BasicBankSession(BasicBankSession&& other)
+        : m_bankserver(other.m_bankserver), m_instrumentation(other.m_instrumentation)
+    {
+        other.m_bankserver = nullptr;
+    }
+
+    BasicBankSession(const BasicBankSession&) = delete;
+    BasicBankSession& operator=(const BasicBankSession&) = delete;
+    BasicBankSession& operator=(BasicBankSession&&) = delete;
+
+    ~BasicBankSession()
+    {
+        try
+        {
+            close();
+        }
+        catch(...)
+        {
+        }
+    }
+
+    // Closes the session (nothing if it is already closed). It is closed even if Disconnect()
+    // throws: it is not called again by the destructor.
+    void close()
+    {
+        if(m_bankserver)
+        {
+            Backend* bankserver = m_bankserver;
+            m_bankserver = nullptr;
+
+            ATM_TIME_SCOPE(m_instrumentation, AtmOperation::Disconnect);
+            bankserver->Disconnect();
+        }
+    }
+
+    bool is_open() const { return m_bankserver != nullptr; }
+
+    Backend* get() const { return m_bankserver; }
+    Backend* operator->() const { return m_bankserver; }
+    Backend& operator*() const { return *m_bankserver; }
+
+  private:
+
+    Backend* m_bankserver;
+    AtmInstrumentation* m_instrumentation;
+};
+
+using BankSession = BasicBankSession<BankServer>;
+
+#endif
@@ -0,0 +1,276 @@
+#ifndef BASICATMMACHINE_HPP
+#define BASICATMMACHINE_HPP
+
+#include "AccountLocks.hpp"
+#include "AtmInstrumentation.hpp"
+#include "BankServer.hpp"
+#include "BankSession.hpp"
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+/*
+    WithdrawRequest struct:
+
+    One item of a batched withdrawal: the account to take the money from and how much.
+*/
+
+struct WithdrawRequest
+{
+    int account_number;
+    int value;
+};
+
+/*
+    DebitPairIncomplete class:
+
+    Exception thrown when two debits of the same account (for example, a withdrawal and its fee)
+    had to be sent as two Debit() calls and the second one failed: the first one was applied, and
+    the second one may or may not have been. The caller must reconcile the account, it must not
+    retry the pair.
+*/
+
+class DebitPairIncomplete : public std::runtime_error
+{
+  public:
+
+    DebitPairIncomplete(int account_number, int applied_value, const std::string& reason)
+        : std::runtime_error("The debit pair of the account " + std::to_string(account_number) + 
+                             " is incomplete (only " + std::to_string(applied_value) + " was surely debited): " + reason),
+          m_account_number(account_number), m_applied_value(applied_value)
+    {
+    }
+
+    int account_number() const { return m_account_number; }
+    int applied_value() const { return m_applied_value; }
+
+  private:
+
+    int m_account_number;
+    int m_applied_value;
+};
+
+namespace atm_detail
+{
+    // How far the debit of a withdrawal went. If the withdrawal throws, it tells if the money was
+    // not taken (NotSent), maybe taken (Sent: the debit call itself failed) or taken (Done).
+    enum class DebitProgress
+    {
+        NotSent,
+        Sent,
+        Done
+    };
+
+    inline void set_progress(DebitProgress* progress, DebitProgress value)
+    {
+        if(progress)
+        {
+            *progress = value;
+        }
+    }
+
+    // Trait to know at compile time if a backend has the TryDebit() operation
+    template <class Backend, class = void>
+    struct has_try_debit : std::false_type {};
+
+    template <class Backend>
+    struct has_try_debit<Backend, decltype(void(std::declval<Backend&>().TryDebit(0, 0)))> : std::true_type {};
+
+    // Balance check and debit of one withdrawal with two calls: GetBalance() and Debit().
+    // If there are account locks, both calls are done holding the lock of the account.
+    // If there is instrumentation, the latency of both calls is recorded.
+    // If there is a progress, it is updated before and after the Debit().
+    template <class Backend>
+    bool check_and_debit(Backend& bankserver, AccountLocks* account_locks, AtmInstrumentation* instrumentation, 
+                         int account_number, int value, DebitProgress* progress = nullptr)
+    {
+        bool result = false;
+
+        // The check-then-debit must be atomic per account in the concurrent mode
+        std::unique_lock<std::mutex> account_lock;
+        if(account_locks)
+        {
+            account_lock = std::unique_lock<std::mutex>(account_locks->lock_for(account_number));
+        }
+
+        int available_balance;
+        {
+            ATM_TIME_SCOPE(instrumentation, AtmOperation::GetBalance);
+            available_balance = bankserver.GetBalance(account_number);
+        }
+
+        if(available_balance >= value)
+        {
+            ATM_TIME_SCOPE(instrumentation, AtmOperation::Debit);
+            set_progress(progress, DebitProgress::Sent);
+            bankserver.Debit(account_number, value);
+            set_progress(progress, DebitProgress::Done);
+            result = true;
+        }
+
+        return result;
+    }
+
+    // Two debits of the same account in a single server call: DoubleTransaction(). 
+    // If the server rejects the combined call (TransactionRejected), nothing was applied, so it 
+    // falls back to two separate Debit() calls. If the second one fails, the first one is already
+    // applied: the progress stays Sent (maybe taken) and DebitPairIncomplete is thrown.
+    template <class Backend>
+    void debit_pair(Backend& bankserver, AtmInstrumentation* instrumentation, 
+                    int account_number, int value1, int value2, DebitProgress* progress = nullptr)
+    {
+        try
+        {
+            ATM_TIME_SCOPE(instrumentation, AtmOperation::DoubleTransaction);
+            set_progress(progress, DebitProgress::Sent);
+            bankserver.DoubleTransaction(account_number, value1, value2);
+            set_progress(progress, DebitProgress::Done);
+            return;
+        }
+        catch(const TransactionRejected&)
+        {
+            set_progress(progress, DebitProgress::NotSent);
+        }
+
+        {
+            ATM_TIME_SCOPE(instrumentation, AtmOperation::Debit);
+            set_progress(progress, DebitProgress::Sent);
+            bankserver.Debit(account_number, value1);
+        }
+        try
+        {
+            ATM_TIME_SCOPE(instrumentation, AtmOperation::Debit);
+            bankserver.Debit(account_number, value2);
+        }
+        catch(const std::exception& e)
+        {
+            throw DebitPairIncomplete(account_number, value1, e.what());
+        }
+        catch(...)
+        {
+            throw DebitPairIncomplete(account_number, value1, "unknown error");
+        }
+        set_progress(progress, DebitProgress::Done);
+    }
+
+    // Balance check and debit of two movements of the same account (for example, a withdrawal
+    // and its fee): GetBalance() and then debit_pair(). If it returns, both or none of them are
+    // done. If it throws, check the progress (or DebitPairIncomplete) to know what was applied.
+    // If there are account locks, it is done holding the lock of the account.
+    template <class Backend>
+    bool check_and_debit_pair(Backend& bankserver, AccountLocks* account_locks, AtmInstrumentation* instrumentation, 
+                              int account_number, int value1, int value2, DebitProgress* progress = nullptr)
+    {
+        std::unique_lock<std::mutex> account_lock;
+        if(account_locks)
+        {
+            account_lock = std::unique_lock<std::mutex>(account_locks->lock_for(account_number));
+        }
+
+        int available_balance;
+        {
+            ATM_TIME_SCOPE(instrumentation, AtmOperation::GetBalance);
+            available_balance = bankserver.GetBalance(account_number);
+        }
+
+        if(available_balance < value1 + value2)
+        {
+            return false;
+        }
+
+        debit_pair(bankserver, instrumentation, account_number, value1, value2, progress);
+        return true;
+    }
+
+    // Withdrawal step chosen at compile time: TryDebit() if the backend has it
+    template <class Backend>
+    bool withdraw_step(Backend& bankserver, AccountLocks*, int account_number, int value, std::true_type)
+    {
+        return bankserver.TryDebit(account_number, value).ok;
+    }
+
+    template <class Backend>
+    bool withdraw_step(Backend& bankserver, AccountLocks* account_locks, int account_number, int value, std::false_type)
+    {
+        return check_and_debit(bankserver, account_locks, nullptr, account_number, value);
+    }
+}
+
+/*
+    BasicAtmMachine class template:
+
+    The same AtmMachine logic, but with the backend bound at compile time instead of through
+    a BankServer pointer.
+
+    The Backend does not need to inherit from BankServer, it only needs to have the same member 
+    functions (Connect, Disconnect, GetBalance, Debit... and optionally TryDebit). With a concrete
+    backend type (better if it is final) the compiler knows which function is called, so there is
+    no virtual dispatch and the backend calls can be inlined in the withdrawal.
+
+    Whether TryDebit() is used or not is also decided at compile time.
+
+    Notice that: AtmMachine is still the type-erased version (BankServer*), the one to use when
+    the backend is only known at run time. To test a BasicAtmMachine, the mock does not need
+    virtual functions either (check MockBankBackend in the test/mock folder).
+*/
+
+template <class Backend>
+class BasicAtmMachine
+{
+  public:
+
+    explicit BasicAtmMachine(Backend* bankserver, AccountLocks* account_locks = nullptr)
+        : m_bankserver(bankserver), m_account_locks(account_locks)
+    {
+    }
+
+    // Same behaviour as AtmMachine::withdraw()
+    bool withdraw(int account_number, int value)
+    {
+        BasicBankSession<Backend> session(m_bankserver);
+
+        bool result = withdraw_connected(account_number, value);
+
+        session.close();
+
+        return result;
+    }
+
+    // Same behaviour as AtmMachine::withdraw_batch()
+    std::vector<bool> withdraw_batch(const std::vector<WithdrawRequest>& requests)
+    {
+        std::vector<bool> results(requests.size(), false);
+
+        if(requests.empty())
+        {
+            return results;
+        }
+
+        BasicBankSession<Backend> session(m_bankserver);
+
+        for(std::size_t i = 0; i < requests.size(); ++i)
+        {
+            results[i] = withdraw_connected(requests[i].account_number, requests[i].value);
+        }
+
+        session.close();
+
+        return results;
+    }
+
+  private:
+
+    bool withdraw_connected(int account_number, int value)
+    {
+        return atm_detail::withdraw_step(*m_bankserver, m_account_locks, account_number, value, 
+                                         atm_detail::has_try_debit<Backend>{});
+    }
+
+    Backend* m_bankserver;
+    AccountLocks* m_account_locks;
+};
+
+#endif
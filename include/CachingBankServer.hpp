@@ -0,0 +1,108 @@
+#ifndef CACHINGBANKSERVER_HPP
+#define CACHINGBANKSERVER_HPP
+
+#include "BankServer.hpp"
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+
+/*
+    CacheStats struct:
+
+    Counters of a CachingBankServer: how many GetBalance() calls were answered by the cache
+    (hits) or by the wrapped server (misses), and an estimation of the memory used by the cache.
+*/
+
+struct CacheStats
+{
+    std::uint64_t hits;
+    std::uint64_t misses;
+    std::size_t entries;
+    std::size_t memory_bytes;
+
+    double hit_ratio() const 
+    { 
+        return hits + misses == 0 ? 0.0 : static_cast<double>(hits) / (hits + misses); 
+    }
+};
+
+/*
+    CachingBankServer class:
+
+    A BankServer decorator that caches the balances returned by GetBalance() (read-through), so
+    the hot accounts don't need a server round-trip in every withdrawal.
+
+        * An entry is valid for ttl since it was read from the server (bounded staleness). 
+        * The cache has a maximum number of entries: the least recently used one is evicted.
+        * Debit() and Credit() are forwarded, and then the cached balance is updated with them,
+          so the cache never shows money that was already taken through it (no overdraft).
+        * DoubleTransaction() is forwarded and the entry of the account is invalidated.
+        * TryDebit() is forwarded, and then the cached balance is updated if it was done (or
+          invalidated if it was not, as the server saw another balance).
+        * Disconnect() invalidates the whole cache, and any exception coming from the wrapped 
+          server invalidates the entry of the account.
+
+    Notice that: The changes done to the accounts by other clients of the server are only seen
+    when the entry expires, so the ttl is the maximum staleness of the cached balances.
+*/
+
+class CachingBankServer : public BankServer, public ConditionalDebit
+{
+  public:
+
+    CachingBankServer(BankServer* bankserver, std::size_t capacity, std::chrono::steady_clock::duration ttl);
+
+    CachingBankServer(const CachingBankServer&) = delete;
+    CachingBankServer& operator=(const CachingBankServer&) = delete;
+
+    void Connect() override;
+    void Disconnect() override;
+    void Credit(int account_number, int value) override;
+    void Debit(int account_number, int value) override;
+    int DoubleTransaction(int account_number, int value1, int value2) override;
+    int GetBalance(int account_number) const override;
+
+    // ConditionalDebit, only if the wrapped server has it (check conditional_debit_of())
+    TryDebitResult TryDebit(int account_number, int value) override;
+    bool HasConditionalDebit() const override;
+
+    void Invalidate(int account_number);
+    void InvalidateAll();
+
+    CacheStats Stats() const;
+
+  private:
+
+    struct Entry
+    {
+        int account_number;
+        int balance;
+        std::chrono::steady_clock::time_point read_time;
+    };
+
+    using Lru = std::list<Entry>;
+
+    // They must be called holding m_mutex
+    void apply_locked(int account_number, int delta);
+    void erase_locked(int account_number) const;
+
+    BankServer* m_bankserver;
+    std::size_t m_capacity;
+    std::chrono::steady_clock::duration m_ttl;
+
+    // GetBalance() is const, but it fills the cache
+    mutable std::mutex m_mutex;
+    mutable Lru m_lru;                                             // Most recently used first
+    mutable std::unordered_map<int, Lru::iterator> m_entries;
+    mutable std::uint64_t m_hits;
+    mutable std::uint64_t m_misses;
+
+    // Incremented by every write, so a balance read from the server while a write was being
+    // done is not cached (it could be older than the write)
+    mutable std::uint64_t m_generation;
+};
+
+#endif
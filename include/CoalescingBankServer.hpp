@@ -0,0 +1,142 @@
+#ifndef COALESCINGBANKSERVER_HPP
+#define COALESCINGBANKSERVER_HPP
+
+#include "BankServer.hpp"
+#include <chrono>
+#include <cstddef>
+#include <exception>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/*
+    FlushOutcomeUnknown class:
+
+    Exception thrown by a CoalescingBankServer when the wrapped server failed (a timeout, a lost
+    connection...) while a net delta was being sent: it may or may not have been applied. It is 
+    not sent again, as a retry could debit or credit it twice, so it is dropped and given here
+    (delta() is negative for a debit) for the caller to reconcile it.
+*/
+
+class FlushOutcomeUnknown : public std::runtime_error
+{
+  public:
+
+    FlushOutcomeUnknown(int account_number, int delta, const std::string& reason)
+        : std::runtime_error("CoalescingBankServer: the delta " + std::to_string(delta) + " of the account " + 
+                             std::to_string(account_number) + " may or may not be applied: " + reason),
+          m_account_number(account_number), m_delta(delta)
+    {
+    }
+
+    int account_number() const { return m_account_number; }
+    int delta() const { return m_delta; }
+
+  private:
+
+    int m_account_number;
+    int m_delta;
+};
+
+/*
+    CoalescingBankServer class:
+
+    A BankServer decorator (it is a BankServer that wraps another BankServer) that delays the 
+    Credit() and Debit() calls (write-behind) and merges all the ones of the same account in a
+    single net operation:
+
+        Debit(1234, 100), Debit(1234, 200), Credit(1234, 50)  -->  Debit(1234, 250)
+
+    The pending deltas are sent (flushed) to the wrapped server when the coalescing window has
+    elapsed since the first pending one (checked in every call), when Flush() is called, and 
+    when the decorator is destroyed.
+
+        * GetBalance() returns the balance of the wrapped server plus the pending delta of the
+          account, so a withdrawal always sees its own pending debits.
+        * DoubleTransaction() and TryDebit() are not coalesced: the pending delta of the 
+          account is flushed first, and then the call is forwarded.
+        * The accounts are flushed in the order they got their first pending delta.
+        * If the wrapped server throws while flushing, the deltas not sent yet stay pending (they
+          are not lost). The failed one also stays pending if it was a TransactionRejected (it
+          was not applied). After any other error it is dropped, counted in UnknownOutcomes(), 
+          and a FlushOutcomeUnknown is thrown instead, as it may have been applied.
+        * A Credit() or Debit() only throws the errors of the flush that are about its own
+          account: a FlushOutcomeUnknown of another account is thrown by the next Flush() or
+          Disconnect() instead, and a rejected delta just stays pending.
+        * Connect() and Disconnect() are forwarded. The flushes are done inside a session of the
+          wrapped server: if there is no open session, Flush() opens one for it. Disconnect()
+          closes the session even if its flush fails.
+*/
+
+class CoalescingBankServer : public BankServer, public ConditionalDebit
+{
+  public:
+
+    CoalescingBankServer(BankServer* bankserver, std::chrono::steady_clock::duration window);
+    ~CoalescingBankServer();
+
+    CoalescingBankServer(const CoalescingBankServer&) = delete;
+    CoalescingBankServer& operator=(const CoalescingBankServer&) = delete;
+
+    void Connect() override;
+    void Disconnect() override;
+    void Credit(int account_number, int value) override;
+    void Debit(int account_number, int value) override;
+    int DoubleTransaction(int account_number, int value1, int value2) override;
+    int GetBalance(int account_number) const override;
+
+    // ConditionalDebit, only if the wrapped server has it (check conditional_debit_of())
+    TryDebitResult TryDebit(int account_number, int value) override;
+    bool HasConditionalDebit() const override;
+
+    // Send all the pending deltas to the wrapped server now
+    void Flush();
+
+    // Number of accounts with a pending delta
+    std::size_t Pending() const;
+
+    // Number of deltas dropped because the server failed while they were sent
+    std::size_t UnknownOutcomes() const;
+
+  private:
+
+    void add(int account_number, int delta);
+    bool due() const;
+
+    // Flushes if the window has elapsed. The second one is the flush of a write of the account.
+    void flush_if_due();
+    void flush_if_due(int account_number);
+
+    // Throws the error of a flush that was not thrown to the write that did it
+    void throw_deferred();
+
+    // They must be called holding m_flush_mutex. The account of a failed send is given in
+    // failed_account.
+    void flush_locked(int* failed_account = nullptr);
+    void flush_account_locked(int account_number);
+
+    // Sends a net delta, and handles its failure (check FlushOutcomeUnknown)
+    void send_locked(int account_number, int delta);
+
+    // Makes pending again the deltas of a failed flush, from order[first]
+    void give_back_locked(const std::vector<int>& order, std::unordered_map<int, int>& deltas, std::size_t first);
+
+    BankServer* m_bankserver;
+    std::chrono::steady_clock::duration m_window;
+
+    // Serializes the flushes (so the operations arrive in order) and the balance reads
+    mutable std::mutex m_flush_mutex;
+
+    // Protects the pending deltas
+    mutable std::mutex m_mutex;
+    std::unordered_map<int, int> m_deltas;
+    std::vector<int> m_order;
+    std::chrono::steady_clock::time_point m_window_start;
+    int m_sessions;
+    std::size_t m_unknown_outcomes;
+    std::exception_ptr m_deferred_error;
+};
+
+#endif
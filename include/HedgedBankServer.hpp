@@ -0,0 +1,143 @@
+#ifndef HEDGEDBANKSERVER_HPP
+#define HEDGEDBANKSERVER_HPP
+
+#include "BankServer.hpp"
+#include "LatencyWindow.hpp"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*
+    HedgingPolicy struct:
+
+    The configuration of a HedgedBankServer: when a read is hedged, and how many of them can be.
+*/
+
+struct HedgingPolicy
+{
+    // A read is hedged when the primary did not answer in this percentile of its latencies
+    double hedge_percentile = 0.95;
+
+    // Maximum fraction of the reads that are hedged (the extra load on the replica)
+    double hedge_budget = 0.05;
+
+    // Reads in flight at the same time on every backend
+    std::size_t threads_per_backend = 4;
+
+    // Latencies of the primary kept, and observed before hedging any read
+    std::size_t latency_window = 256;
+    std::size_t min_samples = 16;
+};
+
+/*
+    HedgingStats struct:
+
+    Counters of a HedgedBankServer.
+*/
+
+struct HedgingStats
+{
+    std::uint64_t reads;
+    std::uint64_t hedged;           // Also sent to the replica
+    std::uint64_t replica_wins;     // Answered by the replica first
+    std::uint64_t cancelled;        // Not sent to a backend, the other one had answered
+};
+
+/*
+    HedgedBankServer class:
+
+    A BankServer decorator for a replicated backend, that cuts the tail latency of GetBalance().
+    GetBalance() is read-only, so it can be sent twice without changing anything:
+
+        * The read is sent to the primary. If it has not answered after the hedge_percentile of
+          its last latencies (a LatencyWindow), the same read is also sent to the replica, and
+          the first answer is returned. If one of them fails, the answer of the other is waited.
+        * The hedges are limited by hedge_budget, a fraction of all the reads, so a slow primary
+          does not double the load of the replica. No read is hedged until min_samples
+          latencies of the primary were observed.
+        * A read still queued for a backend when the other one answers is never sent.
+        * The writes (Credit, Debit, DoubleTransaction, TryDebit) only go to the primary. Connect() and
+          Disconnect() go to both (if one Connect() fails, the other session is closed).
+
+    Notice that: The reads are done by threads of the decorator (threads_per_backend for each
+    one), so the backends must accept calls from several threads at the same time (like
+    InMemoryBankServer). A balance read from the replica may not include the last writes done
+    in the primary yet (replication lag).
+*/
+
+class HedgedBankServer : public BankServer, public ConditionalDebit
+{
+  public:
+
+    HedgedBankServer(BankServer* primary, BankServer* replica, const HedgingPolicy& policy = HedgingPolicy());
+    ~HedgedBankServer() override;
+
+    HedgedBankServer(const HedgedBankServer&) = delete;
+    HedgedBankServer& operator=(const HedgedBankServer&) = delete;
+
+    void Connect() override;
+    void Disconnect() override;
+    void Credit(int account_number, int value) override;
+    void Debit(int account_number, int value) override;
+    int DoubleTransaction(int account_number, int value1, int value2) override;
+    int GetBalance(int account_number) const override;
+
+    // ConditionalDebit, only if the wrapped server has it (check conditional_debit_of())
+    TryDebitResult TryDebit(int account_number, int value) override;
+    bool HasConditionalDebit() const override;
+
+    // The latencies of the reads done by the primary
+    const LatencyWindow& latencies() const { return m_latencies; }
+
+    HedgingStats Stats() const;
+
+  private:
+
+    // A GetBalance() sent to one or both backends. Its client waits on answered.
+    struct Read
+    {
+        int account_number;
+        std::size_t pending;        // Backends that have it and did not answer yet
+        bool done;
+        int result;
+        std::exception_ptr error;
+        std::condition_variable answered;
+    };
+
+    struct Backend
+    {
+        BankServer* bankserver;
+        std::deque<std::shared_ptr<Read>> reads;
+        std::condition_variable read_queued;
+        std::vector<std::thread> threads;
+    };
+
+    // It must be called holding m_mutex
+    void send_locked(Backend& backend, const std::shared_ptr<Read>& read) const;
+
+    void run_backend(Backend& backend, bool primary);
+
+    const HedgingPolicy m_policy;
+    LatencyWindow m_latencies;
+
+    // GetBalance() is const, but it sends the reads to the backends
+    mutable std::mutex m_mutex;
+    mutable Backend m_primary;
+    mutable Backend m_replica;
+    bool m_stopping;
+
+    mutable std::atomic<std::uint64_t> m_reads;
+    mutable std::atomic<std::uint64_t> m_hedged;
+    std::atomic<std::uint64_t> m_replica_wins;
+    std::atomic<std::uint64_t> m_cancelled;
+};
+
+#endif
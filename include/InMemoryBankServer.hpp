@@ -0,0 +1,90 @@
+#ifndef INMEMORYBANKSERVER_HPP
+#define INMEMORYBANKSERVER_HPP
+
+#include "AccountLocks.hpp"
+#include "BankServer.hpp"
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <memory>
+
+/*
+    InMemoryBankServer class:
+
+    A real (not mocked) BankServer that keeps all the accounts in the memory of the process.
+    It is the reference backend for load tests and benchmarks of AtmMachine.
+
+    The accounts are stored in an open-addressing hash table (linear probing) made of two flat
+    arrays indexed by slot: one with the account numbers and another with the balances. The
+    table has a fixed capacity, given in the constructor, so it never rehashes and it can hold
+    tens of millions of accounts in a few hundred MB.
+
+        * Reads (GetBalance) are lock-free: just atomic loads while probing.
+        * Writes (Credit, Debit, DoubleTransaction, TryDebit) take the lock of the account's
+          shard (a striped AccountLocks table), so different accounts are written in parallel.
+
+    Operations:
+
+        * Connect() / Disconnect(): nothing to do, it is always "connected".
+        * Credit() / Debit(): add / subtract the value. Debit() is unconditional, like in any
+          BankServer: checking the balance is the responsibility of the client.
+        * DoubleTransaction(account, value1, value2): debits both values in one operation and
+          returns the new balance.
+        * GetBalance(): balance of the account, 0 if the account does not exist.
+        * TryDebit(): the ConditionalDebit capability, check and debit under the shard lock.
+
+    It is final, so a BasicAtmMachine<InMemoryBankServer> calls it without virtual dispatch.
+
+    An unknown account is created (with balance 0) the first time it is written. If the table
+    is full, the write throws std::length_error.
+*/
+
+class InMemoryBankServer final : public BankServer, public ConditionalDebit
+{
+  public:
+
+    // capacity: maximum number of accounts. write_shards: number of write locks.
+    explicit InMemoryBankServer(std::size_t capacity = 1 << 20, std::size_t write_shards = 1024);
+
+    InMemoryBankServer(const InMemoryBankServer&) = delete;
+    InMemoryBankServer& operator=(const InMemoryBankServer&) = delete;
+
+    void Connect() override {}
+    void Disconnect() override {}
+    void Credit(int account_number, int value) override;
+    void Debit(int account_number, int value) override;
+    int DoubleTransaction(int account_number, int value1, int value2) override;
+    int GetBalance(int account_number) const override;
+    TryDebitResult TryDebit(int account_number, int value) override;
+
+    // Create the account (if it does not exist) and set its balance
+    void OpenAccount(int account_number, int balance);
+
+    // Calls visit(account_number, balance) for every account, in the order of the table (for
+    // example, to take a snapshot of the balances).
+    // Notice that: The writes done at the same time may be seen or not.
+    void ForEachAccount(const std::function<void(int, int)>& visit) const;
+
+    // Number of accounts in the table, and maximum number of them
+    std::size_t Accounts() const { return m_accounts.load(std::memory_order_relaxed); }
+    std::size_t Capacity() const { return m_capacity; }
+
+  private:
+
+    static const std::size_t npos = static_cast<std::size_t>(-1);
+
+    std::size_t home_slot(int account_number) const;
+    std::size_t find_slot(int account_number) const;
+
+    // It must be called holding the shard lock of the account
+    std::size_t find_or_insert_slot(int account_number);
+
+    std::size_t m_capacity;
+    std::size_t m_mask;
+    std::unique_ptr<std::atomic<int>[]> m_keys;
+    std::unique_ptr<std::atomic<int>[]> m_balances;
+    std::atomic<std::size_t> m_accounts;
+    mutable AccountLocks m_write_shards;
+};
+
+#endif
@@ -0,0 +1,45 @@
+#ifndef LATENCYWINDOW_HPP
+#define LATENCYWINDOW_HPP
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+/*
+    LatencyWindow class:
+
+    The last capacity latencies of an operation (a ring buffer), to know its current percentiles.
+    Unlike a LatencyHistogram, the old values are forgotten, so the percentiles follow the
+    changes of the server (check ResilientBankServer).
+
+    It can be used from several threads. percentile() copies the window and selects the value
+    (no sorting), so it costs about a microsecond with the default capacity.
+*/
+
+class LatencyWindow
+{
+  public:
+
+    explicit LatencyWindow(std::size_t capacity = 256);
+
+    void record(std::chrono::nanoseconds latency);
+
+    // Latency under which there are the p fraction (0.0 to 1.0) of the values of the window
+    // (0 if it is empty)
+    std::chrono::nanoseconds percentile(double p) const;
+
+    // Values in the window (up to capacity), and values recorded since the creation
+    std::size_t size() const;
+    std::uint64_t recorded() const;
+
+  private:
+
+    mutable std::mutex m_mutex;
+    std::vector<std::chrono::nanoseconds::rep> m_values;
+    std::size_t m_capacity;
+    std::uint64_t m_recorded;
+};
+
+#endif
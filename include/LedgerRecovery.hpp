@@ -0,0 +1,123 @@
+#ifndef LEDGERRECOVERY_HPP
+#define LEDGERRECOVERY_HPP
+
+#include "InMemoryBankServer.hpp"
+#include "WithdrawLedger.hpp"
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/*
+    Balance snapshots:
+
+    A snapshot is a file with the balances of all the accounts of an InMemoryBankServer, taken
+    when they include exactly the ledger records until a sequence. It is kept in the directory of
+    the ledger, named by that sequence (snapshot-00000000000000001000.snap):
+
+        * A SnapshotHeader and then one SnapshotRecord (8 bytes) per account.
+        * It is written in a temporary file and renamed, so a snapshot is complete or it does
+          not exist. The directory is synced after the rename, before the older snapshots and
+          segments are removed.
+
+    Notice that: The integers are stored in the byte order of the machine that wrote it.
+*/
+
+struct SnapshotHeader
+{
+    char magic[8];                  // "ATMSNAPS"
+    std::uint32_t version;
+    std::uint32_t record_size;
+    std::uint64_t sequence;         // The last ledger record included in the balances
+    std::uint64_t accounts;
+};
+
+struct SnapshotRecord
+{
+    std::int32_t account_number;
+    std::int32_t balance;
+};
+
+static_assert(sizeof(SnapshotHeader) == 32, "The snapshot header must be 32 bytes");
+static_assert(sizeof(SnapshotRecord) == 8, "A snapshot record must be 8 bytes");
+
+/*
+    LedgerRecovery class:
+
+    Rebuilds the balances of an InMemoryBankServer after a restart, from the last snapshot and
+    the ledger records after it (check WithdrawLedger).
+
+        * The snapshot is loaded and the ledger segments are replayed in parallel, by a pool of
+          threads: every thread takes whole segments and adds the balance changes per account
+          (the debits of the successful withdrawals and of the sources of the transfers, and the
+          credits of their destinations), in partitions by account.
+        * Then every partition is merged (and applied to the server) by one thread. The result
+          is a sum per account, so it is the same whatever the number of threads and the order
+          in which the segments were replayed.
+        * The operations that failed with an error may or may not have been done by the server,
+          so they are not applied: they are counted in the report, to be checked.
+        * Snapshots bound the time of the recovery: only the records after the last snapshot are
+          replayed, and optionally the segments already included in it are removed.
+
+    Notice that: Only the balance changes recorded in the ledger are recovered: the ones done by
+    the AtmMachine and TransferEngine objects with the ledger set. Any other change of the 
+    balances of the server (for example, a Credit() of another client) is lost. A snapshot must 
+    include exactly the records until its sequence: snapshot_if_due() makes sure of it with
+    WithdrawLedger::quiesce(), snapshot() must be called when no change is in progress.
+*/
+
+class LedgerRecovery
+{
+  public:
+
+    // What the recovery did, and how long it took
+    struct Report
+    {
+        std::uint64_t snapshot_sequence;    // 0 if there was no snapshot
+        std::uint64_t snapshot_accounts;
+        std::uint64_t last_sequence;        // The last record of the ledger
+        std::uint64_t replayed_records;     // The records after the snapshot
+        std::uint64_t uncertain_records;    // Operations that failed with an error
+        std::uint64_t segments;             // Replayed segments
+        std::uint64_t ledger_bytes;         // Size of the replayed segments
+        std::size_t threads;
+        std::chrono::nanoseconds elapsed;
+    };
+
+    // threads: 0 means one per core
+    explicit LedgerRecovery(const std::string& directory, std::size_t threads = 0);
+
+    // Loads the last snapshot and the ledger records after it into the server. The server
+    // should be empty (the accounts of the snapshot are overwritten, the others are changed).
+    Report recover(InMemoryBankServer& bankserver) const;
+
+    // Writes a snapshot of the balances of the server, that must include exactly the ledger
+    // records until sequence (no change can be in progress). The older snapshots are removed, and
+    // also the ledger segments that are already included in this one if remove_segments is true.
+    void snapshot(const InMemoryBankServer& bankserver, std::uint64_t sequence, bool remove_segments = false);
+
+    // Takes a snapshot if the ledger has at least every_records records after the last one. It
+    // returns true if it was taken. It can be called while the ATMs are working: the balances
+    // are copied with the ledger quiesced (the changes in progress are waited, and the new ones
+    // wait for the copy). It must not be called inside a ledger change.
+    bool snapshot_if_due(const InMemoryBankServer& bankserver, WithdrawLedger& ledger,
+                         std::uint64_t every_records, bool remove_segments = false);
+
+    // The paths of the snapshots of the directory, from the oldest to the newest
+    std::vector<std::string> snapshots() const;
+
+    // The sequence of the newest snapshot (0 if there is none)
+    std::uint64_t last_snapshot_sequence() const;
+
+    std::size_t threads() const { return m_threads; }
+
+  private:
+
+    void write_snapshot(const std::vector<SnapshotRecord>& records, std::uint64_t sequence, bool remove_segments);
+
+    const std::string m_directory;
+    const std::size_t m_threads;
+};
+
+#endif
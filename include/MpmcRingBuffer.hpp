@@ -0,0 +1,140 @@
+#ifndef MPMCRINGBUFFER_HPP
+#define MPMCRINGBUFFER_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <utility>
+
+/*
+    MpmcRingBuffer class template:
+
+    A bounded lock-free queue for many producers and many consumers (D. Vyukov's algorithm).
+
+    Every cell of the ring has a sequence number that tells if it is ready to be written (by 
+    the producer of that position) or to be read (by the consumer of that position), so the 
+    producers and the consumers only compete with a CAS on their own index, and they never 
+    wait for each other: try_push() fails if the queue is full and try_pop() fails if it is
+    empty.
+
+    The capacity is rounded up to a power of two.
+*/
+
+template <typename T>
+class MpmcRingBuffer
+{
+  public:
+
+    explicit MpmcRingBuffer(std::size_t capacity)
+    {
+        std::size_t size = 2;
+        while(size < capacity)
+        {
+            size <<= 1;
+        }
+        m_mask = size - 1;
+        m_cells.reset(new Cell[size]);
+        for(std::size_t i = 0; i < size; ++i)
+        {
+            m_cells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+        m_enqueue_position.store(0, std::memory_order_relaxed);
+        m_dequeue_position.store(0, std::memory_order_relaxed);
+    }
+
+    MpmcRingBuffer(const MpmcRingBuffer&) = delete;
+    MpmcRingBuffer& operator=(const MpmcRingBuffer&) = delete;
+
+    bool try_push(T&& value)
+    {
+        Cell* cell;
+        std::size_t position = m_enqueue_position.load(std::memory_order_relaxed);
+        for(;;)
+        {
+            cell = &m_cells[position & m_mask];
+            std::size_t sequence = cell->sequence.load(std::memory_order_acquire);
+            std::ptrdiff_t difference = static_cast<std::ptrdiff_t>(sequence) - static_cast<std::ptrdiff_t>(position);
+            if(difference == 0)
+            {
+                if(m_enqueue_position.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+                {
+                    break;
+                }
+            }
+            else if(difference < 0)
+            {
+                return false;   // Full
+            }
+            else
+            {
+                position = m_enqueue_position.load(std::memory_order_relaxed);
+            }
+        }
+
+        cell->value = std::move(value);
+        cell->sequence.store(position + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool try_pop(T& value)
+    {
+        Cell* cell;
+        std::size_t position = m_dequeue_position.load(std::memory_order_relaxed);
+        for(;;)
+        {
+            cell = &m_cells[position & m_mask];
+            std::size_t sequence = cell->sequence.load(std::memory_order_acquire);
+            std::ptrdiff_t difference = static_cast<std::ptrdiff_t>(sequence) - static_cast<std::ptrdiff_t>(position + 1);
+            if(difference == 0)
+            {
+                if(m_dequeue_position.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+                {
+                    break;
+                }
+            }
+            else if(difference < 0)
+            {
+                return false;   // Empty
+            }
+            else
+            {
+                position = m_dequeue_position.load(std::memory_order_relaxed);
+            }
+        }
+
+        value = std::move(cell->value);
+        cell->value = T();
+        cell->sequence.store(position + m_mask + 1, std::memory_order_release);
+        return true;
+    }
+
+    std::size_t capacity() const { return m_mask + 1; }
+
+    // Approximated number of elements (exact only when nobody is pushing or popping)
+    std::size_t size_approx() const
+    {
+        std::size_t enqueued = m_enqueue_position.load(std::memory_order_relaxed);
+        std::size_t dequeued = m_dequeue_position.load(std::memory_order_relaxed);
+        return enqueued >= dequeued ? enqueued - dequeued : 0;
+    }
+
+  private:
+
+    struct Cell
+    {
+        std::atomic<std::size_t> sequence;
+        T value;
+    };
+
+    std::unique_ptr<Cell[]> m_cells;
+    std::size_t m_mask;
+
+    // Producers and consumers in different cache lines
+    char m_padding0[64];
+    std::atomic<std::size_t> m_enqueue_position;
+    char m_padding1[64];
+    std::atomic<std::size_t> m_dequeue_position;
+    char m_padding2[64];
+};
+
+#endif
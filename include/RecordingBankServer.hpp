@@ -0,0 +1,61 @@
+#ifndef RECORDINGBANKSERVER_HPP
+#define RECORDINGBANKSERVER_HPP
+
+#include "BankServer.hpp"
+#include "BankServerTrace.hpp"
+#include <atomic>
+#include <cstddef>
+
+/*
+    RecordingBankServer class:
+
+    A BankServer decorator that forwards every call to the wrapped server and writes it in a
+    trace: the function, its arguments, the returned value, when it started and how long it took.
+    The calls that throw are also recorded (marked as failed) and the exception is propagated.
+    A failure writing the trace never reaches the client (nor replaces the exception of the
+    wrapped server): the records lost are counted in TraceErrors(). It is the whole block that
+    the TraceWriter failed to write, not only the record of the call.
+
+    Usage: put it between an AtmMachine and its real server to record the production load, and
+    reproduce it later with a TraceReplayer.
+
+        TraceWriter trace("atm.trace");
+        RecordingBankServer recording(&real_bankserver, &trace);
+        AtmMachine atm_machine(&recording);
+*/
+
+class RecordingBankServer : public BankServer, public ConditionalDebit
+{
+  public:
+
+    RecordingBankServer(BankServer* bankserver, TraceWriter* trace);
+
+    RecordingBankServer(const RecordingBankServer&) = delete;
+    RecordingBankServer& operator=(const RecordingBankServer&) = delete;
+
+    void Connect() override;
+    void Disconnect() override;
+    void Credit(int account_number, int value) override;
+    void Debit(int account_number, int value) override;
+    int DoubleTransaction(int account_number, int value1, int value2) override;
+    int GetBalance(int account_number) const override;
+
+    // ConditionalDebit, only if the wrapped server has it (check conditional_debit_of())
+    TryDebitResult TryDebit(int account_number, int value) override;
+    bool HasConditionalDebit() const override;
+
+    // Number of records that could not be written
+    std::size_t TraceErrors() const;
+
+  private:
+
+    // Runs the call and records it (also if it throws)
+    template <class Call>
+    int record(TraceMethod method, int account_number, int value1, int value2, Call call) const;
+
+    BankServer* m_bankserver;
+    TraceWriter* m_trace;
+    mutable std::atomic<std::size_t> m_trace_errors;
+};
+
+#endif
@@ -0,0 +1,255 @@
+#ifndef RESILIENTBANKSERVER_HPP
+#define RESILIENTBANKSERVER_HPP
+
+#include "AtmInstrumentation.hpp"
+#include "BankServer.hpp"
+#include "LatencyWindow.hpp"
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+/*
+    BankServerUnavailable class:
+
+    Base of the exceptions thrown by a ResilientBankServer when it gives up on a call, so a
+    client can catch all of them at once.
+*/
+
+class BankServerUnavailable : public std::runtime_error
+{
+  public:
+
+    explicit BankServerUnavailable(const std::string& what) : std::runtime_error(what) {}
+};
+
+/*
+    DeadlineExceeded class:
+
+    The call did not finish before its timeout. If it was already sent to the server (sent()),
+    the client does not know if it was applied or not (like with any other error). If it was
+    not (it waited its timeout for a free caller thread), it was never sent and it will never be.
+*/
+
+class DeadlineExceeded : public BankServerUnavailable
+{
+  public:
+
+    DeadlineExceeded(AtmOperation operation, std::chrono::nanoseconds timeout, bool sent);
+
+    AtmOperation operation() const { return m_operation; }
+    std::chrono::nanoseconds timeout() const { return m_timeout; }
+    bool sent() const { return m_sent; }
+
+  private:
+
+    AtmOperation m_operation;
+    std::chrono::nanoseconds m_timeout;
+    bool m_sent;
+};
+
+/*
+    CircuitOpen class:
+
+    The circuit breaker is open: the call was rejected without sending it to the server, so it
+    was not applied and it can be retried later.
+*/
+
+class CircuitOpen : public BankServerUnavailable
+{
+  public:
+
+    CircuitOpen(AtmOperation operation, std::chrono::nanoseconds retry_after);
+
+    AtmOperation operation() const { return m_operation; }
+
+    // Time until the breaker lets a trial call through (0 if a trial is already in flight)
+    std::chrono::nanoseconds retry_after() const { return m_retry_after; }
+
+  private:
+
+    AtmOperation m_operation;
+    std::chrono::nanoseconds m_retry_after;
+};
+
+/*
+    ResiliencePolicy struct:
+
+    The configuration of a ResilientBankServer. The timeout of an operation is
+
+        timeout_multiplier * percentile(timeout_percentile) of its last latencies
+
+    limited to [min_timeout, its max timeout], and initial_timeout until min_samples latencies
+    were observed.
+
+    The calls are done by caller_threads threads, so it should be at least the number of clients
+    sharing the decorator. With 1 they are sent one at a time, as a single session.
+*/
+
+struct ResiliencePolicy
+{
+    std::chrono::nanoseconds initial_timeout = std::chrono::seconds(1);
+    std::chrono::nanoseconds min_timeout = std::chrono::milliseconds(1);
+    std::chrono::nanoseconds max_timeout = std::chrono::seconds(5);
+    double timeout_percentile = 0.99;
+    double timeout_multiplier = 3.0;
+    std::size_t latency_window = 256;
+    std::size_t min_samples = 16;
+    std::size_t caller_threads = 8;
+
+    // Consecutive failures that open the circuit, and how long it stays open
+    std::size_t failure_threshold = 5;
+    std::chrono::nanoseconds open_duration = std::chrono::seconds(1);
+};
+
+// The state of the circuit breaker
+enum class CircuitState
+{
+    Closed,         // The calls are sent
+    Open,           // The calls fail fast
+    HalfOpen        // One trial call is in flight, the others fail fast
+};
+
+const char* to_string(CircuitState state);
+
+/*
+    ResilienceStats struct:
+
+    Counters of a ResilientBankServer.
+*/
+
+struct ResilienceStats
+{
+    std::uint64_t calls;                // Let through by the breaker
+    std::uint64_t failures;             // Exceptions of the server (not TransactionRejected)
+    std::uint64_t deadlines_exceeded;
+    std::uint64_t short_circuited;      // Rejected with CircuitOpen
+    std::uint64_t circuit_opened;       // Times the breaker opened
+    CircuitState state;
+};
+
+/*
+    ResilientBankServer class:
+
+    A BankServer decorator that keeps the clients (AtmMachine threads) from piling up on a slow
+    or broken server.
+
+        * Deadlines: every call is done by a caller thread of the decorator, and the client only
+          waits for it until the timeout of its operation since the call was sent. Then it gets
+          a DeadlineExceeded. A call that waits that long for a free caller thread is cancelled
+          instead (it is never sent), and as the server did not fail, the breaker ignores it.
+        * Adaptive timeouts: every operation (Connect, GetBalance, Debit, TryDebit...) has its own window
+          of latencies and its own timeout, from a percentile of them (check ResiliencePolicy).
+          set_max_timeout() limits the timeout of one operation.
+        * Circuit breaker: after failure_threshold consecutive failures (exceptions of the
+          server or exceeded deadlines) it opens, and the calls fail fast with CircuitOpen.
+          After open_duration a single trial call is sent: if it succeeds the circuit closes,
+          otherwise it opens again.
+        * A TransactionRejected is not a failure (the server is answering), it is just
+          forwarded. Any other exception is forwarded after counting it.
+        * Disconnect() bypasses the breaker, and it is never cancelled while it waits for a
+          caller thread, so a session is always closed. But its client does not wait more than
+          its timeout for a free caller thread: it returns, and the call stays queued.
+        * A Connect() that exceeds its deadline is abandoned: if it succeeds after all, the
+          caller thread sends a Disconnect() to close that session, as nobody owns it.
+
+    Notice that: A call can't be interrupted, so after a DeadlineExceeded the server may still
+    be doing it. The destructor waits until the calls in progress (if any) finish. The wrapped
+    server must accept concurrent calls, unless caller_threads is 1.
+*/
+
+class ResilientBankServer : public BankServer, public ConditionalDebit
+{
+  public:
+
+    explicit ResilientBankServer(BankServer* bankserver, const ResiliencePolicy& policy = ResiliencePolicy());
+    ~ResilientBankServer() override;
+
+    ResilientBankServer(const ResilientBankServer&) = delete;
+    ResilientBankServer& operator=(const ResilientBankServer&) = delete;
+
+    void Connect() override;
+    void Disconnect() override;
+    void Credit(int account_number, int value) override;
+    void Debit(int account_number, int value) override;
+    int DoubleTransaction(int account_number, int value1, int value2) override;
+    int GetBalance(int account_number) const override;
+
+    // ConditionalDebit, only if the wrapped server has it (check conditional_debit_of())
+    TryDebitResult TryDebit(int account_number, int value) override;
+    bool HasConditionalDebit() const override;
+
+    // The current timeout of an operation, and the limit of it
+    std::chrono::nanoseconds timeout(AtmOperation operation) const;
+    void set_max_timeout(AtmOperation operation, std::chrono::nanoseconds max_timeout);
+
+    // The latencies observed for an operation
+    const LatencyWindow& latencies(AtmOperation operation) const;
+
+    CircuitState state() const;
+    ResilienceStats Stats() const;
+
+  private:
+
+    // A call waiting for (or done by) a caller thread. Its client waits on changed.
+    struct Call
+    {
+        enum class Status { Queued, Running, Cancelled, Done };
+
+        AtmOperation operation;
+        std::function<int()> function;
+        Status status;
+        std::chrono::steady_clock::time_point started;
+        bool abandoned;             // The client gave up on it while it was running
+        int result;
+        std::exception_ptr error;
+        std::condition_variable changed;
+    };
+
+    static std::size_t index_of(AtmOperation operation) { return static_cast<std::size_t>(operation); }
+
+    // Sends a call (through the breaker, unless it is a Disconnect()) and waits for it until its
+    // deadline
+    int call(AtmOperation operation, std::function<int()> function) const;
+
+    // Circuit breaker (they take m_breaker_mutex). acquire() returns true for the trial call.
+    bool acquire(AtmOperation operation) const;
+    void on_success() const;
+    void on_failure() const;
+    void on_cancelled(bool trial) const;
+
+    void run_caller();
+
+    BankServer* m_bankserver;
+    const ResiliencePolicy m_policy;
+
+    std::array<std::unique_ptr<LatencyWindow>, static_cast<std::size_t>(AtmOperation::Count)> m_latencies;
+    std::array<std::atomic<std::chrono::nanoseconds::rep>, static_cast<std::size_t>(AtmOperation::Count)> m_max_timeouts;
+
+    // Caller threads (GetBalance() is const, but it sends calls through them)
+    mutable std::mutex m_mutex;
+    mutable std::deque<std::shared_ptr<Call>> m_calls;
+    mutable std::condition_variable m_call_queued;
+    bool m_stopping;
+
+    mutable std::mutex m_breaker_mutex;
+    mutable CircuitState m_state;
+    mutable std::size_t m_consecutive_failures;
+    mutable std::chrono::steady_clock::time_point m_open_until;
+    mutable ResilienceStats m_stats;
+
+    std::vector<std::thread> m_callers;
+};
+
+#endif
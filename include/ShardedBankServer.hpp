@@ -0,0 +1,106 @@
+#ifndef SHARDEDBANKSERVER_HPP
+#define SHARDEDBANKSERVER_HPP
+
+#include "BankServer.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/*
+    ShardedBankServer class:
+
+    A BankServer that spreads the accounts across several backends (shards), so an AtmMachine 
+    is not limited to the throughput of one server.
+
+        * Every account belongs to one shard, chosen with consistent hashing: each shard has 
+          several points (virtual nodes) in a hash ring, and an account goes to the first point
+          after its own hash. 
+        * Credit(), Debit(), DoubleTransaction(), TryDebit() and GetBalance() are forwarded to
+          the shard of the account (the two debits of a DoubleTransaction() never leave their
+          shard).
+        * Connect() and Disconnect() are forwarded to all the shards. If one Connect() fails, the
+          shards that were already connected are disconnected again.
+        * Shards can be added or removed while it is being used (rebalancing without a restart).
+          Thanks to the consistent hashing only the accounts of the new/removed shard change of
+          shard: about 1/K of them instead of almost all of them.
+
+    The shards are identified by a name, and the position of their virtual nodes only depends on
+    it, so every process (every ATM) using the same names routes the accounts in the same way.
+
+    Notice that: It only changes the routing. Moving the balances of the accounts that change of
+    shard (before or after AddShard()/RemoveShard()) is a job of the bank, not of the ATM.
+*/
+
+class ShardedBankServer : public BankServer, public ConditionalDebit
+{
+  public:
+
+    // Empty router: the shards are added later with AddShard()
+    explicit ShardedBankServer(std::size_t virtual_nodes = 128);
+
+    // Router of the given backends, named "shard-0", "shard-1"...
+    explicit ShardedBankServer(const std::vector<BankServer*>& shards, std::size_t virtual_nodes = 128);
+
+    ShardedBankServer(const ShardedBankServer&) = delete;
+    ShardedBankServer& operator=(const ShardedBankServer&) = delete;
+
+    void Connect() override;
+    void Disconnect() override;
+    void Credit(int account_number, int value) override;
+    void Debit(int account_number, int value) override;
+    int DoubleTransaction(int account_number, int value1, int value2) override;
+    int GetBalance(int account_number) const override;
+
+    // ConditionalDebit, only if all the shards have it (check conditional_debit_of())
+    TryDebitResult TryDebit(int account_number, int value) override;
+    bool HasConditionalDebit() const override;
+
+    // Rebalancing. The new shard is connected once per open session of the router before it
+    // receives any account (and the removed one is disconnected once per open session after it
+    // stops receiving them), so every session sees the same shards connected.
+    // Notice that: A call that was already routed to a removed shard can still be running on it.
+    void AddShard(const std::string& name, BankServer* bankserver);
+    void RemoveShard(const std::string& name);
+
+    // The name of the shard of an account, and the number of shards
+    std::string ShardOf(int account_number) const;
+    std::size_t Shards() const;
+
+  private:
+
+    struct Shard
+    {
+        std::string name;
+        BankServer* bankserver;
+    };
+
+    // The routing table: the shards and their sorted points in the ring.
+    // It is never modified: a rebalancing builds a new one and replaces it atomically, so the
+    // calls don't need any lock to route an account.
+    struct Ring
+    {
+        std::vector<Shard> shards;
+        std::vector<std::pair<std::uint64_t, std::size_t>> points;
+    };
+
+    std::shared_ptr<const Ring> ring() const;
+    std::shared_ptr<const Ring> build_ring(std::vector<Shard> shards) const;
+    BankServer& route(int account_number) const;
+    static std::size_t find_shard(const Ring& ring, int account_number);
+
+    static std::uint64_t mix(std::uint64_t value);
+    static std::uint64_t hash_name(const std::string& name);
+
+    const std::size_t m_virtual_nodes;
+    std::shared_ptr<const Ring> m_ring;     // only through std::atomic_load/atomic_store
+
+    // Serializes the changes of the shards and of the open sessions (Connect() calls not
+    // disconnected yet: several clients can share the router)
+    std::mutex m_admin_mutex;
+    std::size_t m_sessions;
+};
+
+#endif
@@ -0,0 +1,87 @@
+#ifndef TRACEREPLAYER_HPP
+#define TRACEREPLAYER_HPP
+
+#include "AtmMachine.hpp"
+#include "BankServer.hpp"
+#include "BankServerTrace.hpp"
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+// How fast a trace is replayed: keeping the time between the calls that it has, or as fast as
+// possible (one call right after the other)
+enum class ReplaySpeed
+{
+    Recorded,
+    Maximum
+};
+
+/*
+    ReplayStats struct:
+
+    Result of a replay: the calls done, how many of them threw an exception, how many didn't 
+    give the same result as in the trace (other returned value, or failed/not failed), and the
+    time it took.
+*/
+
+struct ReplayStats
+{
+    std::size_t calls;
+    std::size_t errors;
+    std::size_t mismatches;
+    std::chrono::nanoseconds elapsed;
+
+    double calls_per_second() const
+    {
+        return elapsed.count() == 0 ? 0.0 : calls * 1e9 / elapsed.count();
+    }
+};
+
+/*
+    TraceReplayer class:
+
+    Reproduces a recorded trace (check RecordingBankServer) offline:
+
+        * Against a BankServer: the same calls with the same arguments, in the same order. 
+          Useful to load-test a backend, or to check that a new one gives the same results.
+          A TryDebit() is replayed as a GetBalance() and a Debit() if the backend does not
+          have the ConditionalDebit capability.
+        * Against an AtmMachine: the withdrawals found in the trace. Every Debit() (and every
+          TryDebit() that was done) is replayed as a withdraw() and every DoubleTransaction()
+          as a withdraw_with_fee(), so the whole ATM stack (with whatever backend it has) gets
+          the recorded load.
+
+    The exceptions of the replayed calls are counted, not propagated, so one bad call does not
+    stop the replay.
+
+    Notice that: The withdrawals that were rejected in the recording (a GetBalance() without a
+    debit) can't be rebuilt, because the requested value never reached the server.
+*/
+
+class TraceReplayer
+{
+  public:
+
+    explicit TraceReplayer(const TraceReader& trace, ReplaySpeed speed = ReplaySpeed::Maximum);
+
+    ReplayStats replay(BankServer& bankserver) const;
+    ReplayStats replay(AtmMachine& atm_machine) const;
+
+  private:
+
+    // Replays a TryDebit(), with or without the ConditionalDebit capability of the backend
+    static bool try_debit(BankServer& bankserver, int account_number, int value);
+
+    // Waits until the time of the record (if the speed is the recorded one)
+    void pace(std::chrono::steady_clock::time_point start, const TraceRecord& record) const;
+
+    const TraceReader& m_trace;
+    const ReplaySpeed m_speed;
+
+    // The earliest start of the trace, the time zero of the replay. It is not always the first
+    // record: they are written when the calls finish, so with several threads a call can start
+    // before the one recorded before it.
+    std::uint64_t m_start_ns;
+};
+
+#endif
@@ -0,0 +1,153 @@
+#ifndef TRANSFERENGINE_HPP
+#define TRANSFERENGINE_HPP
+
+#include "AccountLocks.hpp"
+#include "BankServer.hpp"
+#include "WithdrawLedger.hpp"
+#include <cstddef>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+/*
+    TransferRequest struct:
+
+    One transfer of a batch: the value moved from one account to another one, and the fee paid
+    by the source account (0 if there is no fee).
+*/
+
+struct TransferRequest
+{
+    int from_account_number;
+    int to_account_number;
+    int value;
+    int fee;
+};
+
+/*
+    TransferCreditFailed class:
+
+    Exception thrown by a TransferEngine when the source account was already debited but the
+    Credit() of the destination account failed: the transfer is half done, and retrying the 
+    whole transfer would debit the source twice. Only the credit has to be retried (or the
+    source refunded). cause() is the exception thrown by the Credit().
+*/
+
+class TransferCreditFailed : public std::runtime_error
+{
+  public:
+
+    TransferCreditFailed(int from_account_number, int to_account_number, int value, std::exception_ptr cause, 
+                         const std::string& reason)
+        : std::runtime_error("TransferEngine: the account " + std::to_string(from_account_number) + 
+                             " was debited but the credit of " + std::to_string(value) + " to the account " +
+                             std::to_string(to_account_number) + " failed: " + reason),
+          m_from_account_number(from_account_number), m_to_account_number(to_account_number), m_value(value),
+          m_cause(cause)
+    {
+    }
+
+    int from_account_number() const { return m_from_account_number; }
+    int to_account_number() const { return m_to_account_number; }
+    int value() const { return m_value; }
+    std::exception_ptr cause() const { return m_cause; }
+
+  private:
+
+    int m_from_account_number;
+    int m_to_account_number;
+    int m_value;
+    std::exception_ptr m_cause;
+};
+
+/*
+    TransferEngine class:
+
+    Moves money between accounts with the BankServer operations: a balance check and a debit of
+    the source account (DoubleTransaction() for the value and the fee, TryDebit() if there is no
+    fee and the server has the ConditionalDebit capability, or Debit() otherwise), and then a
+    Credit() of the destination account.
+
+        * Deadlock-free: a transfer holds the locks of both accounts (AccountLocks), and they are
+          always taken in the same global order (the lowest stripe first). So two transfers in
+          opposite directions (A->B and B->A) can't wait for each other. The same locks can be
+          shared with the AtmMachine objects, which only take one lock at a time.
+        * Parallel batches: transfer_batch() splits the requests in waves of independent
+          transfers (no stripe used twice in a wave), and the transfers of a wave run in
+          parallel, one worker thread per session. A transfer is always in a later wave than
+          the previous transfers of its accounts, so the order of the batch is kept per account.
+
+    Notice that: As in AtmMachine::transfer(), if the Credit() fails the source account is already
+    debited. It is not hidden in a generic error: a TransferCreditFailed is thrown (and 
+    Result::debited is set in a batch), so the caller knows it has to retry the credit. The calls of
+    one engine are done one after the other (a batch uses all its sessions): the threads that
+    transfer at the same time use one engine each, with the same AccountLocks.
+*/
+
+class TransferEngine
+{
+  public:
+
+    // The result of one transfer of a batch: done, or not done because the source account did
+    // not have enough money (done = false and no error), or an error thrown by the server.
+    // debited is true if the source account was debited: always if it is done, and also if the
+    // credit failed after the debit (the error is then a TransferCreditFailed).
+    struct Result
+    {
+        bool done;
+        bool debited;
+        std::exception_ptr error;
+    };
+
+    // sessions: one BankServer object per worker of the batches (at least one). It can be the
+    // same object several times if it can be used by several threads at the same time.
+    // account_locks: the locks shared with the other engines and ATMs (its own ones if nullptr)
+    explicit TransferEngine(const std::vector<BankServer*>& sessions, AccountLocks* account_locks = nullptr);
+
+    TransferEngine(const TransferEngine&) = delete;
+    TransferEngine& operator=(const TransferEngine&) = delete;
+
+    // One transfer, in the calling thread and with the first session. It returns false (and
+    // nothing is moved) if the balance of the source account does not cover the value plus the
+    // fee. The errors of the server are thrown (a TransferCreditFailed if the source account was
+    // already debited).
+    bool transfer(int from_account_number, int to_account_number, int value, int fee = 0);
+
+    // Several transfers in parallel. The result of every transfer is in the same position of the
+    // returned vector. Every worker opens its session once for the whole batch.
+    // Notice that: The errors of Connect() and Disconnect() are thrown (the ones of the
+    // transfers are in their results).
+    std::vector<Result> transfer_batch(const std::vector<TransferRequest>& requests);
+
+    // The wave of every transfer of a batch (the waves are run one after the other)
+    std::vector<std::size_t> plan_waves(const std::vector<TransferRequest>& requests) const;
+
+    std::size_t workers() const { return m_sessions.size(); }
+
+    // Optional ledger: both sides of every transfer are appended to it (TransferOut and 
+    // TransferIn, like AtmMachine::transfer()), so it can be recovered with the withdrawals
+    // (check LedgerRecovery). nullptr (the default) disables it.
+    void set_ledger(WithdrawLedger* ledger);
+
+  private:
+
+    // Throws std::invalid_argument if the request can't be done (same source and destination)
+    static void check(const TransferRequest& request);
+
+    // Runs one transfer with the session already opened
+    bool transfer_connected(BankServer& bankserver, const TransferRequest& request);
+
+    // Appends a record to the ledger, if there is one (its failures are only counted)
+    void append_to_ledger(LedgerOperation operation, int account_number, int value, int fee, WithdrawOutcome outcome);
+
+    std::unique_ptr<AccountLocks> m_own_account_locks;
+    AccountLocks* m_account_locks;
+    std::vector<BankServer*> m_sessions;
+    WithdrawLedger* m_ledger;
+    std::mutex m_batch_mutex;
+};
+
+#endif
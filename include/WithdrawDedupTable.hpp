@@ -0,0 +1,150 @@
+#ifndef WITHDRAWDEDUPTABLE_HPP
+#define WITHDRAWDEDUPTABLE_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <string>
+
+/*
+    WithdrawOutcomeUnknown class:
+
+    Exception thrown by AtmMachine::withdraw_once() when the result of a request can't be given:
+    the request is still being processed by another attempt, or a previous attempt failed in 
+    the middle of the debit (so the server may or may not have taken the money).
+*/
+
+class WithdrawOutcomeUnknown : public std::runtime_error
+{
+  public:
+
+    WithdrawOutcomeUnknown(std::uint64_t request_id, const std::string& reason)
+        : std::runtime_error("Withdraw request " + std::to_string(request_id) + " " + reason), m_request_id(request_id)
+    {
+    }
+
+    std::uint64_t request_id() const { return m_request_id; }
+
+  private:
+
+    std::uint64_t m_request_id;
+};
+
+/*
+    WithdrawDedupTable class:
+
+    The outcomes of the last withdraw requests, by request id, so a retried request gets the 
+    result of the first attempt instead of being done again (AtmMachine::withdraw_once()).
+
+        * Lock-free: every entry is a single atomic word (the request id and its outcome), that 
+          is claimed and updated with compare-and-swap.
+        * Bounded: it has a fixed number of entries (8 bytes each), decided in the constructor.
+          A request id can only be in one bucket of 8 entries (a cache line), chosen by its hash,
+          so a lookup is always O(1), with no server round-trip. When a new request finds its
+          bucket full, it evicts a released entry if there is one, and otherwise one of the
+          finished requests (chosen by the new request id).
+        * A request in progress is never evicted, so a retry always finds it. If the 8 requests
+          of a bucket are in progress, claim() throws for a new one (nothing was done for it).
+        * A request id is claimed only once, even by several threads at the same time: the
+          entries of a bucket are used in order and never emptied again, and the entry to evict
+          is chosen from a snapshot of the whole bucket. If the bucket changed and another
+          thread claimed the same request in another entry, the later claim gives its entry up
+          and looks again.
+
+    Notice that: The request ids must be lower than 2^61 (max_request_id). A finished outcome
+    is only kept while its bucket has room: once the bucket is full, every new request of the
+    bucket may evict it (1 in the up to 8 finished ones). With the requests spread over the
+    buckets, after capacity / 8 new requests about 88% of the finished outcomes are still
+    there, and about 34% after capacity new requests. A retry after that may not find its
+    request, and the withdrawal would be done again.
+*/
+
+class WithdrawDedupTable
+{
+  public:
+
+    // The outcome of a request
+    enum class Outcome : std::uint8_t
+    {
+        InProgress = 1,
+        Succeeded = 2,
+        Rejected = 3,       // not enough money
+        Unknown = 4         // failed in the middle of the debit
+    };
+
+    // Result of claim(): if the request is new (claimed), or the outcome it already has
+    struct Claim
+    {
+        bool claimed;
+        Outcome outcome;
+    };
+
+    static const std::uint64_t max_request_id = (std::uint64_t(1) << 61) - 1;
+
+    // The capacity is rounded up to a power of two (and at least one bucket)
+    explicit WithdrawDedupTable(std::size_t capacity = 1 << 16);
+
+    WithdrawDedupTable(const WithdrawDedupTable&) = delete;
+    WithdrawDedupTable& operator=(const WithdrawDedupTable&) = delete;
+
+    // Takes the entry of a request (InProgress) if it is not in the table. Otherwise it returns
+    // the outcome that it has. It throws std::runtime_error if the bucket of the request is full
+    // of requests in progress.
+    Claim claim(std::uint64_t request_id);
+
+    // Sets the final outcome of a claimed request (nothing if it was evicted in the meantime)
+    void complete(std::uint64_t request_id, Outcome outcome);
+
+    // Forgets a claimed request, so it can be claimed again (if nothing was done for it)
+    void release(std::uint64_t request_id);
+
+    // The outcome of a request, if it is in the table
+    bool find(std::uint64_t request_id, Outcome& outcome) const;
+
+    std::size_t capacity() const { return (m_bucket_mask + 1) * bucket_size; }
+    std::size_t memory_bytes() const { return capacity() * sizeof(std::atomic<std::uint64_t>); }
+    std::uint64_t evictions() const { return m_evictions.load(std::memory_order_relaxed); }
+
+  private:
+
+    static const std::size_t bucket_size = 8;
+
+    // A cache line. C++14 "new" does not honour an alignment bigger than the one of max_align_t, 
+    // so the buckets are allocated with posix_memalign() and freed with FreeBuckets.
+    struct alignas(64) Bucket
+    {
+        std::atomic<std::uint64_t> entries[bucket_size];
+    };
+
+    struct FreeBuckets
+    {
+        void operator()(Bucket* buckets) const;
+    };
+
+    static std::uint64_t hash(std::uint64_t request_id);
+    Bucket& bucket_of(std::uint64_t request_id) const;
+
+    // Sets the outcome of the entries of the request that have the outcome "from"
+    void change(std::uint64_t request_id, Outcome from, Outcome to);
+
+    // The entry to evict from a full bucket (bucket_size if all of them are in progress)
+    static std::size_t victim_of(const std::uint64_t (&entries)[bucket_size], std::uint64_t request_id);
+
+    // An entry is (request_id << 3) | state, and 0 if it was never used. A released request 
+    // keeps its entry (so the entries are never emptied), but it is like it is not there. A
+    // vacant entry belongs to no request (a claim gave it up).
+    static const std::uint64_t released = 5;
+    static const std::uint64_t vacant = 6;
+    static std::uint64_t pack(std::uint64_t request_id, std::uint64_t state);
+    static std::uint64_t request_id_of(std::uint64_t entry) { return entry >> 3; }
+    static std::uint64_t state_of(std::uint64_t entry) { return entry & 7; }
+    static bool is_of(std::uint64_t entry, std::uint64_t request_id) { return state_of(entry) != vacant && request_id_of(entry) == request_id; }
+
+    std::unique_ptr<Bucket[], FreeBuckets> m_buckets;
+    std::size_t m_bucket_mask;
+    std::atomic<std::uint64_t> m_evictions;
+};
+
+#endif
@@ -0,0 +1,334 @@
+#ifndef WITHDRAWLEDGER_HPP
+#define WITHDRAWLEDGER_HPP
+
+#include "AtmInstrumentation.hpp"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/*
+    Withdraw ledger:
+
+    An append-only log with the outcome of every withdrawal (and of the other balance changes
+    done by the ATM layer: the two sides of a transfer), for audit and recovery. It is a
+    directory of segment files, named by the sequence of their first record
+    (ledger-00000000000000000001.log), and every segment is:
+
+        * A LedgerSegmentHeader and then up to segment_records LedgerRecord, all of them of 32
+          bytes. The file is created with its full size, so the records after the last written
+          one are zeros: a record with sequence 0 is the end of the segment.
+        * Memory-mapped while it is written, so appending a record is a copy to memory, with no
+          system call.
+
+    Notice that: The integers are stored in the byte order of the machine that wrote it.
+*/
+
+// The operation of a record
+enum class LedgerOperation : std::uint8_t
+{
+    Withdraw,
+    WithdrawWithFee,
+    TransferOut,        // The debit of the source account of a transfer (value and fee)
+    TransferIn          // The credit of the destination account of a transfer (value)
+};
+
+const char* to_string(LedgerOperation operation);
+
+struct LedgerSegmentHeader
+{
+    char magic[8];                  // "ATMLEDGR"
+    std::uint32_t version;
+    std::uint32_t record_size;
+    std::uint64_t first_sequence;
+    std::uint64_t reserved;
+};
+
+struct LedgerRecord
+{
+    std::uint64_t sequence;         // 1, 2, 3... in the order they were appended (0: no record)
+    std::uint64_t timestamp_ns;     // system clock, since the epoch
+    std::int32_t account_number;
+    std::int32_t value;
+    std::int32_t fee;               // 0 for a Withdraw and a TransferIn
+    LedgerOperation operation;
+    std::uint8_t outcome;           // a WithdrawOutcome
+    std::uint16_t reserved;
+};
+
+static_assert(sizeof(LedgerSegmentHeader) == 32, "The ledger segment header must be 32 bytes");
+static_assert(sizeof(LedgerRecord) == 32, "A ledger record must be 32 bytes");
+
+/*
+    WithdrawLedger class:
+
+    Writes the ledger. It can be used from several threads (for example, by all the ATMs of the
+    process, check AtmMachine::set_ledger()).
+
+        * append() copies the record to the mapped segment and returns its sequence. It does not
+          wait for the disk.
+        * Group commit: a committer thread writes the appended records to the disk with a single
+          msync() for all of them, every commit_interval or as soon as group_commit_records are
+          waiting. wait_durable() waits until a record is on the disk (the threads waiting at the
+          same time share the same msync()). If an msync() fails, no later record is ever durable
+          (the disk may have dropped the failed pages, so a retry can't be trusted): the records
+          after durable_sequence() throw the error in wait_durable().
+        * Segment rotation: the committer creates (and maps) the next segment in advance, so when
+          a segment is full the next append() only switches to it. The full segment is written 
+          and unmapped by the committer. If the next one is not ready, append() creates it.
+        * Opening a directory that already has a ledger continues its sequence (in a new
+          segment).
+        * Quiescence: the writers bracket every balance change and its record with a LedgerChange,
+          and quiesce() runs an action when none is in progress, without letting new ones start
+          (for example, to take a snapshot whose balances include exactly the appended records).
+
+    Notice that: Only one WithdrawLedger can write a directory at a time. If the process
+    crashes, the appended records are still written by the operating system. Only a crash of
+    the machine loses the records that were not durable yet.
+*/
+
+class WithdrawLedger
+{
+  public:
+
+    // Writes a range of a mapped segment to the disk, and throws if it fails (msync() by default,
+    // it can be replaced to check the failures of the disk)
+    using SyncFunction = std::function<void(char* address, std::size_t length)>;
+
+    WithdrawLedger(const std::string& directory,
+                   std::size_t segment_records = 1 << 20,
+                   std::size_t group_commit_records = 4096,
+                   std::chrono::microseconds commit_interval = std::chrono::microseconds(1000),
+                   SyncFunction sync_function = SyncFunction());
+
+    // It makes all the records durable
+    ~WithdrawLedger();
+
+    WithdrawLedger(const WithdrawLedger&) = delete;
+    WithdrawLedger& operator=(const WithdrawLedger&) = delete;
+
+    // Appends a record (the sequence and the timestamp are given by the ledger) and returns its
+    // sequence. It only throws if a new segment can't be created.
+    std::uint64_t append(LedgerOperation operation, int account_number, int value, int fee, WithdrawOutcome outcome);
+
+    // The same, but a failure is counted in append_errors() instead of thrown (it returns 0). For
+    // the callers whose own result must not depend on the ledger, like AtmMachine.
+    std::uint64_t try_append(LedgerOperation operation, int account_number, int value, int fee, WithdrawOutcome outcome) noexcept;
+
+    // A balance change (for example, a withdrawal and its record) is in progress between these
+    // two calls (check LedgerChange). begin_change() waits while quiesce() is running.
+    void begin_change();
+    void end_change();
+
+    // Runs action when no balance change is in progress, and without letting new ones start
+    // until it returns. It must not be called inside a change (it would wait for itself).
+    void quiesce(const std::function<void()>& action);
+
+    // Waits until a record (and all the previous ones) is on the disk. It throws if the
+    // committer failed to write it.
+    void wait_durable(std::uint64_t sequence);
+
+    // Makes all the records appended until now durable
+    void commit();
+
+    // The sequence of the last appended record, and of the last durable one (0 if none)
+    std::uint64_t last_sequence() const;
+    std::uint64_t durable_sequence() const;
+
+    // Number of msync() batches done by the committer, and segments created by this object
+    std::uint64_t commits() const { return m_commits.load(std::memory_order_relaxed); }
+    std::uint64_t segments() const { return m_segments.load(std::memory_order_relaxed); }
+
+    // Number of records lost because try_append() failed
+    std::uint64_t append_errors() const { return m_append_errors.load(std::memory_order_relaxed); }
+
+    const std::string& directory() const { return m_directory; }
+
+  private:
+
+    // A segment that is being written
+    struct Segment
+    {
+        int fd;
+        char* mapping;
+        std::size_t mapping_size;
+        std::uint64_t first_sequence;
+        std::size_t records;            // appended to it
+        std::size_t synced_records;     // already on the disk
+    };
+
+    Segment create_segment(std::uint64_t first_sequence);
+    void sync(const Segment& segment, std::size_t from_record, std::size_t to_record) const;
+    static void close(Segment& segment);
+    void remove(Segment& segment);
+    void run_committer();
+
+    // They must be called holding m_mutex (in the lock)
+    void rotate(std::unique_lock<std::mutex>& lock);
+    void prepare_next(std::unique_lock<std::mutex>& lock);
+
+    const std::string m_directory;
+    const std::size_t m_segment_records;
+    const std::size_t m_group_commit_records;
+    const std::chrono::microseconds m_commit_interval;
+    const SyncFunction m_sync_function;
+
+    mutable std::mutex m_mutex;
+    Segment m_current;
+    std::vector<Segment> m_full;        // Rotated segments waiting for the committer
+    Segment m_next;                     // Created in advance by the committer (if mapping)
+    bool m_prepare_next;                // The committer must create the next segment
+    bool m_preparing_next;              // The committer is creating it right now
+    std::condition_variable m_next_ready;
+    std::uint64_t m_last_sequence;
+    std::uint64_t m_durable_sequence;
+    std::exception_ptr m_commit_error;  // The first failed commit (nothing is durable after it)
+    bool m_commit_requested;
+    bool m_stopping;
+    std::condition_variable m_commit_needed;
+    std::condition_variable m_durable;
+
+    // The balance changes in progress, and whether a quiesce() is waiting for them or running
+    std::mutex m_changes_mutex;
+    std::condition_variable m_changes_done;
+    std::size_t m_changes;
+    bool m_quiescing;
+
+    std::atomic<std::uint64_t> m_commits;
+    std::atomic<std::uint64_t> m_segments;
+    std::atomic<std::uint64_t> m_append_errors;
+    std::thread m_committer;
+};
+
+/*
+    LedgerChange class:
+
+    RAII for WithdrawLedger::begin_change() and end_change(). It does nothing without a ledger.
+*/
+
+class LedgerChange
+{
+  public:
+
+    explicit LedgerChange(WithdrawLedger* ledger) : m_ledger(ledger)
+    {
+        if(m_ledger)
+        {
+            m_ledger->begin_change();
+        }
+    }
+
+    ~LedgerChange()
+    {
+        if(m_ledger)
+        {
+            m_ledger->end_change();
+        }
+    }
+
+    LedgerChange(const LedgerChange&) = delete;
+    LedgerChange& operator=(const LedgerChange&) = delete;
+
+  private:
+
+    WithdrawLedger* m_ledger;
+};
+
+/*
+    LedgerSegment class:
+
+    One segment file memory-mapped (read only): a view of its records as an array, from the
+    first one to the last written one.
+*/
+
+class LedgerSegment
+{
+  public:
+
+    explicit LedgerSegment(const std::string& path);
+    ~LedgerSegment();
+
+    LedgerSegment(LedgerSegment&& other) noexcept;
+    LedgerSegment& operator=(LedgerSegment&& other) noexcept;
+    LedgerSegment(const LedgerSegment&) = delete;
+    LedgerSegment& operator=(const LedgerSegment&) = delete;
+
+    std::uint64_t first_sequence() const { return m_first_sequence; }
+    std::size_t size() const { return m_size; }
+    bool empty() const { return m_size == 0; }
+    const LedgerRecord& operator[](std::size_t i) const { return m_records[i]; }
+    const LedgerRecord* begin() const { return m_records; }
+    const LedgerRecord* end() const { return m_records + m_size; }
+
+  private:
+
+    void unmap();
+
+    void* m_mapping;
+    std::size_t m_mapping_size;
+    const LedgerRecord* m_records;
+    std::size_t m_size;
+    std::uint64_t m_first_sequence;
+};
+
+/*
+    LedgerScanner class:
+
+    Reads a ledger directory from the beginning to the end (or from a sequence), segment after
+    segment. The segments are mapped one at a time and read sequentially, with no copies.
+*/
+
+class LedgerScanner
+{
+  public:
+
+    explicit LedgerScanner(const std::string& directory);
+
+    // The paths of the segments, in order
+    const std::vector<std::string>& segments() const { return m_segments; }
+
+    // Calls visit(const LedgerRecord&) for every record with a sequence from from_sequence, in
+    // order, and returns how many of them were visited
+    template <class Visitor>
+    std::uint64_t scan(Visitor visit, std::uint64_t from_sequence = 1) const
+    {
+        std::uint64_t visited = 0;
+        for(std::size_t i = 0; i < m_segments.size(); ++i)
+        {
+            // A segment can be skipped if the next one still starts before from_sequence
+            if(i + 1 < m_segments.size() && first_sequence_of(m_segments[i + 1]) <= from_sequence)
+            {
+                continue;
+            }
+            LedgerSegment segment(m_segments[i]);
+            for(const LedgerRecord& record : segment)
+            {
+                if(record.sequence >= from_sequence)
+                {
+                    visit(record);
+                    visited++;
+                }
+            }
+        }
+        return visited;
+    }
+
+    // The sequence of the first record of a segment, from its file name
+    static std::uint64_t first_sequence_of(const std::string& path);
+
+    // The file name of the segment that starts with a sequence
+    static std::string segment_name(std::uint64_t first_sequence);
+
+  private:
+
+    std::vector<std::string> m_segments;
+};
+
+#endif
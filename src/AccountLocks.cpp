@@ -0,0 +1,21 @@
+#include "AccountLocks.hpp"
+#include <cstdint>
+
+AccountLocks::AccountLocks(std::size_t stripes)
+{
+    std::size_t size = 1;
+    while(size < stripes)
+    {
+        size <<= 1;
+    }
+
+    m_stripes.reset(new Stripe[size]);
+    m_mask = size - 1;
+}
+
+std::size_t AccountLocks::stripe_of(int account_number) const
+{
+    // Fibonacci hashing, so consecutive account numbers don't end in consecutive stripes
+    std::uint64_t hash = static_cast<std::uint32_t>(account_number) * 0x9E3779B97F4A7C15ull;
+    return static_cast<std::size_t>(hash >> 32) & m_mask;
+}
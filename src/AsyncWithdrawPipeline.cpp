@@ -0,0 +1,196 @@
+#include "AsyncWithdrawPipeline.hpp"
+
+void AsyncWithdrawPipeline::start(AsyncBankOperations* bankserver, 
+                                  std::vector<WithdrawRequest> requests,
+                                  std::size_t max_in_flight,
+                                  WithdrawCallback on_withdraw, 
+                                  DoneCallback on_done,
+                                  CloseSession close_session)
+{
+    std::shared_ptr<AsyncWithdrawPipeline> pipeline(new AsyncWithdrawPipeline(
+        bankserver, std::move(requests), max_in_flight, std::move(on_withdraw), std::move(on_done), std::move(close_session)));
+
+    if(pipeline->m_requests.empty())
+    {
+        pipeline->close();
+        return;
+    }
+
+    pipeline->pump();
+}
+
+AsyncWithdrawPipeline::AsyncWithdrawPipeline(AsyncBankOperations* bankserver, 
+                                             std::vector<WithdrawRequest> requests,
+                                             std::size_t max_in_flight,
+                                             WithdrawCallback on_withdraw, 
+                                             DoneCallback on_done,
+                                             CloseSession close_session)
+    : m_bankserver(bankserver), 
+      m_requests(std::move(requests)), 
+      m_max_in_flight(max_in_flight > 0 ? max_in_flight : 1),
+      m_on_withdraw(std::move(on_withdraw)), 
+      m_on_done(std::move(on_done)), 
+      m_close_session(std::move(close_session)),
+      m_in_flight(0), 
+      m_finished(0), 
+      m_pumping(false), 
+      m_pump_again(false)
+{
+    // The first withdrawal of every account can start, the others wait for the previous one
+    for(std::size_t i = 0; i < m_requests.size(); ++i)
+    {
+        auto waiting = m_waiting.find(m_requests[i].account_number);
+        if(waiting == m_waiting.end())
+        {
+            m_waiting[m_requests[i].account_number];
+            m_ready.push_back(i);
+        }
+        else
+        {
+            waiting->second.push_back(i);
+        }
+    }
+}
+
+void AsyncWithdrawPipeline::pump()
+{
+    // Only one thread starts withdrawals at a time. If another one is already doing it, it is
+    // told to check again, so a completion never waits for nothing. This also avoids a deep 
+    // recursion when the backend completes the operations inside the calls.
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if(m_pumping)
+        {
+            m_pump_again = true;
+            return;
+        }
+        m_pumping = true;
+    }
+
+    std::vector<std::size_t> to_issue;
+    for(;;)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            while(m_in_flight < m_max_in_flight && !m_ready.empty())
+            {
+                to_issue.push_back(m_ready.front());
+                m_ready.pop_front();
+                ++m_in_flight;
+            }
+            if(to_issue.empty())
+            {
+                if(!m_pump_again)
+                {
+                    m_pumping = false;
+                    return;
+                }
+            }
+            m_pump_again = false;
+        }
+
+        for(auto index : to_issue)
+        {
+            issue(index);
+        }
+        to_issue.clear();
+    }
+}
+
+void AsyncWithdrawPipeline::issue(std::size_t index)
+{
+    auto self = shared_from_this();
+    try
+    {
+        m_bankserver->GetBalanceAsync(m_requests[index].account_number, 
+            [self, index](std::exception_ptr error, int balance) { self->on_balance(index, error, balance); });
+    }
+    catch(...)
+    {
+        finish(index, false, std::current_exception());
+    }
+}
+
+void AsyncWithdrawPipeline::on_balance(std::size_t index, std::exception_ptr error, int balance)
+{
+    if(error)
+    {
+        finish(index, false, error);
+        return;
+    }
+
+    if(balance < m_requests[index].value)
+    {
+        finish(index, false, nullptr);
+        return;
+    }
+
+    auto self = shared_from_this();
+    try
+    {
+        m_bankserver->DebitAsync(m_requests[index].account_number, m_requests[index].value,
+            [self, index](std::exception_ptr error) { self->finish(index, !error, error); });
+    }
+    catch(...)
+    {
+        finish(index, false, std::current_exception());
+    }
+}
+
+void AsyncWithdrawPipeline::finish(std::size_t index, bool result, std::exception_ptr error)
+{
+    if(m_on_withdraw)
+    {
+        m_on_withdraw(index, result, error);
+    }
+
+    bool all_finished = false;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        --m_in_flight;
+        ++m_finished;
+        all_finished = m_finished == m_requests.size();
+
+        // The next withdrawal of the same account can start now
+        auto waiting = m_waiting.find(m_requests[index].account_number);
+        if(waiting->second.empty())
+        {
+            m_waiting.erase(waiting);
+        }
+        else
+        {
+            m_ready.push_back(waiting->second.front());
+            waiting->second.pop_front();
+        }
+    }
+
+    if(all_finished)
+    {
+        close();
+    }
+    else
+    {
+        pump();
+    }
+}
+
+void AsyncWithdrawPipeline::close()
+{
+    std::exception_ptr error;
+    try
+    {
+        if(m_close_session)
+        {
+            m_close_session();
+        }
+    }
+    catch(...)
+    {
+        error = std::current_exception();
+    }
+
+    if(m_on_done)
+    {
+        m_on_done(error);
+    }
+}
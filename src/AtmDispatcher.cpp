@@ -0,0 +1,241 @@
+#include "AtmDispatcher.hpp"
+#include <chrono>
+#include <stdexcept>
+
+AtmDispatcher::AtmDispatcher(const std::vector<BankServer*>& sessions, std::size_t queue_capacity, AccountLocks* account_locks)
+    : m_stopping(false), m_submitting(0), m_queued(0), m_completed(0), m_stolen(0), m_rejected(0), m_sleeping(0)
+{
+    if(sessions.empty())
+    {
+        throw std::invalid_argument("AtmDispatcher needs at least one session");
+    }
+
+    if(!account_locks)
+    {
+        m_own_account_locks.reset(new AccountLocks());
+        account_locks = m_own_account_locks.get();
+    }
+
+    // Every worker gets its part of the total capacity
+    std::size_t worker_capacity = (queue_capacity + sessions.size() - 1) / sessions.size();
+    for(auto session : sessions)
+    {
+        m_workers.emplace_back(new Worker(session, worker_capacity, account_locks));
+    }
+    for(std::size_t i = 0; i < m_workers.size(); ++i)
+    {
+        m_workers[i]->thread = std::thread(&AtmDispatcher::run, this, i);
+    }
+}
+
+AtmDispatcher::~AtmDispatcher()
+{
+    stop();
+}
+
+bool AtmDispatcher::try_submit(int account_number, int value, Callback on_done)
+{
+    Submitting submitting(m_submitting);
+    if(m_stopping.load())
+    {
+        return false;
+    }
+
+    if(!push(Request{account_number, value, std::move(on_done)}))
+    {
+        m_rejected.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    return true;
+}
+
+void AtmDispatcher::submit(int account_number, int value, Callback on_done)
+{
+    Request request{account_number, value, std::move(on_done)};
+    Submitting submitting(m_submitting);
+    for(;;)
+    {
+        if(m_stopping.load())
+        {
+            throw std::logic_error("AtmDispatcher is stopped");
+        }
+        if(push(std::move(request)))
+        {
+            return;
+        }
+        std::this_thread::yield();
+    }
+}
+
+std::future<bool> AtmDispatcher::submit(int account_number, int value)
+{
+    auto promise = std::make_shared<std::promise<bool>>();
+    std::future<bool> future = promise->get_future();
+    submit(account_number, value, [promise](bool result, std::exception_ptr error)
+    {
+        if(error)
+        {
+            promise->set_exception(error);
+        }
+        else
+        {
+            promise->set_value(result);
+        }
+    });
+    return future;
+}
+
+void AtmDispatcher::stop()
+{
+    if(m_stopping.exchange(true))
+    {
+        return;
+    }
+
+    // A submitter that did not see m_stopping is pushing right now: its request must be in the
+    // queues before the workers are told to finish (both atomics are sequentially consistent,
+    // so every submitter either sees m_stopping or is counted here)
+    while(m_submitting.load() > 0)
+    {
+        std::this_thread::yield();
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_idle_mutex);
+        m_idle.notify_all();
+    }
+    for(auto& worker : m_workers)
+    {
+        if(worker->thread.joinable())
+        {
+            worker->thread.join();
+        }
+    }
+
+    // Nothing can be queued after the workers finished, but just in case: it is not processed,
+    // and its caller is told
+    Request request;
+    for(std::size_t i = 0; i < m_workers.size(); ++i)
+    {
+        while(m_workers[i]->queue.try_pop(request))
+        {
+            m_queued.fetch_sub(1);
+            if(request.on_done)
+            {
+                request.on_done(false, std::make_exception_ptr(std::logic_error("AtmDispatcher is stopped")));
+            }
+        }
+    }
+}
+
+AtmDispatcher::Stats AtmDispatcher::stats() const
+{
+    return Stats{m_completed.load(std::memory_order_relaxed), 
+                 m_stolen.load(std::memory_order_relaxed), 
+                 m_rejected.load(std::memory_order_relaxed)};
+}
+
+std::size_t AtmDispatcher::worker_of(int account_number) const
+{
+    std::uint64_t hash = static_cast<std::uint32_t>(account_number) * 0x9E3779B97F4A7C15ull;
+    return static_cast<std::size_t>(hash >> 32) % m_workers.size();
+}
+
+bool AtmDispatcher::push(Request&& request)
+{
+    // The queue of the account's worker first, then any other with room
+    std::size_t home = worker_of(request.account_number);
+    for(std::size_t i = 0; i < m_workers.size(); ++i)
+    {
+        if(m_workers[(home + i) % m_workers.size()]->queue.try_push(std::move(request)))
+        {
+            m_queued.fetch_add(1);
+            if(m_sleeping.load() > 0)
+            {
+                std::lock_guard<std::mutex> lock(m_idle_mutex);
+                m_idle.notify_one();
+            }
+            return true;
+        }
+    }
+    return false;
+}
+
+bool AtmDispatcher::pop(std::size_t worker, Request& request)
+{
+    if(m_workers[worker]->queue.try_pop(request))
+    {
+        m_queued.fetch_sub(1);
+        return true;
+    }
+
+    // Nothing in its own queue: steal from the others
+    for(std::size_t i = 1; i < m_workers.size(); ++i)
+    {
+        if(m_workers[(worker + i) % m_workers.size()]->queue.try_pop(request))
+        {
+            m_queued.fetch_sub(1);
+            if(worker_of(request.account_number) != worker)
+            {
+                m_stolen.fetch_add(1, std::memory_order_relaxed);
+            }
+            return true;
+        }
+    }
+    return false;
+}
+
+void AtmDispatcher::run(std::size_t index)
+{
+    Worker& worker = *m_workers[index];
+
+    // The session of the worker is opened once, for all its withdrawals
+    try
+    {
+        worker.pool.warm_up();
+    }
+    catch(...)
+    {
+        // It will be retried (lazily) in the first withdrawal
+    }
+
+    Request request;
+    for(;;)
+    {
+        if(pop(index, request))
+        {
+            bool result = false;
+            std::exception_ptr error;
+            try
+            {
+                result = worker.atm_machine.withdraw(request.account_number, request.value);
+            }
+            catch(...)
+            {
+                error = std::current_exception();
+            }
+            // Counted before the callback, so the stats are up to date when the result is seen
+            m_completed.fetch_add(1, std::memory_order_relaxed);
+            if(request.on_done)
+            {
+                request.on_done(result, error);
+            }
+            request = Request();
+            continue;
+        }
+
+        // Nothing to do. Finish if it is stopping (the queues are empty), otherwise sleep 
+        // until something is submitted (with a timeout, just in case of a lost notification)
+        if(m_stopping.load(std::memory_order_acquire) && m_queued.load() <= 0)
+        {
+            return;
+        }
+        std::unique_lock<std::mutex> lock(m_idle_mutex);
+        m_sleeping.fetch_add(1);
+        m_idle.wait_for(lock, std::chrono::milliseconds(1), [this]() 
+        { 
+            return m_queued.load() > 0 || m_stopping.load(std::memory_order_acquire); 
+        });
+        m_sleeping.fetch_sub(1);
+    }
+}
@@ -0,0 +1,220 @@
+#include "AtmInstrumentation.hpp"
+#include <algorithm>
+#include <iomanip>
+
+const char* to_string(AtmOperation operation)
+{
+    switch(operation)
+    {
+        case AtmOperation::Connect:           return "Connect";
+        case AtmOperation::Disconnect:        return "Disconnect";
+        case AtmOperation::GetBalance:        return "GetBalance";
+        case AtmOperation::Debit:             return "Debit";
+        case AtmOperation::TryDebit:          return "TryDebit";
+        case AtmOperation::DoubleTransaction: return "DoubleTransaction";
+        case AtmOperation::Credit:            return "Credit";
+        case AtmOperation::Withdraw:          return "Withdraw";
+        default:                              return "Unknown";
+    }
+}
+
+const char* to_string(WithdrawOutcome outcome)
+{
+    switch(outcome)
+    {
+        case WithdrawOutcome::Success:           return "Success";
+        case WithdrawOutcome::InsufficientFunds: return "InsufficientFunds";
+        case WithdrawOutcome::Error:             return "Error";
+        default:                                 return "Unknown";
+    }
+}
+
+//--------------------------------------------------------------------------------------------------
+// LatencyHistogram
+
+const std::size_t LatencyHistogram::sub_buckets;
+const std::size_t LatencyHistogram::max_magnitude;
+const std::size_t LatencyHistogram::bucket_count;
+
+LatencyHistogram::LatencyHistogram() : m_count(0), m_sum_ns(0), m_max_ns(0)
+{
+    for(auto& bucket : m_buckets)
+    {
+        bucket.store(0, std::memory_order_relaxed);
+    }
+}
+
+void LatencyHistogram::record(std::uint64_t latency_ns)
+{
+    m_buckets[bucket_of(latency_ns)].fetch_add(1, std::memory_order_relaxed);
+    m_count.fetch_add(1, std::memory_order_relaxed);
+    m_sum_ns.fetch_add(latency_ns, std::memory_order_relaxed);
+
+    std::uint64_t max = m_max_ns.load(std::memory_order_relaxed);
+    while(latency_ns > max && !m_max_ns.compare_exchange_weak(max, latency_ns, std::memory_order_relaxed))
+    {
+    }
+}
+
+HistogramSnapshot LatencyHistogram::snapshot() const
+{
+    HistogramSnapshot snapshot;
+    snapshot.buckets.resize(bucket_count);
+    for(std::size_t i = 0; i < bucket_count; ++i)
+    {
+        snapshot.buckets[i] = m_buckets[i].load(std::memory_order_relaxed);
+    }
+    snapshot.count = m_count.load(std::memory_order_relaxed);
+    snapshot.sum_ns = m_sum_ns.load(std::memory_order_relaxed);
+    snapshot.max_ns = m_max_ns.load(std::memory_order_relaxed);
+    return snapshot;
+}
+
+std::size_t LatencyHistogram::bucket_of(std::uint64_t latency_ns)
+{
+    if(latency_ns < sub_buckets)
+    {
+        return static_cast<std::size_t>(latency_ns);
+    }
+
+    std::size_t magnitude = 63 - static_cast<std::size_t>(__builtin_clzll(latency_ns));
+    if(magnitude >= max_magnitude)
+    {
+        return bucket_count - 1;
+    }
+    std::size_t sub_bucket = static_cast<std::size_t>(latency_ns >> (magnitude - 3)) & (sub_buckets - 1);
+    return (magnitude - 2) * sub_buckets + sub_bucket;
+}
+
+std::uint64_t LatencyHistogram::lower_bound_of(std::size_t bucket)
+{
+    if(bucket < sub_buckets)
+    {
+        return bucket;
+    }
+    std::size_t magnitude = bucket / sub_buckets + 2;
+    std::uint64_t sub_bucket = bucket % sub_buckets;
+    return (sub_buckets + sub_bucket) << (magnitude - 3);
+}
+
+//--------------------------------------------------------------------------------------------------
+// HistogramSnapshot
+
+std::uint64_t HistogramSnapshot::percentile(double p) const
+{
+    if(count == 0)
+    {
+        return 0;
+    }
+
+    // The first bucket where the accumulated count reaches the rank
+    std::uint64_t rank = static_cast<std::uint64_t>(p * count);
+    rank = std::max<std::uint64_t>(1, std::min(rank, count));
+    std::uint64_t accumulated = 0;
+    for(std::size_t i = 0; i < buckets.size(); ++i)
+    {
+        accumulated += buckets[i];
+        if(accumulated >= rank)
+        {
+            // The middle of the bucket, but never more than the maximum seen
+            std::uint64_t low = LatencyHistogram::lower_bound_of(i);
+            std::uint64_t high = i + 1 < buckets.size() ? LatencyHistogram::lower_bound_of(i + 1) : low + 1;
+            return std::min(low + (high - low) / 2, max_ns);
+        }
+    }
+    return max_ns;
+}
+
+void HistogramSnapshot::merge(const HistogramSnapshot& other)
+{
+    buckets.resize(std::max(buckets.size(), other.buckets.size()), 0);
+    for(std::size_t i = 0; i < other.buckets.size(); ++i)
+    {
+        buckets[i] += other.buckets[i];
+    }
+    count += other.count;
+    sum_ns += other.sum_ns;
+    max_ns = std::max(max_ns, other.max_ns);
+}
+
+//--------------------------------------------------------------------------------------------------
+// InstrumentationSnapshot
+
+void InstrumentationSnapshot::export_text(std::ostream& out) const
+{
+    out << std::left << std::setw(12) << "operation" << std::right
+        << std::setw(12) << "count" << std::setw(12) << "mean_ns" << std::setw(12) << "p50_ns"
+        << std::setw(12) << "p99_ns" << std::setw(12) << "p999_ns" << std::setw(12) << "max_ns" << "\n";
+    for(std::size_t i = 0; i < operations.size(); ++i)
+    {
+        const HistogramSnapshot& histogram = operations[i];
+        out << std::left << std::setw(12) << to_string(static_cast<AtmOperation>(i)) << std::right
+            << std::setw(12) << histogram.count
+            << std::setw(12) << static_cast<std::uint64_t>(histogram.mean())
+            << std::setw(12) << histogram.percentile(0.50)
+            << std::setw(12) << histogram.percentile(0.99)
+            << std::setw(12) << histogram.percentile(0.999)
+            << std::setw(12) << histogram.max_ns << "\n";
+    }
+    for(std::size_t i = 0; i < outcomes.size(); ++i)
+    {
+        out << to_string(static_cast<WithdrawOutcome>(i)) << ": " << outcomes[i] << "\n";
+    }
+}
+
+//--------------------------------------------------------------------------------------------------
+// AtmInstrumentation
+
+AtmInstrumentation::AtmInstrumentation(std::size_t shards)
+{
+    for(std::size_t i = 0; i < std::max<std::size_t>(shards, 1); ++i)
+    {
+        std::unique_ptr<Shard> shard(new Shard());
+        for(auto& outcome : shard->outcomes)
+        {
+            outcome.store(0, std::memory_order_relaxed);
+        }
+        m_shards.push_back(std::move(shard));
+    }
+}
+
+void AtmInstrumentation::record(AtmOperation operation, std::uint64_t latency_ns)
+{
+    shard().operations[static_cast<std::size_t>(operation)].record(latency_ns);
+}
+
+void AtmInstrumentation::count(WithdrawOutcome outcome)
+{
+    shard().outcomes[static_cast<std::size_t>(outcome)].fetch_add(1, std::memory_order_relaxed);
+}
+
+InstrumentationSnapshot AtmInstrumentation::snapshot() const
+{
+    InstrumentationSnapshot snapshot;
+    for(auto& histogram : snapshot.operations)
+    {
+        histogram = HistogramSnapshot{std::vector<std::uint64_t>(LatencyHistogram::bucket_count, 0), 0, 0, 0};
+    }
+    snapshot.outcomes.fill(0);
+
+    for(const auto& shard : m_shards)
+    {
+        for(std::size_t i = 0; i < snapshot.operations.size(); ++i)
+        {
+            snapshot.operations[i].merge(shard->operations[i].snapshot());
+        }
+        for(std::size_t i = 0; i < snapshot.outcomes.size(); ++i)
+        {
+            snapshot.outcomes[i] += shard->outcomes[i].load(std::memory_order_relaxed);
+        }
+    }
+    return snapshot;
+}
+
+AtmInstrumentation::Shard& AtmInstrumentation::shard()
+{
+    // Every thread gets a number the first time, and it always uses the same shard
+    static std::atomic<std::size_t> next_thread(0);
+    thread_local std::size_t thread_number = next_thread.fetch_add(1, std::memory_order_relaxed);
+    return *m_shards[thread_number % m_shards.size()];
+}
@@ -1,24 +1,367 @@
 #include "AtmMachine.hpp"
 
-AtmMachine::AtmMachine(BankServer* bankserver) : m_bankserver ( bankserver)
+AtmMachine::AtmMachine(BankServer* bankserver, AccountLocks* account_locks) 
+    : m_bankserver ( bankserver), m_pool ( nullptr ), m_account_locks ( account_locks ), m_instrumentation ( nullptr ), m_dedup_table ( nullptr ), m_ledger ( nullptr )
 {
 };
 
-bool AtmMachine::withdraw(int account_number, int value)
+AtmMachine::AtmMachine(BankServerSessionPool* pool, AccountLocks* account_locks) 
+    : m_bankserver ( nullptr ), m_pool ( pool ), m_account_locks ( account_locks ), m_instrumentation ( nullptr ), m_dedup_table ( nullptr ), m_ledger ( nullptr )
+{
+};
+
+void AtmMachine::set_instrumentation(AtmInstrumentation* instrumentation)
 {
-    bool result = false;
+    m_instrumentation = instrumentation;
+}
 
-    m_bankserver->Connect();
+void AtmMachine::set_dedup_table(WithdrawDedupTable* dedup_table)
+{
+    m_dedup_table = dedup_table;
+}
 
-    auto available_balance = m_bankserver->GetBalance(account_number);
+void AtmMachine::set_ledger(WithdrawLedger* ledger)
+{
+    m_ledger = ledger;
+}
 
-    if(available_balance >= value)
+template <class Operation>
+auto AtmMachine::with_session(Operation operation)
+{
+    if(m_pool)
     {
-        m_bankserver->Debit(account_number, value);
-        result = true;
+        auto session = acquire_session();
+        try
+        {
+            return operation(*session);
+        }
+        catch(...)
+        {
+            session.invalidate();
+            throw;
+        }
     }
 
-    m_bankserver->Disconnect();
+    BankSession session(m_bankserver, m_instrumentation);
+
+    auto result = operation(*session);
+
+    session.close();
+
+    return result;
+}
+
+template <class Step>
+bool AtmMachine::record_outcome(LedgerOperation operation, int account_number, int value, int fee, Step step)
+{
+    // The debit and its record are one change for the snapshots of the ledger
+    LedgerChange change(m_ledger);
+
+    bool result;
+    try
+    {
+        result = step();
+    }
+    catch(...)
+    {
+        ATM_COUNT_OUTCOME(m_instrumentation, WithdrawOutcome::Error);
+        append_to_ledger(operation, account_number, value, fee, WithdrawOutcome::Error);
+        throw;
+    }
 
+    WithdrawOutcome outcome = result ? WithdrawOutcome::Success : WithdrawOutcome::InsufficientFunds;
+    ATM_COUNT_OUTCOME(m_instrumentation, outcome);
+    append_to_ledger(operation, account_number, value, fee, outcome);
     return result;
-}
\ No newline at end of file
+}
+
+void AtmMachine::append_to_ledger(LedgerOperation operation, int account_number, int value, int fee, WithdrawOutcome outcome)
+{
+    if(m_ledger)
+    {
+        m_ledger->try_append(operation, account_number, value, fee, outcome);
+    }
+}
+
+template <class Step>
+bool AtmMachine::run_once(std::uint64_t request_id, Step step)
+{
+    if(!m_dedup_table)
+    {
+        throw std::logic_error("AtmMachine: withdraw_once() needs a dedup table");
+    }
+
+    // A request that is already known is answered from the table
+    auto claim = m_dedup_table->claim(request_id);
+    if(!claim.claimed)
+    {
+        switch(claim.outcome)
+        {
+            case WithdrawDedupTable::Outcome::Succeeded: return true;
+            case WithdrawDedupTable::Outcome::Rejected:  return false;
+            case WithdrawDedupTable::Outcome::InProgress: throw WithdrawOutcomeUnknown(request_id, "is in progress");
+            default: throw WithdrawOutcomeUnknown(request_id, "failed in the middle of the debit");
+        }
+    }
+
+    ATM_TIME_SCOPE(m_instrumentation, AtmOperation::Withdraw);
+
+    atm_detail::DebitProgress progress = atm_detail::DebitProgress::NotSent;
+    try
+    {
+        bool result = with_session([&](BankServer& bankserver) 
+        {
+            return step(bankserver, &progress);
+        });
+        m_dedup_table->complete(request_id, result ? WithdrawDedupTable::Outcome::Succeeded 
+                                                   : WithdrawDedupTable::Outcome::Rejected);
+        return result;
+    }
+    catch(...)
+    {
+        // What a retry must do depends on whether the money was taken or not
+        switch(progress)
+        {
+            case atm_detail::DebitProgress::NotSent:
+                m_dedup_table->release(request_id);
+                break;
+            case atm_detail::DebitProgress::Sent:
+                m_dedup_table->complete(request_id, WithdrawDedupTable::Outcome::Unknown);
+                break;
+            case atm_detail::DebitProgress::Done:
+                m_dedup_table->complete(request_id, WithdrawDedupTable::Outcome::Succeeded);
+                break;
+        }
+        throw;
+    }
+}
+
+bool AtmMachine::withdraw(int account_number, int value)
+{
+    ATM_TIME_SCOPE(m_instrumentation, AtmOperation::Withdraw);
+
+    return with_session([&](BankServer& bankserver) 
+    {
+        return withdraw_connected(bankserver, account_number, value);
+    });
+}
+
+bool AtmMachine::withdraw_with_fee(int account_number, int value, int fee)
+{
+    ATM_TIME_SCOPE(m_instrumentation, AtmOperation::Withdraw);
+
+    return with_session([&](BankServer& bankserver) 
+    {
+        return record_outcome(LedgerOperation::WithdrawWithFee, account_number, value, fee, [&]() 
+        {
+            return atm_detail::check_and_debit_pair(bankserver, m_account_locks, m_instrumentation, 
+                                                    account_number, value, fee);
+        });
+    });
+}
+
+bool AtmMachine::transfer(int from_account_number, int to_account_number, int value, int fee)
+{
+    return with_session([&](BankServer& bankserver) 
+    {
+        // Both sides are recorded in the ledger, as one change
+        LedgerChange change(m_ledger);
+
+        bool debited;
+        try
+        {
+            debited = atm_detail::check_and_debit_pair(bankserver, m_account_locks, m_instrumentation, 
+                                                       from_account_number, value, fee);
+        }
+        catch(...)
+        {
+            append_to_ledger(LedgerOperation::TransferOut, from_account_number, value, fee, WithdrawOutcome::Error);
+            throw;
+        }
+        append_to_ledger(LedgerOperation::TransferOut, from_account_number, value, fee, 
+                         debited ? WithdrawOutcome::Success : WithdrawOutcome::InsufficientFunds);
+        if(!debited)
+        {
+            return false;
+        }
+
+        try
+        {
+            ATM_TIME_SCOPE(m_instrumentation, AtmOperation::Credit);
+            bankserver.Credit(to_account_number, value);
+        }
+        catch(...)
+        {
+            append_to_ledger(LedgerOperation::TransferIn, to_account_number, value, 0, WithdrawOutcome::Error);
+            throw;
+        }
+        append_to_ledger(LedgerOperation::TransferIn, to_account_number, value, 0, WithdrawOutcome::Success);
+        return true;
+    });
+}
+
+bool AtmMachine::withdraw_once(std::uint64_t request_id, int account_number, int value)
+{
+    return run_once(request_id, [&](BankServer& bankserver, atm_detail::DebitProgress* progress) 
+    {
+        return record_outcome(LedgerOperation::Withdraw, account_number, value, 0, [&]() 
+        {
+            return withdraw_step(bankserver, account_number, value, progress);
+        });
+    });
+}
+
+bool AtmMachine::withdraw_with_fee_once(std::uint64_t request_id, int account_number, int value, int fee)
+{
+    return run_once(request_id, [&](BankServer& bankserver, atm_detail::DebitProgress* progress) 
+    {
+        return record_outcome(LedgerOperation::WithdrawWithFee, account_number, value, fee, [&]() 
+        {
+            return atm_detail::check_and_debit_pair(bankserver, m_account_locks, m_instrumentation, 
+                                                    account_number, value, fee, progress);
+        });
+    });
+}
+
+std::vector<bool> AtmMachine::withdraw_batch(const std::vector<WithdrawRequest>& requests)
+{
+    if(requests.empty())
+    {
+        return std::vector<bool>();
+    }
+
+    return with_session([&](BankServer& bankserver) 
+    {
+        std::vector<bool> results(requests.size(), false);
+        for(std::size_t i = 0; i < requests.size(); ++i)
+        {
+            results[i] = withdraw_connected(bankserver, requests[i].account_number, requests[i].value);
+        }
+        return results;
+    });
+}
+
+void AtmMachine::withdraw_async(const std::vector<WithdrawRequest>& requests, 
+                                WithdrawCallback on_withdraw, 
+                                WithdrawDoneCallback on_done, 
+                                std::size_t max_in_flight)
+{
+    if(requests.empty())
+    {
+        if(on_done)
+        {
+            on_done(nullptr);
+        }
+        return;
+    }
+
+    // Open the session, and prepare how to close it at the end
+    BankServer* bankserver = m_bankserver;
+    AsyncWithdrawPipeline::CloseSession close_session;
+    if(m_pool)
+    {
+        auto session = std::make_shared<BankServerSessionPool::Lease>(acquire_session());
+        bankserver = session->get();
+        close_session = [session]() { session->release(); };
+    }
+    else
+    {
+        // The session can be closed after this AtmMachine is gone, so the callback owns it. If
+        // the withdrawals can't even start, it is closed when the callback is destroyed.
+        auto session = std::make_shared<BankSession>(m_bankserver, m_instrumentation);
+        close_session = [session]() { session->close(); };
+    }
+
+    // The account locks and the ledger changes (check LedgerChange) can't be held across 
+    // asynchronous completions, so with any of them the withdrawals are done one after the other,
+    // holding the lock of each account and recording each one in its change
+    auto async_bankserver = m_account_locks || m_ledger ? nullptr : dynamic_cast<AsyncBankOperations*>(bankserver);
+    if(async_bankserver)
+    {
+        // The outcomes arrive in the callbacks of the pipeline, maybe after this AtmMachine is gone
+        if(m_instrumentation)
+        {
+            AtmInstrumentation* instrumentation = m_instrumentation;
+            WithdrawCallback caller_on_withdraw = std::move(on_withdraw);
+            on_withdraw = [instrumentation, caller_on_withdraw](std::size_t i, bool result, std::exception_ptr error)
+            {
+                WithdrawOutcome outcome = error ? WithdrawOutcome::Error 
+                                                : (result ? WithdrawOutcome::Success : WithdrawOutcome::InsufficientFunds);
+                ATM_COUNT_OUTCOME(instrumentation, outcome);
+                if(caller_on_withdraw)
+                {
+                    caller_on_withdraw(i, result, error);
+                }
+            };
+        }
+        AsyncWithdrawPipeline::start(async_bankserver, requests, max_in_flight, 
+                                     std::move(on_withdraw), std::move(on_done), std::move(close_session));
+        return;
+    }
+
+    // Synchronous server (or account locks): one withdrawal after the other
+    for(std::size_t i = 0; i < requests.size(); ++i)
+    {
+        bool result = false;
+        std::exception_ptr error;
+        try
+        {
+            result = withdraw_connected(*bankserver, requests[i].account_number, requests[i].value);
+        }
+        catch(...)
+        {
+            error = std::current_exception();
+        }
+        if(on_withdraw)
+        {
+            on_withdraw(i, result, error);
+        }
+    }
+
+    std::exception_ptr error;
+    try
+    {
+        close_session();
+    }
+    catch(...)
+    {
+        error = std::current_exception();
+    }
+    if(on_done)
+    {
+        on_done(error);
+    }
+}
+
+BankServerSessionPool::Lease AtmMachine::acquire_session()
+{
+    // Leasing a session from the pool is what replaces the Connect()
+    ATM_TIME_SCOPE(m_instrumentation, AtmOperation::Connect);
+    return m_pool->acquire();
+}
+
+bool AtmMachine::withdraw_connected(BankServer& bankserver, int account_number, int value)
+{
+    return record_outcome(LedgerOperation::Withdraw, account_number, value, 0, [&]() 
+    {
+        return withdraw_step(bankserver, account_number, value);
+    });
+}
+
+bool AtmMachine::withdraw_step(BankServer& bankserver, int account_number, int value, 
+                               atm_detail::DebitProgress* progress)
+{
+    // If the server can check and debit in one operation, let it do it: only one round-trip 
+    // and it is already atomic, so no account lock is needed
+    auto conditional_debit = conditional_debit_of(&bankserver);
+    if(conditional_debit)
+    {
+        ATM_TIME_SCOPE(m_instrumentation, AtmOperation::TryDebit);
+        atm_detail::set_progress(progress, atm_detail::DebitProgress::Sent);
+        bool result = conditional_debit->TryDebit(account_number, value).ok;
+        atm_detail::set_progress(progress, result ? atm_detail::DebitProgress::Done : atm_detail::DebitProgress::NotSent);
+        return result;
+    }
+
+    return atm_detail::check_and_debit(bankserver, m_account_locks, m_instrumentation, account_number, value, progress);
+}
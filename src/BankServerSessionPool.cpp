@@ -0,0 +1,257 @@
+#include "BankServerSessionPool.hpp"
+#include <stdexcept>
+
+//--------------------------------------------------------------------------------------------------
+// Lease
+
+BankServerSessionPool::Lease::Lease() : m_pool(nullptr), m_slot(0), m_bankserver(nullptr), m_valid(true)
+{
+}
+
+BankServerSessionPool::Lease::Lease(BankServerSessionPool* pool, std::size_t slot, BankServer* bankserver)
+    : m_pool(pool), m_slot(slot), m_bankserver(bankserver), m_valid(true)
+{
+}
+
+BankServerSessionPool::Lease::Lease(Lease&& other)
+    : m_pool(other.m_pool), m_slot(other.m_slot), m_bankserver(other.m_bankserver), m_valid(other.m_valid)
+{
+    other.m_pool = nullptr;
+    other.m_bankserver = nullptr;
+}
+
+BankServerSessionPool::Lease& BankServerSessionPool::Lease::operator=(Lease&& other)
+{
+    if(this != &other)
+    {
+        release();
+        m_pool = other.m_pool;
+        m_slot = other.m_slot;
+        m_bankserver = other.m_bankserver;
+        m_valid = other.m_valid;
+        other.m_pool = nullptr;
+        other.m_bankserver = nullptr;
+    }
+    return *this;
+}
+
+BankServerSessionPool::Lease::~Lease()
+{
+    release();
+}
+
+void BankServerSessionPool::Lease::release()
+{
+    if(m_pool)
+    {
+        m_pool->give_back(m_slot, m_valid);
+        m_pool = nullptr;
+        m_bankserver = nullptr;
+    }
+}
+
+//--------------------------------------------------------------------------------------------------
+// BankServerSessionPool
+
+BankServerSessionPool::BankServerSessionPool(const std::vector<BankServer*>& connections, HealthCheck health_check)
+    : m_health_check(std::move(health_check))
+{
+    if(connections.empty())
+    {
+        throw std::invalid_argument("BankServerSessionPool needs at least one connection");
+    }
+
+    m_slots.reserve(connections.size());
+    for(auto bankserver : connections)
+    {
+        m_slots.push_back(Slot{bankserver, false, false, false});
+    }
+}
+
+BankServerSessionPool::~BankServerSessionPool()
+{
+    // The sessions are disconnected without the pool lock, like any other call to the server
+    std::vector<BankServer*> connected;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for(auto& slot : m_slots)
+        {
+            if(slot.connected)
+            {
+                connected.push_back(slot.bankserver);
+                slot.connected = false;
+            }
+        }
+    }
+
+    for(auto bankserver : connected)
+    {
+        try
+        {
+            bankserver->Disconnect();
+        }
+        catch(...)
+        {
+            // Nothing to do, the pool is going away
+        }
+    }
+}
+
+BankServerSessionPool::Lease BankServerSessionPool::acquire()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    for(;;)
+    {
+        Lease lease = lease_locked(lock);
+        if(lease)
+        {
+            return lease;
+        }
+        m_free.wait(lock);
+    }
+}
+
+BankServerSessionPool::Lease BankServerSessionPool::try_acquire()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    return lease_locked(lock);
+}
+
+void BankServerSessionPool::warm_up()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    for(auto& slot : m_slots)
+    {
+        if(slot.connected || slot.leased)
+        {
+            continue;
+        }
+
+        // The slot is reserved (leased) while it is connected without the pool lock
+        slot.leased = true;
+        lock.unlock();
+        try
+        {
+            slot.bankserver->Connect();
+        }
+        catch(...)
+        {
+            lock.lock();
+            slot.leased = false;
+            m_free.notify_one();
+            throw;
+        }
+        lock.lock();
+
+        slot.connected = true;
+        slot.used = false;
+        slot.leased = false;
+        m_free.notify_one();
+    }
+}
+
+std::size_t BankServerSessionPool::live() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::size_t count = 0;
+    for(const auto& slot : m_slots)
+    {
+        count += slot.connected ? 1 : 0;
+    }
+    return count;
+}
+
+BankServerSessionPool::Lease BankServerSessionPool::lease_locked(std::unique_lock<std::mutex>& lock)
+{
+    // Prefer the sessions that are already connected, so we don't connect new ones for nothing
+    Slot* candidate = nullptr;
+    std::size_t candidate_index = 0;
+    for(std::size_t i = 0; i < m_slots.size(); ++i)
+    {
+        Slot& slot = m_slots[i];
+        if(slot.leased)
+        {
+            continue;
+        }
+        if(!candidate || (slot.connected && !candidate->connected))
+        {
+            candidate = &slot;
+            candidate_index = i;
+        }
+    }
+
+    if(!candidate)
+    {
+        return Lease();
+    }
+
+    // The connect or the health check can be slow (they are calls to the server), and they
+    // only touch this slot, so they are done without the pool lock on a copy of the slot.
+    candidate->leased = true;
+    Slot prepared = *candidate;
+    lock.unlock();
+    try
+    {
+        prepare(prepared);
+    }
+    catch(...)
+    {
+        lock.lock();
+        candidate->connected = prepared.connected;
+        candidate->leased = false;
+        m_free.notify_one();
+        throw;
+    }
+    lock.lock();
+
+    candidate->connected = prepared.connected;
+    candidate->used = true;
+    return Lease(this, candidate_index, candidate->bankserver);
+}
+
+void BankServerSessionPool::prepare(Slot& slot)
+{
+    if(slot.connected && slot.used && m_health_check && !m_health_check(*slot.bankserver))
+    {
+        try
+        {
+            slot.bankserver->Disconnect();
+        }
+        catch(...)
+        {
+            // It is broken anyway, we are going to reconnect it
+        }
+        slot.connected = false;
+    }
+
+    if(!slot.connected)
+    {
+        slot.bankserver->Connect();
+        slot.connected = true;
+    }
+}
+
+void BankServerSessionPool::give_back(std::size_t index, bool valid)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    Slot& slot = m_slots[index];
+
+    // The slot stays leased while it is disconnected without the pool lock
+    if(!valid && slot.connected)
+    {
+        lock.unlock();
+        try
+        {
+            slot.bankserver->Disconnect();
+        }
+        catch(...)
+        {
+            // It will be reconnected in the next lease
+        }
+        lock.lock();
+        slot.connected = false;
+    }
+
+    slot.leased = false;
+    m_free.notify_one();
+}
@@ -0,0 +1,207 @@
+#include "BankServerTrace.hpp"
+#include <cstring>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace
+{
+    const char trace_magic[8] = {'A', 'T', 'M', 'T', 'R', 'A', 'C', 'E'};
+    const std::uint32_t trace_version = 1;
+}
+
+const char* to_string(TraceMethod method)
+{
+    switch(method)
+    {
+        case TraceMethod::Connect:           return "Connect";
+        case TraceMethod::Disconnect:        return "Disconnect";
+        case TraceMethod::Credit:            return "Credit";
+        case TraceMethod::Debit:             return "Debit";
+        case TraceMethod::DoubleTransaction: return "DoubleTransaction";
+        case TraceMethod::GetBalance:        return "GetBalance";
+        case TraceMethod::TryDebit:          return "TryDebit";
+        default:                             return "Unknown";
+    }
+}
+
+//--------------------------------------------------------------------------------------------------
+// TraceWriter
+
+TraceWriter::TraceWriter(const std::string& path, std::size_t buffered_records)
+    : m_file(std::fopen(path.c_str(), "wb")), m_start(std::chrono::steady_clock::now()), 
+      m_buffered_records(buffered_records == 0 ? 1 : buffered_records), m_records(0), m_dropped(0)
+{
+    if(!m_file)
+    {
+        throw std::runtime_error("TraceWriter: can't create " + path);
+    }
+
+    TraceHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, trace_magic, sizeof(header.magic));
+    header.version = trace_version;
+    header.record_size = sizeof(TraceRecord);
+    if(std::fwrite(&header, sizeof(header), 1, m_file) != 1)
+    {
+        std::fclose(m_file);
+        throw std::runtime_error("TraceWriter: can't write " + path);
+    }
+
+    m_buffer.reserve(m_buffered_records);
+}
+
+TraceWriter::~TraceWriter()
+{
+    try
+    {
+        flush();
+    }
+    catch(...)
+    {
+    }
+    std::fclose(m_file);
+}
+
+std::uint64_t TraceWriter::now_ns() const
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - m_start).count();
+}
+
+void TraceWriter::write(const TraceRecord& record)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_buffer.push_back(record);
+    m_records++;
+    if(m_buffer.size() >= m_buffered_records)
+    {
+        flush_locked();
+    }
+}
+
+void TraceWriter::flush()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    flush_locked();
+}
+
+std::size_t TraceWriter::records() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_records;
+}
+
+std::size_t TraceWriter::dropped() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_dropped;
+}
+
+void TraceWriter::flush_locked()
+{
+    if(m_buffer.empty())
+    {
+        return;
+    }
+    std::size_t count = m_buffer.size();
+    std::size_t written = std::fwrite(m_buffer.data(), sizeof(TraceRecord), count, m_file);
+    m_buffer.clear();
+
+    // If the fflush() fails, it is not known which ones reached the file: all of them are lost
+    if(written == count && std::fflush(m_file) != 0)
+    {
+        written = 0;
+    }
+    if(written != count)
+    {
+        std::size_t lost = count - written;
+        m_records -= lost;
+        m_dropped += lost;
+        throw TraceWriteError(lost);
+    }
+}
+
+//--------------------------------------------------------------------------------------------------
+// TraceReader
+
+TraceReader::TraceReader(const std::string& path)
+    : m_mapping(nullptr), m_mapping_size(0), m_records(nullptr), m_size(0)
+{
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if(fd < 0)
+    {
+        throw std::runtime_error("TraceReader: can't open " + path);
+    }
+
+    struct stat info;
+    if(::fstat(fd, &info) != 0 || static_cast<std::size_t>(info.st_size) < sizeof(TraceHeader))
+    {
+        ::close(fd);
+        throw std::runtime_error("TraceReader: " + path + " is not a trace");
+    }
+
+    m_mapping_size = static_cast<std::size_t>(info.st_size);
+    m_mapping = ::mmap(nullptr, m_mapping_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);    // the mapping keeps the file
+    if(m_mapping == MAP_FAILED)
+    {
+        m_mapping = nullptr;
+        throw std::runtime_error("TraceReader: can't map " + path);
+    }
+
+    const TraceHeader* header = static_cast<const TraceHeader*>(m_mapping);
+    if(std::memcmp(header->magic, trace_magic, sizeof(trace_magic)) != 0 || 
+       header->version != trace_version || header->record_size != sizeof(TraceRecord))
+    {
+        unmap();
+        throw std::runtime_error("TraceReader: " + path + " is not a trace (or of another version)");
+    }
+
+    // The header and the records are 32 bytes, so the records are aligned in the mapping
+    m_records = reinterpret_cast<const TraceRecord*>(static_cast<const char*>(m_mapping) + sizeof(TraceHeader));
+    m_size = (m_mapping_size - sizeof(TraceHeader)) / sizeof(TraceRecord);
+
+    // It is read from the beginning to the end
+    ::madvise(m_mapping, m_mapping_size, MADV_SEQUENTIAL);
+}
+
+TraceReader::~TraceReader()
+{
+    unmap();
+}
+
+TraceReader::TraceReader(TraceReader&& other) noexcept
+    : m_mapping(other.m_mapping), m_mapping_size(other.m_mapping_size), m_records(other.m_records), m_size(other.m_size)
+{
+    other.m_mapping = nullptr;
+    other.m_mapping_size = 0;
+    other.m_records = nullptr;
+    other.m_size = 0;
+}
+
+TraceReader& TraceReader::operator=(TraceReader&& other) noexcept
+{
+    if(this != &other)
+    {
+        unmap();
+        std::swap(m_mapping, other.m_mapping);
+        std::swap(m_mapping_size, other.m_mapping_size);
+        std::swap(m_records, other.m_records);
+        std::swap(m_size, other.m_size);
+    }
+    return *this;
+}
+
+void TraceReader::unmap()
+{
+    if(m_mapping)
+    {
+        ::munmap(m_mapping, m_mapping_size);
+    }
+    m_mapping = nullptr;
+    m_mapping_size = 0;
+    m_records = nullptr;
+    m_size = 0;
+}
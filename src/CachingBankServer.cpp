@@ -0,0 +1,184 @@
+#include "CachingBankServer.hpp"
+
+CachingBankServer::CachingBankServer(BankServer* bankserver, std::size_t capacity, std::chrono::steady_clock::duration ttl)
+    : m_bankserver(bankserver), m_capacity(capacity), m_ttl(ttl), m_hits(0), m_misses(0), m_generation(0)
+{
+}
+
+void CachingBankServer::Connect()
+{
+    m_bankserver->Connect();
+}
+
+void CachingBankServer::Disconnect()
+{
+    InvalidateAll();
+    m_bankserver->Disconnect();
+}
+
+void CachingBankServer::Credit(int account_number, int value)
+{
+    try
+    {
+        m_bankserver->Credit(account_number, value);
+    }
+    catch(...)
+    {
+        Invalidate(account_number);
+        throw;
+    }
+    std::lock_guard<std::mutex> lock(m_mutex);
+    apply_locked(account_number, value);
+}
+
+void CachingBankServer::Debit(int account_number, int value)
+{
+    try
+    {
+        m_bankserver->Debit(account_number, value);
+    }
+    catch(...)
+    {
+        Invalidate(account_number);
+        throw;
+    }
+    std::lock_guard<std::mutex> lock(m_mutex);
+    apply_locked(account_number, -value);
+}
+
+int CachingBankServer::DoubleTransaction(int account_number, int value1, int value2)
+{
+    try
+    {
+        int result = m_bankserver->DoubleTransaction(account_number, value1, value2);
+        Invalidate(account_number);
+        return result;
+    }
+    catch(...)
+    {
+        Invalidate(account_number);
+        throw;
+    }
+}
+
+TryDebitResult CachingBankServer::TryDebit(int account_number, int value)
+{
+    TryDebitResult result;
+    try
+    {
+        result = wrapped_conditional_debit(m_bankserver).TryDebit(account_number, value);
+    }
+    catch(...)
+    {
+        Invalidate(account_number);
+        throw;
+    }
+    if(!result.ok)
+    {
+        Invalidate(account_number);
+        return result;
+    }
+    std::lock_guard<std::mutex> lock(m_mutex);
+    apply_locked(account_number, -value);
+    return result;
+}
+
+bool CachingBankServer::HasConditionalDebit() const
+{
+    return conditional_debit_of(m_bankserver) != nullptr;
+}
+
+int CachingBankServer::GetBalance(int account_number) const
+{
+    std::uint64_t generation;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto entry = m_entries.find(account_number);
+        if(entry != m_entries.end())
+        {
+            if(std::chrono::steady_clock::now() - entry->second->read_time < m_ttl)
+            {
+                // Hit: it is now the most recently used
+                m_lru.splice(m_lru.begin(), m_lru, entry->second);
+                ++m_hits;
+                return entry->second->balance;
+            }
+            erase_locked(account_number);
+        }
+        ++m_misses;
+        generation = m_generation;
+    }
+
+    int balance;
+    try
+    {
+        balance = m_bankserver->GetBalance(account_number);
+    }
+    catch(...)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        erase_locked(account_number);
+        throw;
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if(generation == m_generation && m_capacity > 0 && m_entries.count(account_number) == 0)
+    {
+        if(m_entries.size() >= m_capacity)
+        {
+            m_entries.erase(m_lru.back().account_number);
+            m_lru.pop_back();
+        }
+        m_lru.push_front(Entry{account_number, balance, std::chrono::steady_clock::now()});
+        m_entries[account_number] = m_lru.begin();
+    }
+    return balance;
+}
+
+void CachingBankServer::Invalidate(int account_number)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    ++m_generation;
+    erase_locked(account_number);
+}
+
+void CachingBankServer::InvalidateAll()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    ++m_generation;
+    m_entries.clear();
+    m_lru.clear();
+}
+
+CacheStats CachingBankServer::Stats() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    // Estimation: a list node (entry + 2 pointers), a hash map node (key, iterator, next 
+    // pointer and cached hash) for every entry, plus the bucket array
+    const std::size_t list_node = sizeof(Entry) + 2 * sizeof(void*);
+    const std::size_t map_node = sizeof(std::pair<const int, Lru::iterator>) + sizeof(void*) + sizeof(std::size_t);
+    std::size_t memory = m_entries.size() * (list_node + map_node) + m_entries.bucket_count() * sizeof(void*);
+
+    return CacheStats{m_hits, m_misses, m_entries.size(), memory};
+}
+
+void CachingBankServer::apply_locked(int account_number, int delta)
+{
+    ++m_generation;
+    auto entry = m_entries.find(account_number);
+    if(entry != m_entries.end())
+    {
+        entry->second->balance += delta;
+    }
+}
+
+void CachingBankServer::erase_locked(int account_number) const
+{
+    auto entry = m_entries.find(account_number);
+    if(entry != m_entries.end())
+    {
+        m_lru.erase(entry->second);
+        m_entries.erase(entry);
+    }
+}
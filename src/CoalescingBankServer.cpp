@@ -0,0 +1,374 @@
+#include "CoalescingBankServer.hpp"
+#include <algorithm>
+
+CoalescingBankServer::CoalescingBankServer(BankServer* bankserver, std::chrono::steady_clock::duration window)
+    : m_bankserver(bankserver), m_window(window), m_sessions(0), m_unknown_outcomes(0)
+{
+}
+
+CoalescingBankServer::~CoalescingBankServer()
+{
+    try
+    {
+        Flush();
+    }
+    catch(...)
+    {
+        // Nothing else can be done here. Call Flush() before destroying it to see the errors.
+    }
+}
+
+void CoalescingBankServer::Connect()
+{
+    m_bankserver->Connect();
+    std::lock_guard<std::mutex> lock(m_mutex);
+    ++m_sessions;
+}
+
+void CoalescingBankServer::Disconnect()
+{
+    // Last chance to flush inside this session. The session is closed even if it fails, and
+    // then the error of the flush is thrown.
+    std::exception_ptr error;
+    try
+    {
+        flush_if_due();
+        throw_deferred();
+    }
+    catch(...)
+    {
+        error = std::current_exception();
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        --m_sessions;
+    }
+    try
+    {
+        m_bankserver->Disconnect();
+    }
+    catch(...)
+    {
+        if(!error)
+        {
+            error = std::current_exception();
+        }
+    }
+    if(error)
+    {
+        std::rethrow_exception(error);
+    }
+}
+
+void CoalescingBankServer::Credit(int account_number, int value)
+{
+    add(account_number, value);
+    flush_if_due(account_number);
+}
+
+void CoalescingBankServer::Debit(int account_number, int value)
+{
+    add(account_number, -value);
+    flush_if_due(account_number);
+}
+
+int CoalescingBankServer::DoubleTransaction(int account_number, int value1, int value2)
+{
+    std::lock_guard<std::mutex> flush_lock(m_flush_mutex);
+    flush_account_locked(account_number);
+    return m_bankserver->DoubleTransaction(account_number, value1, value2);
+}
+
+TryDebitResult CoalescingBankServer::TryDebit(int account_number, int value)
+{
+    // The server must see the pending delta of the account to check the balance
+    ConditionalDebit& conditional_debit = wrapped_conditional_debit(m_bankserver);
+    std::lock_guard<std::mutex> flush_lock(m_flush_mutex);
+    flush_account_locked(account_number);
+    return conditional_debit.TryDebit(account_number, value);
+}
+
+bool CoalescingBankServer::HasConditionalDebit() const
+{
+    return conditional_debit_of(m_bankserver) != nullptr;
+}
+
+int CoalescingBankServer::GetBalance(int account_number) const
+{
+    // No flush can be in the middle, so every delta is either pending or already applied
+    std::lock_guard<std::mutex> flush_lock(m_flush_mutex);
+    int pending = 0;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto delta = m_deltas.find(account_number);
+        if(delta != m_deltas.end())
+        {
+            pending = delta->second;
+        }
+    }
+    return m_bankserver->GetBalance(account_number) + pending;
+}
+
+void CoalescingBankServer::Flush()
+{
+    std::lock_guard<std::mutex> flush_lock(m_flush_mutex);
+
+    bool connected;
+    bool empty;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        empty = m_deltas.empty();
+        connected = m_sessions > 0;
+    }
+
+    if(empty)
+    {
+        throw_deferred();
+        return;
+    }
+
+    if(connected)
+    {
+        flush_locked();
+        throw_deferred();
+        return;
+    }
+
+    m_bankserver->Connect();
+    try
+    {
+        flush_locked();
+    }
+    catch(...)
+    {
+        m_bankserver->Disconnect();
+        throw;
+    }
+    m_bankserver->Disconnect();
+    throw_deferred();
+}
+
+std::size_t CoalescingBankServer::Pending() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_deltas.size();
+}
+
+std::size_t CoalescingBankServer::UnknownOutcomes() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_unknown_outcomes;
+}
+
+void CoalescingBankServer::add(int account_number, int delta)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if(m_deltas.empty())
+    {
+        m_window_start = std::chrono::steady_clock::now();
+    }
+    auto inserted = m_deltas.emplace(account_number, delta);
+    if(inserted.second)
+    {
+        m_order.push_back(account_number);
+    }
+    else
+    {
+        inserted.first->second += delta;
+    }
+}
+
+bool CoalescingBankServer::due() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return !m_deltas.empty() && m_sessions > 0 && std::chrono::steady_clock::now() - m_window_start >= m_window;
+}
+
+void CoalescingBankServer::flush_if_due()
+{
+    std::lock_guard<std::mutex> flush_lock(m_flush_mutex);
+    if(due())
+    {
+        flush_locked();
+    }
+}
+
+void CoalescingBankServer::flush_if_due(int account_number)
+{
+    std::lock_guard<std::mutex> flush_lock(m_flush_mutex);
+    if(!due())
+    {
+        return;
+    }
+
+    int failed_account = 0;
+    try
+    {
+        flush_locked(&failed_account);
+    }
+    catch(const TransactionRejected&)
+    {
+        // The deltas are still pending (this write too), so they are sent in the next flush
+    }
+    catch(...)
+    {
+        if(failed_account == account_number)
+        {
+            throw;
+        }
+
+        // It is not an error of this write, so it waits for the next Flush() or Disconnect()
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if(!m_deferred_error)
+        {
+            m_deferred_error = std::current_exception();
+        }
+    }
+}
+
+void CoalescingBankServer::throw_deferred()
+{
+    std::exception_ptr error;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        error.swap(m_deferred_error);
+    }
+    if(error)
+    {
+        std::rethrow_exception(error);
+    }
+}
+
+void CoalescingBankServer::flush_locked(int* failed_account)
+{
+    // Take all the pending deltas, so the other threads can keep adding new ones meanwhile
+    std::unordered_map<int, int> deltas;
+    std::vector<int> order;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        deltas.swap(m_deltas);
+        order.swap(m_order);
+    }
+
+    std::size_t sent = 0;
+    try
+    {
+        for(; sent < order.size(); ++sent)
+        {
+            send_locked(order[sent], deltas[order[sent]]);
+        }
+    }
+    catch(const TransactionRejected&)
+    {
+        // Not applied, so the failed one is given back too
+        give_back_locked(order, deltas, sent);
+        if(failed_account)
+        {
+            *failed_account = order[sent];
+        }
+        throw;
+    }
+    catch(...)
+    {
+        // send_locked() already dropped the failed one
+        give_back_locked(order, deltas, sent + 1);
+        if(failed_account)
+        {
+            *failed_account = order[sent];
+        }
+        throw;
+    }
+}
+
+void CoalescingBankServer::give_back_locked(const std::vector<int>& order, std::unordered_map<int, int>& deltas, std::size_t first)
+{
+    // Before the new ones, so they are not lost and they keep their order
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::vector<int> new_order;
+    new_order.swap(m_order);
+    for(std::size_t i = first; i < order.size(); ++i)
+    {
+        m_order.push_back(order[i]);
+        m_deltas[order[i]] += deltas[order[i]];
+    }
+    for(int account_number : new_order)
+    {
+        if(std::find(order.begin() + first, order.end(), account_number) == order.end())
+        {
+            m_order.push_back(account_number);
+        }
+    }
+    m_window_start = std::chrono::steady_clock::now();
+}
+
+void CoalescingBankServer::flush_account_locked(int account_number)
+{
+    int delta = 0;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto pending = m_deltas.find(account_number);
+        if(pending == m_deltas.end())
+        {
+            return;
+        }
+        delta = pending->second;
+        m_deltas.erase(pending);
+        m_order.erase(std::find(m_order.begin(), m_order.end(), account_number));
+    }
+
+    try
+    {
+        send_locked(account_number, delta);
+    }
+    catch(const TransactionRejected&)
+    {
+        // Not applied, so not lost: pending again, and the first one to be flushed
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto inserted = m_deltas.emplace(account_number, delta);
+        if(inserted.second)
+        {
+            m_order.insert(m_order.begin(), account_number);
+        }
+        else
+        {
+            inserted.first->second += delta;
+        }
+        throw;
+    }
+}
+
+void CoalescingBankServer::send_locked(int account_number, int delta)
+{
+    try
+    {
+        if(delta > 0)
+        {
+            m_bankserver->Credit(account_number, delta);
+        }
+        else if(delta < 0)
+        {
+            m_bankserver->Debit(account_number, -delta);
+        }
+    }
+    catch(const TransactionRejected&)
+    {
+        throw;
+    }
+    catch(const std::exception& e)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            ++m_unknown_outcomes;
+        }
+        throw FlushOutcomeUnknown(account_number, delta, e.what());
+    }
+    catch(...)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            ++m_unknown_outcomes;
+        }
+        throw FlushOutcomeUnknown(account_number, delta, "unknown error");
+    }
+}
@@ -0,0 +1,212 @@
+#include "HedgedBankServer.hpp"
+#include <algorithm>
+#include <functional>
+
+HedgedBankServer::HedgedBankServer(BankServer* primary, BankServer* replica, const HedgingPolicy& policy)
+    : m_policy(policy),
+      m_latencies(policy.latency_window),
+      m_stopping(false),
+      m_reads(0),
+      m_hedged(0),
+      m_replica_wins(0),
+      m_cancelled(0)
+{
+    m_primary.bankserver = primary;
+    m_replica.bankserver = replica;
+    for(std::size_t i = 0; i < std::max<std::size_t>(1, m_policy.threads_per_backend); ++i)
+    {
+        m_primary.threads.emplace_back(&HedgedBankServer::run_backend, this, std::ref(m_primary), true);
+        m_replica.threads.emplace_back(&HedgedBankServer::run_backend, this, std::ref(m_replica), false);
+    }
+}
+
+HedgedBankServer::~HedgedBankServer()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopping = true;
+    }
+    for(Backend* backend : {&m_primary, &m_replica})
+    {
+        backend->read_queued.notify_all();
+        for(auto& thread : backend->threads)
+        {
+            thread.join();
+        }
+    }
+}
+
+void HedgedBankServer::Connect()
+{
+    m_primary.bankserver->Connect();
+    try
+    {
+        m_replica.bankserver->Connect();
+    }
+    catch(...)
+    {
+        // Both or none: undo the session of the primary
+        try
+        {
+            m_primary.bankserver->Disconnect();
+        }
+        catch(...)
+        {
+        }
+        throw;
+    }
+}
+
+void HedgedBankServer::Disconnect()
+{
+    // Both backends are disconnected even if one of them fails (the first error is thrown)
+    std::exception_ptr error;
+    for(Backend* backend : {&m_primary, &m_replica})
+    {
+        try
+        {
+            backend->bankserver->Disconnect();
+        }
+        catch(...)
+        {
+            if(!error)
+            {
+                error = std::current_exception();
+            }
+        }
+    }
+    if(error)
+    {
+        std::rethrow_exception(error);
+    }
+}
+
+void HedgedBankServer::Credit(int account_number, int value)
+{
+    m_primary.bankserver->Credit(account_number, value);
+}
+
+void HedgedBankServer::Debit(int account_number, int value)
+{
+    m_primary.bankserver->Debit(account_number, value);
+}
+
+int HedgedBankServer::DoubleTransaction(int account_number, int value1, int value2)
+{
+    return m_primary.bankserver->DoubleTransaction(account_number, value1, value2);
+}
+
+TryDebitResult HedgedBankServer::TryDebit(int account_number, int value)
+{
+    return wrapped_conditional_debit(m_primary.bankserver).TryDebit(account_number, value);
+}
+
+bool HedgedBankServer::HasConditionalDebit() const
+{
+    return conditional_debit_of(m_primary.bankserver) != nullptr;
+}
+
+int HedgedBankServer::GetBalance(int account_number) const
+{
+    std::uint64_t reads = m_reads.fetch_add(1, std::memory_order_relaxed) + 1;
+    bool can_hedge = m_latencies.size() >= std::max<std::size_t>(1, m_policy.min_samples);
+    std::chrono::nanoseconds hedge_delay = can_hedge ? m_latencies.percentile(m_policy.hedge_percentile)
+                                                     : std::chrono::nanoseconds::zero();
+
+    auto read = std::make_shared<Read>();
+    read->account_number = account_number;
+    read->pending = 0;
+    read->done = false;
+    read->result = 0;
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    send_locked(m_primary, read);
+    if(can_hedge && !read->answered.wait_for(lock, hedge_delay, [&]() { return read->done; }))
+    {
+        // Hedged only if it is in the budget
+        if(static_cast<double>(m_hedged.load(std::memory_order_relaxed) + 1) <= m_policy.hedge_budget * reads)
+        {
+            m_hedged.fetch_add(1, std::memory_order_relaxed);
+            send_locked(m_replica, read);
+        }
+    }
+    read->answered.wait(lock, [&]() { return read->done; });
+    lock.unlock();
+
+    if(read->error)
+    {
+        std::rethrow_exception(read->error);
+    }
+    return read->result;
+}
+
+HedgingStats HedgedBankServer::Stats() const
+{
+    HedgingStats stats;
+    stats.reads = m_reads.load(std::memory_order_relaxed);
+    stats.hedged = m_hedged.load(std::memory_order_relaxed);
+    stats.replica_wins = m_replica_wins.load(std::memory_order_relaxed);
+    stats.cancelled = m_cancelled.load(std::memory_order_relaxed);
+    return stats;
+}
+
+void HedgedBankServer::send_locked(Backend& backend, const std::shared_ptr<Read>& read) const
+{
+    read->pending++;
+    backend.reads.push_back(read);
+    backend.read_queued.notify_one();
+}
+
+void HedgedBankServer::run_backend(Backend& backend, bool primary)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    for(;;)
+    {
+        backend.read_queued.wait(lock, [&]() { return m_stopping || !backend.reads.empty(); });
+        if(backend.reads.empty())
+        {
+            return;
+        }
+        std::shared_ptr<Read> read = backend.reads.front();
+        backend.reads.pop_front();
+        if(read->done)
+        {
+            m_cancelled.fetch_add(1, std::memory_order_relaxed);
+            continue;
+        }
+        lock.unlock();
+
+        // The latencies of the primary are recorded even if the replica answered first, so
+        // its slow reads stay in the percentiles
+        auto start = std::chrono::steady_clock::now();
+        int result = 0;
+        std::exception_ptr error;
+        try
+        {
+            result = backend.bankserver->GetBalance(read->account_number);
+        }
+        catch(...)
+        {
+            error = std::current_exception();
+        }
+        if(primary && !error)
+        {
+            m_latencies.record(std::chrono::steady_clock::now() - start);
+        }
+
+        // The first answer is taken, or the last error if both backends failed
+        lock.lock();
+        read->pending--;
+        if(!read->done && (!error || read->pending == 0))
+        {
+            read->done = true;
+            read->result = result;
+            read->error = error;
+            if(!primary)
+            {
+                m_replica_wins.fetch_add(1, std::memory_order_relaxed);
+            }
+            read->answered.notify_one();
+        }
+    }
+}
@@ -0,0 +1,163 @@
+#include "InMemoryBankServer.hpp"
+#include <climits>
+#include <cstdint>
+#include <stdexcept>
+
+namespace
+{
+    // Account number used to mark the empty slots, so it can't be used as a real account
+    const int empty_key = INT_MIN;
+
+    void check_account(int account_number)
+    {
+        if(account_number == empty_key)
+        {
+            throw std::invalid_argument("InMemoryBankServer: invalid account number");
+        }
+    }
+}
+
+InMemoryBankServer::InMemoryBankServer(std::size_t capacity, std::size_t write_shards)
+    : m_capacity(capacity), m_accounts(0), m_write_shards(write_shards)
+{
+    // Keep the load factor under 3/4, so the probe sequences stay short
+    std::size_t slots = 1;
+    while(slots < capacity + capacity / 3 + 1)
+    {
+        slots <<= 1;
+    }
+    m_mask = slots - 1;
+
+    m_keys.reset(new std::atomic<int>[slots]);
+    m_balances.reset(new std::atomic<int>[slots]);
+    for(std::size_t i = 0; i < slots; ++i)
+    {
+        m_keys[i].store(empty_key, std::memory_order_relaxed);
+        m_balances[i].store(0, std::memory_order_relaxed);
+    }
+}
+
+void InMemoryBankServer::Credit(int account_number, int value)
+{
+    check_account(account_number);
+    std::lock_guard<std::mutex> lock(m_write_shards.lock_for(account_number));
+    std::size_t slot = find_or_insert_slot(account_number);
+    m_balances[slot].fetch_add(value, std::memory_order_release);
+}
+
+void InMemoryBankServer::Debit(int account_number, int value)
+{
+    check_account(account_number);
+    std::lock_guard<std::mutex> lock(m_write_shards.lock_for(account_number));
+    std::size_t slot = find_or_insert_slot(account_number);
+    m_balances[slot].fetch_sub(value, std::memory_order_release);
+}
+
+int InMemoryBankServer::DoubleTransaction(int account_number, int value1, int value2)
+{
+    check_account(account_number);
+    std::lock_guard<std::mutex> lock(m_write_shards.lock_for(account_number));
+    std::size_t slot = find_or_insert_slot(account_number);
+    return m_balances[slot].fetch_sub(value1 + value2, std::memory_order_release) - value1 - value2;
+}
+
+int InMemoryBankServer::GetBalance(int account_number) const
+{
+    std::size_t slot = find_slot(account_number);
+    return slot == npos ? 0 : m_balances[slot].load(std::memory_order_acquire);
+}
+
+TryDebitResult InMemoryBankServer::TryDebit(int account_number, int value)
+{
+    check_account(account_number);
+    std::lock_guard<std::mutex> lock(m_write_shards.lock_for(account_number));
+
+    std::size_t slot = find_slot(account_number);
+    int balance = slot == npos ? 0 : m_balances[slot].load(std::memory_order_relaxed);
+    if(balance < value)
+    {
+        return TryDebitResult{false, balance};
+    }
+
+    if(slot == npos)
+    {
+        slot = find_or_insert_slot(account_number);
+    }
+    m_balances[slot].store(balance - value, std::memory_order_release);
+    return TryDebitResult{true, balance - value};
+}
+
+void InMemoryBankServer::OpenAccount(int account_number, int balance)
+{
+    check_account(account_number);
+    std::lock_guard<std::mutex> lock(m_write_shards.lock_for(account_number));
+    std::size_t slot = find_or_insert_slot(account_number);
+    m_balances[slot].store(balance, std::memory_order_release);
+}
+
+void InMemoryBankServer::ForEachAccount(const std::function<void(int, int)>& visit) const
+{
+    for(std::size_t slot = 0; slot <= m_mask; ++slot)
+    {
+        int key = m_keys[slot].load(std::memory_order_acquire);
+        if(key != empty_key)
+        {
+            visit(key, m_balances[slot].load(std::memory_order_acquire));
+        }
+    }
+}
+
+std::size_t InMemoryBankServer::home_slot(int account_number) const
+{
+    std::uint64_t hash = static_cast<std::uint32_t>(account_number) * 0x9E3779B97F4A7C15ull;
+    return static_cast<std::size_t>(hash >> 32) & m_mask;
+}
+
+std::size_t InMemoryBankServer::find_slot(int account_number) const
+{
+    for(std::size_t slot = home_slot(account_number), probes = 0; probes <= m_mask; slot = (slot + 1) & m_mask, ++probes)
+    {
+        int key = m_keys[slot].load(std::memory_order_acquire);
+        if(key == account_number)
+        {
+            return slot;
+        }
+        if(key == empty_key)
+        {
+            return npos;
+        }
+    }
+    return npos;
+}
+
+std::size_t InMemoryBankServer::find_or_insert_slot(int account_number)
+{
+    for(std::size_t slot = home_slot(account_number), probes = 0; probes <= m_mask; slot = (slot + 1) & m_mask, ++probes)
+    {
+        int key = m_keys[slot].load(std::memory_order_acquire);
+        if(key == account_number)
+        {
+            return slot;
+        }
+        if(key != empty_key)
+        {
+            continue;
+        }
+
+        // A free slot. Other shards can be inserting in the same probe sequence, so the slot
+        // is claimed with a CAS. The same account can't be inserted twice at the same time
+        // because we are holding its shard lock.
+        if(m_accounts.fetch_add(1, std::memory_order_relaxed) >= m_capacity)
+        {
+            m_accounts.fetch_sub(1, std::memory_order_relaxed);
+            throw std::length_error("InMemoryBankServer: the account table is full");
+        }
+        int expected = empty_key;
+        if(m_keys[slot].compare_exchange_strong(expected, account_number, std::memory_order_acq_rel))
+        {
+            return slot;
+        }
+        m_accounts.fetch_sub(1, std::memory_order_relaxed);
+    }
+    throw std::length_error("InMemoryBankServer: the account table is full");
+}
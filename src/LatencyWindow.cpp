@@ -0,0 +1,52 @@
+#include "LatencyWindow.hpp"
+#include <algorithm>
+
+LatencyWindow::LatencyWindow(std::size_t capacity)
+    : m_capacity(std::max<std::size_t>(1, capacity)), m_recorded(0)
+{
+    m_values.reserve(m_capacity);
+}
+
+void LatencyWindow::record(std::chrono::nanoseconds latency)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if(m_values.size() < m_capacity)
+    {
+        m_values.push_back(latency.count());
+    }
+    else
+    {
+        // The oldest value is overwritten
+        m_values[m_recorded % m_capacity] = latency.count();
+    }
+    m_recorded++;
+}
+
+std::chrono::nanoseconds LatencyWindow::percentile(double p) const
+{
+    std::vector<std::chrono::nanoseconds::rep> values;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        values = m_values;
+    }
+    if(values.empty())
+    {
+        return std::chrono::nanoseconds::zero();
+    }
+
+    std::size_t rank = static_cast<std::size_t>(std::max(0.0, std::min(1.0, p)) * (values.size() - 1) + 0.5);
+    std::nth_element(values.begin(), values.begin() + rank, values.end());
+    return std::chrono::nanoseconds(values[rank]);
+}
+
+std::size_t LatencyWindow::size() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_values.size();
+}
+
+std::uint64_t LatencyWindow::recorded() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_recorded;
+}
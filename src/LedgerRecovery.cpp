@@ -0,0 +1,428 @@
+#include "LedgerRecovery.hpp"
+#include <algorithm>
+#include <atomic>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <stdexcept>
+#include <thread>
+#include <unordered_map>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace
+{
+    const char snapshot_magic[8] = {'A', 'T', 'M', 'S', 'N', 'A', 'P', 'S'};
+    const std::uint32_t snapshot_version = 1;
+    const char snapshot_prefix[] = "snapshot-";
+    const char snapshot_suffix[] = ".snap";
+    const std::size_t sequence_digits = 20;
+
+    // Snapshot records loaded by a thread at a time
+    const std::size_t snapshot_chunk = 4096;
+
+    std::string snapshot_name(std::uint64_t sequence)
+    {
+        char name[64];
+        std::snprintf(name, sizeof(name), "%s%020llu%s", snapshot_prefix, static_cast<unsigned long long>(sequence), snapshot_suffix);
+        return name;
+    }
+
+    std::uint64_t sequence_of_snapshot(const std::string& path)
+    {
+        std::size_t start = path.rfind(snapshot_prefix);
+        return std::strtoull(path.c_str() + start + sizeof(snapshot_prefix) - 1, nullptr, 10);
+    }
+
+    // Runs work(worker) in a number of threads (the calling one is the first worker), and
+    // throws the first exception thrown by any of them
+    template <class Work>
+    void run_in_parallel(std::size_t threads, Work work)
+    {
+        std::vector<std::exception_ptr> errors(threads);
+        auto run = [&](std::size_t worker)
+        {
+            try
+            {
+                work(worker);
+            }
+            catch(...)
+            {
+                errors[worker] = std::current_exception();
+            }
+        };
+
+        std::vector<std::thread> pool;
+        for(std::size_t worker = 1; worker < threads; ++worker)
+        {
+            pool.emplace_back(run, worker);
+        }
+        run(0);
+        for(auto& thread : pool)
+        {
+            thread.join();
+        }
+
+        for(auto& error : errors)
+        {
+            if(error)
+            {
+                std::rethrow_exception(error);
+            }
+        }
+    }
+
+    // A snapshot file memory-mapped (read only)
+    class SnapshotFile
+    {
+      public:
+
+        explicit SnapshotFile(const std::string& path)
+            : m_mapping(nullptr), m_mapping_size(0)
+        {
+            int fd = ::open(path.c_str(), O_RDONLY);
+            if(fd < 0)
+            {
+                throw std::runtime_error("LedgerRecovery: can't open " + path);
+            }
+
+            struct stat info;
+            if(::fstat(fd, &info) != 0 || static_cast<std::size_t>(info.st_size) < sizeof(SnapshotHeader))
+            {
+                ::close(fd);
+                throw std::runtime_error("LedgerRecovery: " + path + " is not a snapshot");
+            }
+
+            m_mapping_size = static_cast<std::size_t>(info.st_size);
+            m_mapping = ::mmap(nullptr, m_mapping_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            ::close(fd);
+            if(m_mapping == MAP_FAILED)
+            {
+                m_mapping = nullptr;
+                throw std::runtime_error("LedgerRecovery: can't map " + path);
+            }
+
+            const SnapshotHeader& snapshot = header();
+            if(std::memcmp(snapshot.magic, snapshot_magic, sizeof(snapshot_magic)) != 0 ||
+               snapshot.version != snapshot_version || snapshot.record_size != sizeof(SnapshotRecord) ||
+               m_mapping_size < sizeof(SnapshotHeader) + snapshot.accounts * sizeof(SnapshotRecord))
+            {
+                ::munmap(m_mapping, m_mapping_size);
+                throw std::runtime_error("LedgerRecovery: " + path + " is not a snapshot (or it is incomplete)");
+            }
+            ::madvise(m_mapping, m_mapping_size, MADV_SEQUENTIAL);
+        }
+
+        ~SnapshotFile()
+        {
+            ::munmap(m_mapping, m_mapping_size);
+        }
+
+        SnapshotFile(const SnapshotFile&) = delete;
+        SnapshotFile& operator=(const SnapshotFile&) = delete;
+
+        const SnapshotHeader& header() const { return *static_cast<const SnapshotHeader*>(m_mapping); }
+        const SnapshotRecord* records() const
+        {
+            return reinterpret_cast<const SnapshotRecord*>(static_cast<const char*>(m_mapping) + sizeof(SnapshotHeader));
+        }
+
+      private:
+
+        void* m_mapping;
+        std::size_t m_mapping_size;
+    };
+
+    // Partition of an account in the replay
+    std::size_t partition_of(int account_number, std::size_t partitions)
+    {
+        std::uint64_t hash = static_cast<std::uint32_t>(account_number) * 0x9E3779B97F4A7C15ull;
+        return static_cast<std::size_t>(hash >> 32) % partitions;
+    }
+
+    int saturate(std::int64_t value)
+    {
+        return static_cast<int>(std::max<std::int64_t>(INT_MIN + 1, std::min<std::int64_t>(INT_MAX, value)));
+    }
+
+    // The balance change of a successful record: a credit for the destination of a transfer, and
+    // a debit of the value and the fee for the others
+    std::int64_t change_of(const LedgerRecord& record)
+    {
+        if(record.operation == LedgerOperation::TransferIn)
+        {
+            return record.value;
+        }
+        return -(static_cast<std::int64_t>(record.value) + record.fee);
+    }
+
+    std::vector<SnapshotRecord> balances_of(const InMemoryBankServer& bankserver)
+    {
+        std::vector<SnapshotRecord> records;
+        records.reserve(bankserver.Accounts());
+        bankserver.ForEachAccount([&](int account_number, int balance)
+        {
+            records.push_back(SnapshotRecord{account_number, balance});
+        });
+        return records;
+    }
+
+    // What a thread found in the segments it replayed
+    struct ReplayTotals
+    {
+        std::uint64_t replayed_records = 0;
+        std::uint64_t uncertain_records = 0;
+        std::uint64_t last_sequence = 0;
+        std::uint64_t ledger_bytes = 0;
+    };
+}
+
+LedgerRecovery::LedgerRecovery(const std::string& directory, std::size_t threads)
+    : m_directory(directory),
+      m_threads(threads > 0 ? threads : std::max(1u, std::thread::hardware_concurrency()))
+{
+}
+
+LedgerRecovery::Report LedgerRecovery::recover(InMemoryBankServer& bankserver) const
+{
+    auto start = std::chrono::steady_clock::now();
+    Report report = Report();
+    report.threads = m_threads;
+
+    // The last snapshot, loaded in chunks by all the threads
+    std::vector<std::string> snapshot_paths = snapshots();
+    if(!snapshot_paths.empty())
+    {
+        SnapshotFile snapshot(snapshot_paths.back());
+        report.snapshot_sequence = snapshot.header().sequence;
+        report.snapshot_accounts = snapshot.header().accounts;
+
+        std::atomic<std::size_t> next(0);
+        run_in_parallel(m_threads, [&](std::size_t)
+        {
+            const std::size_t accounts = static_cast<std::size_t>(snapshot.header().accounts);
+            for(std::size_t begin; (begin = next.fetch_add(snapshot_chunk)) < accounts; )
+            {
+                for(std::size_t i = begin; i < std::min(accounts, begin + snapshot_chunk); ++i)
+                {
+                    bankserver.OpenAccount(snapshot.records()[i].account_number, snapshot.records()[i].balance);
+                }
+            }
+        });
+    }
+    report.last_sequence = report.snapshot_sequence;
+
+    // The segments with records after the snapshot (a segment is only skipped if the next one
+    // starts before the end of the snapshot)
+    LedgerScanner scanner(m_directory);
+    std::vector<std::string> segments;
+    for(std::size_t i = 0; i < scanner.segments().size(); ++i)
+    {
+        if(i + 1 < scanner.segments().size() &&
+           LedgerScanner::first_sequence_of(scanner.segments()[i + 1]) <= report.snapshot_sequence + 1)
+        {
+            continue;
+        }
+        segments.push_back(scanner.segments()[i]);
+    }
+    report.segments = segments.size();
+
+    // Replay: every thread takes whole segments, and adds the balance changes per account in 
+    // its own maps (one per partition), so the threads don't share anything
+    const std::size_t partitions = m_threads;
+    std::vector<std::vector<std::unordered_map<int, std::int64_t>>> changes(
+        m_threads, std::vector<std::unordered_map<int, std::int64_t>>(partitions));
+    std::vector<ReplayTotals> totals(m_threads);
+    std::atomic<std::size_t> next_segment(0);
+    run_in_parallel(m_threads, [&](std::size_t worker)
+    {
+        for(std::size_t i; (i = next_segment.fetch_add(1)) < segments.size(); )
+        {
+            LedgerSegment segment(segments[i]);
+            totals[worker].ledger_bytes += sizeof(LedgerSegmentHeader) + segment.size() * sizeof(LedgerRecord);
+            for(const LedgerRecord& record : segment)
+            {
+                if(record.sequence <= report.snapshot_sequence)
+                {
+                    continue;
+                }
+                totals[worker].replayed_records++;
+                totals[worker].last_sequence = std::max(totals[worker].last_sequence, record.sequence);
+
+                switch(static_cast<WithdrawOutcome>(record.outcome))
+                {
+                    case WithdrawOutcome::Success:
+                        changes[worker][partition_of(record.account_number, partitions)][record.account_number] +=
+                            change_of(record);
+                        break;
+                    case WithdrawOutcome::Error:
+                        totals[worker].uncertain_records++;
+                        break;
+                    default:
+                        break;
+                }
+            }
+        }
+    });
+
+    // Merge: every partition is merged by one thread, and its accounts are updated in the
+    // server. A sum does not depend on the order, so the result is deterministic.
+    run_in_parallel(m_threads, [&](std::size_t worker)
+    {
+        for(std::size_t partition = worker; partition < partitions; partition += m_threads)
+        {
+            std::unordered_map<int, std::int64_t> merged = std::move(changes[0][partition]);
+            for(std::size_t other = 1; other < m_threads; ++other)
+            {
+                for(const auto& change : changes[other][partition])
+                {
+                    merged[change.first] += change.second;
+                }
+                changes[other][partition].clear();
+            }
+            for(const auto& change : merged)
+            {
+                bankserver.OpenAccount(change.first, saturate(bankserver.GetBalance(change.first) + change.second));
+            }
+        }
+    });
+
+    for(const auto& worker_totals : totals)
+    {
+        report.replayed_records += worker_totals.replayed_records;
+        report.uncertain_records += worker_totals.uncertain_records;
+        report.last_sequence = std::max(report.last_sequence, worker_totals.last_sequence);
+        report.ledger_bytes += worker_totals.ledger_bytes;
+    }
+    report.elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+    return report;
+}
+
+void LedgerRecovery::snapshot(const InMemoryBankServer& bankserver, std::uint64_t sequence, bool remove_segments)
+{
+    write_snapshot(balances_of(bankserver), sequence, remove_segments);
+}
+
+bool LedgerRecovery::snapshot_if_due(const InMemoryBankServer& bankserver, WithdrawLedger& ledger,
+                                     std::uint64_t every_records, bool remove_segments)
+{
+    std::uint64_t last_snapshot = last_snapshot_sequence();
+    if(ledger.last_sequence() < last_snapshot + every_records)
+    {
+        return false;
+    }
+
+    // Only the copy of the balances is done with the ledger quiesced, not the file writing
+    std::vector<SnapshotRecord> records;
+    std::uint64_t sequence = 0;
+    ledger.quiesce([&]()
+    {
+        sequence = ledger.last_sequence();
+        records = balances_of(bankserver);
+    });
+    write_snapshot(records, sequence, remove_segments);
+    return true;
+}
+
+void LedgerRecovery::write_snapshot(const std::vector<SnapshotRecord>& records, std::uint64_t sequence, bool remove_segments)
+{
+    SnapshotHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, snapshot_magic, sizeof(header.magic));
+    header.version = snapshot_version;
+    header.record_size = sizeof(SnapshotRecord);
+    header.sequence = sequence;
+    header.accounts = records.size();
+
+    // Written in a temporary file, on the disk before it is renamed
+    std::string path = m_directory + "/" + snapshot_name(sequence);
+    std::string temporary = path + ".tmp";
+    std::FILE* file = std::fopen(temporary.c_str(), "wb");
+    if(!file)
+    {
+        throw std::runtime_error("LedgerRecovery: can't create " + temporary);
+    }
+    bool written = std::fwrite(&header, sizeof(header), 1, file) == 1 &&
+                   std::fwrite(records.data(), sizeof(SnapshotRecord), records.size(), file) == records.size() &&
+                   std::fflush(file) == 0 && ::fsync(::fileno(file)) == 0;
+    std::fclose(file);
+    if(!written || std::rename(temporary.c_str(), path.c_str()) != 0)
+    {
+        std::remove(temporary.c_str());
+        throw std::runtime_error("LedgerRecovery: can't write " + path);
+    }
+
+    // The rename is only in the directory entry: it must be on the disk before removing what the
+    // snapshot replaces, or a crash of the machine could leave neither of them
+    int directory_fd = ::open(m_directory.c_str(), O_RDONLY | O_DIRECTORY);
+    if(directory_fd < 0 || ::fsync(directory_fd) != 0)
+    {
+        if(directory_fd >= 0)
+        {
+            ::close(directory_fd);
+        }
+        throw std::runtime_error("LedgerRecovery: can't sync the directory of " + path);
+    }
+    ::close(directory_fd);
+
+    // The older snapshots are not needed anymore
+    for(const auto& old : snapshots())
+    {
+        if(sequence_of_snapshot(old) < sequence)
+        {
+            std::remove(old.c_str());
+        }
+    }
+
+    // Neither the segments whose records are all in the snapshot
+    if(remove_segments)
+    {
+        LedgerScanner scanner(m_directory);
+        for(std::size_t i = 0; i + 1 < scanner.segments().size(); ++i)
+        {
+            if(LedgerScanner::first_sequence_of(scanner.segments()[i + 1]) <= sequence + 1)
+            {
+                std::remove(scanner.segments()[i].c_str());
+            }
+        }
+    }
+}
+
+std::vector<std::string> LedgerRecovery::snapshots() const
+{
+    DIR* dir = ::opendir(m_directory.c_str());
+    if(!dir)
+    {
+        throw std::runtime_error("LedgerRecovery: can't open " + m_directory);
+    }
+
+    std::vector<std::string> paths;
+    const std::size_t prefix_length = sizeof(snapshot_prefix) - 1;
+    const std::size_t suffix_length = sizeof(snapshot_suffix) - 1;
+    while(struct dirent* entry = ::readdir(dir))
+    {
+        std::string name = entry->d_name;
+        if(name.size() == prefix_length + sequence_digits + suffix_length &&
+           name.compare(0, prefix_length, snapshot_prefix) == 0 &&
+           name.compare(prefix_length + sequence_digits, suffix_length, snapshot_suffix) == 0)
+        {
+            paths.push_back(m_directory + "/" + name);
+        }
+    }
+    ::closedir(dir);
+
+    // The sequences have all their digits, so the names are sorted as the sequences
+    std::sort(paths.begin(), paths.end());
+    return paths;
+}
+
+std::uint64_t LedgerRecovery::last_snapshot_sequence() const
+{
+    std::vector<std::string> paths = snapshots();
+    return paths.empty() ? 0 : sequence_of_snapshot(paths.back());
+}
@@ -0,0 +1,129 @@
+#include "RecordingBankServer.hpp"
+#include <algorithm>
+#include <limits>
+
+RecordingBankServer::RecordingBankServer(BankServer* bankserver, TraceWriter* trace)
+    : m_bankserver(bankserver), m_trace(trace), m_trace_errors(0)
+{
+}
+
+template <class Call>
+int RecordingBankServer::record(TraceMethod method, int account_number, int value1, int value2, Call call) const
+{
+    TraceRecord record;
+    record.method = method;
+    record.failed = 0;
+    record.reserved = 0;
+    record.account_number = account_number;
+    record.value1 = value1;
+    record.value2 = value2;
+    record.result = 0;
+    record.start_ns = m_trace->now_ns();
+
+    auto finish = [&]() 
+    {
+        std::uint64_t duration = m_trace->now_ns() - record.start_ns;
+        record.duration_ns = static_cast<std::uint32_t>(
+            std::min<std::uint64_t>(duration, std::numeric_limits<std::uint32_t>::max()));
+        try
+        {
+            m_trace->write(record);
+        }
+        catch(const TraceWriteError& error)
+        {
+            m_trace_errors.fetch_add(error.dropped(), std::memory_order_relaxed);
+        }
+        catch(...)
+        {
+            // The trace is only an observer: the call itself went fine (or failed) anyway
+            m_trace_errors.fetch_add(1, std::memory_order_relaxed);
+        }
+    };
+
+    try
+    {
+        record.result = call();
+    }
+    catch(...)
+    {
+        record.failed = 1;
+        finish();
+        throw;
+    }
+    finish();
+    return record.result;
+}
+
+void RecordingBankServer::Connect()
+{
+    record(TraceMethod::Connect, 0, 0, 0, [this]() 
+    { 
+        m_bankserver->Connect(); 
+        return 0; 
+    });
+}
+
+void RecordingBankServer::Disconnect()
+{
+    record(TraceMethod::Disconnect, 0, 0, 0, [this]() 
+    { 
+        m_bankserver->Disconnect(); 
+        return 0; 
+    });
+}
+
+void RecordingBankServer::Credit(int account_number, int value)
+{
+    record(TraceMethod::Credit, account_number, value, 0, [&]() 
+    { 
+        m_bankserver->Credit(account_number, value); 
+        return 0; 
+    });
+}
+
+void RecordingBankServer::Debit(int account_number, int value)
+{
+    record(TraceMethod::Debit, account_number, value, 0, [&]() 
+    { 
+        m_bankserver->Debit(account_number, value); 
+        return 0; 
+    });
+}
+
+int RecordingBankServer::DoubleTransaction(int account_number, int value1, int value2)
+{
+    return record(TraceMethod::DoubleTransaction, account_number, value1, value2, [&]() 
+    { 
+        return m_bankserver->DoubleTransaction(account_number, value1, value2); 
+    });
+}
+
+int RecordingBankServer::GetBalance(int account_number) const
+{
+    return record(TraceMethod::GetBalance, account_number, 0, 0, [&]() 
+    { 
+        return m_bankserver->GetBalance(account_number); 
+    });
+}
+
+TryDebitResult RecordingBankServer::TryDebit(int account_number, int value)
+{
+    ConditionalDebit& conditional_debit = wrapped_conditional_debit(m_bankserver);
+    TryDebitResult result{false, 0};
+    record(TraceMethod::TryDebit, account_number, value, 0, [&]() 
+    { 
+        result = conditional_debit.TryDebit(account_number, value); 
+        return result.ok ? 1 : 0; 
+    });
+    return result;
+}
+
+bool RecordingBankServer::HasConditionalDebit() const
+{
+    return conditional_debit_of(m_bankserver) != nullptr;
+}
+
+std::size_t RecordingBankServer::TraceErrors() const
+{
+    return m_trace_errors.load(std::memory_order_relaxed);
+}
@@ -0,0 +1,365 @@
+#include "ResilientBankServer.hpp"
+#include <algorithm>
+
+namespace
+{
+    std::string deadline_message(AtmOperation operation, std::chrono::nanoseconds timeout, bool sent)
+    {
+        return std::string("ResilientBankServer: ") + to_string(operation) + " exceeded its deadline of " +
+               std::to_string(std::chrono::duration_cast<std::chrono::microseconds>(timeout).count()) + " us" +
+               (sent ? "" : " (not sent)");
+    }
+}
+
+DeadlineExceeded::DeadlineExceeded(AtmOperation operation, std::chrono::nanoseconds timeout, bool sent)
+    : BankServerUnavailable(deadline_message(operation, timeout, sent)),
+      m_operation(operation), m_timeout(timeout), m_sent(sent)
+{
+}
+
+CircuitOpen::CircuitOpen(AtmOperation operation, std::chrono::nanoseconds retry_after)
+    : BankServerUnavailable(std::string("ResilientBankServer: the circuit is open, ") + to_string(operation) + " was not sent"),
+      m_operation(operation), m_retry_after(retry_after)
+{
+}
+
+const char* to_string(CircuitState state)
+{
+    switch(state)
+    {
+        case CircuitState::Closed:   return "Closed";
+        case CircuitState::Open:     return "Open";
+        case CircuitState::HalfOpen: return "HalfOpen";
+        default:                     return "Unknown";
+    }
+}
+
+ResilientBankServer::ResilientBankServer(BankServer* bankserver, const ResiliencePolicy& policy)
+    : m_bankserver(bankserver),
+      m_policy(policy),
+      m_stopping(false),
+      m_state(CircuitState::Closed),
+      m_consecutive_failures(0),
+      m_stats(ResilienceStats())
+{
+    for(std::size_t i = 0; i < m_latencies.size(); ++i)
+    {
+        m_latencies[i].reset(new LatencyWindow(m_policy.latency_window));
+        m_max_timeouts[i].store(m_policy.max_timeout.count(), std::memory_order_relaxed);
+    }
+    m_stats.state = CircuitState::Closed;
+    for(std::size_t i = 0; i < std::max<std::size_t>(1, m_policy.caller_threads); ++i)
+    {
+        m_callers.emplace_back(&ResilientBankServer::run_caller, this);
+    }
+}
+
+ResilientBankServer::~ResilientBankServer()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopping = true;
+    }
+    m_call_queued.notify_all();
+    for(auto& caller : m_callers)
+    {
+        caller.join();
+    }
+}
+
+void ResilientBankServer::Connect()
+{
+    BankServer* bankserver = m_bankserver;
+    call(AtmOperation::Connect, [bankserver]() { bankserver->Connect(); return 0; });
+}
+
+void ResilientBankServer::Disconnect()
+{
+    BankServer* bankserver = m_bankserver;
+    call(AtmOperation::Disconnect, [bankserver]() { bankserver->Disconnect(); return 0; });
+}
+
+void ResilientBankServer::Credit(int account_number, int value)
+{
+    BankServer* bankserver = m_bankserver;
+    call(AtmOperation::Credit, [=]() { bankserver->Credit(account_number, value); return 0; });
+}
+
+void ResilientBankServer::Debit(int account_number, int value)
+{
+    BankServer* bankserver = m_bankserver;
+    call(AtmOperation::Debit, [=]() { bankserver->Debit(account_number, value); return 0; });
+}
+
+int ResilientBankServer::DoubleTransaction(int account_number, int value1, int value2)
+{
+    BankServer* bankserver = m_bankserver;
+    return call(AtmOperation::DoubleTransaction, [=]() { return bankserver->DoubleTransaction(account_number, value1, value2); });
+}
+
+int ResilientBankServer::GetBalance(int account_number) const
+{
+    BankServer* bankserver = m_bankserver;
+    return call(AtmOperation::GetBalance, [=]() { return bankserver->GetBalance(account_number); });
+}
+
+TryDebitResult ResilientBankServer::TryDebit(int account_number, int value)
+{
+    // The caller thread may still write it after a DeadlineExceeded, so it is not on the stack
+    ConditionalDebit* conditional_debit = &wrapped_conditional_debit(m_bankserver);
+    auto result = std::make_shared<TryDebitResult>();
+    call(AtmOperation::TryDebit, [=]() { *result = conditional_debit->TryDebit(account_number, value); return 0; });
+    return *result;
+}
+
+bool ResilientBankServer::HasConditionalDebit() const
+{
+    return conditional_debit_of(m_bankserver) != nullptr;
+}
+
+std::chrono::nanoseconds ResilientBankServer::timeout(AtmOperation operation) const
+{
+    const LatencyWindow& window = *m_latencies[index_of(operation)];
+    std::chrono::nanoseconds max_timeout(m_max_timeouts[index_of(operation)].load(std::memory_order_relaxed));
+    if(window.size() < std::max<std::size_t>(1, m_policy.min_samples))
+    {
+        return std::min(m_policy.initial_timeout, max_timeout);
+    }
+
+    auto adaptive = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        window.percentile(m_policy.timeout_percentile) * m_policy.timeout_multiplier);
+    return std::max(m_policy.min_timeout, std::min(adaptive, max_timeout));
+}
+
+void ResilientBankServer::set_max_timeout(AtmOperation operation, std::chrono::nanoseconds max_timeout)
+{
+    m_max_timeouts[index_of(operation)].store(max_timeout.count(), std::memory_order_relaxed);
+}
+
+const LatencyWindow& ResilientBankServer::latencies(AtmOperation operation) const
+{
+    return *m_latencies[index_of(operation)];
+}
+
+CircuitState ResilientBankServer::state() const
+{
+    std::lock_guard<std::mutex> lock(m_breaker_mutex);
+    return m_state;
+}
+
+ResilienceStats ResilientBankServer::Stats() const
+{
+    std::lock_guard<std::mutex> lock(m_breaker_mutex);
+    ResilienceStats stats = m_stats;
+    stats.state = m_state;
+    return stats;
+}
+
+int ResilientBankServer::call(AtmOperation operation, std::function<int()> function) const
+{
+    // A Disconnect() must always be sent, or the session would be left open
+    const bool breaker = operation != AtmOperation::Disconnect;
+    const bool trial = breaker && acquire(operation);
+    std::chrono::nanoseconds deadline = timeout(operation);
+
+    auto pending = std::make_shared<Call>();
+    pending->operation = operation;
+    pending->function = std::move(function);
+    pending->status = Call::Status::Queued;
+    pending->abandoned = false;
+    pending->result = 0;
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_calls.push_back(pending);
+    m_call_queued.notify_one();
+
+    // The timeout is taken from the latencies of the server, so it is counted from the moment
+    // the call is sent. The wait for a caller thread has its own limit of the same length, and
+    // a call cancelled there was never sent, so it is not a failure of the server.
+    pending->changed.wait_for(lock, deadline, [&]() { return pending->status != Call::Status::Queued; });
+    if(pending->status == Call::Status::Queued)
+    {
+        if(!breaker)
+        {
+            // The Disconnect() stays queued, so the session is still closed when a caller
+            // thread is free, but the client does not pile up waiting for it
+            return 0;
+        }
+        pending->status = Call::Status::Cancelled;
+        lock.unlock();
+        {
+            std::lock_guard<std::mutex> breaker_lock(m_breaker_mutex);
+            m_stats.deadlines_exceeded++;
+        }
+        on_cancelled(trial);
+        throw DeadlineExceeded(operation, deadline, false);
+    }
+
+    if(!pending->changed.wait_until(lock, pending->started + deadline, [&]() { return pending->status == Call::Status::Done; }))
+    {
+        // The client gives up on the running call (check run_caller() for a Connect())
+        pending->abandoned = true;
+        lock.unlock();
+        {
+            std::lock_guard<std::mutex> breaker_lock(m_breaker_mutex);
+            m_stats.deadlines_exceeded++;
+        }
+        if(breaker)
+        {
+            on_failure();
+        }
+        throw DeadlineExceeded(operation, deadline, true);
+    }
+    lock.unlock();
+
+    if(pending->error)
+    {
+        try
+        {
+            std::rethrow_exception(pending->error);
+        }
+        catch(const TransactionRejected&)
+        {
+            if(breaker)
+            {
+                on_success();
+            }
+            throw;
+        }
+        catch(...)
+        {
+            {
+                std::lock_guard<std::mutex> breaker_lock(m_breaker_mutex);
+                m_stats.failures++;
+            }
+            if(breaker)
+            {
+                on_failure();
+            }
+            throw;
+        }
+    }
+    if(breaker)
+    {
+        on_success();
+    }
+    return pending->result;
+}
+
+bool ResilientBankServer::acquire(AtmOperation operation) const
+{
+    std::lock_guard<std::mutex> lock(m_breaker_mutex);
+    auto now = std::chrono::steady_clock::now();
+    bool trial = false;
+    if(m_state == CircuitState::Open && now >= m_open_until)
+    {
+        // This call is the trial
+        m_state = CircuitState::HalfOpen;
+        trial = true;
+    }
+    else if(m_state != CircuitState::Closed)
+    {
+        m_stats.short_circuited++;
+        auto retry_after = m_state == CircuitState::Open ? m_open_until - now : std::chrono::steady_clock::duration::zero();
+        throw CircuitOpen(operation, std::chrono::duration_cast<std::chrono::nanoseconds>(retry_after));
+    }
+    m_stats.calls++;
+    return trial;
+}
+
+void ResilientBankServer::on_success() const
+{
+    std::lock_guard<std::mutex> lock(m_breaker_mutex);
+    m_consecutive_failures = 0;
+    m_state = CircuitState::Closed;
+}
+
+void ResilientBankServer::on_failure() const
+{
+    std::lock_guard<std::mutex> lock(m_breaker_mutex);
+    m_consecutive_failures++;
+    bool open = m_state == CircuitState::HalfOpen ||
+                (m_state == CircuitState::Closed && m_consecutive_failures >= m_policy.failure_threshold);
+    if(open)
+    {
+        m_state = CircuitState::Open;
+        m_open_until = std::chrono::steady_clock::now() + m_policy.open_duration;
+        m_stats.circuit_opened++;
+    }
+}
+
+void ResilientBankServer::on_cancelled(bool trial) const
+{
+    // A trial that was not sent leaves the turn to the next call
+    std::lock_guard<std::mutex> lock(m_breaker_mutex);
+    if(trial && m_state == CircuitState::HalfOpen)
+    {
+        m_state = CircuitState::Open;
+    }
+}
+
+void ResilientBankServer::run_caller()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    for(;;)
+    {
+        m_call_queued.wait(lock, [this]() { return m_stopping || !m_calls.empty(); });
+        if(m_calls.empty())
+        {
+            return;
+        }
+        std::shared_ptr<Call> pending = m_calls.front();
+        m_calls.pop_front();
+        if(pending->status == Call::Status::Cancelled)
+        {
+            continue;
+        }
+        pending->status = Call::Status::Running;
+        pending->started = std::chrono::steady_clock::now();
+        pending->changed.notify_one();
+        lock.unlock();
+
+        // The latencies of the calls answered by the server are recorded, even if the client
+        // already gave up on them, so a slower server raises the timeout
+        auto start = pending->started;
+        bool answered = true;
+        int result = 0;
+        std::exception_ptr error;
+        try
+        {
+            result = pending->function();
+        }
+        catch(const TransactionRejected&)
+        {
+            error = std::current_exception();
+        }
+        catch(...)
+        {
+            error = std::current_exception();
+            answered = false;
+        }
+        if(answered)
+        {
+            m_latencies[index_of(pending->operation)]->record(std::chrono::steady_clock::now() - start);
+        }
+
+        lock.lock();
+        if(pending->abandoned && pending->operation == AtmOperation::Connect && !error)
+        {
+            // Its client took it as failed, so nobody is going to close this session
+            lock.unlock();
+            try
+            {
+                m_bankserver->Disconnect();
+            }
+            catch(...)
+            {
+            }
+            lock.lock();
+        }
+        pending->result = result;
+        pending->error = error;
+        pending->status = Call::Status::Done;
+        pending->changed.notify_one();
+    }
+}
@@ -0,0 +1,284 @@
+#include "ShardedBankServer.hpp"
+#include <algorithm>
+#include <exception>
+#include <stdexcept>
+
+ShardedBankServer::ShardedBankServer(std::size_t virtual_nodes)
+    : m_virtual_nodes(std::max<std::size_t>(virtual_nodes, 1)), m_sessions(0)
+{
+    m_ring = build_ring(std::vector<Shard>());
+}
+
+ShardedBankServer::ShardedBankServer(const std::vector<BankServer*>& shards, std::size_t virtual_nodes)
+    : m_virtual_nodes(std::max<std::size_t>(virtual_nodes, 1)), m_sessions(0)
+{
+    std::vector<Shard> named_shards;
+    for(std::size_t i = 0; i < shards.size(); ++i)
+    {
+        named_shards.push_back(Shard{"shard-" + std::to_string(i), shards[i]});
+    }
+    m_ring = build_ring(std::move(named_shards));
+}
+
+void ShardedBankServer::Connect()
+{
+    std::lock_guard<std::mutex> lock(m_admin_mutex);
+    auto current = ring();
+
+    std::size_t connected = 0;
+    try
+    {
+        for(; connected < current->shards.size(); ++connected)
+        {
+            current->shards[connected].bankserver->Connect();
+        }
+    }
+    catch(...)
+    {
+        // All or nothing: undo the connections already opened
+        while(connected > 0)
+        {
+            try
+            {
+                current->shards[--connected].bankserver->Disconnect();
+            }
+            catch(...)
+            {
+            }
+        }
+        throw;
+    }
+    ++m_sessions;
+}
+
+void ShardedBankServer::Disconnect()
+{
+    std::lock_guard<std::mutex> lock(m_admin_mutex);
+    auto current = ring();
+    if(m_sessions > 0)
+    {
+        --m_sessions;
+    }
+
+    // Every shard is disconnected even if one of them fails (the first error is thrown)
+    std::exception_ptr error;
+    for(const auto& shard : current->shards)
+    {
+        try
+        {
+            shard.bankserver->Disconnect();
+        }
+        catch(...)
+        {
+            if(!error)
+            {
+                error = std::current_exception();
+            }
+        }
+    }
+    if(error)
+    {
+        std::rethrow_exception(error);
+    }
+}
+
+void ShardedBankServer::Credit(int account_number, int value)
+{
+    route(account_number).Credit(account_number, value);
+}
+
+void ShardedBankServer::Debit(int account_number, int value)
+{
+    route(account_number).Debit(account_number, value);
+}
+
+int ShardedBankServer::DoubleTransaction(int account_number, int value1, int value2)
+{
+    return route(account_number).DoubleTransaction(account_number, value1, value2);
+}
+
+int ShardedBankServer::GetBalance(int account_number) const
+{
+    return route(account_number).GetBalance(account_number);
+}
+
+TryDebitResult ShardedBankServer::TryDebit(int account_number, int value)
+{
+    return wrapped_conditional_debit(&route(account_number)).TryDebit(account_number, value);
+}
+
+bool ShardedBankServer::HasConditionalDebit() const
+{
+    auto current = ring();
+    if(current->shards.empty())
+    {
+        return false;
+    }
+    for(const auto& shard : current->shards)
+    {
+        if(!conditional_debit_of(shard.bankserver))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+void ShardedBankServer::AddShard(const std::string& name, BankServer* bankserver)
+{
+    std::lock_guard<std::mutex> lock(m_admin_mutex);
+    auto current = ring();
+
+    for(const auto& shard : current->shards)
+    {
+        if(shard.name == name)
+        {
+            throw std::invalid_argument("ShardedBankServer: duplicated shard " + name);
+        }
+    }
+
+    // One connection per open session, all or nothing
+    std::size_t connected = 0;
+    try
+    {
+        for(; connected < m_sessions; ++connected)
+        {
+            bankserver->Connect();
+        }
+    }
+    catch(...)
+    {
+        for(; connected > 0; --connected)
+        {
+            try
+            {
+                bankserver->Disconnect();
+            }
+            catch(...)
+            {
+            }
+        }
+        throw;
+    }
+
+    std::vector<Shard> shards = current->shards;
+    shards.push_back(Shard{name, bankserver});
+    std::atomic_store(&m_ring, build_ring(std::move(shards)));
+}
+
+void ShardedBankServer::RemoveShard(const std::string& name)
+{
+    std::lock_guard<std::mutex> lock(m_admin_mutex);
+    auto current = ring();
+
+    std::vector<Shard> shards = current->shards;
+    auto removed = std::find_if(shards.begin(), shards.end(), [&name](const Shard& shard) 
+    {
+        return shard.name == name;
+    });
+    if(removed == shards.end())
+    {
+        throw std::invalid_argument("ShardedBankServer: unknown shard " + name);
+    }
+    BankServer* bankserver = removed->bankserver;
+    shards.erase(removed);
+    std::atomic_store(&m_ring, build_ring(std::move(shards)));
+
+    // Every session is disconnected even if one of them fails (the first error is thrown)
+    std::exception_ptr error;
+    for(std::size_t session = 0; session < m_sessions; ++session)
+    {
+        try
+        {
+            bankserver->Disconnect();
+        }
+        catch(...)
+        {
+            if(!error)
+            {
+                error = std::current_exception();
+            }
+        }
+    }
+    if(error)
+    {
+        std::rethrow_exception(error);
+    }
+}
+
+std::string ShardedBankServer::ShardOf(int account_number) const
+{
+    auto current = ring();
+    return current->shards[find_shard(*current, account_number)].name;
+}
+
+std::size_t ShardedBankServer::Shards() const
+{
+    return ring()->shards.size();
+}
+
+std::shared_ptr<const ShardedBankServer::Ring> ShardedBankServer::ring() const
+{
+    return std::atomic_load(&m_ring);
+}
+
+std::shared_ptr<const ShardedBankServer::Ring> ShardedBankServer::build_ring(std::vector<Shard> shards) const
+{
+    auto new_ring = std::make_shared<Ring>();
+    new_ring->shards = std::move(shards);
+    new_ring->points.reserve(new_ring->shards.size() * m_virtual_nodes);
+    for(std::size_t i = 0; i < new_ring->shards.size(); ++i)
+    {
+        std::uint64_t name_hash = hash_name(new_ring->shards[i].name);
+        for(std::size_t node = 0; node < m_virtual_nodes; ++node)
+        {
+            new_ring->points.emplace_back(mix(name_hash + node * 0x9E3779B97F4A7C15ull), i);
+        }
+    }
+    std::sort(new_ring->points.begin(), new_ring->points.end());
+    return new_ring;
+}
+
+BankServer& ShardedBankServer::route(int account_number) const
+{
+    // The backends are not owned by the ring, so they are still valid after releasing it
+    auto current = ring();
+    return *current->shards[find_shard(*current, account_number)].bankserver;
+}
+
+std::size_t ShardedBankServer::find_shard(const Ring& ring, int account_number)
+{
+    if(ring.points.empty())
+    {
+        throw std::logic_error("ShardedBankServer: there are no shards");
+    }
+
+    std::uint64_t hash = mix(static_cast<std::uint32_t>(account_number));
+    auto point = std::lower_bound(ring.points.begin(), ring.points.end(), 
+                                  std::make_pair(hash, std::size_t(0)));
+    if(point == ring.points.end())
+    {
+        point = ring.points.begin();    // it is a ring
+    }
+    return point->second;
+}
+
+std::uint64_t ShardedBankServer::mix(std::uint64_t value)
+{
+    // splitmix64 finalizer: all the bits of the input affect all the bits of the output
+    value += 0x9E3779B97F4A7C15ull;
+    value = (value ^ (value >> 30)) * 0xBF58476D1CE4E5B9ull;
+    value = (value ^ (value >> 27)) * 0x94D049BB133111EBull;
+    return value ^ (value >> 31);
+}
+
+std::uint64_t ShardedBankServer::hash_name(const std::string& name)
+{
+    // FNV-1a: stable across processes and platforms (unlike std::hash)
+    std::uint64_t hash = 0xCBF29CE484222325ull;
+    for(unsigned char c : name)
+    {
+        hash = (hash ^ c) * 0x100000001B3ull;
+    }
+    return hash;
+}
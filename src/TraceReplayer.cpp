@@ -0,0 +1,139 @@
+#include "TraceReplayer.hpp"
+#include <algorithm>
+#include <thread>
+
+TraceReplayer::TraceReplayer(const TraceReader& trace, ReplaySpeed speed)
+    : m_trace(trace), m_speed(speed), m_start_ns(0)
+{
+    if(m_trace.size() > 0)
+    {
+        m_start_ns = m_trace[0].start_ns;
+        for(const TraceRecord& record : m_trace)
+        {
+            m_start_ns = std::min(m_start_ns, record.start_ns);
+        }
+    }
+}
+
+ReplayStats TraceReplayer::replay(BankServer& bankserver) const
+{
+    ReplayStats stats{0, 0, 0, std::chrono::nanoseconds(0)};
+    auto start = std::chrono::steady_clock::now();
+
+    for(const TraceRecord& record : m_trace)
+    {
+        pace(start, record);
+
+        int result = 0;
+        bool failed = false;
+        try
+        {
+            switch(record.method)
+            {
+                case TraceMethod::Connect:
+                    bankserver.Connect();
+                    break;
+                case TraceMethod::Disconnect:
+                    bankserver.Disconnect();
+                    break;
+                case TraceMethod::Credit:
+                    bankserver.Credit(record.account_number, record.value1);
+                    break;
+                case TraceMethod::Debit:
+                    bankserver.Debit(record.account_number, record.value1);
+                    break;
+                case TraceMethod::DoubleTransaction:
+                    result = bankserver.DoubleTransaction(record.account_number, record.value1, record.value2);
+                    break;
+                case TraceMethod::GetBalance:
+                    result = bankserver.GetBalance(record.account_number);
+                    break;
+                case TraceMethod::TryDebit:
+                    result = try_debit(bankserver, record.account_number, record.value1) ? 1 : 0;
+                    break;
+            }
+        }
+        catch(...)
+        {
+            failed = true;
+            stats.errors++;
+        }
+
+        stats.calls++;
+        if(failed != (record.failed != 0) || (!failed && result != record.result))
+        {
+            stats.mismatches++;
+        }
+    }
+
+    stats.elapsed = std::chrono::steady_clock::now() - start;
+    return stats;
+}
+
+ReplayStats TraceReplayer::replay(AtmMachine& atm_machine) const
+{
+    ReplayStats stats{0, 0, 0, std::chrono::nanoseconds(0)};
+    auto start = std::chrono::steady_clock::now();
+
+    for(const TraceRecord& record : m_trace)
+    {
+        // Only the debits that were done are withdrawals that can be rebuilt
+        bool is_withdrawal = record.method == TraceMethod::Debit || record.method == TraceMethod::DoubleTransaction
+                          || (record.method == TraceMethod::TryDebit && record.result == 1);
+        if(!is_withdrawal || record.failed)
+        {
+            continue;
+        }
+
+        pace(start, record);
+
+        bool result = false;
+        try
+        {
+            result = record.method != TraceMethod::DoubleTransaction 
+                   ? atm_machine.withdraw(record.account_number, record.value1)
+                   : atm_machine.withdraw_with_fee(record.account_number, record.value1, record.value2);
+        }
+        catch(...)
+        {
+            stats.errors++;
+        }
+
+        // In the recording all of them were accepted
+        stats.calls++;
+        if(!result)
+        {
+            stats.mismatches++;
+        }
+    }
+
+    stats.elapsed = std::chrono::steady_clock::now() - start;
+    return stats;
+}
+
+bool TraceReplayer::try_debit(BankServer& bankserver, int account_number, int value)
+{
+    if(ConditionalDebit* conditional_debit = conditional_debit_of(&bankserver))
+    {
+        return conditional_debit->TryDebit(account_number, value).ok;
+    }
+
+    // The backend can't check and debit in one call: same result, but not atomic
+    if(bankserver.GetBalance(account_number) < value)
+    {
+        return false;
+    }
+    bankserver.Debit(account_number, value);
+    return true;
+}
+
+void TraceReplayer::pace(std::chrono::steady_clock::time_point start, const TraceRecord& record) const
+{
+    if(m_speed != ReplaySpeed::Recorded)
+    {
+        return;
+    }
+
+    std::uint64_t offset_ns = record.start_ns - m_start_ns;
+    std::this_thread::sleep_until(start + std::chrono::nanoseconds(offset_ns));
+}
@@ -0,0 +1,293 @@
+#include "TransferEngine.hpp"
+#include "BankSession.hpp"
+#include "BasicAtmMachine.hpp"
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+
+namespace
+{
+    // The workers wait here until all of them finished the current wave
+    class WaveBarrier
+    {
+      public:
+
+        explicit WaveBarrier(std::size_t workers)
+            : m_workers(workers), m_waiting(0), m_generation(0)
+        {
+        }
+
+        void wait()
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            std::size_t generation = m_generation;
+            if(++m_waiting == m_workers)
+            {
+                m_waiting = 0;
+                m_generation++;
+                m_all_arrived.notify_all();
+                return;
+            }
+            m_all_arrived.wait(lock, [&]() { return m_generation != generation; });
+        }
+
+      private:
+
+        std::mutex m_mutex;
+        std::condition_variable m_all_arrived;
+        std::size_t m_workers;
+        std::size_t m_waiting;
+        std::size_t m_generation;
+    };
+}
+
+TransferEngine::TransferEngine(const std::vector<BankServer*>& sessions, AccountLocks* account_locks)
+    : m_account_locks(account_locks), m_sessions(sessions), m_ledger(nullptr)
+{
+    if(m_sessions.empty())
+    {
+        throw std::invalid_argument("TransferEngine: at least one session is needed");
+    }
+
+    if(!m_account_locks)
+    {
+        m_own_account_locks.reset(new AccountLocks());
+        m_account_locks = m_own_account_locks.get();
+    }
+}
+
+void TransferEngine::set_ledger(WithdrawLedger* ledger)
+{
+    m_ledger = ledger;
+}
+
+bool TransferEngine::transfer(int from_account_number, int to_account_number, int value, int fee)
+{
+    TransferRequest request{from_account_number, to_account_number, value, fee};
+    check(request);
+
+    std::lock_guard<std::mutex> batch_lock(m_batch_mutex);
+
+    BankSession session(m_sessions[0]);
+
+    bool result = transfer_connected(*session, request);
+
+    session.close();
+
+    return result;
+}
+
+std::vector<TransferEngine::Result> TransferEngine::transfer_batch(const std::vector<TransferRequest>& requests)
+{
+    std::vector<Result> results(requests.size(), Result{false, false, nullptr});
+    if(requests.empty())
+    {
+        return results;
+    }
+
+    std::lock_guard<std::mutex> batch_lock(m_batch_mutex);
+
+    // The transfers of every wave
+    std::vector<std::vector<std::size_t>> waves;
+    std::size_t widest_wave = 0;
+    std::vector<std::size_t> wave_of = plan_waves(requests);
+    for(std::size_t i = 0; i < requests.size(); ++i)
+    {
+        if(wave_of[i] >= waves.size())
+        {
+            waves.resize(wave_of[i] + 1);
+        }
+        waves[wave_of[i]].push_back(i);
+        widest_wave = std::max(widest_wave, waves[wave_of[i]].size());
+    }
+
+    // No more workers than transfers in the widest wave. All the sessions are opened before
+    // starting: if a Connect() fails, the opened ones are closed and nothing is transferred.
+    std::size_t workers = std::min(m_sessions.size(), widest_wave);
+    std::vector<BankSession> sessions;
+    sessions.reserve(workers);
+    for(std::size_t worker = 0; worker < workers; ++worker)
+    {
+        sessions.emplace_back(m_sessions[worker]);
+    }
+
+    // The transfers of a wave are taken by the first free worker
+    std::unique_ptr<std::atomic<std::size_t>[]> next_of_wave(new std::atomic<std::size_t>[waves.size()]);
+    for(std::size_t wave = 0; wave < waves.size(); ++wave)
+    {
+        next_of_wave[wave].store(0, std::memory_order_relaxed);
+    }
+    WaveBarrier barrier(workers);
+
+    auto run = [&](std::size_t worker)
+    {
+        for(std::size_t wave = 0; wave < waves.size(); ++wave)
+        {
+            std::size_t next;
+            while((next = next_of_wave[wave].fetch_add(1, std::memory_order_relaxed)) < waves[wave].size())
+            {
+                std::size_t i = waves[wave][next];
+                try
+                {
+                    results[i].done = transfer_connected(*sessions[worker], requests[i]);
+                    results[i].debited = results[i].done;
+                }
+                catch(const TransferCreditFailed&)
+                {
+                    results[i].debited = true;
+                    results[i].error = std::current_exception();
+                }
+                catch(...)
+                {
+                    results[i].error = std::current_exception();
+                }
+            }
+            barrier.wait();
+        }
+    };
+
+    // The calling thread is the first worker
+    std::vector<std::thread> threads;
+    for(std::size_t worker = 1; worker < workers; ++worker)
+    {
+        threads.emplace_back(run, worker);
+    }
+    run(0);
+    for(auto& thread : threads)
+    {
+        thread.join();
+    }
+
+    // All the sessions are closed, and the first error is thrown
+    std::exception_ptr error;
+    for(auto& session : sessions)
+    {
+        try
+        {
+            session.close();
+        }
+        catch(...)
+        {
+            if(!error)
+            {
+                error = std::current_exception();
+            }
+        }
+    }
+    if(error)
+    {
+        std::rethrow_exception(error);
+    }
+
+    return results;
+}
+
+std::vector<std::size_t> TransferEngine::plan_waves(const std::vector<TransferRequest>& requests) const
+{
+    // The first wave where every stripe is still free. A transfer goes to the first wave where
+    // both of its stripes are free, so it is after the previous transfers of its accounts.
+    std::vector<std::size_t> free_from(m_account_locks->stripes(), 0);
+    std::vector<std::size_t> wave_of(requests.size());
+    for(std::size_t i = 0; i < requests.size(); ++i)
+    {
+        std::size_t from_stripe = m_account_locks->stripe_of(requests[i].from_account_number);
+        std::size_t to_stripe = m_account_locks->stripe_of(requests[i].to_account_number);
+        wave_of[i] = std::max(free_from[from_stripe], free_from[to_stripe]);
+        free_from[from_stripe] = wave_of[i] + 1;
+        free_from[to_stripe] = wave_of[i] + 1;
+    }
+    return wave_of;
+}
+
+void TransferEngine::check(const TransferRequest& request)
+{
+    if(request.from_account_number == request.to_account_number)
+    {
+        throw std::invalid_argument("TransferEngine: the source and the destination accounts are the same");
+    }
+}
+
+bool TransferEngine::transfer_connected(BankServer& bankserver, const TransferRequest& request)
+{
+    check(request);
+
+    // Both sides are recorded in the ledger as one change, entered before taking the locks (a
+    // change can wait for a quiesce() of the ledger, and it must not hold any lock meanwhile)
+    LedgerChange change(m_ledger);
+
+    // Both accounts locked, always the lowest stripe first (the same stripe is locked once)
+    std::size_t first_stripe = m_account_locks->stripe_of(request.from_account_number);
+    std::size_t second_stripe = m_account_locks->stripe_of(request.to_account_number);
+    if(second_stripe < first_stripe)
+    {
+        std::swap(first_stripe, second_stripe);
+    }
+    std::unique_lock<std::mutex> first_lock(m_account_locks->stripe(first_stripe));
+    std::unique_lock<std::mutex> second_lock;
+    if(second_stripe != first_stripe)
+    {
+        second_lock = std::unique_lock<std::mutex>(m_account_locks->stripe(second_stripe));
+    }
+
+    // The locks are already held, so the debit helpers don't take them again
+    bool debited = false;
+    auto conditional_debit = conditional_debit_of(&bankserver);
+    try
+    {
+        if(request.fee != 0)
+        {
+            debited = atm_detail::check_and_debit_pair(bankserver, nullptr, nullptr, request.from_account_number,
+                                                       request.value, request.fee);
+        }
+        else if(conditional_debit)
+        {
+            debited = conditional_debit->TryDebit(request.from_account_number, request.value).ok;
+        }
+        else
+        {
+            debited = atm_detail::check_and_debit(bankserver, nullptr, nullptr, request.from_account_number, request.value);
+        }
+    }
+    catch(...)
+    {
+        append_to_ledger(LedgerOperation::TransferOut, request.from_account_number, request.value, request.fee, WithdrawOutcome::Error);
+        throw;
+    }
+    append_to_ledger(LedgerOperation::TransferOut, request.from_account_number, request.value, request.fee,
+                     debited ? WithdrawOutcome::Success : WithdrawOutcome::InsufficientFunds);
+
+    if(!debited)
+    {
+        return false;
+    }
+
+    try
+    {
+        bankserver.Credit(request.to_account_number, request.value);
+    }
+    catch(const std::exception& error)
+    {
+        append_to_ledger(LedgerOperation::TransferIn, request.to_account_number, request.value, 0, WithdrawOutcome::Error);
+        throw TransferCreditFailed(request.from_account_number, request.to_account_number, request.value,
+                                   std::current_exception(), error.what());
+    }
+    catch(...)
+    {
+        append_to_ledger(LedgerOperation::TransferIn, request.to_account_number, request.value, 0, WithdrawOutcome::Error);
+        throw TransferCreditFailed(request.from_account_number, request.to_account_number, request.value,
+                                   std::current_exception(), "unknown error");
+    }
+    append_to_ledger(LedgerOperation::TransferIn, request.to_account_number, request.value, 0, WithdrawOutcome::Success);
+    return true;
+}
+
+void TransferEngine::append_to_ledger(LedgerOperation operation, int account_number, int value, int fee, WithdrawOutcome outcome)
+{
+    if(m_ledger)
+    {
+        m_ledger->try_append(operation, account_number, value, fee, outcome);
+    }
+}
@@ -0,0 +1,223 @@
+#include "WithdrawDedupTable.hpp"
+#include <cstdlib>
+#include <new>
+#include <stdexcept>
+#include <string>
+
+const std::uint64_t WithdrawDedupTable::max_request_id;
+const std::size_t WithdrawDedupTable::bucket_size;
+const std::uint64_t WithdrawDedupTable::released;
+const std::uint64_t WithdrawDedupTable::vacant;
+
+WithdrawDedupTable::WithdrawDedupTable(std::size_t capacity)
+    : m_bucket_mask(0), m_evictions(0)
+{
+    std::size_t buckets = 1;
+    while(buckets * bucket_size < capacity)
+    {
+        buckets <<= 1;
+    }
+    m_bucket_mask = buckets - 1;
+
+    void* memory = nullptr;
+    if(::posix_memalign(&memory, alignof(Bucket), buckets * sizeof(Bucket)) != 0)
+    {
+        throw std::bad_alloc();
+    }
+    m_buckets.reset(static_cast<Bucket*>(memory));
+    for(std::size_t i = 0; i < buckets; ++i)
+    {
+        new(&m_buckets[i]) Bucket;
+        for(auto& entry : m_buckets[i].entries)
+        {
+            entry.store(0, std::memory_order_relaxed);
+        }
+    }
+}
+
+void WithdrawDedupTable::FreeBuckets::operator()(Bucket* buckets) const
+{
+    // The buckets are only atomic integers: nothing to destroy
+    std::free(buckets);
+}
+
+WithdrawDedupTable::Claim WithdrawDedupTable::claim(std::uint64_t request_id)
+{
+    Bucket& bucket = bucket_of(request_id);
+    const std::uint64_t desired = pack(request_id, static_cast<std::uint64_t>(Outcome::InProgress));
+
+    for(;;)
+    {
+        std::uint64_t seen[bucket_size];
+        std::size_t empty = bucket_size;
+        for(std::size_t i = 0; i < bucket_size; ++i)
+        {
+            seen[i] = bucket.entries[i].load(std::memory_order_acquire);
+            if(seen[i] == 0)
+            {
+                empty = i;      // the entries are used in order: the rest of them are empty too
+                break;
+            }
+            if(is_of(seen[i], request_id))
+            {
+                if(state_of(seen[i]) != released)
+                {
+                    return Claim{false, static_cast<Outcome>(state_of(seen[i]))};
+                }
+
+                // It was released: take it again
+                if(bucket.entries[i].compare_exchange_strong(seen[i], desired, std::memory_order_acq_rel))
+                {
+                    return Claim{true, Outcome::InProgress};
+                }
+                empty = bucket_size + 1;    // it changed, look again
+                break;
+            }
+        }
+
+        if(empty < bucket_size)
+        {
+            // The first empty entry. If another thread takes it first, look again (maybe it was
+            // the same request)
+            std::uint64_t expected = 0;
+            if(bucket.entries[empty].compare_exchange_strong(expected, desired, std::memory_order_acq_rel))
+            {
+                return Claim{true, Outcome::InProgress};
+            }
+        }
+        else if(empty == bucket_size)
+        {
+            // Full, and the request is not in the bucket: evict. It only works if the entry is
+            // still the one that was seen in the whole bucket, otherwise look again.
+            std::size_t victim = victim_of(seen, request_id);
+            if(victim == bucket_size)
+            {
+                throw std::runtime_error("WithdrawDedupTable: the bucket of the request " + std::to_string(request_id) +
+                                         " is full of requests in progress");
+            }
+            if(!bucket.entries[victim].compare_exchange_strong(seen[victim], desired, std::memory_order_acq_rel))
+            {
+                continue;
+            }
+            std::uint64_t evicted = state_of(seen[victim]);
+            if(evicted != released && evicted != vacant)
+            {
+                m_evictions.fetch_add(1, std::memory_order_relaxed);
+            }
+
+            // Another thread that saw the bucket before a change may have claimed the same
+            // request in another entry. Then this claim gives its entry up. If that one was
+            // already completed or released (they change all the entries of the request), it
+            // keeps the same outcome and it is left as it is.
+            bool duplicate = false;
+            for(std::size_t i = 0; i < bucket_size && !duplicate; ++i)
+            {
+                duplicate = i != victim && is_of(bucket.entries[i].load(std::memory_order_acquire), request_id);
+            }
+            if(!duplicate)
+            {
+                return Claim{true, Outcome::InProgress};
+            }
+            std::uint64_t mine = desired;
+            bucket.entries[victim].compare_exchange_strong(mine, pack(0, vacant), std::memory_order_acq_rel);
+        }
+    }
+}
+
+void WithdrawDedupTable::complete(std::uint64_t request_id, Outcome outcome)
+{
+    change(request_id, Outcome::InProgress, outcome);
+}
+
+void WithdrawDedupTable::release(std::uint64_t request_id)
+{
+    Bucket& bucket = bucket_of(request_id);
+    const std::uint64_t expected = pack(request_id, static_cast<std::uint64_t>(Outcome::InProgress));
+    for(auto& entry : bucket.entries)
+    {
+        std::uint64_t current = expected;
+        entry.compare_exchange_strong(current, pack(request_id, released), std::memory_order_acq_rel);
+    }
+}
+
+bool WithdrawDedupTable::find(std::uint64_t request_id, Outcome& outcome) const
+{
+    Bucket& bucket = bucket_of(request_id);
+    for(const auto& entry : bucket.entries)
+    {
+        std::uint64_t current = entry.load(std::memory_order_acquire);
+        if(current == 0)
+        {
+            return false;
+        }
+        if(is_of(current, request_id))
+        {
+            if(state_of(current) == released)
+            {
+                return false;
+            }
+            outcome = static_cast<Outcome>(state_of(current));
+            return true;
+        }
+    }
+    return false;
+}
+
+void WithdrawDedupTable::change(std::uint64_t request_id, Outcome from, Outcome to)
+{
+    // Nothing if it is not found: it was evicted in the meantime. All the entries are changed,
+    // in case a duplicated claim did not give its entry up yet (check claim()).
+    Bucket& bucket = bucket_of(request_id);
+    const std::uint64_t expected = pack(request_id, static_cast<std::uint64_t>(from));
+    for(auto& entry : bucket.entries)
+    {
+        std::uint64_t current = expected;
+        entry.compare_exchange_strong(current, pack(request_id, static_cast<std::uint64_t>(to)), std::memory_order_acq_rel);
+    }
+}
+
+std::size_t WithdrawDedupTable::victim_of(const std::uint64_t (&entries)[bucket_size], std::uint64_t request_id)
+{
+    // An entry that nobody can be looking for, if there is one
+    std::size_t finished[bucket_size];
+    std::size_t count = 0;
+    for(std::size_t i = 0; i < bucket_size; ++i)
+    {
+        std::uint64_t state = state_of(entries[i]);
+        if(state == released || state == vacant)
+        {
+            return i;
+        }
+        if(state != static_cast<std::uint64_t>(Outcome::InProgress))
+        {
+            finished[count++] = i;
+        }
+    }
+
+    // One of the finished ones, decided by the request id, so the threads claiming the same
+    // request in the same bucket compete for the same entry
+    return count == 0 ? bucket_size : finished[(hash(request_id) >> 32) % count];
+}
+
+std::uint64_t WithdrawDedupTable::hash(std::uint64_t request_id)
+{
+    // splitmix64 finalizer, so consecutive request ids are spread over the table
+    std::uint64_t hash = request_id + 0x9E3779B97F4A7C15ull;
+    hash = (hash ^ (hash >> 30)) * 0xBF58476D1CE4E5B9ull;
+    hash = (hash ^ (hash >> 27)) * 0x94D049BB133111EBull;
+    return hash ^ (hash >> 31);
+}
+
+WithdrawDedupTable::Bucket& WithdrawDedupTable::bucket_of(std::uint64_t request_id) const
+{
+    return m_buckets[hash(request_id) & m_bucket_mask];
+}
+
+std::uint64_t WithdrawDedupTable::pack(std::uint64_t request_id, std::uint64_t state)
+{
+    if(request_id > max_request_id)
+    {
+        throw std::invalid_argument("WithdrawDedupTable: request id " + std::to_string(request_id) + " is too big");
+    }
+    return (request_id << 3) | state;
+}
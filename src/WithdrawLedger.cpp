@@ -0,0 +1,606 @@
+#include "WithdrawLedger.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace
+{
+    const char ledger_magic[8] = {'A', 'T', 'M', 'L', 'E', 'D', 'G', 'R'};
+    const std::uint32_t ledger_version = 1;
+    const char segment_prefix[] = "ledger-";
+    const char segment_suffix[] = ".log";
+    const std::size_t sequence_digits = 20;
+
+    std::size_t page_size()
+    {
+        static const std::size_t size = static_cast<std::size_t>(::sysconf(_SC_PAGESIZE));
+        return size;
+    }
+
+    // Offset in the segment file of the end of a number of records
+    std::size_t end_of_records(std::size_t records)
+    {
+        return sizeof(LedgerSegmentHeader) + records * sizeof(LedgerRecord);
+    }
+}
+
+const char* to_string(LedgerOperation operation)
+{
+    switch(operation)
+    {
+        case LedgerOperation::Withdraw:         return "Withdraw";
+        case LedgerOperation::WithdrawWithFee:  return "WithdrawWithFee";
+        case LedgerOperation::TransferOut:      return "TransferOut";
+        case LedgerOperation::TransferIn:       return "TransferIn";
+        default:                                return "Unknown";
+    }
+}
+
+//--------------------------------------------------------------------------------------------------
+// WithdrawLedger
+
+WithdrawLedger::WithdrawLedger(const std::string& directory,
+                               std::size_t segment_records,
+                               std::size_t group_commit_records,
+                               std::chrono::microseconds commit_interval,
+                               SyncFunction sync_function)
+    : m_directory(directory),
+      m_segment_records(segment_records == 0 ? 1 : segment_records),
+      m_group_commit_records(group_commit_records == 0 ? 1 : group_commit_records),
+      m_commit_interval(commit_interval),
+      m_sync_function(std::move(sync_function)),
+      m_current{-1, nullptr, 0, 0, 0, 0},
+      m_next{-1, nullptr, 0, 0, 0, 0},
+      m_prepare_next(true),
+      m_preparing_next(false),
+      m_last_sequence(0),
+      m_durable_sequence(0),
+      m_commit_requested(false),
+      m_stopping(false),
+      m_changes(0),
+      m_quiescing(false),
+      m_commits(0),
+      m_segments(0),
+      m_append_errors(0)
+{
+    if(::mkdir(m_directory.c_str(), 0755) != 0 && errno != EEXIST)
+    {
+        throw std::runtime_error("WithdrawLedger: can't create " + m_directory);
+    }
+
+    // Continue the sequence of the ledger that is already there
+    LedgerScanner scanner(m_directory);
+    if(!scanner.segments().empty())
+    {
+        LedgerSegment last(scanner.segments().back());
+        m_last_sequence = last.empty() ? last.first_sequence() - 1 : last[last.size() - 1].sequence;
+        m_durable_sequence = m_last_sequence;
+    }
+
+    m_committer = std::thread(&WithdrawLedger::run_committer, this);
+}
+
+WithdrawLedger::~WithdrawLedger()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopping = true;
+    }
+    m_commit_needed.notify_one();
+    m_committer.join();
+
+    if(m_current.mapping)
+    {
+        close(m_current);
+    }
+
+    // The next segment was never used: it is not left empty in the directory
+    if(m_next.mapping)
+    {
+        remove(m_next);
+    }
+}
+
+std::uint64_t WithdrawLedger::append(LedgerOperation operation, int account_number, int value, int fee, WithdrawOutcome outcome)
+{
+    LedgerRecord record;
+    record.timestamp_ns = static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count());
+    record.account_number = account_number;
+    record.value = value;
+    record.fee = fee;
+    record.operation = operation;
+    record.outcome = static_cast<std::uint8_t>(outcome);
+    record.reserved = 0;
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+
+    // Rotation (or the first segment): the full one is written and closed by the committer
+    while(!m_current.mapping || m_current.records == m_segment_records)
+    {
+        rotate(lock);
+    }
+
+    record.sequence = ++m_last_sequence;
+    std::memcpy(m_current.mapping + end_of_records(m_current.records), &record, sizeof(record));
+    m_current.records++;
+
+    // Enough records for a group: wake up the committer (only once per group)
+    if(m_last_sequence - m_durable_sequence == m_group_commit_records)
+    {
+        m_commit_requested = true;
+        m_commit_needed.notify_one();
+    }
+
+    return record.sequence;
+}
+
+std::uint64_t WithdrawLedger::try_append(LedgerOperation operation, int account_number, int value, int fee, WithdrawOutcome outcome) noexcept
+{
+    try
+    {
+        return append(operation, account_number, value, fee, outcome);
+    }
+    catch(...)
+    {
+        m_append_errors.fetch_add(1, std::memory_order_relaxed);
+        return 0;
+    }
+}
+
+void WithdrawLedger::begin_change()
+{
+    std::unique_lock<std::mutex> lock(m_changes_mutex);
+    m_changes_done.wait(lock, [this]() { return !m_quiescing; });
+    m_changes++;
+}
+
+void WithdrawLedger::end_change()
+{
+    std::lock_guard<std::mutex> lock(m_changes_mutex);
+    if(--m_changes == 0 && m_quiescing)
+    {
+        m_changes_done.notify_all();
+    }
+}
+
+void WithdrawLedger::quiesce(const std::function<void()>& action)
+{
+    // One at a time. The new changes wait from now on, and the running ones are waited.
+    std::unique_lock<std::mutex> lock(m_changes_mutex);
+    m_changes_done.wait(lock, [this]() { return !m_quiescing; });
+    m_quiescing = true;
+    m_changes_done.wait(lock, [this]() { return m_changes == 0; });
+    lock.unlock();
+
+    std::exception_ptr error;
+    try
+    {
+        action();
+    }
+    catch(...)
+    {
+        error = std::current_exception();
+    }
+
+    lock.lock();
+    m_quiescing = false;
+    m_changes_done.notify_all();
+    lock.unlock();
+
+    if(error)
+    {
+        std::rethrow_exception(error);
+    }
+}
+
+void WithdrawLedger::wait_durable(std::uint64_t sequence)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    sequence = std::min(sequence, m_last_sequence);
+    // m_durable_sequence does not move after a failed commit, so the later records get its error
+    while(m_durable_sequence < sequence)
+    {
+        if(m_commit_error)
+        {
+            std::rethrow_exception(m_commit_error);
+        }
+        m_commit_requested = true;
+        m_commit_needed.notify_one();
+        m_durable.wait(lock);
+    }
+}
+
+void WithdrawLedger::commit()
+{
+    wait_durable(last_sequence());
+}
+
+std::uint64_t WithdrawLedger::last_sequence() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_last_sequence;
+}
+
+std::uint64_t WithdrawLedger::durable_sequence() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_durable_sequence;
+}
+
+WithdrawLedger::Segment WithdrawLedger::create_segment(std::uint64_t first_sequence)
+{
+    std::string path = m_directory + "/" + LedgerScanner::segment_name(first_sequence);
+    int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if(fd < 0)
+    {
+        throw std::runtime_error("WithdrawLedger: can't create " + path);
+    }
+
+    // The blocks are allocated now, so the appends don't wait for the file system (if it does
+    // not support it, the file is just extended)
+    std::size_t size = end_of_records(m_segment_records);
+    if(::posix_fallocate(fd, 0, static_cast<off_t>(size)) != 0 && ::ftruncate(fd, static_cast<off_t>(size)) != 0)
+    {
+        ::close(fd);
+        throw std::runtime_error("WithdrawLedger: can't allocate " + path);
+    }
+
+    // The msync() of the records does not write the new directory entry: without this, a crash
+    // of the machine could lose the whole file
+    int directory_fd = ::open(m_directory.c_str(), O_RDONLY | O_DIRECTORY);
+    if(directory_fd < 0 || ::fsync(directory_fd) != 0)
+    {
+        if(directory_fd >= 0)
+        {
+            ::close(directory_fd);
+        }
+        ::close(fd);
+        throw std::runtime_error("WithdrawLedger: can't sync the directory of " + path);
+    }
+    ::close(directory_fd);
+
+    void* mapping = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if(mapping == MAP_FAILED)
+    {
+        ::close(fd);
+        throw std::runtime_error("WithdrawLedger: can't map " + path);
+    }
+
+    LedgerSegmentHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, ledger_magic, sizeof(header.magic));
+    header.version = ledger_version;
+    header.record_size = sizeof(LedgerRecord);
+    header.first_sequence = first_sequence;
+    std::memcpy(mapping, &header, sizeof(header));
+
+    return Segment{fd, static_cast<char*>(mapping), size, first_sequence, 0, 0};
+}
+
+void WithdrawLedger::sync(const Segment& segment, std::size_t from_record, std::size_t to_record) const
+{
+    // msync() needs an address aligned to a page. The header is written with the first records.
+    std::size_t from = from_record == 0 ? 0 : end_of_records(from_record);
+    from -= from % page_size();
+    std::size_t to = end_of_records(to_record);
+    if(to <= from)
+    {
+        return;
+    }
+    if(m_sync_function)
+    {
+        m_sync_function(segment.mapping + from, to - from);
+    }
+    else if(::msync(segment.mapping + from, to - from, MS_SYNC) != 0)
+    {
+        throw std::runtime_error("WithdrawLedger: msync failed");
+    }
+}
+
+void WithdrawLedger::close(Segment& segment)
+{
+    // The unused records are cut from the file
+    ::munmap(segment.mapping, segment.mapping_size);
+    if(segment.records < (segment.mapping_size - sizeof(LedgerSegmentHeader)) / sizeof(LedgerRecord))
+    {
+        if(::ftruncate(segment.fd, static_cast<off_t>(end_of_records(segment.records))) != 0)
+        {
+            // The zeros are still a valid end of the segment
+        }
+    }
+    ::close(segment.fd);
+    segment.mapping = nullptr;
+    segment.fd = -1;
+}
+
+void WithdrawLedger::remove(Segment& segment)
+{
+    std::string path = m_directory + "/" + LedgerScanner::segment_name(segment.first_sequence);
+    close(segment);
+    ::unlink(path.c_str());
+}
+
+void WithdrawLedger::rotate(std::unique_lock<std::mutex>& lock)
+{
+    // The committer may be creating the next segment right now
+    m_next_ready.wait(lock, [this]() { return !m_preparing_next; });
+    if(m_current.mapping && m_current.records < m_segment_records)
+    {
+        return;     // Another append() rotated it meanwhile
+    }
+
+    Segment next = m_next;
+    m_next = Segment{-1, nullptr, 0, 0, 0, 0};
+    if(next.mapping && next.first_sequence != m_last_sequence + 1)
+    {
+        remove(next);
+    }
+    if(!next.mapping)
+    {
+        // Not ready (the committer failed or did not run yet): created here, in the lock
+        next = create_segment(m_last_sequence + 1);
+    }
+
+    if(m_current.mapping)
+    {
+        m_full.push_back(m_current);
+    }
+    m_current = next;
+    m_segments++;
+
+    m_prepare_next = true;
+    m_commit_needed.notify_one();
+}
+
+void WithdrawLedger::prepare_next(std::unique_lock<std::mutex>& lock)
+{
+    m_prepare_next = false;
+    if(m_next.mapping)
+    {
+        return;
+    }
+
+    // The open(), posix_fallocate() and mmap() are done without the lock, so the appends go on
+    // in the meantime (an append() that needs the segment waits for it)
+    std::uint64_t first_sequence = m_current.mapping ? m_current.first_sequence + m_segment_records 
+                                                     : m_last_sequence + 1;
+    m_preparing_next = true;
+    lock.unlock();
+
+    Segment next{-1, nullptr, 0, 0, 0, 0};
+    try
+    {
+        next = create_segment(first_sequence);
+    }
+    catch(...)
+    {
+        // The append() that needs it will try again (and report the error)
+    }
+
+    lock.lock();
+    m_next = next;
+    m_preparing_next = false;
+    m_next_ready.notify_all();
+}
+
+void WithdrawLedger::run_committer()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    for(;;)
+    {
+        m_commit_needed.wait_for(lock, m_commit_interval, [this]() 
+        { 
+            return m_commit_requested || m_stopping || m_prepare_next; 
+        });
+        if(m_prepare_next && !m_stopping)
+        {
+            prepare_next(lock);
+        }
+        m_commit_requested = false;
+        bool stopping = m_stopping;
+
+        // After a failed commit there is nothing left to make durable, only segments to close
+        bool failed = static_cast<bool>(m_commit_error);
+        if((m_durable_sequence == m_last_sequence || failed) && m_full.empty())
+        {
+            if(stopping)
+            {
+                return;
+            }
+            continue;
+        }
+
+        // The msync() calls are done without the lock, so the appends go on in the meantime
+        std::vector<Segment> full;
+        full.swap(m_full);
+        Segment current = m_current;
+        std::uint64_t target = m_last_sequence;
+        lock.unlock();
+
+        std::exception_ptr error;
+        if(!failed)
+        {
+            try
+            {
+                for(const auto& segment : full)
+                {
+                    sync(segment, segment.synced_records, segment.records);
+                }
+                if(current.mapping)
+                {
+                    sync(current, current.synced_records, current.records);
+                }
+            }
+            catch(...)
+            {
+                error = std::current_exception();
+            }
+        }
+        for(auto& segment : full)
+        {
+            close(segment);
+        }
+
+        lock.lock();
+        if(error)
+        {
+            m_commit_error = error;
+        }
+        else if(!failed)
+        {
+            m_durable_sequence = std::max(m_durable_sequence, target);
+            if(m_current.mapping == current.mapping)
+            {
+                m_current.synced_records = current.records;
+            }
+            m_commits++;
+        }
+        m_durable.notify_all();
+    }
+}
+
+//--------------------------------------------------------------------------------------------------
+// LedgerSegment
+
+LedgerSegment::LedgerSegment(const std::string& path)
+    : m_mapping(nullptr), m_mapping_size(0), m_records(nullptr), m_size(0), m_first_sequence(0)
+{
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if(fd < 0)
+    {
+        throw std::runtime_error("LedgerSegment: can't open " + path);
+    }
+
+    struct stat info;
+    if(::fstat(fd, &info) != 0 || static_cast<std::size_t>(info.st_size) < sizeof(LedgerSegmentHeader))
+    {
+        ::close(fd);
+        throw std::runtime_error("LedgerSegment: " + path + " is not a ledger segment");
+    }
+
+    m_mapping_size = static_cast<std::size_t>(info.st_size);
+    m_mapping = ::mmap(nullptr, m_mapping_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);    // the mapping keeps the file
+    if(m_mapping == MAP_FAILED)
+    {
+        m_mapping = nullptr;
+        throw std::runtime_error("LedgerSegment: can't map " + path);
+    }
+
+    const LedgerSegmentHeader* header = static_cast<const LedgerSegmentHeader*>(m_mapping);
+    if(std::memcmp(header->magic, ledger_magic, sizeof(ledger_magic)) != 0 ||
+       header->version != ledger_version || header->record_size != sizeof(LedgerRecord))
+    {
+        unmap();
+        throw std::runtime_error("LedgerSegment: " + path + " is not a ledger segment (or of another version)");
+    }
+    m_first_sequence = header->first_sequence;
+
+    // It is read from the beginning to the end
+    ::madvise(m_mapping, m_mapping_size, MADV_SEQUENTIAL);
+
+    // The header and the records are 32 bytes, so the records are aligned in the mapping. The
+    // written records end at the first one without sequence (or an incomplete one).
+    m_records = reinterpret_cast<const LedgerRecord*>(static_cast<const char*>(m_mapping) + sizeof(LedgerSegmentHeader));
+    std::size_t capacity = (m_mapping_size - sizeof(LedgerSegmentHeader)) / sizeof(LedgerRecord);
+    while(m_size < capacity && m_records[m_size].sequence != 0)
+    {
+        m_size++;
+    }
+}
+
+LedgerSegment::~LedgerSegment()
+{
+    unmap();
+}
+
+LedgerSegment::LedgerSegment(LedgerSegment&& other) noexcept
+    : m_mapping(other.m_mapping), m_mapping_size(other.m_mapping_size), m_records(other.m_records),
+      m_size(other.m_size), m_first_sequence(other.m_first_sequence)
+{
+    other.m_mapping = nullptr;
+    other.m_mapping_size = 0;
+    other.m_records = nullptr;
+    other.m_size = 0;
+}
+
+LedgerSegment& LedgerSegment::operator=(LedgerSegment&& other) noexcept
+{
+    if(this != &other)
+    {
+        unmap();
+        std::swap(m_mapping, other.m_mapping);
+        std::swap(m_mapping_size, other.m_mapping_size);
+        std::swap(m_records, other.m_records);
+        std::swap(m_size, other.m_size);
+        std::swap(m_first_sequence, other.m_first_sequence);
+    }
+    return *this;
+}
+
+void LedgerSegment::unmap()
+{
+    if(m_mapping)
+    {
+        ::munmap(m_mapping, m_mapping_size);
+    }
+    m_mapping = nullptr;
+    m_mapping_size = 0;
+    m_records = nullptr;
+    m_size = 0;
+}
+
+//--------------------------------------------------------------------------------------------------
+// LedgerScanner
+
+LedgerScanner::LedgerScanner(const std::string& directory)
+{
+    DIR* dir = ::opendir(directory.c_str());
+    if(!dir)
+    {
+        throw std::runtime_error("LedgerScanner: can't open " + directory);
+    }
+
+    const std::size_t prefix_length = sizeof(segment_prefix) - 1;
+    const std::size_t suffix_length = sizeof(segment_suffix) - 1;
+    while(struct dirent* entry = ::readdir(dir))
+    {
+        std::string name = entry->d_name;
+        if(name.size() == prefix_length + sequence_digits + suffix_length &&
+           name.compare(0, prefix_length, segment_prefix) == 0 &&
+           name.compare(prefix_length + sequence_digits, suffix_length, segment_suffix) == 0)
+        {
+            m_segments.push_back(directory + "/" + name);
+        }
+    }
+    ::closedir(dir);
+
+    // The sequences have all their digits, so the names are sorted as the sequences
+    std::sort(m_segments.begin(), m_segments.end());
+}
+
+std::uint64_t LedgerScanner::first_sequence_of(const std::string& path)
+{
+    std::size_t start = path.rfind(segment_prefix);
+    if(start == std::string::npos)
+    {
+        return 0;
+    }
+    return std::strtoull(path.c_str() + start + sizeof(segment_prefix) - 1, nullptr, 10);
+}
+
+std::string LedgerScanner::segment_name(std::uint64_t first_sequence)
+{
+    char name[64];
+    std::snprintf(name, sizeof(name), "%s%020llu%s", segment_prefix, static_cast<unsigned long long>(first_sequence), segment_suffix);
+    return name;
+}
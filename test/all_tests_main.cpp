@@ -0,0 +1,123 @@
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+/*
+    Main of atm_all_tests (all the example tests in one program).
+
+    It is the same main as the one of gtest_main, plus a listener that measures the wall-clock
+    time of every test and prints a timing report at the end: the total time of the program 
+    (of this shard, if it is sharded) and the slowest test suites.
+
+    If the ATM_TEST_TIMING_REPORT environment variable has a file name, the time of every test 
+    is also appended to it as CSV (shard,suite,test,milliseconds), to track the suite latency.
+
+    The sharding is the one of Google Test: with GTEST_TOTAL_SHARDS=N and GTEST_SHARD_INDEX=i 
+    in the environment, the program only runs the i-th part of the tests. CTest runs the N parts 
+    in parallel (check ATM_SHARDED_TESTS in test/CMakeLists.txt).
+*/
+
+namespace
+{
+    class TimingListener : public ::testing::EmptyTestEventListener
+    {
+      public:
+
+        void OnTestProgramStart(const ::testing::UnitTest&) override
+        {
+            m_program_start = Clock::now();
+        }
+
+        void OnTestStart(const ::testing::TestInfo&) override
+        {
+            m_test_start = Clock::now();
+        }
+
+        void OnTestEnd(const ::testing::TestInfo& test_info) override
+        {
+            double ms = Milliseconds(Clock::now() - m_test_start).count();
+            m_tests.push_back(TestTime{test_info.test_suite_name(), test_info.name(), ms});
+        }
+
+        void OnTestProgramEnd(const ::testing::UnitTest&) override
+        {
+            double total_ms = Milliseconds(Clock::now() - m_program_start).count();
+            std::string shard = shard_name();
+
+            // The time of every suite, the slowest first
+            std::vector<TestTime> suites;
+            for(const auto& test : m_tests)
+            {
+                auto suite = std::find_if(suites.begin(), suites.end(), [&test](const TestTime& s) 
+                { 
+                    return s.suite == test.suite; 
+                });
+                if(suite == suites.end())
+                {
+                    suites.push_back(TestTime{test.suite, "", 0.0});
+                    suite = suites.end() - 1;
+                }
+                suite->ms += test.ms;
+            }
+            std::sort(suites.begin(), suites.end(), [](const TestTime& a, const TestTime& b) { return a.ms > b.ms; });
+
+            std::cout << "[  TIMING  ] shard " << shard << ": " << m_tests.size() << " tests in " 
+                      << total_ms << " ms (wall clock)\n";
+            for(std::size_t i = 0; i < suites.size() && i < 5; ++i)
+            {
+                std::cout << "[  TIMING  ]   " << suites[i].suite << ": " << suites[i].ms << " ms\n";
+            }
+            std::cout << std::flush;
+
+            const char* report_path = std::getenv("ATM_TEST_TIMING_REPORT");
+            if(report_path && *report_path)
+            {
+                std::ofstream report(report_path, std::ios::app);
+                for(const auto& test : m_tests)
+                {
+                    report << shard << "," << test.suite << "," << test.test << "," << test.ms << "\n";
+                }
+            }
+        }
+
+      private:
+
+        using Clock = std::chrono::steady_clock;
+        using Milliseconds = std::chrono::duration<double, std::milli>;
+
+        struct TestTime
+        {
+            std::string suite;
+            std::string test;
+            double ms;
+        };
+
+        static std::string shard_name()
+        {
+            const char* index = std::getenv("GTEST_SHARD_INDEX");
+            const char* total = std::getenv("GTEST_TOTAL_SHARDS");
+            if(index && total)
+            {
+                return std::string(index) + "/" + total;
+            }
+            return "0/1";
+        }
+
+        Clock::time_point m_program_start;
+        Clock::time_point m_test_start;
+        std::vector<TestTime> m_tests;
+    };
+}
+
+int main(int argc, char** argv)
+{
+    ::testing::InitGoogleMock(&argc, argv);
+    ::testing::UnitTest::GetInstance()->listeners().Append(new TimingListener);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,284 @@
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+#include "MockBankServer.hpp"
+#include "AtmDispatcher.hpp"
+#include "InMemoryBankServer.hpp"
+#include "MpmcRingBuffer.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <thread>
+#include <vector>
+
+using ::testing::NiceMock;
+using ::testing::Invoke;
+using ::testing::Return;
+using ::testing::_;
+
+//--------------------------------------------------------------------------------------------------
+// RING BUFFER
+TEST(MpmcRingBuffer, FullAndEmpty)
+{
+    MpmcRingBuffer<int> queue(3);
+    EXPECT_EQ(queue.capacity(), 4u);
+
+    int value = 0;
+    EXPECT_FALSE(queue.try_pop(value));
+    for(int i = 0; i < 4; ++i)
+    {
+        EXPECT_TRUE(queue.try_push(std::move(i)));
+    }
+    int extra = 4;
+    EXPECT_FALSE(queue.try_push(std::move(extra)));
+
+    for(int i = 0; i < 4; ++i)
+    {
+        EXPECT_TRUE(queue.try_pop(value));
+        EXPECT_EQ(value, i);        // FIFO
+    }
+    EXPECT_FALSE(queue.try_pop(value));
+}
+
+TEST(MpmcRingBuffer, ManyProducersManyConsumers)
+{
+    MpmcRingBuffer<int> queue(64);
+    const int producers = 4;
+    const int per_producer = 20000;
+    std::atomic<long> sum(0);
+    std::atomic<int> consumed(0);
+
+    std::vector<std::thread> threads;
+    for(int p = 0; p < producers; ++p)
+    {
+        threads.emplace_back([&queue]() 
+        {
+            for(int i = 1; i <= per_producer; ++i)
+            {
+                int value = i;
+                while(!queue.try_push(std::move(value)))
+                {
+                    std::this_thread::yield();
+                }
+            }
+        });
+        threads.emplace_back([&]() 
+        {
+            int value;
+            while(consumed.load() < producers * per_producer)
+            {
+                if(queue.try_pop(value))
+                {
+                    sum += value;
+                    consumed++;
+                }
+                else
+                {
+                    std::this_thread::yield();
+                }
+            }
+        });
+    }
+    for(auto& thread : threads)
+    {
+        thread.join();
+    }
+
+    EXPECT_EQ(sum.load(), static_cast<long>(producers) * per_producer * (per_producer + 1) / 2);
+}
+
+//--------------------------------------------------------------------------------------------------
+// DISPATCHER WITH MOCKS
+TEST(AtmDispatcher, OneSessionPerWorker)
+{
+    // Arrange: 2 workers, each one with its own mock session
+    NiceMock<MockBankServer> session1;
+    NiceMock<MockBankServer> session2;
+    for(auto session : {&session1, &session2})
+    {
+        ON_CALL(*session, GetBalance(_)).WillByDefault(Return(1000));
+        EXPECT_CALL(*session, Connect()).Times(1);
+        EXPECT_CALL(*session, Disconnect()).Times(1);
+    }
+
+    // Acts
+    std::vector<std::future<bool>> results;
+    {
+        AtmDispatcher dispatcher({&session1, &session2});
+        for(int account_number = 0; account_number < 100; ++account_number)
+        {
+            results.push_back(dispatcher.submit(account_number, 100));
+        }
+        for(auto& result : results)
+        {
+            EXPECT_TRUE(result.get());
+        }
+        EXPECT_EQ(dispatcher.stats().completed, 100u);
+    }
+}
+
+TEST(AtmDispatcher, BackPressure)
+{
+    // Arrange: the only worker gets blocked in its first withdrawal
+    NiceMock<MockBankServer> session;
+    std::promise<void> gate;
+    std::shared_future<void> gate_open = gate.get_future().share();
+    std::atomic<bool> blocked(false);
+    ON_CALL(session, GetBalance(_)).WillByDefault(Invoke([&](int) 
+    {
+        blocked = true;
+        gate_open.wait();
+        return 1000;
+    }));
+
+    AtmDispatcher dispatcher({&session}, 4);
+    std::atomic<int> done(0);
+    auto count = [&done](bool, std::exception_ptr) { done++; };
+
+    // Acts: the first one is being processed, and 4 more fill the queue
+    ASSERT_TRUE(dispatcher.try_submit(1, 10, count));
+    while(!blocked)
+    {
+        std::this_thread::yield();
+    }
+    for(int i = 0; i < 4; ++i)
+    {
+        EXPECT_TRUE(dispatcher.try_submit(1, 10, count));
+    }
+
+    // Asserts: no more room
+    EXPECT_FALSE(dispatcher.try_submit(1, 10, count));
+    EXPECT_EQ(dispatcher.stats().rejected, 1u);
+
+    gate.set_value();
+    dispatcher.stop();
+    EXPECT_EQ(done.load(), 5);
+    EXPECT_FALSE(dispatcher.try_submit(1, 10, count));
+}
+
+TEST(AtmDispatcher, ErrorsAreReported)
+{
+    // Arrange
+    NiceMock<MockBankServer> session;
+    EXPECT_CALL(session, GetBalance(_))
+        .WillOnce(Invoke([](int) -> int { throw std::runtime_error("timeout"); }))
+        .WillRepeatedly(Return(1000));
+
+    // Acts and Asserts: the error goes to the future, and the next one works
+    AtmDispatcher dispatcher({&session});
+    auto failed = dispatcher.submit(1234, 10);
+    EXPECT_THROW(failed.get(), std::runtime_error);
+    EXPECT_TRUE(dispatcher.submit(1234, 10).get());
+}
+
+TEST(AtmDispatcher, SubmitRacingWithStop)
+{
+    // Arrange: several threads submitting while the dispatcher is stopped
+    NiceMock<MockBankServer> session;
+    ON_CALL(session, GetBalance(_)).WillByDefault(Return(1000));
+
+    for(int round = 0; round < 20; ++round)
+    {
+        AtmDispatcher dispatcher({&session});
+        std::atomic<int> submitted(0);
+        std::atomic<int> done(0);
+        auto count = [&done](bool, std::exception_ptr) { done++; };
+
+        // Acts
+        std::vector<std::thread> submitters;
+        for(int t = 0; t < 4; ++t)
+        {
+            submitters.emplace_back([&, t]()
+            {
+                for(int i = 0; i < 50; ++i)
+                {
+                    if(dispatcher.try_submit(t, 1, count))
+                    {
+                        submitted++;
+                    }
+                }
+            });
+        }
+        dispatcher.stop();
+        for(auto& submitter : submitters)
+        {
+            submitter.join();
+        }
+
+        // Asserts: every accepted request got its callback
+        EXPECT_EQ(done.load(), submitted.load());
+    }
+}
+
+//--------------------------------------------------------------------------------------------------
+// THROUGHPUT SCALING FROM 1 TO N WORKERS
+//
+// Against the InMemoryBankServer (it can be shared by all the workers). Every run must be 
+// correct (no overdraft), and the throughput is printed to compare the number of workers.
+// The skewed run sends 90% of the requests to one hot account, so the work stealing has to
+// balance it.
+class DispatcherScaling : public ::testing::TestWithParam<bool>
+{
+};
+
+TEST_P(DispatcherScaling, OneToNWorkers)
+{
+    const bool skewed = GetParam();
+    const int accounts = 1000;
+    const int producers = 4;
+    const int per_producer = 20000;
+    const std::size_t max_workers = std::max(2u, std::thread::hardware_concurrency());
+
+    for(std::size_t workers = 1; workers <= max_workers; workers *= 2)
+    {
+        InMemoryBankServer bankserver(accounts * 2);
+        for(int account_number = 0; account_number < accounts; ++account_number)
+        {
+            bankserver.OpenAccount(account_number, 1000);
+        }
+
+        std::atomic<int> successes(0);
+        auto start = std::chrono::steady_clock::now();
+        AtmDispatcher::Stats stats;
+        {
+            AtmDispatcher dispatcher(std::vector<BankServer*>(workers, &bankserver), 4096);
+            std::vector<std::thread> threads;
+            for(int p = 0; p < producers; ++p)
+            {
+                threads.emplace_back([&, p]() 
+                {
+                    for(int i = 0; i < per_producer; ++i)
+                    {
+                        int account_number = (skewed && i % 10 != 0) ? 0 : (p * per_producer + i) % accounts;
+                        dispatcher.submit(account_number, 1, [&successes](bool result, std::exception_ptr) 
+                        {
+                            successes += result ? 1 : 0;
+                        });
+                    }
+                });
+            }
+            for(auto& thread : threads)
+            {
+                thread.join();
+            }
+            dispatcher.stop();
+            stats = dispatcher.stats();
+        }
+        auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        // Asserts: every request was processed, and no account was overdrawn
+        EXPECT_EQ(stats.completed, static_cast<std::uint64_t>(producers * per_producer));
+        long total = 0;
+        for(int account_number = 0; account_number < accounts; ++account_number)
+        {
+            ASSERT_GE(bankserver.GetBalance(account_number), 0);
+            total += bankserver.GetBalance(account_number);
+        }
+        EXPECT_EQ(total + successes.load(), static_cast<long>(accounts) * 1000);
+
+        std::cout << (skewed ? "[skewed] " : "[uniform] ") << workers << " workers: " 
+                  << static_cast<long>(producers * per_producer / elapsed) << " withdrawals/s, "
+                  << stats.stolen << " stolen" << std::endl;
+    }
+}
+INSTANTIATE_TEST_SUITE_P(AtmDispatcher, DispatcherScaling, ::testing::Values(false, true));
@@ -0,0 +1,227 @@
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+#include "MockBankBackend.hpp"
+#include "MockBankServer.hpp"
+#include "AtmMachine.hpp"
+#include "BankSession.hpp"
+#include "BasicAtmMachine.hpp"
+#include <stdexcept>
+
+using ::testing::InSequence;
+using ::testing::Return;
+using ::testing::Throw;
+using ::testing::_;
+
+//--------------------------------------------------------------------------------------------------
+// SESSIONS ARE ALWAYS CLOSED
+//
+// Whatever the BankServer call that throws (with the Throw actions of example_test_6), the
+// exception reaches the caller and Disconnect() is still called once after the Connect().
+
+TEST(BankSession, GetBalanceThrows)
+{
+    // Arrange
+    MockBankServer mock_bankserver;
+
+    // Expectations
+    {
+        InSequence seq;
+        EXPECT_CALL(mock_bankserver, Connect());
+        EXPECT_CALL(mock_bankserver, GetBalance(1234)).WillOnce(Throw(std::runtime_error("timeout")));
+        EXPECT_CALL(mock_bankserver, Disconnect());
+    }
+    EXPECT_CALL(mock_bankserver, Debit(_,_)).Times(0);
+
+    // Acts and Asserts
+    AtmMachine atm_machine(&mock_bankserver);
+    EXPECT_THROW(atm_machine.withdraw(1234, 1000), std::runtime_error);
+}
+
+TEST(BankSession, DebitThrows)
+{
+    // Arrange
+    MockBankServer mock_bankserver;
+
+    // Expectations
+    {
+        InSequence seq;
+        EXPECT_CALL(mock_bankserver, Connect());
+        EXPECT_CALL(mock_bankserver, GetBalance(1234)).WillOnce(Return(2000));
+        EXPECT_CALL(mock_bankserver, Debit(1234, 1000)).WillOnce(Throw(std::runtime_error("timeout")));
+        EXPECT_CALL(mock_bankserver, Disconnect());
+    }
+
+    // Acts and Asserts
+    AtmMachine atm_machine(&mock_bankserver);
+    EXPECT_THROW(atm_machine.withdraw(1234, 1000), std::runtime_error);
+}
+
+// No session was opened, so there is nothing to close
+TEST(BankSession, ConnectThrows)
+{
+    // Arrange
+    MockBankServer mock_bankserver;
+
+    // Expectations
+    EXPECT_CALL(mock_bankserver, Connect()).WillOnce(Throw(std::runtime_error("server down")));
+    EXPECT_CALL(mock_bankserver, GetBalance(_)).Times(0);
+    EXPECT_CALL(mock_bankserver, Disconnect()).Times(0);
+
+    // Acts and Asserts
+    AtmMachine atm_machine(&mock_bankserver);
+    EXPECT_THROW(atm_machine.withdraw(1234, 1000), std::runtime_error);
+}
+
+// The error of the Disconnect() can't hide the one that made the withdrawal fail
+TEST(BankSession, DisconnectThrowsAfterAnotherError)
+{
+    // Arrange
+    MockBankServer mock_bankserver;
+
+    // Expectations
+    EXPECT_CALL(mock_bankserver, Connect());
+    EXPECT_CALL(mock_bankserver, GetBalance(1234)).WillOnce(Throw(std::runtime_error("timeout")));
+    EXPECT_CALL(mock_bankserver, Disconnect()).WillOnce(Throw(std::logic_error("broken pipe")));
+
+    // Acts and Asserts
+    AtmMachine atm_machine(&mock_bankserver);
+    EXPECT_THAT([&]() { atm_machine.withdraw(1234, 1000); },
+                ::testing::ThrowsMessage<std::runtime_error>(::testing::StrEq("timeout")));
+}
+
+// Without another error, the caller is told that the Disconnect() failed (only one call)
+TEST(BankSession, DisconnectThrows)
+{
+    // Arrange
+    MockBankServer mock_bankserver;
+
+    // Expectations
+    EXPECT_CALL(mock_bankserver, Connect());
+    EXPECT_CALL(mock_bankserver, GetBalance(1234)).WillOnce(Return(2000));
+    EXPECT_CALL(mock_bankserver, Debit(1234, 1000));
+    EXPECT_CALL(mock_bankserver, Disconnect()).WillOnce(Throw(std::runtime_error("broken pipe")));
+
+    // Acts and Asserts
+    AtmMachine atm_machine(&mock_bankserver);
+    EXPECT_THROW(atm_machine.withdraw(1234, 1000), std::runtime_error);
+}
+
+TEST(BankSession, WithFeeAndTransfer)
+{
+    // Arrange
+    MockBankServer mock_bankserver;
+
+    // Expectations: one session for each operation, both closed
+    EXPECT_CALL(mock_bankserver, Connect()).Times(2);
+    EXPECT_CALL(mock_bankserver, GetBalance(1234)).WillRepeatedly(Return(2000));
+    EXPECT_CALL(mock_bankserver, DoubleTransaction(1234, 1000, 2))
+        .WillOnce(Throw(std::runtime_error("timeout")));
+    EXPECT_CALL(mock_bankserver, DoubleTransaction(1234, 1000, 0)).WillOnce(Return(1000));
+    EXPECT_CALL(mock_bankserver, Credit(5678, 1000)).WillOnce(Throw(std::runtime_error("timeout")));
+    EXPECT_CALL(mock_bankserver, Disconnect()).Times(2);
+
+    // Acts and Asserts
+    AtmMachine atm_machine(&mock_bankserver);
+    EXPECT_THROW(atm_machine.withdraw_with_fee(1234, 1000, 2), std::runtime_error);
+    EXPECT_THROW(atm_machine.transfer(1234, 5678, 1000), std::runtime_error);
+}
+
+TEST(BankSession, BatchThrows)
+{
+    // Arrange
+    MockBankServer mock_bankserver;
+
+    // Expectations: the batch stops at the second request, but its session is closed
+    EXPECT_CALL(mock_bankserver, Connect());
+    EXPECT_CALL(mock_bankserver, GetBalance(_)).WillRepeatedly(Return(2000));
+    EXPECT_CALL(mock_bankserver, Debit(1234, 100));
+    EXPECT_CALL(mock_bankserver, Debit(5678, 200)).WillOnce(Throw(std::runtime_error("timeout")));
+    EXPECT_CALL(mock_bankserver, Disconnect());
+
+    // Acts and Asserts
+    AtmMachine atm_machine(&mock_bankserver);
+    EXPECT_THROW(atm_machine.withdraw_batch({{1234, 100}, {5678, 200}, {1234, 300}}), std::runtime_error);
+}
+
+TEST(BankSession, AsyncThrows)
+{
+    // Arrange
+    MockBankServer mock_bankserver;
+
+    // Expectations: the errors are given to the callback, and the session is closed once
+    EXPECT_CALL(mock_bankserver, Connect());
+    EXPECT_CALL(mock_bankserver, GetBalance(_))
+        .WillOnce(Throw(std::runtime_error("timeout")))
+        .WillOnce(Return(2000));
+    EXPECT_CALL(mock_bankserver, Debit(5678, 200));
+    EXPECT_CALL(mock_bankserver, Disconnect());
+
+    // Acts
+    int errors = 0;
+    bool done = false;
+    AtmMachine atm_machine(&mock_bankserver);
+    atm_machine.withdraw_async({{1234, 100}, {5678, 200}},
+        [&](std::size_t, bool, std::exception_ptr error) { errors += error ? 1 : 0; },
+        [&](std::exception_ptr error) { done = !error; });
+
+    // Asserts
+    EXPECT_EQ(errors, 1);
+    EXPECT_TRUE(done);
+}
+
+TEST(BankSession, BasicAtmMachineGetBalanceThrows)
+{
+    // Arrange
+    MockBankBackend mock_backend;
+
+    // Expectations
+    {
+        InSequence seq;
+        EXPECT_CALL(mock_backend, Connect());
+        EXPECT_CALL(mock_backend, GetBalance(1234)).WillOnce(Throw(std::runtime_error("timeout")));
+        EXPECT_CALL(mock_backend, Disconnect());
+    }
+
+    // Acts and Asserts
+    BasicAtmMachine<MockBankBackend> atm_machine(&mock_backend);
+    EXPECT_THROW(atm_machine.withdraw(1234, 1000), std::runtime_error);
+}
+
+//--------------------------------------------------------------------------------------------------
+// THE GUARD ITSELF
+
+TEST(BankSession, CloseOnlyOnce)
+{
+    // Arrange
+    MockBankServer mock_bankserver;
+
+    // Expectations
+    EXPECT_CALL(mock_bankserver, Connect());
+    EXPECT_CALL(mock_bankserver, Disconnect()).WillOnce(Throw(std::runtime_error("broken pipe")));
+
+    // Acts and Asserts: a failed close() is not retried by close() or by the destructor
+    BankSession session(&mock_bankserver);
+    EXPECT_TRUE(session.is_open());
+    EXPECT_THROW(session.close(), std::runtime_error);
+    EXPECT_FALSE(session.is_open());
+    EXPECT_NO_THROW(session.close());
+}
+
+TEST(BankSession, Move)
+{
+    // Arrange
+    MockBankServer mock_bankserver;
+
+    // Expectations
+    EXPECT_CALL(mock_bankserver, Connect());
+    EXPECT_CALL(mock_bankserver, Disconnect());
+
+    // Acts and Asserts: only the last owner closes the session
+    BankSession first(&mock_bankserver);
+    {
+        BankSession second(std::move(first));
+        EXPECT_FALSE(first.is_open());
+        EXPECT_EQ(second.get(), &mock_bankserver);
+    }
+    ::testing::Mock::VerifyAndClearExpectations(&mock_bankserver);
+}
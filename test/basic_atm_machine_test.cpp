@@ -0,0 +1,112 @@
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+#include "MockBankBackend.hpp"
+#include "MockBankServer.hpp"
+#include "BasicAtmMachine.hpp"
+#include "InMemoryBankServer.hpp"
+
+using ::testing::InSequence;
+using ::testing::NiceMock;
+using ::testing::Return;
+using ::testing::_;
+
+//--------------------------------------------------------------------------------------------------
+// BasicAtmMachine WITH A NON-VIRTUAL MOCK
+//
+// The same expectations of example_test_5, but the backend is bound at compile time
+TEST(BasicAtmMachine, WithdrawInSequence)
+{
+    // Arrange
+    MockBankBackend mock_backend;
+
+    // Expectations
+    {
+        InSequence seq;
+        EXPECT_CALL(mock_backend, Connect());
+        EXPECT_CALL(mock_backend, GetBalance(1234))
+            .WillOnce(Return(2000));
+        EXPECT_CALL(mock_backend, Debit(1234, 1000));
+        EXPECT_CALL(mock_backend, Disconnect());
+    }
+
+    // Acts and Asserts
+    BasicAtmMachine<MockBankBackend> atm_machine(&mock_backend);
+    EXPECT_TRUE(atm_machine.withdraw(1234, 1000));
+}
+
+TEST(BasicAtmMachine, NotEnoughBalance)
+{
+    // Arrange
+    NiceMock<MockBankBackend> mock_backend;
+
+    // Expectations
+    EXPECT_CALL(mock_backend, GetBalance(1234))
+        .WillOnce(Return(999));
+    EXPECT_CALL(mock_backend, Debit(_,_)).Times(0);
+
+    // Acts and Asserts
+    BasicAtmMachine<MockBankBackend> atm_machine(&mock_backend);
+    EXPECT_FALSE(atm_machine.withdraw(1234, 1000));
+}
+
+TEST(BasicAtmMachine, Batch)
+{
+    // Arrange
+    NiceMock<MockBankBackend> mock_backend;
+    ON_CALL(mock_backend, GetBalance(_)).WillByDefault(Return(1500));
+
+    // Expectations
+    EXPECT_CALL(mock_backend, Connect()).Times(1);
+    EXPECT_CALL(mock_backend, Disconnect()).Times(1);
+
+    // Acts and Asserts
+    BasicAtmMachine<MockBankBackend> atm_machine(&mock_backend);
+    EXPECT_THAT(atm_machine.withdraw_batch({{1234, 1000}, {1234, 2000}}), ::testing::ElementsAre(true, false));
+}
+
+//--------------------------------------------------------------------------------------------------
+// TryDebit() IS SELECTED AT COMPILE TIME
+TEST(BasicAtmMachine, TryDebitSelectedAtCompileTime)
+{
+    static_assert(atm_detail::has_try_debit<MockConditionalDebitBankBackend>::value, "It has TryDebit");
+    static_assert(!atm_detail::has_try_debit<MockBankBackend>::value, "It doesn't have TryDebit");
+    static_assert(atm_detail::has_try_debit<InMemoryBankServer>::value, "It has TryDebit");
+
+    // Arrange
+    NiceMock<MockConditionalDebitBankBackend> mock_backend;
+
+    // Expectations
+    EXPECT_CALL(mock_backend, TryDebit(1234, 1000))
+        .WillOnce(Return(TryDebitResult{true, 0}));
+    EXPECT_CALL(mock_backend, GetBalance(_)).Times(0);
+    EXPECT_CALL(mock_backend, Debit(_,_)).Times(0);
+
+    // Acts and Asserts
+    BasicAtmMachine<MockConditionalDebitBankBackend> atm_machine(&mock_backend);
+    EXPECT_TRUE(atm_machine.withdraw(1234, 1000));
+}
+
+//--------------------------------------------------------------------------------------------------
+// REAL AND VIRTUAL BACKENDS
+TEST(BasicAtmMachine, InMemoryBackend)
+{
+    InMemoryBankServer bankserver(16);
+    bankserver.OpenAccount(1234, 1000);
+
+    BasicAtmMachine<InMemoryBankServer> atm_machine(&bankserver);
+    EXPECT_TRUE(atm_machine.withdraw(1234, 600));
+    EXPECT_FALSE(atm_machine.withdraw(1234, 600));
+    EXPECT_EQ(bankserver.GetBalance(1234), 400);
+}
+
+// The virtual MockBankServer can also be used as a (type-erased) backend
+TEST(BasicAtmMachine, VirtualBackend)
+{
+    NiceMock<MockBankServer> mock_bankserver;
+    EXPECT_CALL(mock_bankserver, GetBalance(1234))
+        .WillOnce(Return(1000));
+    EXPECT_CALL(mock_bankserver, Debit(1234, 1000));
+
+    BasicAtmMachine<BankServer> atm_machine(&mock_bankserver);
+    EXPECT_TRUE(atm_machine.withdraw(1234, 1000));
+}
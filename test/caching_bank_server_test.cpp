@@ -0,0 +1,153 @@
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+#include "MockBankServer.hpp"
+#include "AtmMachine.hpp"
+#include "CachingBankServer.hpp"
+#include <chrono>
+#include <stdexcept>
+
+using ::testing::NiceMock;
+using ::testing::Return;
+using ::testing::Throw;
+using ::testing::_;
+
+namespace
+{
+    const std::chrono::steady_clock::duration long_ttl = std::chrono::hours(1);
+}
+
+//--------------------------------------------------------------------------------------------------
+// READ-THROUGH CACHE
+TEST(CachingBankServer, HitsAndMisses)
+{
+    // Arrange
+    NiceMock<MockBankServer> mock_bankserver;
+
+    // Expectations: only the first read of each account reaches the server
+    EXPECT_CALL(mock_bankserver, GetBalance(1234)).Times(1).WillOnce(Return(1000));
+    EXPECT_CALL(mock_bankserver, GetBalance(5678)).Times(1).WillOnce(Return(50));
+
+    // Acts
+    CachingBankServer caching(&mock_bankserver, 16, long_ttl);
+    for(int i = 0; i < 10; ++i)
+    {
+        EXPECT_EQ(caching.GetBalance(1234), 1000);
+    }
+    EXPECT_EQ(caching.GetBalance(5678), 50);
+
+    // Asserts
+    CacheStats stats = caching.Stats();
+    EXPECT_EQ(stats.hits, 9u);
+    EXPECT_EQ(stats.misses, 2u);
+    EXPECT_EQ(stats.entries, 2u);
+    EXPECT_GT(stats.memory_bytes, 0u);
+    EXPECT_NEAR(stats.hit_ratio(), 9.0 / 11.0, 1e-9);
+}
+
+TEST(CachingBankServer, TtlExpiration)
+{
+    // Arrange
+    NiceMock<MockBankServer> mock_bankserver;
+
+    // Expectations: with ttl 0 nothing is served from the cache
+    EXPECT_CALL(mock_bankserver, GetBalance(1234)).Times(3).WillRepeatedly(Return(1000));
+
+    // Acts
+    CachingBankServer caching(&mock_bankserver, 16, std::chrono::steady_clock::duration::zero());
+    caching.GetBalance(1234);
+    caching.GetBalance(1234);
+    caching.GetBalance(1234);
+    EXPECT_EQ(caching.Stats().hits, 0u);
+}
+
+TEST(CachingBankServer, LruEviction)
+{
+    // Arrange
+    NiceMock<MockBankServer> mock_bankserver;
+    ON_CALL(mock_bankserver, GetBalance(_)).WillByDefault(Return(1000));
+
+    // Expectations: account 2 is the least recently used when account 3 arrives
+    EXPECT_CALL(mock_bankserver, GetBalance(1)).Times(1);
+    EXPECT_CALL(mock_bankserver, GetBalance(2)).Times(2);
+    EXPECT_CALL(mock_bankserver, GetBalance(3)).Times(1);
+
+    // Acts
+    CachingBankServer caching(&mock_bankserver, 2, long_ttl);
+    caching.GetBalance(1);
+    caching.GetBalance(2);
+    caching.GetBalance(1);
+    caching.GetBalance(3);      // Evicts 2
+    caching.GetBalance(1);
+    caching.GetBalance(2);      // Miss again
+    EXPECT_EQ(caching.Stats().entries, 2u);
+}
+
+//--------------------------------------------------------------------------------------------------
+// THE CACHE NEVER ALLOWS AN OVERDRAFT
+//
+// The server is read only once, but the debits done through the cache update the cached balance
+TEST(CachingBankServer, NoOverdraft)
+{
+    // Arrange
+    NiceMock<MockBankServer> mock_bankserver;
+
+    // Expectations
+    EXPECT_CALL(mock_bankserver, GetBalance(1234)).Times(1).WillOnce(Return(1000));
+    EXPECT_CALL(mock_bankserver, Debit(1234, 400)).Times(2);
+
+    // Acts: all the withdrawals in the same session (Disconnect() clears the cache)
+    CachingBankServer caching(&mock_bankserver, 16, long_ttl);
+    AtmMachine atm_machine(&caching);
+    std::vector<bool> results = atm_machine.withdraw_batch({{1234, 400}, {1234, 400}, {1234, 400}});
+
+    // Asserts
+    EXPECT_THAT(results, ::testing::ElementsAre(true, true, false));
+    EXPECT_EQ(caching.Stats().hits, 2u);
+}
+
+//--------------------------------------------------------------------------------------------------
+// INVALIDATIONS
+TEST(CachingBankServer, InvalidateOnDisconnect)
+{
+    // Arrange
+    NiceMock<MockBankServer> mock_bankserver;
+
+    // Expectations: every withdraw() opens and closes its own session, so nothing is reused
+    EXPECT_CALL(mock_bankserver, GetBalance(1234)).Times(2).WillRepeatedly(Return(1000));
+
+    // Acts
+    CachingBankServer caching(&mock_bankserver, 16, long_ttl);
+    AtmMachine atm_machine(&caching);
+    atm_machine.withdraw(1234, 100);
+    atm_machine.withdraw(1234, 100);
+}
+
+TEST(CachingBankServer, InvalidateOnError)
+{
+    // Arrange
+    NiceMock<MockBankServer> mock_bankserver;
+
+    // Expectations
+    EXPECT_CALL(mock_bankserver, GetBalance(1234)).Times(2).WillRepeatedly(Return(1000));
+    EXPECT_CALL(mock_bankserver, Debit(1234, _)).WillOnce(Throw(std::runtime_error("timeout")));
+
+    // Acts: we don't know if the failed debit was done or not, so the balance is read again
+    CachingBankServer caching(&mock_bankserver, 16, long_ttl);
+    caching.GetBalance(1234);
+    EXPECT_THROW(caching.Debit(1234, 100), std::runtime_error);
+    EXPECT_EQ(caching.Stats().entries, 0u);
+    caching.GetBalance(1234);
+}
+
+TEST(CachingBankServer, CreditsAreApplied)
+{
+    // Arrange
+    NiceMock<MockBankServer> mock_bankserver;
+    EXPECT_CALL(mock_bankserver, GetBalance(1234)).Times(1).WillOnce(Return(1000));
+
+    // Acts and Asserts
+    CachingBankServer caching(&mock_bankserver, 16, long_ttl);
+    caching.GetBalance(1234);
+    caching.Credit(1234, 500);
+    EXPECT_EQ(caching.GetBalance(1234), 1500);
+}
@@ -0,0 +1,306 @@
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+#include "MockBankServer.hpp"
+#include "AtmMachine.hpp"
+#include "CoalescingBankServer.hpp"
+#include <chrono>
+#include <stdexcept>
+#include <thread>
+
+using ::testing::NiceMock;
+using ::testing::InSequence;
+using ::testing::Return;
+using ::testing::Throw;
+using ::testing::_;
+
+namespace
+{
+    // A window so long that only the explicit flushes happen during the tests
+    const std::chrono::steady_clock::duration long_window = std::chrono::hours(1);
+}
+
+//--------------------------------------------------------------------------------------------------
+// COALESCING
+//
+// Two withdrawals from the same account reach the server as only one Debit()
+TEST(CoalescingBankServer, SameAccountDebitsAreMerged)
+{
+    // Arrange
+    NiceMock<MockBankServer> mock_bankserver;
+    ON_CALL(mock_bankserver, GetBalance(1234)).WillByDefault(Return(1000));
+
+    // Expectations
+    EXPECT_CALL(mock_bankserver, Debit(1234, 300)).Times(1);
+
+    // Acts
+    CoalescingBankServer coalescing(&mock_bankserver, long_window);
+    AtmMachine atm_machine(&coalescing);
+    EXPECT_TRUE(atm_machine.withdraw(1234, 100));
+    EXPECT_TRUE(atm_machine.withdraw(1234, 200));
+    EXPECT_EQ(coalescing.Pending(), 1u);
+    coalescing.Flush();
+    EXPECT_EQ(coalescing.Pending(), 0u);
+}
+
+TEST(CoalescingBankServer, NetOperation)
+{
+    // Arrange
+    MockBankServer mock_bankserver;
+
+    // Expectations: 1234 gets +500 -200, 5678 gets -100 +100 (nothing to send)
+    EXPECT_CALL(mock_bankserver, Connect()).Times(1);
+    EXPECT_CALL(mock_bankserver, Credit(1234, 300)).Times(1);
+    EXPECT_CALL(mock_bankserver, Debit(_,_)).Times(0);
+    EXPECT_CALL(mock_bankserver, Credit(5678, _)).Times(0);
+    EXPECT_CALL(mock_bankserver, Disconnect()).Times(1);
+
+    // Acts
+    CoalescingBankServer coalescing(&mock_bankserver, long_window);
+    coalescing.Connect();
+    coalescing.Credit(1234, 500);
+    coalescing.Debit(5678, 100);
+    coalescing.Debit(1234, 200);
+    coalescing.Credit(5678, 100);
+    coalescing.Flush();
+    coalescing.Disconnect();
+}
+
+//--------------------------------------------------------------------------------------------------
+// THE BALANCE CHECK SEES THE PENDING DELTAS
+TEST(CoalescingBankServer, NoOverdraftWithPendingDebits)
+{
+    // Arrange: the server still says 1000, because the debit is pending
+    NiceMock<MockBankServer> mock_bankserver;
+    ON_CALL(mock_bankserver, GetBalance(1234)).WillByDefault(Return(1000));
+
+    // Expectations
+    EXPECT_CALL(mock_bankserver, Debit(1234, 600)).Times(1);
+
+    // Acts and Asserts
+    CoalescingBankServer coalescing(&mock_bankserver, long_window);
+    AtmMachine atm_machine(&coalescing);
+    EXPECT_TRUE(atm_machine.withdraw(1234, 600));
+    EXPECT_EQ(coalescing.GetBalance(1234), 400);
+    EXPECT_FALSE(atm_machine.withdraw(1234, 600));
+}
+
+//--------------------------------------------------------------------------------------------------
+// ORDERING
+TEST(CoalescingBankServer, FlushInFirstTouchOrder)
+{
+    // Arrange
+    NiceMock<MockBankServer> mock_bankserver;
+
+    // Expectations
+    {
+        InSequence seq;
+        EXPECT_CALL(mock_bankserver, Debit(3, 30));
+        EXPECT_CALL(mock_bankserver, Debit(1, 11));
+        EXPECT_CALL(mock_bankserver, Credit(2, 20));
+    }
+
+    // Acts
+    CoalescingBankServer coalescing(&mock_bankserver, long_window);
+    coalescing.Debit(3, 30);
+    coalescing.Debit(1, 10);
+    coalescing.Credit(2, 20);
+    coalescing.Debit(1, 1);
+    coalescing.Flush();
+}
+
+TEST(CoalescingBankServer, DoubleTransactionAfterPendingDelta)
+{
+    // Arrange
+    NiceMock<MockBankServer> mock_bankserver;
+
+    // Expectations: the pending debit of the account must arrive before the DoubleTransaction
+    {
+        InSequence seq;
+        EXPECT_CALL(mock_bankserver, Debit(1234, 100));
+        EXPECT_CALL(mock_bankserver, DoubleTransaction(1234, 10, 20)).WillOnce(Return(870));
+    }
+
+    // Acts
+    CoalescingBankServer coalescing(&mock_bankserver, long_window);
+    coalescing.Debit(1234, 100);
+    EXPECT_EQ(coalescing.DoubleTransaction(1234, 10, 20), 870);
+    EXPECT_EQ(coalescing.Pending(), 0u);
+}
+
+// When the window has elapsed, the deltas are flushed inside the session, before Disconnect()
+TEST(CoalescingBankServer, FlushWhenTheWindowElapses)
+{
+    // Arrange
+    NiceMock<MockBankServer> mock_bankserver;
+    ON_CALL(mock_bankserver, GetBalance(1234)).WillByDefault(Return(1000));
+
+    // Expectations
+    {
+        InSequence seq;
+        EXPECT_CALL(mock_bankserver, Connect());
+        EXPECT_CALL(mock_bankserver, Debit(1234, 100));
+        EXPECT_CALL(mock_bankserver, Disconnect());
+    }
+
+    // Acts: window 0, so every write is due immediately
+    CoalescingBankServer coalescing(&mock_bankserver, std::chrono::steady_clock::duration::zero());
+    AtmMachine atm_machine(&coalescing);
+    atm_machine.withdraw(1234, 100);
+    EXPECT_EQ(coalescing.Pending(), 0u);
+}
+
+//--------------------------------------------------------------------------------------------------
+// DURABILITY
+TEST(CoalescingBankServer, RejectedFlushKeepsTheDeltas)
+{
+    // Arrange
+    NiceMock<MockBankServer> mock_bankserver;
+
+    // Expectations: the first try is rejected in the second account
+    {
+        InSequence seq;
+        EXPECT_CALL(mock_bankserver, Debit(1, 10));
+        EXPECT_CALL(mock_bankserver, Debit(2, 20)).WillOnce(Throw(TransactionRejected("busy")));
+        EXPECT_CALL(mock_bankserver, Debit(2, 25));
+        EXPECT_CALL(mock_bankserver, Debit(3, 30));
+    }
+
+    // Acts
+    CoalescingBankServer coalescing(&mock_bankserver, long_window);
+    coalescing.Debit(1, 10);
+    coalescing.Debit(2, 20);
+    coalescing.Debit(3, 30);
+    EXPECT_THROW(coalescing.Flush(), TransactionRejected);
+
+    // Asserts: accounts 2 and 3 are still pending, and new deltas are merged with them
+    EXPECT_EQ(coalescing.Pending(), 2u);
+    coalescing.Debit(2, 5);
+    coalescing.Flush();
+    EXPECT_EQ(coalescing.Pending(), 0u);
+    EXPECT_EQ(coalescing.UnknownOutcomes(), 0u);
+}
+
+// A delta that failed in any other way may be applied, so it is never sent again
+TEST(CoalescingBankServer, FailedFlushDropsTheUnknownDelta)
+{
+    // Arrange
+    NiceMock<MockBankServer> mock_bankserver;
+
+    // Expectations: the debit of 20 that failed is not retried
+    {
+        InSequence seq;
+        EXPECT_CALL(mock_bankserver, Debit(1, 10));
+        EXPECT_CALL(mock_bankserver, Debit(2, 20)).WillOnce(Throw(std::runtime_error("connection lost")));
+        EXPECT_CALL(mock_bankserver, Debit(3, 30));
+        EXPECT_CALL(mock_bankserver, Debit(2, 5));
+    }
+
+    // Acts
+    CoalescingBankServer coalescing(&mock_bankserver, long_window);
+    coalescing.Debit(1, 10);
+    coalescing.Debit(2, 20);
+    coalescing.Debit(3, 30);
+    try
+    {
+        coalescing.Flush();
+        FAIL() << "FlushOutcomeUnknown expected";
+    }
+    catch(const FlushOutcomeUnknown& e)
+    {
+        EXPECT_EQ(e.account_number(), 2);
+        EXPECT_EQ(e.delta(), -20);
+    }
+
+    // Asserts: only account 3 is still pending
+    EXPECT_EQ(coalescing.Pending(), 1u);
+    EXPECT_EQ(coalescing.UnknownOutcomes(), 1u);
+    coalescing.Debit(2, 5);
+    coalescing.Flush();
+    EXPECT_EQ(coalescing.Pending(), 0u);
+}
+
+// The session is closed even if its last flush fails
+TEST(CoalescingBankServer, FailedFlushInDisconnect)
+{
+    // Arrange
+    MockBankServer mock_bankserver;
+
+    // Expectations
+    {
+        InSequence seq;
+        EXPECT_CALL(mock_bankserver, Connect());
+        EXPECT_CALL(mock_bankserver, Debit(1234, 100)).WillOnce(Throw(std::runtime_error("connection lost")));
+        EXPECT_CALL(mock_bankserver, Disconnect());
+
+        // The flush of the destructor, in its own session
+        EXPECT_CALL(mock_bankserver, Connect());
+        EXPECT_CALL(mock_bankserver, Debit(1234, 5));
+        EXPECT_CALL(mock_bankserver, Disconnect());
+    }
+
+    // Acts
+    CoalescingBankServer coalescing(&mock_bankserver, std::chrono::milliseconds(20));
+    coalescing.Connect();
+    coalescing.Debit(1234, 100);
+    std::this_thread::sleep_for(std::chrono::milliseconds(30));
+    EXPECT_THROW(coalescing.Disconnect(), FlushOutcomeUnknown);
+
+    // Asserts: there is no session now, so a write is not flushed even if it is due
+    coalescing.Debit(1234, 5);
+    EXPECT_EQ(coalescing.Pending(), 1u);
+}
+
+// A write does not get the error of the flush of another account
+TEST(CoalescingBankServer, WriteOnlyGetsTheErrorsOfItsAccount)
+{
+    // Arrange
+    NiceMock<MockBankServer> mock_bankserver;
+
+    // Expectations
+    {
+        InSequence seq;
+        EXPECT_CALL(mock_bankserver, Debit(2, 20)).WillOnce(Throw(std::runtime_error("connection lost")));
+        EXPECT_CALL(mock_bankserver, Debit(1, 10));
+    }
+
+    // Acts: the write of account 1 flushes account 2 first, and it fails
+    CoalescingBankServer coalescing(&mock_bankserver, std::chrono::milliseconds(20));
+    coalescing.Connect();
+    coalescing.Debit(2, 20);
+    std::this_thread::sleep_for(std::chrono::milliseconds(30));
+    coalescing.Debit(1, 10);
+
+    // Asserts: the error is thrown by the next Flush()
+    EXPECT_EQ(coalescing.UnknownOutcomes(), 1u);
+    try
+    {
+        coalescing.Flush();
+        FAIL() << "FlushOutcomeUnknown expected";
+    }
+    catch(const FlushOutcomeUnknown& e)
+    {
+        EXPECT_EQ(e.account_number(), 2);
+    }
+    EXPECT_EQ(coalescing.Pending(), 0u);
+    coalescing.Flush();
+}
+
+TEST(CoalescingBankServer, FlushOnDestruction)
+{
+    // Arrange
+    MockBankServer mock_bankserver;
+
+    // Expectations: there is no open session, so the flush opens one
+    {
+        InSequence seq;
+        EXPECT_CALL(mock_bankserver, Connect());
+        EXPECT_CALL(mock_bankserver, Debit(1234, 100));
+        EXPECT_CALL(mock_bankserver, Disconnect());
+    }
+
+    // Acts
+    {
+        CoalescingBankServer coalescing(&mock_bankserver, long_window);
+        coalescing.Debit(1234, 100);
+    }
+}
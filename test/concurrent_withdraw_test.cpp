@@ -0,0 +1,127 @@
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+#include "MockBankServer.hpp"
+#include "AtmMachine.hpp"
+#include "AccountLocks.hpp"
+#include <atomic>
+#include <thread>
+#include <vector>
+
+using ::testing::NiceMock;
+using ::testing::Invoke;
+using ::testing::_;
+
+//--------------------------------------------------------------------------------------------------
+// CONCURRENT WITHDRAWALS
+//
+// The mock keeps the balances of some accounts (using Invoke()) and it yields the thread between
+// the balance check and the debit, so the race window is as big as possible.
+// Many threads (many ATM front-ends) withdraw from the same accounts at the same time, and no
+// account can end with a negative balance.
+class ConcurrentWithdraw : public ::testing::Test
+{
+    public:
+        void SetUp() override
+        {
+            for(auto& balance : m_balances)
+            {
+                balance = m_initial_balance;
+            }
+
+            ON_CALL(m_mock_bankserver, GetBalance(_))
+                .WillByDefault(Invoke([this](int account_number) 
+                {
+                    int balance = m_balances[account_number].load();
+                    std::this_thread::yield();
+                    return balance;
+                }));
+            ON_CALL(m_mock_bankserver, Debit(_,_))
+                .WillByDefault(Invoke([this](int account_number, int value) 
+                {
+                    m_balances[account_number] -= value;
+                }));
+        }
+
+        // It runs m_threads ATMs, each one withdrawing m_withdrawals times, and returns the
+        // number of successful withdrawals
+        int run(AccountLocks* account_locks)
+        {
+            std::atomic<int> successes(0);
+            std::vector<std::thread> threads;
+            for(int t = 0; t < m_threads; ++t)
+            {
+                threads.emplace_back([this, t, account_locks, &successes]() 
+                {
+                    AtmMachine atm_machine(&m_mock_bankserver, account_locks);
+                    for(int i = 0; i < m_withdrawals; ++i)
+                    {
+                        if(atm_machine.withdraw((t + i) % m_accounts, m_value))
+                        {
+                            ++successes;
+                        }
+                    }
+                });
+            }
+            for(auto& thread : threads)
+            {
+                thread.join();
+            }
+            return successes.load();
+        }
+
+        static const int m_accounts = 4;
+        const int m_initial_balance = 1000;
+        const int m_value = 10;
+        const int m_threads = 8;
+        const int m_withdrawals = 200;
+        std::atomic<int> m_balances[m_accounts];
+        NiceMock<MockBankServer> m_mock_bankserver;
+};
+
+TEST_F(ConcurrentWithdraw, NoOverdraftWithStripedLocks)
+{
+    AccountLocks account_locks;
+
+    int successes = run(&account_locks);
+
+    // 8 threads x 200 withdrawals of 10 = 16000, but there are only 4 x 1000 in the accounts,
+    // so exactly 400 withdrawals can be done and all the accounts must end empty, never negative
+    EXPECT_EQ(successes, m_accounts * m_initial_balance / m_value);
+    for(auto& balance : m_balances)
+    {
+        EXPECT_EQ(balance.load(), 0);
+    }
+}
+
+TEST_F(ConcurrentWithdraw, OneStripeStillCorrect)
+{
+    // All the accounts share the same lock: slower, but it must be correct too
+    AccountLocks account_locks(1);
+
+    int successes = run(&account_locks);
+
+    EXPECT_EQ(successes, m_accounts * m_initial_balance / m_value);
+    for(auto& balance : m_balances)
+    {
+        EXPECT_EQ(balance.load(), 0);
+    }
+}
+
+//--------------------------------------------------------------------------------------------------
+// The stripes: the same account always goes to the same stripe, and the accounts are spread
+TEST(AccountLocks, StripeMapping)
+{
+    AccountLocks account_locks(100);
+    EXPECT_EQ(account_locks.stripes(), 128u);
+    EXPECT_EQ(&account_locks.lock_for(1234), &account_locks.lock_for(1234));
+
+    std::vector<int> used(account_locks.stripes(), 0);
+    for(int account_number = 0; account_number < 1024; ++account_number)
+    {
+        used[account_locks.stripe_of(account_number)]++;
+    }
+    for(int count : used)
+    {
+        EXPECT_GT(count, 0);
+    }
+}
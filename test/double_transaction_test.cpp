@@ -0,0 +1,202 @@
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+#include "MockBankServer.hpp"
+#include "AtmMachine.hpp"
+#include "InMemoryBankServer.hpp"
+
+using ::testing::InSequence;
+using ::testing::Return;
+using ::testing::Throw;
+using ::testing::_;
+
+//--------------------------------------------------------------------------------------------------
+// WITHDRAW WITH FEE
+//
+// The withdrawal and its fee must go to the server in a single DoubleTransaction() call:
+// no Debit() at all.
+TEST(DoubleTransaction, WithdrawWithFeeInOneCall)
+{
+    // Arrange
+    MockBankServer mock_bankserver;
+
+    // Expectations
+    {
+        InSequence seq;
+        EXPECT_CALL(mock_bankserver, Connect());
+        EXPECT_CALL(mock_bankserver, GetBalance(1234)).WillOnce(Return(1002));
+        EXPECT_CALL(mock_bankserver, DoubleTransaction(1234, 1000, 2)).WillOnce(Return(0));
+        EXPECT_CALL(mock_bankserver, Disconnect());
+    }
+    EXPECT_CALL(mock_bankserver, Debit(_,_)).Times(0);
+
+    // Acts and Asserts
+    AtmMachine atm_machine(&mock_bankserver);
+    EXPECT_TRUE(atm_machine.withdraw_with_fee(1234, 1000, 2));
+}
+
+TEST(DoubleTransaction, FeeNotCovered)
+{
+    // Arrange
+    MockBankServer mock_bankserver;
+
+    // Expectations: the balance covers the withdrawal, but not the fee too
+    EXPECT_CALL(mock_bankserver, Connect());
+    EXPECT_CALL(mock_bankserver, GetBalance(1234)).WillOnce(Return(1001));
+    EXPECT_CALL(mock_bankserver, DoubleTransaction(_,_,_)).Times(0);
+    EXPECT_CALL(mock_bankserver, Debit(_,_)).Times(0);
+    EXPECT_CALL(mock_bankserver, Disconnect());
+
+    // Acts and Asserts
+    AtmMachine atm_machine(&mock_bankserver);
+    EXPECT_FALSE(atm_machine.withdraw_with_fee(1234, 1000, 2));
+}
+
+TEST(DoubleTransaction, FallbackWhenRejected)
+{
+    // Arrange
+    MockBankServer mock_bankserver;
+
+    // Expectations: the server does not accept the combined call, so two debits are done
+    {
+        InSequence seq;
+        EXPECT_CALL(mock_bankserver, Connect());
+        EXPECT_CALL(mock_bankserver, GetBalance(1234)).WillOnce(Return(2000));
+        EXPECT_CALL(mock_bankserver, DoubleTransaction(1234, 1000, 2))
+            .WillOnce(Throw(TransactionRejected("not allowed")));
+        EXPECT_CALL(mock_bankserver, Debit(1234, 1000));
+        EXPECT_CALL(mock_bankserver, Debit(1234, 2));
+        EXPECT_CALL(mock_bankserver, Disconnect());
+    }
+
+    // Acts and Asserts
+    AtmMachine atm_machine(&mock_bankserver);
+    EXPECT_TRUE(atm_machine.withdraw_with_fee(1234, 1000, 2));
+}
+
+TEST(DoubleTransaction, FallbackFailsHalfWay)
+{
+    // Arrange
+    MockBankServer mock_bankserver;
+
+    // Expectations: the withdrawal is debited, but the debit of the fee is rejected
+    {
+        InSequence seq;
+        EXPECT_CALL(mock_bankserver, Connect());
+        EXPECT_CALL(mock_bankserver, GetBalance(1234)).WillOnce(Return(2000));
+        EXPECT_CALL(mock_bankserver, DoubleTransaction(1234, 1000, 2))
+            .WillOnce(Throw(TransactionRejected("not allowed")));
+        EXPECT_CALL(mock_bankserver, Debit(1234, 1000));
+        EXPECT_CALL(mock_bankserver, Debit(1234, 2)).WillOnce(Throw(TransactionRejected("limit reached")));
+        EXPECT_CALL(mock_bankserver, Disconnect());
+    }
+
+    // Acts and Asserts: not a TransactionRejected, as the pair must not be retried
+    AtmMachine atm_machine(&mock_bankserver);
+    try
+    {
+        atm_machine.withdraw_with_fee(1234, 1000, 2);
+        FAIL() << "DebitPairIncomplete expected";
+    }
+    catch(const DebitPairIncomplete& e)
+    {
+        EXPECT_EQ(e.account_number(), 1234);
+        EXPECT_EQ(e.applied_value(), 1000);
+    }
+}
+
+TEST(DoubleTransaction, NoFallbackOnOtherErrors)
+{
+    // Arrange
+    MockBankServer mock_bankserver;
+
+    // Expectations: a timeout may have applied the transaction, so it must not be repeated
+    EXPECT_CALL(mock_bankserver, Connect());
+    EXPECT_CALL(mock_bankserver, GetBalance(1234)).WillOnce(Return(2000));
+    EXPECT_CALL(mock_bankserver, DoubleTransaction(1234, 1000, 2))
+        .WillOnce(Throw(std::runtime_error("timeout")));
+    EXPECT_CALL(mock_bankserver, Debit(_,_)).Times(0);
+    EXPECT_CALL(mock_bankserver, Disconnect());
+
+    // Acts and Asserts
+    AtmMachine atm_machine(&mock_bankserver);
+    EXPECT_THROW(atm_machine.withdraw_with_fee(1234, 1000, 2), std::runtime_error);
+}
+
+TEST(DoubleTransaction, HalvesTheDebitCalls)
+{
+    // Arrange: 10 fee-bearing withdrawals, with and without DoubleTransaction
+    MockBankServer mock_bankserver;
+    EXPECT_CALL(mock_bankserver, Connect()).Times(30);
+    EXPECT_CALL(mock_bankserver, Disconnect()).Times(30);
+    EXPECT_CALL(mock_bankserver, GetBalance(_)).WillRepeatedly(Return(1000));
+
+    // Expectations: 10 combined calls against 20 separated debits
+    EXPECT_CALL(mock_bankserver, DoubleTransaction(_,100,1)).Times(10);
+    EXPECT_CALL(mock_bankserver, Debit(_,_)).Times(20);
+
+    // Acts
+    AtmMachine atm_machine(&mock_bankserver);
+    for(int i = 0; i < 10; ++i)
+    {
+        EXPECT_TRUE(atm_machine.withdraw_with_fee(i, 100, 1));
+        EXPECT_TRUE(atm_machine.withdraw(i, 100));
+        EXPECT_TRUE(atm_machine.withdraw(i, 1));
+    }
+}
+
+//--------------------------------------------------------------------------------------------------
+// TRANSFER
+TEST(DoubleTransaction, TransferWithFee)
+{
+    // Arrange
+    MockBankServer mock_bankserver;
+
+    // Expectations: the source debit and its fee in one call, and the credit of the destination
+    {
+        InSequence seq;
+        EXPECT_CALL(mock_bankserver, Connect());
+        EXPECT_CALL(mock_bankserver, GetBalance(1)).WillOnce(Return(500));
+        EXPECT_CALL(mock_bankserver, DoubleTransaction(1, 400, 5)).WillOnce(Return(95));
+        EXPECT_CALL(mock_bankserver, Credit(2, 400));
+        EXPECT_CALL(mock_bankserver, Disconnect());
+    }
+
+    // Acts and Asserts
+    AtmMachine atm_machine(&mock_bankserver);
+    EXPECT_TRUE(atm_machine.transfer(1, 2, 400, 5));
+}
+
+TEST(DoubleTransaction, TransferNotCovered)
+{
+    // Arrange
+    MockBankServer mock_bankserver;
+
+    // Expectations
+    EXPECT_CALL(mock_bankserver, Connect());
+    EXPECT_CALL(mock_bankserver, GetBalance(1)).WillOnce(Return(404));
+    EXPECT_CALL(mock_bankserver, DoubleTransaction(_,_,_)).Times(0);
+    EXPECT_CALL(mock_bankserver, Credit(_,_)).Times(0);
+    EXPECT_CALL(mock_bankserver, Disconnect());
+
+    // Acts and Asserts
+    AtmMachine atm_machine(&mock_bankserver);
+    EXPECT_FALSE(atm_machine.transfer(1, 2, 400, 5));
+}
+
+TEST(DoubleTransaction, InMemoryBalances)
+{
+    // Arrange
+    InMemoryBankServer bankserver(16);
+    bankserver.OpenAccount(1, 1000);
+    bankserver.OpenAccount(2, 0);
+
+    // Acts
+    AtmMachine atm_machine(&bankserver);
+    EXPECT_TRUE(atm_machine.withdraw_with_fee(1, 100, 2));
+    EXPECT_TRUE(atm_machine.transfer(1, 2, 500, 3));
+    EXPECT_FALSE(atm_machine.transfer(1, 2, 395, 1));
+
+    // Asserts
+    EXPECT_EQ(bankserver.GetBalance(1), 395);
+    EXPECT_EQ(bankserver.GetBalance(2), 500);
+}
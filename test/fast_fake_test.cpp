@@ -0,0 +1,205 @@
+#include <gtest/gtest.h>
+#include <gtest/gtest-spi.h>
+#include <gmock/gmock.h>
+#include "FastFakeBankServer.hpp"
+#include "MockBankServer.hpp"
+#include "AtmMachine.hpp"
+#include <chrono>
+#include <thread>
+
+using ::testing::Return;
+using ::testing::_;
+
+using Method = FastFakeBankServer::Method;
+
+//--------------------------------------------------------------------------------------------------
+// THE SAME VERIFICATIONS THAN THE MOCK EXAMPLES
+//
+// Call counts (as in example_test_2)
+TEST(FastFake, TestWithdrawExpectedCalls)
+{
+    // Arrange
+    FastFakeBankServer fake_bankserver(16);
+    fake_bankserver.set_balance(2000);
+
+    // Expectations
+    fake_bankserver.expect_calls(Method::Connect, FastFakeBankServer::times(1));
+    fake_bankserver.expect_calls(Method::GetBalance, FastFakeBankServer::at_least(1));
+    fake_bankserver.expect_calls(Method::Debit, FastFakeBankServer::at_least(1));
+    fake_bankserver.expect_calls(Method::Disconnect, FastFakeBankServer::times(1));
+
+    // Acts and Asserts
+    AtmMachine atm_machine(&fake_bankserver);
+    EXPECT_TRUE(atm_machine.withdraw(1234, 1000));
+    EXPECT_EQ(fake_bankserver.count(Method::Debit, 1234), 1u);
+}
+
+// Ordering (as in example_test_5)
+TEST(FastFake, TestInSequence)
+{
+    // Arrange
+    FastFakeBankServer fake_bankserver(16);
+    fake_bankserver.set_balance(1000);
+
+    // Expectations
+    fake_bankserver.expect_in_sequence({Method::Connect, Method::Disconnect});
+    fake_bankserver.expect_in_sequence({Method::GetBalance, Method::Debit});
+    fake_bankserver.expect_after(Method::GetBalance, Method::Connect);
+    fake_bankserver.expect_after(Method::Disconnect, Method::Debit);
+
+    // Acts
+    AtmMachine atm_machine(&fake_bankserver);
+    atm_machine.withdraw(1234, 1000);
+}
+
+TEST(FastFake, FailuresAreReported)
+{
+    // Arrange: not enough money (as in TestWithdrawExpectedCallsFAIL of example_test_2)
+    FastFakeBankServer fake_bankserver(16);
+    fake_bankserver.set_balance(999);
+    fake_bankserver.set_balance(5678, 5000);
+
+    // Expectations
+    fake_bankserver.expect_calls(Method::Connect, FastFakeBankServer::times(1));
+    fake_bankserver.expect_calls(Method::Debit, FastFakeBankServer::at_least(1));
+    fake_bankserver.expect_in_sequence({Method::GetBalance, Method::Debit});
+    fake_bankserver.expect_after(Method::Disconnect, Method::Debit);
+
+    // Acts
+    AtmMachine atm_machine(&fake_bankserver);
+    EXPECT_FALSE(atm_machine.withdraw(1234, 1000));
+    EXPECT_TRUE(atm_machine.withdraw(5678, 1000));
+
+    // Asserts: only the Debit() expectation is satisfied (by the second withdrawal)
+    auto failures = fake_bankserver.failures();
+    ASSERT_EQ(failures.size(), 3u);
+    EXPECT_EQ(failures[0], "Connect called 2 times, expected 1");
+    EXPECT_EQ(failures[1], "call #4 is GetBalance, expected Debit (in sequence)");
+    EXPECT_EQ(failures[2], "call #2 Disconnect is not after a Debit");
+}
+
+// verify() can't be used to silence the failures: it reports them itself
+TEST(FastFake, VerifyReportsTheFailures)
+{
+    // Arrange
+    FastFakeBankServer fake_bankserver(16);
+    fake_bankserver.expect_calls(Method::Connect, FastFakeBankServer::times(1));
+
+    // Acts and Asserts: no call at all
+    bool verified = true;
+    EXPECT_NONFATAL_FAILURE(verified = fake_bankserver.verify(), "Connect called 0 times, expected 1");
+    EXPECT_FALSE(verified);
+}
+
+TEST(FastFake, OrderCantBeCheckedAfterTheCapacity)
+{
+    // Arrange
+    FastFakeBankServer fake_bankserver(3);
+    fake_bankserver.set_balance(2000);
+    fake_bankserver.expect_calls(Method::Connect, FastFakeBankServer::times(1));
+    fake_bankserver.expect_in_sequence({Method::Connect, Method::Disconnect});
+
+    // Acts: 4 calls
+    AtmMachine atm_machine(&fake_bankserver);
+    atm_machine.withdraw(1234, 1000);
+
+    // Asserts: the calls are still counted
+    EXPECT_EQ(fake_bankserver.recorded(), 3u);
+    EXPECT_EQ(fake_bankserver.count(Method::Disconnect), 1u);
+    EXPECT_EQ(fake_bankserver.failures().size(), 1u);
+}
+
+//--------------------------------------------------------------------------------------------------
+// HIGH VOLUME
+TEST(FastFake, MillionWithdrawals)
+{
+    // Arrange
+    const std::size_t withdrawals = 1000000;
+    FastFakeBankServer fake_bankserver(4 * withdrawals);
+    fake_bankserver.set_balance(1000);
+
+    // Expectations
+    fake_bankserver.expect_calls(Method::Connect, FastFakeBankServer::times(withdrawals));
+    fake_bankserver.expect_calls(Method::Debit, FastFakeBankServer::times(withdrawals));
+    fake_bankserver.expect_in_sequence({Method::Connect, Method::GetBalance, Method::Debit, Method::Disconnect});
+
+    // Acts
+    AtmMachine atm_machine(&fake_bankserver);
+    for(std::size_t i = 0; i < withdrawals; ++i)
+    {
+        atm_machine.withdraw(static_cast<int>(i % 1000), 100);
+    }
+}
+
+TEST(FastFake, ConcurrentWithdrawals)
+{
+    // Arrange
+    FastFakeBankServer fake_bankserver(4 * 40000);
+    fake_bankserver.set_balance(1000);
+    fake_bankserver.expect_calls(Method::Connect, FastFakeBankServer::times(4));
+    fake_bankserver.expect_calls(Method::GetBalance, FastFakeBankServer::times(40000));
+    fake_bankserver.expect_calls(Method::Disconnect, FastFakeBankServer::times(4));
+
+    // Acts: 4 ATMs, one batch (session) each. The calls of the sessions are mixed, so only
+    // the counts can be expected
+    std::vector<std::thread> threads;
+    for(int t = 0; t < 4; ++t)
+    {
+        threads.emplace_back([&fake_bankserver]() 
+        {
+            AtmMachine atm_machine(&fake_bankserver);
+            std::vector<WithdrawRequest> requests(10000, WithdrawRequest{1, 1});
+            atm_machine.withdraw_batch(requests);
+        });
+    }
+    for(auto& thread : threads)
+    {
+        thread.join();
+    }
+    EXPECT_EQ(fake_bankserver.recorded(), 4u * 20002);
+}
+
+// The same withdrawals through the gMock mock and through the fake, to see the difference
+TEST(FastFake, RuntimeAgainstMockBankServer)
+{
+    const int withdrawals = 50000;
+
+    auto start = std::chrono::steady_clock::now();
+    {
+        MockBankServer mock_bankserver;
+        EXPECT_CALL(mock_bankserver, Connect()).Times(withdrawals);
+        EXPECT_CALL(mock_bankserver, GetBalance(_)).Times(withdrawals).WillRepeatedly(Return(1000));
+        EXPECT_CALL(mock_bankserver, Debit(_,_)).Times(withdrawals);
+        EXPECT_CALL(mock_bankserver, Disconnect()).Times(withdrawals);
+
+        AtmMachine atm_machine(&mock_bankserver);
+        for(int i = 0; i < withdrawals; ++i)
+        {
+            atm_machine.withdraw(i, 100);
+        }
+    }
+    auto mock_time = std::chrono::steady_clock::now() - start;
+
+    start = std::chrono::steady_clock::now();
+    {
+        FastFakeBankServer fake_bankserver(4 * withdrawals);
+        fake_bankserver.set_balance(1000);
+        fake_bankserver.expect_calls(Method::Connect, FastFakeBankServer::times(withdrawals));
+        fake_bankserver.expect_calls(Method::GetBalance, FastFakeBankServer::times(withdrawals));
+        fake_bankserver.expect_calls(Method::Debit, FastFakeBankServer::times(withdrawals));
+        fake_bankserver.expect_calls(Method::Disconnect, FastFakeBankServer::times(withdrawals));
+
+        AtmMachine atm_machine(&fake_bankserver);
+        for(int i = 0; i < withdrawals; ++i)
+        {
+            atm_machine.withdraw(i, 100);
+        }
+    }
+    auto fake_time = std::chrono::steady_clock::now() - start;
+
+    using ms = std::chrono::duration<double, std::milli>;
+    std::cout << withdrawals << " withdrawals: MockBankServer " << ms(mock_time).count() << " ms, "
+              << "FastFakeBankServer " << ms(fake_time).count() << " ms "
+              << "(x" << ms(mock_time).count() / ms(fake_time).count() << ")" << std::endl;
+    EXPECT_LT(fake_time, mock_time);
+}
@@ -0,0 +1,235 @@
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+#include "MockBankServer.hpp"
+#include "HedgedBankServer.hpp"
+#include "LatencyWindow.hpp"
+#include <atomic>
+#include <chrono>
+#include <stdexcept>
+#include <thread>
+
+using ::testing::Invoke;
+using ::testing::NiceMock;
+using ::testing::Return;
+using ::testing::Throw;
+using ::testing::_;
+
+namespace
+{
+    // A replica that answers in 2 ms
+    auto replica_balance(int balance)
+    {
+        return Invoke([balance](int)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(2));
+            return balance;
+        });
+    }
+
+    // A primary that answers in 1 ms, but 1 of every slow_every reads takes slow_delay
+    auto primary_balance(int balance, int slow_every, std::chrono::milliseconds slow_delay)
+    {
+        auto calls = std::make_shared<std::atomic<int>>(0);
+        return Invoke([=](int)
+        {
+            bool slow = (calls->fetch_add(1) + 1) % slow_every == 0;
+            std::this_thread::sleep_for(slow ? slow_delay : std::chrono::milliseconds(1));
+            return balance;
+        });
+    }
+
+    // p99 of the latencies of some reads (done one after the other) seen by the client
+    std::chrono::nanoseconds client_p99(HedgedBankServer& hedged, int reads)
+    {
+        LatencyWindow window(reads);
+        for(int i = 0; i < reads; ++i)
+        {
+            auto start = std::chrono::steady_clock::now();
+            EXPECT_EQ(hedged.GetBalance(1234), 1000);
+            window.record(std::chrono::steady_clock::now() - start);
+        }
+        return window.percentile(0.99);
+    }
+}
+
+//--------------------------------------------------------------------------------------------------
+// HEDGED READS
+// 4% of the reads of the primary are slow: they are in its p99, but not in its p95, so they
+// are the ones hedged
+TEST(HedgedBankServer, HedgingCutsTheP99)
+{
+    // Arrange
+    NiceMock<MockBankServer> primary;
+    NiceMock<MockBankServer> replica;
+    ON_CALL(primary, GetBalance(_)).WillByDefault(primary_balance(1000, 25, std::chrono::milliseconds(60)));
+    ON_CALL(replica, GetBalance(_)).WillByDefault(replica_balance(1000));
+
+    HedgingPolicy no_hedging;
+    no_hedging.hedge_budget = 0.0;
+    HedgingPolicy hedging;
+    hedging.hedge_budget = 0.2;
+
+    // Acts
+    std::chrono::nanoseconds p99_unhedged;
+    {
+        HedgedBankServer hedged(&primary, &replica, no_hedging);
+        p99_unhedged = client_p99(hedged, 200);
+        EXPECT_EQ(hedged.Stats().hedged, 0u);
+    }
+    std::chrono::nanoseconds p99_hedged;
+    HedgingStats stats;
+    {
+        HedgedBankServer hedged(&primary, &replica, hedging);
+        p99_hedged = client_p99(hedged, 200);
+        stats = hedged.Stats();
+    }
+
+    // Asserts
+    EXPECT_GE(p99_unhedged, std::chrono::milliseconds(60));
+    EXPECT_LT(p99_hedged, std::chrono::milliseconds(30));
+    EXPECT_EQ(stats.reads, 200u);
+    EXPECT_GE(stats.hedged, 7u);
+    EXPECT_LE(stats.hedged, 40u);
+    EXPECT_GE(stats.replica_wins, 7u);
+}
+
+// Half of the reads of the primary are slow (and over the hedge percentile), but only the
+// budget of them is hedged
+TEST(HedgedBankServer, HedgeBudget)
+{
+    // Arrange
+    NiceMock<MockBankServer> primary;
+    NiceMock<MockBankServer> replica;
+    ON_CALL(primary, GetBalance(_)).WillByDefault(primary_balance(1000, 2, std::chrono::milliseconds(10)));
+    ON_CALL(replica, GetBalance(_)).WillByDefault(replica_balance(1000));
+
+    HedgingPolicy policy;
+    policy.hedge_percentile = 0.25;
+    policy.hedge_budget = 0.1;
+    policy.min_samples = 4;
+
+    // Acts
+    HedgedBankServer hedged(&primary, &replica, policy);
+    for(int i = 0; i < 50; ++i)
+    {
+        EXPECT_EQ(hedged.GetBalance(1234), 1000);
+    }
+
+    // Asserts
+    HedgingStats stats = hedged.Stats();
+    EXPECT_EQ(stats.reads, 50u);
+    EXPECT_GE(stats.hedged, 1u);
+    EXPECT_LE(stats.hedged, 5u);
+}
+
+// No read is hedged until the primary has enough latencies
+TEST(HedgedBankServer, NoHedgingWithoutSamples)
+{
+    // Arrange
+    NiceMock<MockBankServer> primary;
+    NiceMock<MockBankServer> replica;
+
+    // Expectations
+    EXPECT_CALL(primary, GetBalance(1234)).Times(3).WillRepeatedly(Return(1000));
+    EXPECT_CALL(replica, GetBalance(_)).Times(0);
+
+    // Acts & Asserts
+    HedgedBankServer hedged(&primary, &replica);
+    for(int i = 0; i < 3; ++i)
+    {
+        EXPECT_EQ(hedged.GetBalance(1234), 1000);
+    }
+    EXPECT_EQ(hedged.latencies().recorded(), 3u);
+}
+
+// If the primary fails after the read was hedged, the answer of the replica is taken
+TEST(HedgedBankServer, PrimaryErrorAfterHedge)
+{
+    // Arrange
+    NiceMock<MockBankServer> primary;
+    NiceMock<MockBankServer> replica;
+    EXPECT_CALL(primary, GetBalance(_))
+        .WillOnce(Invoke([](int)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(30));
+            return 1000;
+        }))
+        .WillOnce(Invoke([](int) -> int
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            throw std::runtime_error("connection lost");
+        }))
+        .WillOnce(Throw(std::runtime_error("connection lost")));
+    ON_CALL(replica, GetBalance(_)).WillByDefault(replica_balance(900));
+
+    HedgingPolicy policy;
+    policy.hedge_budget = 1.0;
+    policy.min_samples = 1;
+
+    // Acts & Asserts: the first read sets the hedge delay to 30 ms
+    HedgedBankServer hedged(&primary, &replica, policy);
+    EXPECT_EQ(hedged.GetBalance(1234), 1000);
+    EXPECT_EQ(hedged.GetBalance(1234), 900);
+    EXPECT_EQ(hedged.Stats().replica_wins, 1u);
+
+    // An error of the primary before the hedge delay is not hedged
+    EXPECT_THROW(hedged.GetBalance(1234), std::runtime_error);
+}
+
+// The writes only go to the primary
+TEST(HedgedBankServer, WritesGoToThePrimary)
+{
+    // Arrange
+    NiceMock<MockBankServer> primary;
+    NiceMock<MockBankServer> replica;
+
+    // Expectations
+    EXPECT_CALL(primary, Connect()).Times(1);
+    EXPECT_CALL(replica, Connect()).Times(1);
+    EXPECT_CALL(primary, Debit(1234, 100)).Times(1);
+    EXPECT_CALL(primary, Credit(5678, 100)).Times(1);
+    EXPECT_CALL(primary, DoubleTransaction(1234, 10, 2)).Times(1).WillOnce(Return(500));
+    EXPECT_CALL(replica, Debit(_, _)).Times(0);
+    EXPECT_CALL(replica, Credit(_, _)).Times(0);
+    EXPECT_CALL(replica, DoubleTransaction(_, _, _)).Times(0);
+
+    // Acts
+    HedgedBankServer hedged(&primary, &replica);
+    hedged.Connect();
+    hedged.Debit(1234, 100);
+    hedged.Credit(5678, 100);
+    EXPECT_EQ(hedged.DoubleTransaction(1234, 10, 2), 500);
+}
+
+TEST(HedgedBankServer, FailedConnectIsUndone)
+{
+    // Arrange
+    MockBankServer primary;
+    MockBankServer replica;
+
+    // Expectations: the session of the primary is closed again
+    EXPECT_CALL(primary, Connect());
+    EXPECT_CALL(primary, Disconnect());
+    EXPECT_CALL(replica, Connect()).WillOnce(Throw(std::runtime_error("unreachable")));
+    EXPECT_CALL(replica, Disconnect()).Times(0);
+
+    // Acts and Asserts
+    HedgedBankServer hedged(&primary, &replica);
+    EXPECT_THROW(hedged.Connect(), std::runtime_error);
+}
+
+TEST(HedgedBankServer, DisconnectReachesBothEvenWithErrors)
+{
+    // Arrange
+    NiceMock<MockBankServer> primary;
+    NiceMock<MockBankServer> replica;
+
+    // Expectations
+    EXPECT_CALL(primary, Disconnect()).WillOnce(Throw(std::runtime_error("broken pipe")));
+    EXPECT_CALL(replica, Disconnect());
+
+    // Acts and Asserts
+    HedgedBankServer hedged(&primary, &replica);
+    hedged.Connect();
+    EXPECT_THROW(hedged.Disconnect(), std::runtime_error);
+}
\ No newline at end of file
@@ -0,0 +1,279 @@
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+#include "MockBankServer.hpp"
+#include "AtmMachine.hpp"
+#include "InMemoryBankServer.hpp"
+#include "WithdrawDedupTable.hpp"
+#include <atomic>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+using ::testing::NiceMock;
+using ::testing::Return;
+using ::testing::Throw;
+using ::testing::_;
+
+//--------------------------------------------------------------------------------------------------
+// RETRIES
+//
+// The Disconnect() fails after the money was taken: the retry must not take it again, and it 
+// must not even call the server.
+TEST(IdempotentWithdraw, RetryAfterTheDebitIsNotDoneAgain)
+{
+    // Arrange
+    MockBankServer mock_bankserver;
+    WithdrawDedupTable dedup_table(1024);
+
+    // Expectations: only one withdrawal reaches the server
+    EXPECT_CALL(mock_bankserver, Connect()).Times(1);
+    EXPECT_CALL(mock_bankserver, GetBalance(1234)).WillOnce(Return(2000));
+    EXPECT_CALL(mock_bankserver, Debit(1234, 1000)).Times(1);
+    EXPECT_CALL(mock_bankserver, Disconnect()).WillOnce(Throw(std::runtime_error("connection lost")));
+
+    // Acts and Asserts
+    AtmMachine atm_machine(&mock_bankserver);
+    atm_machine.set_dedup_table(&dedup_table);
+    EXPECT_THROW(atm_machine.withdraw_once(42, 1234, 1000), std::runtime_error);
+    EXPECT_TRUE(atm_machine.withdraw_once(42, 1234, 1000));
+    EXPECT_TRUE(atm_machine.withdraw_once(42, 1234, 1000));
+}
+
+// The Connect() fails (as in example_test_6): nothing was done, so the retry does it
+TEST(IdempotentWithdraw, RetryBeforeTheDebitIsDone)
+{
+    // Arrange
+    MockBankServer mock_bankserver;
+    WithdrawDedupTable dedup_table(1024);
+
+    // Expectations
+    EXPECT_CALL(mock_bankserver, Connect())
+        .WillOnce(Throw(std::runtime_error("server down")))
+        .WillOnce(Return());
+    EXPECT_CALL(mock_bankserver, GetBalance(1234)).WillOnce(Return(2000));
+    EXPECT_CALL(mock_bankserver, Debit(1234, 1000)).Times(1);
+    EXPECT_CALL(mock_bankserver, Disconnect()).Times(1);
+
+    // Acts and Asserts
+    AtmMachine atm_machine(&mock_bankserver);
+    atm_machine.set_dedup_table(&dedup_table);
+    EXPECT_THROW(atm_machine.withdraw_once(42, 1234, 1000), std::runtime_error);
+    EXPECT_TRUE(atm_machine.withdraw_once(42, 1234, 1000));
+}
+
+// The Debit() itself fails: the server may or may not have done it, so a retry can't decide
+TEST(IdempotentWithdraw, RetryAfterAFailedDebitIsUnknown)
+{
+    // Arrange
+    NiceMock<MockBankServer> mock_bankserver;
+    WithdrawDedupTable dedup_table(1024);
+
+    // Expectations
+    ON_CALL(mock_bankserver, GetBalance(1234)).WillByDefault(Return(2000));
+    EXPECT_CALL(mock_bankserver, Debit(1234, 1000)).WillOnce(Throw(std::runtime_error("timeout")));
+
+    // Acts and Asserts
+    AtmMachine atm_machine(&mock_bankserver);
+    atm_machine.set_dedup_table(&dedup_table);
+    EXPECT_THROW(atm_machine.withdraw_once(42, 1234, 1000), std::runtime_error);
+    EXPECT_THROW(atm_machine.withdraw_once(42, 1234, 1000), WithdrawOutcomeUnknown);
+}
+
+TEST(IdempotentWithdraw, RejectionIsRemembered)
+{
+    // Arrange
+    MockBankServer mock_bankserver;
+    WithdrawDedupTable dedup_table(1024);
+
+    // Expectations: one withdrawal without enough money, and a new one (another request id)
+    EXPECT_CALL(mock_bankserver, Connect()).Times(2);
+    EXPECT_CALL(mock_bankserver, GetBalance(1234))
+        .WillOnce(Return(999))
+        .WillOnce(Return(5000));
+    EXPECT_CALL(mock_bankserver, Debit(1234, 1000)).Times(1);
+    EXPECT_CALL(mock_bankserver, Disconnect()).Times(2);
+
+    // Acts and Asserts
+    AtmMachine atm_machine(&mock_bankserver);
+    atm_machine.set_dedup_table(&dedup_table);
+    EXPECT_FALSE(atm_machine.withdraw_once(1, 1234, 1000));
+    EXPECT_FALSE(atm_machine.withdraw_once(1, 1234, 1000));
+    EXPECT_TRUE(atm_machine.withdraw_once(2, 1234, 1000));
+}
+
+TEST(IdempotentWithdraw, WithFee)
+{
+    // Arrange
+    MockBankServer mock_bankserver;
+    WithdrawDedupTable dedup_table(1024);
+
+    // Expectations
+    EXPECT_CALL(mock_bankserver, Connect()).Times(1);
+    EXPECT_CALL(mock_bankserver, GetBalance(1234)).WillOnce(Return(2000));
+    EXPECT_CALL(mock_bankserver, DoubleTransaction(1234, 1000, 2)).WillOnce(Return(998));
+    EXPECT_CALL(mock_bankserver, Disconnect()).WillOnce(Throw(std::runtime_error("connection lost")));
+
+    // Acts and Asserts
+    AtmMachine atm_machine(&mock_bankserver);
+    atm_machine.set_dedup_table(&dedup_table);
+    EXPECT_THROW(atm_machine.withdraw_with_fee_once(7, 1234, 1000, 2), std::runtime_error);
+    EXPECT_TRUE(atm_machine.withdraw_with_fee_once(7, 1234, 1000, 2));
+}
+
+TEST(IdempotentWithdraw, WithFeeHalfApplied)
+{
+    // Arrange
+    NiceMock<MockBankServer> mock_bankserver;
+    WithdrawDedupTable dedup_table(1024);
+
+    // Expectations: only the first debit of the fallback is applied
+    EXPECT_CALL(mock_bankserver, GetBalance(1234)).WillOnce(Return(2000));
+    EXPECT_CALL(mock_bankserver, DoubleTransaction(1234, 1000, 2)).WillOnce(Throw(TransactionRejected("not allowed")));
+    EXPECT_CALL(mock_bankserver, Debit(1234, 1000)).Times(1);
+    EXPECT_CALL(mock_bankserver, Debit(1234, 2)).WillOnce(Throw(std::runtime_error("timeout")));
+
+    // Acts and Asserts: the retry does not debit anything, the outcome is unknown
+    AtmMachine atm_machine(&mock_bankserver);
+    atm_machine.set_dedup_table(&dedup_table);
+    EXPECT_THROW(atm_machine.withdraw_with_fee_once(8, 1234, 1000, 2), DebitPairIncomplete);
+    EXPECT_THROW(atm_machine.withdraw_with_fee_once(8, 1234, 1000, 2), WithdrawOutcomeUnknown);
+}
+
+TEST(IdempotentWithdraw, NeedsADedupTable)
+{
+    NiceMock<MockBankServer> mock_bankserver;
+    AtmMachine atm_machine(&mock_bankserver);
+    EXPECT_THROW(atm_machine.withdraw_once(1, 1234, 1000), std::logic_error);
+}
+
+//--------------------------------------------------------------------------------------------------
+// DEDUP TABLE
+TEST(WithdrawDedupTable, ClaimCompleteAndRelease)
+{
+    WithdrawDedupTable dedup_table(8);
+    WithdrawDedupTable::Outcome outcome;
+
+    EXPECT_TRUE(dedup_table.claim(5).claimed);
+    auto second = dedup_table.claim(5);
+    EXPECT_FALSE(second.claimed);
+    EXPECT_EQ(second.outcome, WithdrawDedupTable::Outcome::InProgress);
+
+    dedup_table.complete(5, WithdrawDedupTable::Outcome::Succeeded);
+    ASSERT_TRUE(dedup_table.find(5, outcome));
+    EXPECT_EQ(outcome, WithdrawDedupTable::Outcome::Succeeded);
+
+    // Only an in progress request can be released
+    dedup_table.release(5);
+    EXPECT_TRUE(dedup_table.find(5, outcome));
+    EXPECT_TRUE(dedup_table.claim(6).claimed);
+    dedup_table.release(6);
+    EXPECT_FALSE(dedup_table.find(6, outcome));
+
+    EXPECT_THROW(dedup_table.claim(WithdrawDedupTable::max_request_id + 1), std::invalid_argument);
+}
+
+TEST(WithdrawDedupTable, MemoryIsBounded)
+{
+    // Arrange
+    WithdrawDedupTable dedup_table(1000);
+    EXPECT_EQ(dedup_table.capacity(), 1024u);
+    EXPECT_EQ(dedup_table.memory_bytes(), 1024u * 8);
+
+    // Acts: many more requests than entries
+    for(std::uint64_t request_id = 0; request_id < 100000; ++request_id)
+    {
+        dedup_table.claim(request_id);
+        dedup_table.complete(request_id, WithdrawDedupTable::Outcome::Succeeded);
+    }
+
+    // Asserts: the old ones are evicted, and most of the last ones are still there
+    EXPECT_GT(dedup_table.evictions(), 90000u);
+    WithdrawDedupTable::Outcome outcome;
+    int found = 0;
+    for(std::uint64_t request_id = 99900; request_id < 100000; ++request_id)
+    {
+        found += dedup_table.find(request_id, outcome) ? 1 : 0;
+    }
+    EXPECT_GT(found, 80);
+}
+
+// A request in progress stays in its bucket however many requests go through it, so its retry
+// is not done again
+TEST(WithdrawDedupTable, InProgressIsNeverEvicted)
+{
+    // Arrange: a single bucket
+    WithdrawDedupTable dedup_table(8);
+    ASSERT_TRUE(dedup_table.claim(1).claimed);
+
+    // Acts
+    for(std::uint64_t request_id = 2; request_id < 1000; ++request_id)
+    {
+        ASSERT_TRUE(dedup_table.claim(request_id).claimed);
+        dedup_table.complete(request_id, WithdrawDedupTable::Outcome::Succeeded);
+    }
+
+    // Asserts
+    auto retry = dedup_table.claim(1);
+    EXPECT_FALSE(retry.claimed);
+    EXPECT_EQ(retry.outcome, WithdrawDedupTable::Outcome::InProgress);
+    EXPECT_EQ(dedup_table.evictions(), 1000u - 9);
+
+    // Acts: with the whole bucket in progress, a new request can't be claimed
+    for(std::uint64_t request_id = 2000; request_id < 2007; ++request_id)
+    {
+        ASSERT_TRUE(dedup_table.claim(request_id).claimed);
+    }
+    EXPECT_THROW(dedup_table.claim(3000), std::runtime_error);
+    dedup_table.complete(1, WithdrawDedupTable::Outcome::Succeeded);
+    EXPECT_TRUE(dedup_table.claim(3000).claimed);
+}
+
+// Several ATMs receive the same request at the same time: it is done only once
+TEST(WithdrawDedupTable, ConcurrentRetries)
+{
+    // Arrange
+    InMemoryBankServer bankserver(1024);
+    AccountLocks account_locks;
+    WithdrawDedupTable dedup_table(1 << 12);
+    for(int account_number = 0; account_number < 100; ++account_number)
+    {
+        bankserver.OpenAccount(account_number, 1000000);
+    }
+
+    // Acts: 4 threads send the same 1000 requests (request id i takes i+1 from account i%100)
+    std::atomic<int> unknown(0);
+    std::vector<std::thread> threads;
+    for(int t = 0; t < 4; ++t)
+    {
+        threads.emplace_back([&]() 
+        {
+            AtmMachine atm_machine(&bankserver, &account_locks);
+            atm_machine.set_dedup_table(&dedup_table);
+            for(int i = 0; i < 1000; ++i)
+            {
+                try
+                {
+                    atm_machine.withdraw_once(i, i % 100, i + 1);
+                }
+                catch(const WithdrawOutcomeUnknown&)
+                {
+                    unknown++;      // in progress in another thread
+                }
+            }
+        });
+    }
+    for(auto& thread : threads)
+    {
+        thread.join();
+    }
+
+    // Asserts: every request was debited once
+    long total = 0;
+    for(int account_number = 0; account_number < 100; ++account_number)
+    {
+        total += 1000000 - bankserver.GetBalance(account_number);
+    }
+    EXPECT_EQ(dedup_table.evictions(), 0u);
+    EXPECT_EQ(total, 1000L * 1001 / 2);
+    std::cout << unknown.load() << " retries found their request in progress" << std::endl;
+}
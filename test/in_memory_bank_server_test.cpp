@@ -0,0 +1,153 @@
+#include <gtest/gtest.h>
+#include "AtmMachine.hpp"
+#include "InMemoryBankServer.hpp"
+#include <atomic>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+//--------------------------------------------------------------------------------------------------
+// BASIC OPERATIONS
+TEST(InMemoryBankServer, Operations)
+{
+    InMemoryBankServer bankserver(16);
+
+    EXPECT_EQ(bankserver.GetBalance(1234), 0);     // Unknown account
+    EXPECT_EQ(bankserver.Accounts(), 0u);
+
+    bankserver.OpenAccount(1234, 5000);
+    bankserver.Credit(1234, 500);
+    bankserver.Debit(1234, 1000);
+    EXPECT_EQ(bankserver.GetBalance(1234), 4500);
+
+    EXPECT_EQ(bankserver.DoubleTransaction(1234, 1000, 2), 3498);
+    EXPECT_EQ(bankserver.GetBalance(1234), 3498);
+
+    bankserver.Credit(5678, 10);                   // Created by the first write
+    EXPECT_EQ(bankserver.GetBalance(5678), 10);
+    EXPECT_EQ(bankserver.Accounts(), 2u);
+}
+
+TEST(InMemoryBankServer, TryDebit)
+{
+    InMemoryBankServer bankserver(16);
+    bankserver.OpenAccount(1234, 1000);
+
+    TryDebitResult result = bankserver.TryDebit(1234, 600);
+    EXPECT_TRUE(result.ok);
+    EXPECT_EQ(result.new_balance, 400);
+
+    result = bankserver.TryDebit(1234, 600);
+    EXPECT_FALSE(result.ok);
+    EXPECT_EQ(result.new_balance, 400);
+
+    result = bankserver.TryDebit(5678, 1);         // Unknown account: balance 0
+    EXPECT_FALSE(result.ok);
+    EXPECT_EQ(bankserver.Accounts(), 1u);
+}
+
+TEST(InMemoryBankServer, FullTable)
+{
+    InMemoryBankServer bankserver(4);
+    for(int account_number = 0; account_number < 4; ++account_number)
+    {
+        bankserver.OpenAccount(account_number, 1);
+    }
+
+    EXPECT_THROW(bankserver.Credit(100, 1), std::length_error);
+    EXPECT_NO_THROW(bankserver.Credit(3, 1));      // The existing ones still work
+    EXPECT_EQ(bankserver.GetBalance(3), 2);
+}
+
+TEST(InMemoryBankServer, ManyAccounts)
+{
+    const int accounts = 1 << 20;
+    InMemoryBankServer bankserver(accounts);
+    for(int account_number = 0; account_number < accounts; ++account_number)
+    {
+        bankserver.OpenAccount(account_number * 7, account_number);
+    }
+
+    EXPECT_EQ(bankserver.Accounts(), static_cast<std::size_t>(accounts));
+    for(int account_number = 0; account_number < accounts; ++account_number)
+    {
+        ASSERT_EQ(bankserver.GetBalance(account_number * 7), account_number);
+    }
+}
+
+TEST(InMemoryBankServer, ForEachAccount)
+{
+    InMemoryBankServer bankserver(16);
+    bankserver.OpenAccount(1234, 5000);
+    bankserver.OpenAccount(-5, 0);
+    bankserver.Credit(5678, 10);
+
+    long accounts = 0;
+    long total = 0;
+    bankserver.ForEachAccount([&](int account_number, int balance)
+    {
+        accounts++;
+        total += balance;
+        EXPECT_EQ(bankserver.GetBalance(account_number), balance);
+    });
+    EXPECT_EQ(accounts, 3);
+    EXPECT_EQ(total, 5010);
+}
+
+//--------------------------------------------------------------------------------------------------
+// CONCURRENT WRITES AND READS
+TEST(InMemoryBankServer, ConcurrentCredits)
+{
+    InMemoryBankServer bankserver(1024);
+    const int threads = 8;
+    const int credits = 10000;
+
+    std::vector<std::thread> workers;
+    for(int t = 0; t < threads; ++t)
+    {
+        workers.emplace_back([&bankserver, t]() 
+        {
+            for(int i = 0; i < credits; ++i)
+            {
+                bankserver.Credit(1234, 1);            // Hot account, shared by all
+                bankserver.Credit(t * 1000 + i % 100, 1);  // Accounts of this thread only
+            }
+        });
+    }
+    for(auto& worker : workers)
+    {
+        worker.join();
+    }
+
+    EXPECT_EQ(bankserver.GetBalance(1234), threads * credits);
+    EXPECT_EQ(bankserver.GetBalance(1000), credits / 100);
+}
+
+// The AtmMachine uses the TryDebit() capability of this backend, so it can't overdraw
+// even without account locks
+TEST(InMemoryBankServer, ConcurrentAtmMachines)
+{
+    InMemoryBankServer bankserver(1024);
+    bankserver.OpenAccount(1234, 1000);
+    std::atomic<int> successes(0);
+
+    std::vector<std::thread> workers;
+    for(int t = 0; t < 8; ++t)
+    {
+        workers.emplace_back([&bankserver, &successes]() 
+        {
+            AtmMachine atm_machine(&bankserver);
+            for(int i = 0; i < 100; ++i)
+            {
+                successes += atm_machine.withdraw(1234, 10) ? 1 : 0;
+            }
+        });
+    }
+    for(auto& worker : workers)
+    {
+        worker.join();
+    }
+
+    EXPECT_EQ(successes.load(), 100);
+    EXPECT_EQ(bankserver.GetBalance(1234), 0);
+}
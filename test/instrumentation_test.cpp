@@ -0,0 +1,148 @@
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+#include "MockBankServer.hpp"
+#include "AtmInstrumentation.hpp"
+#include "AtmMachine.hpp"
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+using ::testing::NiceMock;
+using ::testing::Return;
+using ::testing::Throw;
+using ::testing::_;
+
+//--------------------------------------------------------------------------------------------------
+// HISTOGRAM
+TEST(LatencyHistogram, Buckets)
+{
+    // Small values have their own bucket, and the buckets are contiguous
+    for(std::uint64_t value = 0; value < 8; ++value)
+    {
+        EXPECT_EQ(LatencyHistogram::bucket_of(value), value);
+    }
+    for(std::size_t bucket = 0; bucket + 1 < LatencyHistogram::bucket_count; ++bucket)
+    {
+        std::uint64_t low = LatencyHistogram::lower_bound_of(bucket);
+        EXPECT_EQ(LatencyHistogram::bucket_of(low), bucket);
+        EXPECT_EQ(LatencyHistogram::bucket_of(LatencyHistogram::lower_bound_of(bucket + 1) - 1), bucket);
+    }
+
+    // Huge values go to the last one
+    EXPECT_EQ(LatencyHistogram::bucket_of(~0ull), LatencyHistogram::bucket_count - 1);
+}
+
+TEST(LatencyHistogram, Percentiles)
+{
+    LatencyHistogram histogram;
+    for(std::uint64_t value = 1; value <= 1000; ++value)
+    {
+        histogram.record(value * 1000);     // From 1 us to 1 ms
+    }
+
+    HistogramSnapshot snapshot = histogram.snapshot();
+    EXPECT_EQ(snapshot.count, 1000u);
+    EXPECT_EQ(snapshot.max_ns, 1000000u);
+    EXPECT_NEAR(snapshot.mean(), 500500.0, 1.0);
+
+    // Relative error under 12.5%
+    EXPECT_NEAR(static_cast<double>(snapshot.percentile(0.50)), 500000.0, 500000.0 * 0.125);
+    EXPECT_NEAR(static_cast<double>(snapshot.percentile(0.99)), 990000.0, 990000.0 * 0.125);
+    EXPECT_LE(snapshot.percentile(1.0), snapshot.max_ns);
+}
+
+//--------------------------------------------------------------------------------------------------
+// AtmMachine INSTRUMENTATION
+class Instrumentation : public ::testing::Test
+{
+    public:
+        void SetUp() override
+        {
+#if !ATM_INSTRUMENTATION
+            GTEST_SKIP() << "Compiled without ATM_INSTRUMENTATION";
+#endif
+        }
+};
+
+TEST_F(Instrumentation, EveryCallAndOutcome)
+{
+    // Arrange
+    NiceMock<MockBankServer> mock_bankserver;
+    EXPECT_CALL(mock_bankserver, GetBalance(_))
+        .WillOnce(Return(1000))
+        .WillOnce(Return(0))
+        .WillOnce(Throw(std::runtime_error("timeout")));
+    AtmInstrumentation instrumentation;
+
+    // Acts: one success, one without money and one error
+    AtmMachine atm_machine(&mock_bankserver);
+    atm_machine.set_instrumentation(&instrumentation);
+    atm_machine.withdraw(1234, 100);
+    atm_machine.withdraw(1234, 100);
+    EXPECT_THROW(atm_machine.withdraw(1234, 100), std::runtime_error);
+
+    // Asserts
+    InstrumentationSnapshot snapshot = instrumentation.snapshot();
+    EXPECT_EQ(snapshot[AtmOperation::Connect].count, 3u);
+    EXPECT_EQ(snapshot[AtmOperation::GetBalance].count, 3u);
+    EXPECT_EQ(snapshot[AtmOperation::Debit].count, 1u);
+    EXPECT_EQ(snapshot[AtmOperation::Disconnect].count, 3u);   // Also after the error
+    EXPECT_EQ(snapshot[AtmOperation::Withdraw].count, 3u);
+    EXPECT_EQ(snapshot[WithdrawOutcome::Success], 1u);
+    EXPECT_EQ(snapshot[WithdrawOutcome::InsufficientFunds], 1u);
+    EXPECT_EQ(snapshot[WithdrawOutcome::Error], 1u);
+
+    // And it can be exported
+    std::ostringstream text;
+    snapshot.export_text(text);
+    EXPECT_THAT(text.str(), ::testing::HasSubstr("GetBalance"));
+    EXPECT_THAT(text.str(), ::testing::HasSubstr("InsufficientFunds: 1"));
+    std::cout << text.str();
+}
+
+TEST_F(Instrumentation, ManyThreads)
+{
+    // Arrange
+    NiceMock<MockBankServer> mock_bankserver;
+    ON_CALL(mock_bankserver, GetBalance(_)).WillByDefault(Return(1000));
+    AtmInstrumentation instrumentation(4);
+
+    // Acts: more threads than shards
+    std::vector<std::thread> threads;
+    for(int t = 0; t < 8; ++t)
+    {
+        threads.emplace_back([&]() 
+        {
+            AtmMachine atm_machine(&mock_bankserver);
+            atm_machine.set_instrumentation(&instrumentation);
+            for(int i = 0; i < 100; ++i)
+            {
+                atm_machine.withdraw(1234, 10);
+            }
+        });
+    }
+    for(auto& thread : threads)
+    {
+        thread.join();
+    }
+
+    // Asserts: nothing is lost
+    InstrumentationSnapshot snapshot = instrumentation.snapshot();
+    EXPECT_EQ(snapshot[AtmOperation::Withdraw].count, 800u);
+    EXPECT_EQ(snapshot[WithdrawOutcome::Success], 800u);
+}
+
+TEST_F(Instrumentation, DisabledByDefault)
+{
+    // Arrange
+    NiceMock<MockBankServer> mock_bankserver;
+    AtmInstrumentation instrumentation;
+
+    // Acts: the AtmMachine has no instrumentation
+    AtmMachine atm_machine(&mock_bankserver);
+    atm_machine.withdraw(1234, 100);
+
+    // Asserts
+    EXPECT_EQ(instrumentation.snapshot()[AtmOperation::Withdraw].count, 0u);
+}
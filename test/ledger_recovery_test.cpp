@@ -0,0 +1,310 @@
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+#include "AccountLocks.hpp"
+#include "AtmMachine.hpp"
+#include "InMemoryBankServer.hpp"
+#include "LedgerRecovery.hpp"
+#include "TransferEngine.hpp"
+#include "WithdrawLedger.hpp"
+#include <atomic>
+#include <cstdio>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Every test uses its own (empty) ledger directory
+static std::string ledger_directory()
+{
+    std::string directory = ::testing::TempDir() + ::testing::UnitTest::GetInstance()->current_test_info()->name() + ".recovery";
+    if(DIR* dir = ::opendir(directory.c_str()))
+    {
+        while(struct dirent* entry = ::readdir(dir))
+        {
+            std::remove((directory + "/" + entry->d_name).c_str());
+        }
+        ::closedir(dir);
+        ::rmdir(directory.c_str());
+    }
+    return directory;
+}
+
+static std::map<int, int> balances(const InMemoryBankServer& bankserver)
+{
+    std::map<int, int> result;
+    bankserver.ForEachAccount([&](int account_number, int balance) { result[account_number] = balance; });
+    return result;
+}
+
+// Withdraws from the server with an AtmMachine that records every outcome in the ledger. Every
+// account pays 1 per withdrawal, and the accounts with an odd number pay a fee of 2 too.
+static void withdraw_and_record(InMemoryBankServer& bankserver, WithdrawLedger& ledger, int withdrawals, int accounts)
+{
+    AtmMachine atm_machine(&bankserver);
+    atm_machine.set_ledger(&ledger);
+    for(int i = 0; i < withdrawals; ++i)
+    {
+        int account_number = (i * 7) % accounts;
+        if(account_number % 2)
+        {
+            atm_machine.withdraw_with_fee(account_number, 1, 2);
+        }
+        else
+        {
+            atm_machine.withdraw(account_number, 1);
+        }
+    }
+}
+
+//--------------------------------------------------------------------------------------------------
+// RECOVERY
+TEST(LedgerRecovery, RebuildsTheBalances)
+{
+    // Arrange: a snapshot of the opened accounts, and the withdrawals after it
+    std::string directory = ledger_directory();
+    InMemoryBankServer bankserver;
+    for(int account = 0; account < 100; ++account)
+    {
+        bankserver.OpenAccount(account, 50 + account);
+    }
+    {
+        WithdrawLedger ledger(directory, 1000);
+        LedgerRecovery(directory).snapshot(bankserver, 0);
+        withdraw_and_record(bankserver, ledger, 10000, 100);
+    }
+
+    // Acts
+    InMemoryBankServer recovered;
+    LedgerRecovery::Report report = LedgerRecovery(directory, 4).recover(recovered);
+
+    // Asserts
+    EXPECT_EQ(balances(recovered), balances(bankserver));
+    EXPECT_EQ(report.snapshot_sequence, 0u);
+    EXPECT_EQ(report.snapshot_accounts, 100u);
+    EXPECT_EQ(report.last_sequence, 10000u);
+    EXPECT_EQ(report.replayed_records, 10000u);
+    EXPECT_EQ(report.uncertain_records, 0u);
+    EXPECT_EQ(report.segments, 10u);
+    EXPECT_EQ(report.threads, 4u);
+}
+
+// The result is the same whatever the number of threads
+TEST(LedgerRecovery, DeterministicWithAnyNumberOfThreads)
+{
+    // Arrange
+    std::string directory = ledger_directory();
+    InMemoryBankServer bankserver;
+    for(int account = 0; account < 1000; ++account)
+    {
+        bankserver.OpenAccount(account, 1000);
+    }
+    {
+        WithdrawLedger ledger(directory, 512);
+        LedgerRecovery(directory).snapshot(bankserver, 0);
+        withdraw_and_record(bankserver, ledger, 20000, 1000);
+    }
+
+    // Acts
+    InMemoryBankServer one_thread;
+    InMemoryBankServer many_threads;
+    LedgerRecovery(directory, 1).recover(one_thread);
+    LedgerRecovery(directory, 7).recover(many_threads);
+
+    // Asserts
+    EXPECT_EQ(balances(one_thread), balances(bankserver));
+    EXPECT_EQ(balances(many_threads), balances(bankserver));
+}
+
+// Only the records after the last snapshot are replayed, and the segments included in it can
+// be removed
+TEST(LedgerRecovery, SnapshotBoundsTheReplay)
+{
+    // Arrange
+    std::string directory = ledger_directory();
+    InMemoryBankServer bankserver;
+    for(int account = 0; account < 10; ++account)
+    {
+        bankserver.OpenAccount(account, 100000);
+    }
+    LedgerRecovery recovery(directory, 2);
+    {
+        WithdrawLedger ledger(directory, 100);
+        recovery.snapshot(bankserver, 0);
+        withdraw_and_record(bankserver, ledger, 1050, 10);
+
+        // Acts
+        recovery.snapshot(bankserver, ledger.last_sequence(), true);
+        withdraw_and_record(bankserver, ledger, 130, 10);
+    }
+
+    // Asserts: one snapshot, and the segments from the one with the record 1050 (1001-1100)
+    EXPECT_EQ(recovery.snapshots().size(), 1u);
+    EXPECT_EQ(recovery.last_snapshot_sequence(), 1050u);
+    EXPECT_EQ(LedgerScanner(directory).segments().size(), 2u);
+
+    InMemoryBankServer recovered;
+    LedgerRecovery::Report report = recovery.recover(recovered);
+    EXPECT_EQ(balances(recovered), balances(bankserver));
+    EXPECT_EQ(report.snapshot_sequence, 1050u);
+    EXPECT_EQ(report.replayed_records, 130u);
+    EXPECT_EQ(report.last_sequence, 1180u);
+}
+
+// The withdrawals that failed with an error are reported, not applied
+TEST(LedgerRecovery, ErrorsAreUncertain)
+{
+    // Arrange
+    std::string directory = ledger_directory();
+    {
+        InMemoryBankServer bankserver;
+        bankserver.OpenAccount(1, 100);
+        WithdrawLedger ledger(directory);
+        LedgerRecovery(directory).snapshot(bankserver, 0);
+        ledger.append(LedgerOperation::Withdraw, 1, 10, 0, WithdrawOutcome::Success);
+        ledger.append(LedgerOperation::Withdraw, 1, 20, 0, WithdrawOutcome::Error);
+        ledger.append(LedgerOperation::WithdrawWithFee, 1, 30, 5, WithdrawOutcome::Success);
+        ledger.append(LedgerOperation::Withdraw, 1, 500, 0, WithdrawOutcome::InsufficientFunds);
+    }
+
+    // Acts
+    InMemoryBankServer recovered;
+    LedgerRecovery::Report report = LedgerRecovery(directory).recover(recovered);
+
+    // Asserts
+    EXPECT_EQ(recovered.GetBalance(1), 55);
+    EXPECT_EQ(report.replayed_records, 4u);
+    EXPECT_EQ(report.uncertain_records, 1u);
+}
+
+TEST(LedgerRecovery, SnapshotIfDue)
+{
+    // Arrange
+    std::string directory = ledger_directory();
+    InMemoryBankServer bankserver;
+    bankserver.OpenAccount(1, 1000);
+    WithdrawLedger ledger(directory);
+    LedgerRecovery recovery(directory);
+
+    // Acts & Asserts
+    EXPECT_TRUE(recovery.snapshot_if_due(bankserver, ledger, 0));
+    withdraw_and_record(bankserver, ledger, 99, 2);
+    EXPECT_FALSE(recovery.snapshot_if_due(bankserver, ledger, 100));
+    withdraw_and_record(bankserver, ledger, 1, 2);
+    EXPECT_TRUE(recovery.snapshot_if_due(bankserver, ledger, 100));
+    EXPECT_EQ(recovery.last_snapshot_sequence(), 100u);
+    EXPECT_EQ(recovery.snapshots().size(), 1u);
+}
+
+// End to end: ATMs and a transfer engine change the balances (withdrawals, fees and transfers
+// in both directions) while snapshots are taken, and the recovery gives the same balances
+TEST(LedgerRecovery, AtmsTransfersAndSnapshotsAtTheSameTime)
+{
+    // Arrange
+    std::string directory = ledger_directory();
+    const int accounts = 20;
+    InMemoryBankServer bankserver;
+    for(int account = 0; account < accounts; ++account)
+    {
+        bankserver.OpenAccount(account, 500);
+    }
+    LedgerRecovery recovery(directory, 3);
+    std::size_t snapshots = 0;
+    {
+        WithdrawLedger ledger(directory, 256);
+        recovery.snapshot(bankserver, 0);
+        AccountLocks account_locks;
+
+        // Acts
+        std::atomic<int> running(3);
+        std::vector<std::thread> threads;
+        for(int atm = 0; atm < 2; ++atm)
+        {
+            threads.emplace_back([&, atm]()
+            {
+                AtmMachine atm_machine(&bankserver, &account_locks);
+                atm_machine.set_ledger(&ledger);
+                for(int i = 0; i < 2000; ++i)
+                {
+                    int account_number = (i * 7 + atm) % accounts;
+                    switch(i % 3)
+                    {
+                        case 0: atm_machine.withdraw(account_number, 3); break;
+                        case 1: atm_machine.withdraw_with_fee(account_number, 2, 1); break;
+                        default: atm_machine.transfer(account_number, (account_number + 1) % accounts, 5, 1); break;
+                    }
+                }
+                running--;
+            });
+        }
+        threads.emplace_back([&]()
+        {
+            TransferEngine engine({&bankserver, &bankserver}, &account_locks);
+            engine.set_ledger(&ledger);
+            for(int batch = 0; batch < 50; ++batch)
+            {
+                std::vector<TransferRequest> requests;
+                for(int i = 0; i < 20; ++i)
+                {
+                    requests.push_back(TransferRequest{(batch + i) % accounts, (batch + 3 * i + 1) % accounts, 4, i % 2});
+                }
+                engine.transfer_batch(requests);
+            }
+            running--;
+        });
+        while(running > 0)
+        {
+            snapshots += recovery.snapshot_if_due(bankserver, ledger, 500, true) ? 1 : 0;
+            std::this_thread::yield();
+        }
+        for(auto& thread : threads)
+        {
+            thread.join();
+        }
+        EXPECT_EQ(ledger.append_errors(), 0u);
+    }
+
+    // Asserts
+    InMemoryBankServer recovered;
+    LedgerRecovery::Report report = recovery.recover(recovered);
+    EXPECT_EQ(balances(recovered), balances(bankserver));
+    EXPECT_EQ(report.uncertain_records, 0u);
+    EXPECT_GT(snapshots, 0u);
+    EXPECT_EQ(report.snapshot_sequence, recovery.last_snapshot_sequence());
+}
+
+// The transfers are recorded on both sides, and a failed credit is uncertain
+TEST(LedgerRecovery, TransfersAreRecorded)
+{
+    // Arrange
+    std::string directory = ledger_directory();
+    {
+        InMemoryBankServer bankserver;
+        bankserver.OpenAccount(1, 100);
+        bankserver.OpenAccount(2, 0);
+        WithdrawLedger ledger(directory);
+        LedgerRecovery(directory).snapshot(bankserver, 0);
+        ledger.append(LedgerOperation::TransferOut, 1, 30, 2, WithdrawOutcome::Success);
+        ledger.append(LedgerOperation::TransferIn, 2, 30, 0, WithdrawOutcome::Success);
+        ledger.append(LedgerOperation::TransferOut, 1, 10, 0, WithdrawOutcome::Success);
+        ledger.append(LedgerOperation::TransferIn, 2, 10, 0, WithdrawOutcome::Error);
+    }
+
+    // Acts
+    InMemoryBankServer recovered;
+    LedgerRecovery::Report report = LedgerRecovery(directory).recover(recovered);
+
+    // Asserts
+    EXPECT_EQ(recovered.GetBalance(1), 58);
+    EXPECT_EQ(recovered.GetBalance(2), 30);
+    EXPECT_EQ(report.uncertain_records, 1u);
+}
+
+TEST(LedgerRecovery, NotALedger)
+{
+    InMemoryBankServer bankserver;
+    EXPECT_THROW(LedgerRecovery(ledger_directory()).recover(bankserver), std::runtime_error);
+}
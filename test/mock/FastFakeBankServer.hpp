@@ -0,0 +1,315 @@
+#ifndef FASTFAKEBANKSERVER_HPP
+#define FASTFAKEBANKSERVER_HPP
+
+#include "BankServer.hpp"
+#include "BankServerTrace.hpp"
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <climits>
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+
+/*
+    FastFakeBankServer class:
+
+    A BankServer for the tests that push a lot of withdrawals (millions) through the AtmMachine.
+
+    A MockBankServer checks every call when it is done: it looks for the matching expectation,
+    takes a lock, formats the arguments... That is what we want in a normal test, but it takes
+    microseconds per call. This fake only writes every call in a preallocated array (and counts
+    it), and all the expectations are checked at once at the end (bulk verification):
+
+        * expect_calls(method, times(n) / at_least(n) / between(a, b)): the number of calls of a
+          function, like EXPECT_CALL(...).Times() in example_test_2.
+        * expect_in_sequence({...}): the calls of these functions must follow this order, again
+          and again (once per withdrawal), like InSequence in example_test_5.
+        * expect_after(later, earlier): every call of "later" must have a call of "earlier" 
+          since the previous "later" one, like .After() in example_test_5.
+
+    They are checked by verify(), which reports every failure to the test (ADD_FAILURE), or, if
+    it was not called, when the fake is destroyed (like the mocks, which check their expectations
+    in their destructor). failures() only returns them, for the tests that expect them to fail.
+
+    GetBalance() returns the balance given with set_balance() (for all the accounts, or for one
+    of them) and DoubleTransaction() returns 0. Debit() and Credit() don't change the balances.
+
+    Notice that: The arguments are recorded, but the expectations only check the functions. The
+    arguments can be checked with calls() or count(method, account_number). If there are more
+    calls than the capacity, they are counted but not recorded (and the order can't be checked).
+*/
+
+class FastFakeBankServer : public BankServer
+{
+  public:
+
+    using Method = TraceMethod;
+
+    struct Call
+    {
+        Method method;
+        int account_number;
+        int value1;
+        int value2;
+    };
+
+    // Number of calls expected (both included)
+    struct CallCount
+    {
+        std::size_t min;
+        std::size_t max;
+    };
+
+    static CallCount times(std::size_t n) { return CallCount{n, n}; }
+    static CallCount at_least(std::size_t n) { return CallCount{n, SIZE_MAX}; }
+    static CallCount between(std::size_t min, std::size_t max) { return CallCount{min, max}; }
+
+    explicit FastFakeBankServer(std::size_t capacity = 1 << 20)
+        : m_calls(new Call[capacity]), m_capacity(capacity), m_size(0), m_default_balance(0), m_verified(false)
+    {
+        for(auto& count : m_counts)
+        {
+            count.store(0, std::memory_order_relaxed);
+        }
+    }
+
+    ~FastFakeBankServer()
+    {
+        if(!m_verified)
+        {
+            verify();
+        }
+    }
+
+    FastFakeBankServer(const FastFakeBankServer&) = delete;
+    FastFakeBankServer& operator=(const FastFakeBankServer&) = delete;
+
+    // The BankServer functions: just record the call
+    void Connect() override { record(Method::Connect, 0, 0, 0); }
+    void Disconnect() override { record(Method::Disconnect, 0, 0, 0); }
+    void Credit(int account_number, int value) override { record(Method::Credit, account_number, value, 0); }
+    void Debit(int account_number, int value) override { record(Method::Debit, account_number, value, 0); }
+
+    int DoubleTransaction(int account_number, int value1, int value2) override 
+    { 
+        record(Method::DoubleTransaction, account_number, value1, value2); 
+        return 0;
+    }
+
+    int GetBalance(int account_number) const override 
+    { 
+        record(Method::GetBalance, account_number, 0, 0);
+        if(account_number >= 0 && static_cast<std::size_t>(account_number) < m_balances.size())
+        {
+            return m_balances[account_number];
+        }
+        return m_default_balance;
+    }
+
+    // The balance of all the accounts, or of one account (better if they are small numbers, they
+    // are kept in a flat array indexed by the account number)
+    void set_balance(int balance)
+    {
+        m_default_balance = balance;
+        std::fill(m_balances.begin(), m_balances.end(), balance);
+    }
+
+    void set_balance(int account_number, int balance)
+    {
+        if(static_cast<std::size_t>(account_number) >= m_balances.size())
+        {
+            m_balances.resize(account_number + 1, m_default_balance);
+        }
+        m_balances[account_number] = balance;
+    }
+
+    // Expectations (checked by verify())
+    void expect_calls(Method method, CallCount count)
+    {
+        m_count_expectations.push_back(CountExpectation{method, count});
+    }
+
+    void expect_in_sequence(std::vector<Method> sequence)
+    {
+        m_sequences.push_back(std::move(sequence));
+    }
+
+    void expect_after(Method later, Method earlier)
+    {
+        m_afters.push_back(std::make_pair(later, earlier));
+    }
+
+    // Checks all the expectations against the recorded calls and reports the failures to the
+    // test. It returns true if all of them are satisfied.
+    bool verify()
+    {
+        m_verified = true;
+        std::vector<std::string> failures = check();
+        for(const auto& failure : failures)
+        {
+            ADD_FAILURE() << "FastFakeBankServer: " << failure;
+        }
+        return failures.empty();
+    }
+
+    // The same check, but the failures are returned to the caller (and not reported), who then
+    // has to check them
+    std::vector<std::string> failures()
+    {
+        m_verified = true;
+        return check();
+    }
+
+    // The recorded calls
+    std::size_t count(Method method) const 
+    { 
+        return m_counts[static_cast<std::size_t>(method)].load(std::memory_order_relaxed); 
+    }
+
+    std::size_t count(Method method, int account_number) const
+    {
+        return std::count_if(m_calls.get(), m_calls.get() + recorded(), [&](const Call& call) 
+        {
+            return call.method == method && call.account_number == account_number;
+        });
+    }
+
+    std::size_t recorded() const { return std::min(m_size.load(std::memory_order_acquire), m_capacity); }
+    bool overflowed() const { return m_size.load(std::memory_order_acquire) > m_capacity; }
+    const Call* calls() const { return m_calls.get(); }
+
+  private:
+
+    struct CountExpectation
+    {
+        Method method;
+        CallCount count;
+    };
+
+    // The failures of the expectations (empty if all of them are satisfied)
+    std::vector<std::string> check() const
+    {
+        std::vector<std::string> failures;
+
+        for(const auto& expectation : m_count_expectations)
+        {
+            std::size_t calls = count(expectation.method);
+            if(calls < expectation.count.min || calls > expectation.count.max)
+            {
+                failures.push_back(std::string(to_string(expectation.method)) + " called " + std::to_string(calls) 
+                    + " times, expected " + describe(expectation.count));
+            }
+        }
+
+        if((!m_sequences.empty() || !m_afters.empty()) && overflowed())
+        {
+            failures.push_back("more calls than the capacity (" + std::to_string(m_capacity) + "), the order can't be checked");
+            return failures;
+        }
+
+        for(const auto& sequence : m_sequences)
+        {
+            check_sequence(sequence, failures);
+        }
+        for(const auto& after : m_afters)
+        {
+            check_after(after.first, after.second, failures);
+        }
+
+        return failures;
+    }
+
+    void record(Method method, int account_number, int value1, int value2) const
+    {
+        std::size_t index = m_size.fetch_add(1, std::memory_order_relaxed);
+        if(index < m_capacity)
+        {
+            m_calls[index] = Call{method, account_number, value1, value2};
+        }
+        m_counts[static_cast<std::size_t>(method)].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    static std::string describe(CallCount count)
+    {
+        if(count.min == count.max)
+        {
+            return std::to_string(count.min);
+        }
+        if(count.max == SIZE_MAX)
+        {
+            return "at least " + std::to_string(count.min);
+        }
+        return "between " + std::to_string(count.min) + " and " + std::to_string(count.max);
+    }
+
+    void check_sequence(const std::vector<Method>& sequence, std::vector<std::string>& failures) const
+    {
+        if(sequence.empty())
+        {
+            return;
+        }
+
+        // The calls of the functions of the sequence must repeat it, in complete rounds
+        std::size_t position = 0;
+        std::size_t calls = recorded();
+        for(std::size_t i = 0; i < calls; ++i)
+        {
+            if(std::find(sequence.begin(), sequence.end(), m_calls[i].method) == sequence.end())
+            {
+                continue;
+            }
+            if(m_calls[i].method != sequence[position % sequence.size()])
+            {
+                failures.push_back("call #" + std::to_string(i) + " is " + to_string(m_calls[i].method) 
+                    + ", expected " + to_string(sequence[position % sequence.size()]) + " (in sequence)");
+                return;
+            }
+            position++;
+        }
+        if(position % sequence.size() != 0)
+        {
+            failures.push_back(std::string("incomplete sequence, missing ") + to_string(sequence[position % sequence.size()]));
+        }
+    }
+
+    void check_after(Method later, Method earlier, std::vector<std::string>& failures) const
+    {
+        bool earlier_seen = false;
+        std::size_t calls = recorded();
+        for(std::size_t i = 0; i < calls; ++i)
+        {
+            if(m_calls[i].method == earlier)
+            {
+                earlier_seen = true;
+            }
+            else if(m_calls[i].method == later)
+            {
+                if(!earlier_seen)
+                {
+                    failures.push_back("call #" + std::to_string(i) + " " + to_string(later) 
+                        + " is not after a " + to_string(earlier));
+                    return;
+                }
+                earlier_seen = false;
+            }
+        }
+    }
+
+    std::unique_ptr<Call[]> m_calls;
+    const std::size_t m_capacity;
+    mutable std::atomic<std::size_t> m_size;
+    mutable std::array<std::atomic<std::size_t>, 6> m_counts;
+
+    int m_default_balance;
+    std::vector<int> m_balances;
+
+    std::vector<CountExpectation> m_count_expectations;
+    std::vector<std::vector<Method>> m_sequences;
+    std::vector<std::pair<Method, Method>> m_afters;
+    bool m_verified;
+};
+
+#endif
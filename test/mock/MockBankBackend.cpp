@@ -0,0 +1,9 @@
+#include "MockBankBackend.hpp"
+
+// The mock code of the MOCK_METHODs is generated here (check MockBankBackend.hpp)
+
+MockBankBackend::MockBankBackend() = default;
+MockBankBackend::~MockBankBackend() = default;
+
+MockConditionalDebitBankBackend::MockConditionalDebitBankBackend() = default;
+MockConditionalDebitBankBackend::~MockConditionalDebitBankBackend() = default;
@@ -0,0 +1,52 @@
+#ifndef MOCKBANKBACKEND_HPP
+#define MOCKBANKBACKEND_HPP
+
+#include "BankServer.hpp"
+#include <gmock/gmock.h>
+
+/*
+    Mock BankBackend class: 
+
+    The Mock of the backend of a BasicAtmMachine<Backend>.
+
+    BasicAtmMachine binds its backend at compile time (it is a template), so the backend does
+    not need to inherit from BankServer and its functions don't need to be virtual. In that
+    case the mock functions are neither virtual: notice that there is no (override) in the 
+    MOCK_METHODs and there is no base class at all. 
+    
+    The test simply uses BasicAtmMachine<MockBankBackend> instead of BasicAtmMachine<RealBackend>,
+    and all the expectations and actions work as with MockBankServer.
+
+    Notice that: As in MockBankServer, the constructor and the destructor are defined in 
+    MockBankBackend.cpp, so the mock code is compiled only once (in the atm_mocks library).
+*/
+
+class MockBankBackend
+{
+    public:
+        MockBankBackend();
+        ~MockBankBackend();
+
+        MOCK_METHOD(void, Connect, ());
+        MOCK_METHOD(void, Disconnect, ());
+        MOCK_METHOD(void, Credit, (int, int));
+        MOCK_METHOD(void, Debit, (int, int));
+        MOCK_METHOD(int,  DoubleTransaction, (int, int, int));
+        MOCK_METHOD(int,  GetBalance, (int), (const));
+};
+
+/*
+    Mock of a backend that also has the TryDebit() operation: BasicAtmMachine detects it at 
+    compile time and uses it instead of GetBalance() + Debit().
+*/
+
+class MockConditionalDebitBankBackend : public MockBankBackend
+{
+    public:
+        MockConditionalDebitBankBackend();
+        ~MockConditionalDebitBankBackend();
+
+        MOCK_METHOD(TryDebitResult, TryDebit, (int, int));
+};
+
+#endif
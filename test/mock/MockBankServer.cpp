@@ -0,0 +1,12 @@
+#include "MockBankServer.hpp"
+
+// The mock code of the MOCK_METHODs is generated here (check MockBankServer.hpp)
+
+MockBankServer::MockBankServer() = default;
+MockBankServer::~MockBankServer() = default;
+
+MockConditionalDebitBankServer::MockConditionalDebitBankServer() = default;
+MockConditionalDebitBankServer::~MockConditionalDebitBankServer() = default;
+
+MockAsyncBankServer::MockAsyncBankServer() = default;
+MockAsyncBankServer::~MockAsyncBankServer() = default;
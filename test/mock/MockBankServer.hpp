@@ -1,3 +1,7 @@
+#ifndef MOCKBANKSERVER_HPP
+#define MOCKBANKSERVER_HPP
+
+#include "AsyncBankServer.hpp"
 #include "BankServer.hpp"
 #include <gmock/gmock.h>
 
@@ -16,11 +20,19 @@
           mock function for each one with tits own args.
         * In case the base class is templated, simply template also the mock class in the 
           same way
+
+    Notice that: The constructor and the destructor are declared here but defined in 
+    MockBankServer.cpp. Most of the code generated by the MOCK_METHODs is instantiated where 
+    they are defined, so this way it is compiled once (in the atm_mocks library) instead of once
+    per test file (https://google.github.io/googletest/gmock_cook_book.html#making-the-compilation-faster).
 */
 
 class MockBankServer : public BankServer 
 {
     public:
+        MockBankServer();
+        ~MockBankServer() override;
+
         MOCK_METHOD(void, Connect, (), (override));
         MOCK_METHOD(void, Disconnect, (), (override));
         MOCK_METHOD(void, Credit, (int, int), (override));
@@ -28,3 +40,37 @@ class MockBankServer : public BankServer
         MOCK_METHOD(int,  DoubleTransaction, (int, int, int), (override));
         MOCK_METHOD(int,  GetBalance, (int), (const, override));
 };
+
+/*
+    Mock of a BankServer that also supports the ConditionalDebit capability.
+
+    It is a MockBankServer (all the BankServer mock methods are inherited) plus the TryDebit one.
+*/
+
+class MockConditionalDebitBankServer : public MockBankServer, public ConditionalDebit
+{
+    public:
+        MockConditionalDebitBankServer();
+        ~MockConditionalDebitBankServer() override;
+
+        MOCK_METHOD(TryDebitResult, TryDebit, (int, int), (override));
+};
+
+/*
+    Mock of an asynchronous BankServer (a BankServer with the AsyncBankOperations capability).
+
+    The completion callbacks are received as arguments of the mock methods, so the test can save
+    them (for example with Invoke() or SaveArg<>()) and call them later, in the order it wants.
+*/
+
+class MockAsyncBankServer : public MockBankServer, public AsyncBankOperations
+{
+    public:
+        MockAsyncBankServer();
+        ~MockAsyncBankServer() override;
+
+        MOCK_METHOD(void, GetBalanceAsync, (int, AsyncBankOperations::BalanceCallback), (override));
+        MOCK_METHOD(void, DebitAsync, (int, int, AsyncBankOperations::DebitCallback), (override));
+};
+
+#endif
@@ -0,0 +1,81 @@
+#ifndef TRACEEXPECTATIONS_HPP
+#define TRACEEXPECTATIONS_HPP
+
+#include "BankServerTrace.hpp"
+#include "MockBankServer.hpp"
+#include <gmock/gmock.h>
+#include <stdexcept>
+
+/*
+    expect_trace function:
+
+    Builds the expectations of a MockBankServer from a recorded trace: every record becomes an
+    EXPECT_CALL with the same arguments, in sequence, that returns the recorded value (or throws
+    a std::runtime_error if the recorded call failed).
+
+    With it, a bug seen in production can be turned into a test: record the calls, and check
+    that the AtmMachine does exactly the same calls against the mock.
+
+        TraceReader trace("bug.trace");
+        MockBankServer mock_bankserver;
+        expect_trace(mock_bankserver, trace);
+
+    Notice that: The trace must outlive the mock, or at least the end of the test.
+    To get the same expectations written as C++ code, use the atm_trace tool (folder "tools").
+*/
+
+inline void expect_trace(MockBankServer& mock_bankserver, const TraceReader& trace)
+{
+    using ::testing::Return;
+    using ::testing::Throw;
+
+    ::testing::InSequence seq;
+    for(const TraceRecord& record : trace)
+    {
+        std::runtime_error recorded_error(std::string("recorded ") + to_string(record.method) + " error");
+
+        // The void functions can only fail, the other ones fail or return the recorded value
+        auto may_fail = [&](auto& expectation) 
+        {
+            if(record.failed)
+            {
+                expectation.WillOnce(Throw(recorded_error));
+            }
+        };
+        auto returns = [&](auto& expectation) 
+        {
+            if(record.failed)
+            {
+                expectation.WillOnce(Throw(recorded_error));
+            }
+            else
+            {
+                expectation.WillOnce(Return(record.result));
+            }
+        };
+
+        switch(record.method)
+        {
+            case TraceMethod::Connect:
+                may_fail(EXPECT_CALL(mock_bankserver, Connect()));
+                break;
+            case TraceMethod::Disconnect:
+                may_fail(EXPECT_CALL(mock_bankserver, Disconnect()));
+                break;
+            case TraceMethod::Credit:
+                may_fail(EXPECT_CALL(mock_bankserver, Credit(record.account_number, record.value1)));
+                break;
+            case TraceMethod::Debit:
+                may_fail(EXPECT_CALL(mock_bankserver, Debit(record.account_number, record.value1)));
+                break;
+            case TraceMethod::DoubleTransaction:
+                returns(EXPECT_CALL(mock_bankserver, DoubleTransaction(record.account_number, record.value1, record.value2)));
+                break;
+            case TraceMethod::GetBalance:
+                returns(EXPECT_CALL(mock_bankserver, GetBalance(record.account_number)));
+                break;
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,384 @@
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+#include "MockBankServer.hpp"
+#include "AtmMachine.hpp"
+#include "ResilientBankServer.hpp"
+#include <atomic>
+#include <chrono>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+using ::testing::Invoke;
+using ::testing::NiceMock;
+using ::testing::Return;
+using ::testing::Throw;
+using ::testing::_;
+
+namespace
+{
+    // A server call that takes some time
+    auto slow_balance(std::chrono::milliseconds delay, int balance)
+    {
+        return Invoke([delay, balance](int)
+        {
+            std::this_thread::sleep_for(delay);
+            return balance;
+        });
+    }
+
+    std::chrono::milliseconds elapsed_since(std::chrono::steady_clock::time_point start)
+    {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+    }
+}
+
+//--------------------------------------------------------------------------------------------------
+// DEADLINES
+TEST(ResilientBankServer, ForwardsTheCalls)
+{
+    // Arrange
+    NiceMock<MockBankServer> mock_bankserver;
+
+    // Expectations
+    EXPECT_CALL(mock_bankserver, Connect()).Times(1);
+    EXPECT_CALL(mock_bankserver, GetBalance(1234)).Times(1).WillOnce(Return(1000));
+    EXPECT_CALL(mock_bankserver, Debit(1234, 100)).Times(1);
+    EXPECT_CALL(mock_bankserver, DoubleTransaction(1234, 10, 2)).Times(1).WillOnce(Return(888));
+
+    // Acts
+    ResilientBankServer resilient(&mock_bankserver);
+    resilient.Connect();
+    EXPECT_EQ(resilient.GetBalance(1234), 1000);
+    resilient.Debit(1234, 100);
+    EXPECT_EQ(resilient.DoubleTransaction(1234, 10, 2), 888);
+
+    // Asserts
+    ResilienceStats stats = resilient.Stats();
+    EXPECT_EQ(stats.calls, 4u);
+    EXPECT_EQ(stats.failures, 0u);
+    EXPECT_EQ(stats.state, CircuitState::Closed);
+    EXPECT_EQ(resilient.latencies(AtmOperation::GetBalance).recorded(), 1u);
+}
+
+// The client does not wait for a slow call after its deadline, and in a single session the
+// calls queued behind it are never sent
+TEST(ResilientBankServer, DeadlineExceeded)
+{
+    // Arrange
+    NiceMock<MockBankServer> mock_bankserver;
+    ResiliencePolicy policy;
+    policy.initial_timeout = std::chrono::milliseconds(20);
+    policy.caller_threads = 1;
+
+    // Expectations
+    EXPECT_CALL(mock_bankserver, GetBalance(1234)).Times(1).WillOnce(slow_balance(std::chrono::milliseconds(500), 1000));
+    EXPECT_CALL(mock_bankserver, Debit(_, _)).Times(0);
+
+    // Acts & Asserts
+    ResilientBankServer resilient(&mock_bankserver, policy);
+    auto start = std::chrono::steady_clock::now();
+    try
+    {
+        resilient.GetBalance(1234);
+        FAIL() << "DeadlineExceeded expected";
+    }
+    catch(const DeadlineExceeded& e)
+    {
+        EXPECT_EQ(e.operation(), AtmOperation::GetBalance);
+        EXPECT_EQ(e.timeout(), std::chrono::milliseconds(20));
+        EXPECT_TRUE(e.sent());
+    }
+    try
+    {
+        resilient.Debit(1234, 100);
+        FAIL() << "DeadlineExceeded expected";
+    }
+    catch(const DeadlineExceeded& e)
+    {
+        EXPECT_FALSE(e.sent());
+    }
+    EXPECT_LT(elapsed_since(start), std::chrono::milliseconds(400));
+    EXPECT_EQ(resilient.Stats().deadlines_exceeded, 2u);
+}
+
+// The clients sharing the decorator do not queue behind each other's calls
+TEST(ResilientBankServer, ConcurrentClients)
+{
+    // Arrange: serialized, the last calls would exceed the deadline
+    NiceMock<MockBankServer> mock_bankserver;
+    ResiliencePolicy policy;
+    policy.initial_timeout = std::chrono::milliseconds(200);
+    policy.failure_threshold = 1;
+    ON_CALL(mock_bankserver, GetBalance(_)).WillByDefault(slow_balance(std::chrono::milliseconds(50), 1000));
+    ResilientBankServer resilient(&mock_bankserver, policy);
+
+    // Acts
+    std::atomic<int> answered(0);
+    std::vector<std::thread> clients;
+    for(std::size_t i = 0; i < policy.caller_threads; ++i)
+    {
+        clients.emplace_back([&]()
+        {
+            if(resilient.GetBalance(1234) == 1000)
+            {
+                answered++;
+            }
+        });
+    }
+    for(auto& client : clients)
+    {
+        client.join();
+    }
+
+    // Asserts
+    EXPECT_EQ(answered.load(), static_cast<int>(policy.caller_threads));
+    EXPECT_EQ(resilient.Stats().deadlines_exceeded, 0u);
+    EXPECT_EQ(resilient.state(), CircuitState::Closed);
+}
+
+// In a single session, the wait behind the call of another client does not count against the
+// deadline of the call
+TEST(ResilientBankServer, QueueWaitIsNotPartOfTheDeadline)
+{
+    // Arrange
+    NiceMock<MockBankServer> mock_bankserver;
+    ResiliencePolicy policy;
+    policy.initial_timeout = std::chrono::milliseconds(150);
+    policy.failure_threshold = 1;
+    policy.caller_threads = 1;
+    ON_CALL(mock_bankserver, GetBalance(_)).WillByDefault(slow_balance(std::chrono::milliseconds(100), 1000));
+    ResilientBankServer resilient(&mock_bankserver, policy);
+
+    // Acts: the second call waits about 100 ms for the first one, and then it takes 100 ms
+    std::thread first([&]() { EXPECT_EQ(resilient.GetBalance(1), 1000); });
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    EXPECT_EQ(resilient.GetBalance(2), 1000);
+    first.join();
+
+    // Asserts
+    EXPECT_EQ(resilient.state(), CircuitState::Closed);
+}
+
+//--------------------------------------------------------------------------------------------------
+// ADAPTIVE TIMEOUTS
+TEST(ResilientBankServer, TimeoutsFollowTheLatencies)
+{
+    // Arrange
+    NiceMock<MockBankServer> mock_bankserver;
+    ResiliencePolicy policy;
+    policy.latency_window = 16;
+    policy.min_samples = 16;
+    policy.failure_threshold = 1000;
+    ResilientBankServer resilient(&mock_bankserver, policy);
+
+    // Acts: a fast server
+    ON_CALL(mock_bankserver, GetBalance(_)).WillByDefault(Return(1000));
+    EXPECT_EQ(resilient.timeout(AtmOperation::GetBalance), policy.initial_timeout);
+    for(int i = 0; i < 16; ++i)
+    {
+        resilient.GetBalance(1234);
+    }
+
+    // Asserts: every operation has its own timeout
+    EXPECT_LT(resilient.timeout(AtmOperation::GetBalance), std::chrono::milliseconds(100));
+    EXPECT_EQ(resilient.timeout(AtmOperation::Debit), policy.initial_timeout);
+
+    // Acts: the server becomes slower. Some calls exceed the deadline, until their latencies
+    // raise the timeout.
+    ON_CALL(mock_bankserver, GetBalance(_)).WillByDefault(slow_balance(std::chrono::milliseconds(5), 1000));
+    for(int i = 0; i < 200 && resilient.latencies(AtmOperation::GetBalance).percentile(0.0) < std::chrono::milliseconds(5); ++i)
+    {
+        try
+        {
+            resilient.GetBalance(1234);
+        }
+        catch(const DeadlineExceeded&)
+        {
+        }
+    }
+
+    // Asserts
+    EXPECT_GE(resilient.timeout(AtmOperation::GetBalance), std::chrono::milliseconds(15));
+    EXPECT_EQ(resilient.GetBalance(1234), 1000);
+}
+
+TEST(ResilientBankServer, MaxTimeoutPerOperation)
+{
+    NiceMock<MockBankServer> mock_bankserver;
+    ResilientBankServer resilient(&mock_bankserver);
+
+    resilient.set_max_timeout(AtmOperation::Connect, std::chrono::milliseconds(10));
+
+    EXPECT_EQ(resilient.timeout(AtmOperation::Connect), std::chrono::milliseconds(10));
+    EXPECT_EQ(resilient.timeout(AtmOperation::GetBalance), ResiliencePolicy().initial_timeout);
+}
+
+//--------------------------------------------------------------------------------------------------
+// CIRCUIT BREAKER
+TEST(ResilientBankServer, CircuitOpensAndFailsFast)
+{
+    // Arrange
+    NiceMock<MockBankServer> mock_bankserver;
+    ResiliencePolicy policy;
+    policy.failure_threshold = 3;
+    policy.open_duration = std::chrono::seconds(10);
+
+    // Expectations: only the calls before the circuit opens reach the server
+    EXPECT_CALL(mock_bankserver, GetBalance(_)).Times(3).WillRepeatedly(Throw(std::runtime_error("connection lost")));
+
+    // Acts
+    ResilientBankServer resilient(&mock_bankserver, policy);
+    for(int i = 0; i < 3; ++i)
+    {
+        EXPECT_THROW(resilient.GetBalance(1234), std::runtime_error);
+    }
+    try
+    {
+        resilient.GetBalance(1234);
+        FAIL() << "CircuitOpen expected";
+    }
+    catch(const CircuitOpen& e)
+    {
+        EXPECT_EQ(e.operation(), AtmOperation::GetBalance);
+        EXPECT_GT(e.retry_after(), std::chrono::seconds(5));
+    }
+
+    // Asserts
+    ResilienceStats stats = resilient.Stats();
+    EXPECT_EQ(stats.state, CircuitState::Open);
+    EXPECT_EQ(stats.failures, 3u);
+    EXPECT_EQ(stats.short_circuited, 1u);
+    EXPECT_EQ(stats.circuit_opened, 1u);
+}
+
+// After open_duration one trial call is sent: a failure opens the circuit again, a success
+// closes it
+TEST(ResilientBankServer, HalfOpenTrial)
+{
+    // Arrange
+    NiceMock<MockBankServer> mock_bankserver;
+    ResiliencePolicy policy;
+    policy.failure_threshold = 1;
+    policy.open_duration = std::chrono::milliseconds(50);
+
+    // Expectations
+    EXPECT_CALL(mock_bankserver, GetBalance(_))
+        .Times(3)
+        .WillOnce(Throw(std::runtime_error("connection lost")))
+        .WillOnce(Throw(std::runtime_error("connection lost")))
+        .WillOnce(Return(1000));
+
+    // Acts & Asserts
+    ResilientBankServer resilient(&mock_bankserver, policy);
+    EXPECT_THROW(resilient.GetBalance(1234), std::runtime_error);
+    EXPECT_EQ(resilient.state(), CircuitState::Open);
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(80));
+    EXPECT_THROW(resilient.GetBalance(1234), std::runtime_error);
+    EXPECT_THROW(resilient.GetBalance(1234), CircuitOpen);
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(80));
+    EXPECT_EQ(resilient.GetBalance(1234), 1000);
+    EXPECT_EQ(resilient.state(), CircuitState::Closed);
+    EXPECT_EQ(resilient.Stats().circuit_opened, 2u);
+}
+
+// The server answered, so it is not a failure
+TEST(ResilientBankServer, TransactionRejectedIsNotAFailure)
+{
+    // Arrange
+    NiceMock<MockBankServer> mock_bankserver;
+    ResiliencePolicy policy;
+    policy.failure_threshold = 1;
+
+    // Expectations
+    EXPECT_CALL(mock_bankserver, DoubleTransaction(_, _, _))
+        .Times(2)
+        .WillRepeatedly(Throw(TransactionRejected("not allowed")));
+
+    // Acts & Asserts
+    ResilientBankServer resilient(&mock_bankserver, policy);
+    EXPECT_THROW(resilient.DoubleTransaction(1234, 100, 2), TransactionRejected);
+    EXPECT_THROW(resilient.DoubleTransaction(1234, 100, 2), TransactionRejected);
+    EXPECT_EQ(resilient.state(), CircuitState::Closed);
+    EXPECT_EQ(resilient.Stats().failures, 0u);
+}
+
+// A Disconnect() is sent with the circuit open, and even after waiting longer than its timeout
+// behind a slow call (but its client does not wait for it)
+TEST(ResilientBankServer, DisconnectIsAlwaysSent)
+{
+    // Arrange
+    NiceMock<MockBankServer> mock_bankserver;
+    ResiliencePolicy policy;
+    policy.initial_timeout = std::chrono::milliseconds(20);
+    policy.failure_threshold = 1;
+    policy.open_duration = std::chrono::seconds(10);
+    policy.caller_threads = 1;
+
+    // Expectations
+    EXPECT_CALL(mock_bankserver, GetBalance(1234)).Times(1).WillOnce(slow_balance(std::chrono::milliseconds(200), 1000));
+    EXPECT_CALL(mock_bankserver, Disconnect()).Times(1);
+
+    // Acts & Asserts
+    ResilientBankServer resilient(&mock_bankserver, policy);
+    EXPECT_THROW(resilient.GetBalance(1234), DeadlineExceeded);
+    EXPECT_EQ(resilient.state(), CircuitState::Open);
+    auto start = std::chrono::steady_clock::now();
+    resilient.Disconnect();
+    EXPECT_LT(elapsed_since(start), std::chrono::milliseconds(150));
+    EXPECT_EQ(resilient.state(), CircuitState::Open);
+}
+
+// The client of a Connect() that exceeds its deadline does not own the session, so it is
+// closed if the Connect() succeeds after all
+TEST(ResilientBankServer, AbandonedConnectIsUndone)
+{
+    // Arrange
+    NiceMock<MockBankServer> mock_bankserver;
+    ResiliencePolicy policy;
+    policy.initial_timeout = std::chrono::milliseconds(20);
+
+    // Expectations
+    EXPECT_CALL(mock_bankserver, Connect()).WillOnce(Invoke([]()
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }));
+    EXPECT_CALL(mock_bankserver, Disconnect()).Times(1);
+
+    // Acts & Asserts (the destructor waits for the Connect())
+    ResilientBankServer resilient(&mock_bankserver, policy);
+    EXPECT_THROW(resilient.Connect(), DeadlineExceeded);
+}
+
+//--------------------------------------------------------------------------------------------------
+// ATM MACHINE
+// The withdrawals over a stalled server fail fast instead of waiting for it
+TEST(ResilientBankServer, AtmMachineFailsFast)
+{
+    // Arrange
+    NiceMock<MockBankServer> mock_bankserver;
+    ResiliencePolicy policy;
+    policy.initial_timeout = std::chrono::milliseconds(20);
+    policy.failure_threshold = 1;
+    policy.open_duration = std::chrono::seconds(10);
+
+    // Expectations: the session of the first withdrawal is the only one that reaches the server,
+    // and it is closed even though the circuit is open
+    EXPECT_CALL(mock_bankserver, Connect()).Times(1);
+    EXPECT_CALL(mock_bankserver, GetBalance(1234)).Times(1).WillOnce(slow_balance(std::chrono::milliseconds(500), 1000));
+    EXPECT_CALL(mock_bankserver, Debit(_, _)).Times(0);
+    EXPECT_CALL(mock_bankserver, Disconnect()).Times(1);
+
+    // Acts: the GetBalance exceeds its deadline and opens the circuit
+    ResilientBankServer resilient(&mock_bankserver, policy);
+    AtmMachine atm_machine(&resilient);
+    auto start = std::chrono::steady_clock::now();
+    EXPECT_THROW(atm_machine.withdraw(1234, 100), DeadlineExceeded);
+    EXPECT_THROW(atm_machine.withdraw(1234, 100), CircuitOpen);
+
+    // Asserts
+    EXPECT_LT(elapsed_since(start), std::chrono::milliseconds(400));
+    EXPECT_EQ(resilient.state(), CircuitState::Open);
+}
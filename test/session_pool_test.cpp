@@ -0,0 +1,174 @@
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+#include "MockBankServer.hpp"
+#include "AtmMachine.hpp"
+#include "BankServerSessionPool.hpp"
+#include <exception>
+#include <future>
+#include <stdexcept>
+#include <thread>
+
+using ::testing::NiceMock;
+using ::testing::InSequence;
+using ::testing::Return;
+using ::testing::Throw;
+using ::testing::_;
+
+//--------------------------------------------------------------------------------------------------
+// POOLED SESSIONS
+//
+// With a pool, the session is opened once (lazily or in warm_up()) and it is reused by all 
+// the withdrawals. It is only closed when the pool is destroyed.
+TEST(SessionPool, ConnectOncePerWarmUp)
+{
+    // Arrange
+    NiceMock<MockBankServer> mock_bankserver;
+    ON_CALL(mock_bankserver, GetBalance(_)).WillByDefault(Return(5000));
+
+    // Expectations
+    EXPECT_CALL(mock_bankserver, Connect()).Times(1);
+    EXPECT_CALL(mock_bankserver, Debit(1234, 1000)).Times(3);
+    EXPECT_CALL(mock_bankserver, Disconnect()).Times(1);    // Only when the pool is destroyed
+
+    // Acts
+    {
+        BankServerSessionPool pool({&mock_bankserver});
+        pool.warm_up();
+        AtmMachine atm_machine(&pool);
+        EXPECT_TRUE(atm_machine.withdraw(1234, 1000));
+        EXPECT_TRUE(atm_machine.withdraw(1234, 1000));
+        EXPECT_THAT(atm_machine.withdraw_batch({{1234, 1000}}), ::testing::ElementsAre(true));
+        EXPECT_EQ(pool.live(), 1u);
+    }
+}
+
+TEST(SessionPool, LazyConnect)
+{
+    // Arrange
+    NiceMock<MockBankServer> connection1;
+    NiceMock<MockBankServer> connection2;
+
+    // Expectations: only one session is needed, so the other one is never connected
+    EXPECT_CALL(connection1, Connect()).Times(1);
+    EXPECT_CALL(connection2, Connect()).Times(0);
+
+    // Acts
+    BankServerSessionPool pool({&connection1, &connection2});
+    EXPECT_EQ(pool.live(), 0u);
+    AtmMachine atm_machine(&pool);
+    atm_machine.withdraw(1234, 1000);
+    atm_machine.withdraw(1234, 1000);
+    EXPECT_EQ(pool.live(), 1u);
+}
+
+TEST(SessionPool, Bounded)
+{
+    // Arrange
+    NiceMock<MockBankServer> connection1;
+    NiceMock<MockBankServer> connection2;
+    BankServerSessionPool pool({&connection1, &connection2});
+
+    // Acts and Asserts: there are only 2 sessions to lease
+    auto lease1 = pool.acquire();
+    auto lease2 = pool.acquire();
+    EXPECT_FALSE(pool.try_acquire());
+    EXPECT_NE(lease1.get(), lease2.get());
+
+    // Giving one of them back makes it available again
+    lease1.release();
+    auto lease3 = pool.try_acquire();
+    ASSERT_TRUE(lease3);
+    EXPECT_EQ(lease3.get(), &connection1);
+}
+
+//--------------------------------------------------------------------------------------------------
+// HEALTH CHECKS AND RECONNECTIONS
+TEST(SessionPool, ReconnectWhenHealthCheckFails)
+{
+    // Arrange
+    NiceMock<MockBankServer> mock_bankserver;
+    bool healthy = true;
+    BankServerSessionPool pool({&mock_bankserver}, [&healthy](BankServer&) { return healthy; });
+
+    // Expectations
+    {
+        InSequence seq;
+        EXPECT_CALL(mock_bankserver, Connect());
+        EXPECT_CALL(mock_bankserver, Disconnect());     // The health check has failed
+        EXPECT_CALL(mock_bankserver, Connect());
+        EXPECT_CALL(mock_bankserver, Disconnect());     // The pool is destroyed
+    }
+
+    // Acts
+    AtmMachine atm_machine(&pool);
+    atm_machine.withdraw(1234, 1000);
+    atm_machine.withdraw(1234, 1000);
+    healthy = false;
+    atm_machine.withdraw(1234, 1000);
+}
+
+TEST(SessionPool, InvalidateOnServerException)
+{
+    // Arrange
+    NiceMock<MockBankServer> mock_bankserver;
+
+    // Expectations: the exception during GetBalance() drops the session, so the next
+    // withdrawal connects again
+    EXPECT_CALL(mock_bankserver, Connect()).Times(2);
+    EXPECT_CALL(mock_bankserver, GetBalance(_))
+        .WillOnce(Throw(std::runtime_error("connection reset")))
+        .WillOnce(Return(5000));
+    EXPECT_CALL(mock_bankserver, Disconnect()).Times(2);
+
+    // Acts
+    BankServerSessionPool pool({&mock_bankserver});
+    AtmMachine atm_machine(&pool);
+    EXPECT_THROW(atm_machine.withdraw(1234, 1000), std::runtime_error);
+    EXPECT_EQ(pool.live(), 0u);
+    EXPECT_TRUE(atm_machine.withdraw(1234, 1000));
+}
+
+TEST(SessionPool, FailedConnectReleasesTheSession)
+{
+    // Arrange
+    NiceMock<MockBankServer> mock_bankserver;
+    EXPECT_CALL(mock_bankserver, Connect())
+        .WillOnce(Throw(std::runtime_error("server down")))
+        .WillOnce(Return());
+
+    // Acts and Asserts
+    BankServerSessionPool pool({&mock_bankserver});
+    EXPECT_THROW(pool.acquire(), std::runtime_error);
+    EXPECT_TRUE(pool.try_acquire());
+}
+
+// A slow Disconnect() of an invalidated session does not block the leases of the other ones
+TEST(SessionPool, SlowDisconnectDoesNotBlockTheOtherSessions)
+{
+    // Arrange
+    NiceMock<MockBankServer> connection1;
+    NiceMock<MockBankServer> connection2;
+    std::promise<void> disconnect_started;
+    std::promise<void> finish_disconnect;
+    std::shared_future<void> finish = finish_disconnect.get_future().share();
+    EXPECT_CALL(connection1, Disconnect()).WillOnce(::testing::Invoke([&]()
+    {
+        disconnect_started.set_value();
+        finish.wait();
+    }));
+
+    BankServerSessionPool pool({&connection1, &connection2});
+    BankServerSessionPool::Lease lease = pool.acquire();
+    ASSERT_EQ(lease.get(), &connection1);
+    lease.invalidate();
+
+    // Acts
+    std::thread releaser([&]() { lease.release(); });
+    disconnect_started.get_future().wait();
+    BankServerSessionPool::Lease other = pool.try_acquire();
+
+    // Asserts
+    EXPECT_EQ(other.get(), &connection2);
+    finish_disconnect.set_value();
+    releaser.join();
+}
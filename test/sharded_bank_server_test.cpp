@@ -0,0 +1,245 @@
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+#include "MockBankServer.hpp"
+#include "AtmMachine.hpp"
+#include "InMemoryBankServer.hpp"
+#include "ShardedBankServer.hpp"
+#include <map>
+#include <stdexcept>
+
+using ::testing::NiceMock;
+using ::testing::Return;
+using ::testing::Throw;
+using ::testing::_;
+
+//--------------------------------------------------------------------------------------------------
+// ROUTING
+//
+// Every shard answers GetBalance() with its own id, to know who received each account.
+TEST(ShardedBankServer, EveryAccountGoesToOneShard)
+{
+    // Arrange
+    NiceMock<MockBankServer> shards[3];
+    for(int i = 0; i < 3; ++i)
+    {
+        ON_CALL(shards[i], GetBalance(_)).WillByDefault(Return(i));
+    }
+    ShardedBankServer bankserver({&shards[0], &shards[1], &shards[2]});
+
+    // Acts
+    std::map<int, int> accounts_per_shard;
+    for(int account_number = 0; account_number < 3000; ++account_number)
+    {
+        int shard = bankserver.GetBalance(account_number);
+        accounts_per_shard[shard]++;
+
+        // Asserts: always the same shard, and ShardOf() agrees
+        EXPECT_EQ(bankserver.GetBalance(account_number), shard);
+        EXPECT_EQ(bankserver.ShardOf(account_number), "shard-" + std::to_string(shard));
+    }
+
+    // Asserts: all of them get a fair part of the accounts
+    ASSERT_EQ(accounts_per_shard.size(), 3u);
+    for(const auto& shard : accounts_per_shard)
+    {
+        EXPECT_GT(shard.second, 700);
+        EXPECT_LT(shard.second, 1300);
+    }
+}
+
+TEST(ShardedBankServer, OperationsGoToTheShardOfTheAccount)
+{
+    // Arrange
+    MockBankServer shard0;
+    MockBankServer shard1;
+    ShardedBankServer bankserver({&shard0, &shard1});
+    int account_number = 0;
+    while(bankserver.ShardOf(account_number) != "shard-1")
+    {
+        account_number++;
+    }
+
+    // Expectations: nothing reaches the other shard
+    EXPECT_CALL(shard1, Credit(account_number, 10));
+    EXPECT_CALL(shard1, Debit(account_number, 20));
+    EXPECT_CALL(shard1, DoubleTransaction(account_number, 30, 1)).WillOnce(Return(5));
+    EXPECT_CALL(shard0, Credit(_,_)).Times(0);
+    EXPECT_CALL(shard0, Debit(_,_)).Times(0);
+    EXPECT_CALL(shard0, DoubleTransaction(_,_,_)).Times(0);
+
+    // Acts and Asserts
+    bankserver.Credit(account_number, 10);
+    bankserver.Debit(account_number, 20);
+    EXPECT_EQ(bankserver.DoubleTransaction(account_number, 30, 1), 5);
+}
+
+TEST(ShardedBankServer, NoShards)
+{
+    ShardedBankServer bankserver;
+    EXPECT_THROW(bankserver.GetBalance(1234), std::logic_error);
+}
+
+//--------------------------------------------------------------------------------------------------
+// CONNECT AND DISCONNECT FAN-OUT
+TEST(ShardedBankServer, ConnectAndDisconnectAllTheShards)
+{
+    // Arrange
+    MockBankServer shards[3];
+
+    // Expectations
+    for(auto& shard : shards)
+    {
+        EXPECT_CALL(shard, Connect()).Times(1);
+        EXPECT_CALL(shard, Disconnect()).Times(1);
+    }
+
+    // Acts
+    ShardedBankServer bankserver({&shards[0], &shards[1], &shards[2]});
+    bankserver.Connect();
+    bankserver.Disconnect();
+}
+
+TEST(ShardedBankServer, FailedConnectIsUndone)
+{
+    // Arrange
+    MockBankServer shards[3];
+
+    // Expectations: the second shard fails, so the first one is disconnected again and the 
+    // third one is not even tried
+    EXPECT_CALL(shards[0], Connect());
+    EXPECT_CALL(shards[0], Disconnect());
+    EXPECT_CALL(shards[1], Connect()).WillOnce(Throw(std::runtime_error("unreachable")));
+    EXPECT_CALL(shards[1], Disconnect()).Times(0);
+    EXPECT_CALL(shards[2], Connect()).Times(0);
+
+    // Acts and Asserts
+    ShardedBankServer bankserver({&shards[0], &shards[1], &shards[2]});
+    EXPECT_THROW(bankserver.Connect(), std::runtime_error);
+}
+
+TEST(ShardedBankServer, DisconnectReachesAllTheShardsEvenWithErrors)
+{
+    // Arrange
+    NiceMock<MockBankServer> shards[2];
+
+    // Expectations
+    EXPECT_CALL(shards[0], Disconnect()).WillOnce(Throw(std::runtime_error("broken pipe")));
+    EXPECT_CALL(shards[1], Disconnect());
+
+    // Acts and Asserts
+    ShardedBankServer bankserver({&shards[0], &shards[1]});
+    bankserver.Connect();
+    EXPECT_THROW(bankserver.Disconnect(), std::runtime_error);
+}
+
+//--------------------------------------------------------------------------------------------------
+// REBALANCING
+TEST(ShardedBankServer, AddingAShardOnlyMovesItsAccounts)
+{
+    // Arrange
+    NiceMock<MockBankServer> shards[4];
+    ShardedBankServer bankserver({&shards[0], &shards[1], &shards[2]});
+    std::vector<std::string> before;
+    for(int account_number = 0; account_number < 4000; ++account_number)
+    {
+        before.push_back(bankserver.ShardOf(account_number));
+    }
+
+    // Acts
+    bankserver.AddShard("shard-3", &shards[3]);
+
+    // Asserts: the accounts only move to the new shard, and it takes about 1/4 of them
+    int moved = 0;
+    for(int account_number = 0; account_number < 4000; ++account_number)
+    {
+        std::string after = bankserver.ShardOf(account_number);
+        if(after != before[account_number])
+        {
+            EXPECT_EQ(after, "shard-3");
+            moved++;
+        }
+    }
+    EXPECT_GT(moved, 700);
+    EXPECT_LT(moved, 1300);
+
+    // Acts: and removing it gives them back to their previous shards
+    bankserver.RemoveShard("shard-3");
+    for(int account_number = 0; account_number < 4000; ++account_number)
+    {
+        EXPECT_EQ(bankserver.ShardOf(account_number), before[account_number]);
+    }
+    EXPECT_EQ(bankserver.Shards(), 3u);
+}
+
+TEST(ShardedBankServer, RebalancingWhileConnected)
+{
+    // Arrange
+    NiceMock<MockBankServer> shard0;
+    MockBankServer shard1;
+    ShardedBankServer bankserver({&shard0});
+    bankserver.Connect();
+
+    // Expectations: the new shard is connected when it is added, and disconnected when removed
+    EXPECT_CALL(shard1, Connect());
+    EXPECT_CALL(shard1, Disconnect());
+
+    // Acts
+    bankserver.AddShard("new", &shard1);
+    EXPECT_THROW(bankserver.AddShard("new", &shard1), std::invalid_argument);
+    bankserver.RemoveShard("new");
+    EXPECT_THROW(bankserver.RemoveShard("new"), std::invalid_argument);
+    bankserver.Disconnect();
+}
+
+TEST(ShardedBankServer, RebalancingWithSeveralSessions)
+{
+    // Arrange: two clients have a session, and one of them closes it
+    NiceMock<MockBankServer> shard0;
+    MockBankServer shard1;
+    ShardedBankServer bankserver({&shard0});
+    bankserver.Connect();
+    bankserver.Connect();
+    bankserver.Disconnect();
+
+    // Expectations: the other session is still open, so the new shard is connected
+    EXPECT_CALL(shard1, Connect()).Times(1);
+    EXPECT_CALL(shard1, Disconnect()).Times(1);
+
+    // Acts
+    bankserver.AddShard("new", &shard1);
+    bankserver.Disconnect();
+
+    // The router has no sessions now: nothing to disconnect when it is removed
+    bankserver.RemoveShard("new");
+}
+
+//--------------------------------------------------------------------------------------------------
+// ATM OVER SHARDS
+TEST(ShardedBankServer, AtmMachineOverInMemoryShards)
+{
+    // Arrange
+    InMemoryBankServer backend0(64);
+    InMemoryBankServer backend1(64);
+    ShardedBankServer bankserver({&backend0, &backend1});
+    for(int account_number = 0; account_number < 20; ++account_number)
+    {
+        auto& backend = bankserver.ShardOf(account_number) == "shard-0" ? backend0 : backend1;
+        backend.OpenAccount(account_number, 100);
+    }
+
+    // Acts
+    AtmMachine atm_machine(&bankserver);
+    for(int account_number = 0; account_number < 20; ++account_number)
+    {
+        EXPECT_TRUE(atm_machine.withdraw_with_fee(account_number, 90, 1));
+        EXPECT_FALSE(atm_machine.withdraw(account_number, 10));
+    }
+
+    // Asserts
+    EXPECT_GT(backend0.Accounts(), 0u);
+    EXPECT_GT(backend1.Accounts(), 0u);
+    for(int account_number = 0; account_number < 20; ++account_number)
+    {
+        EXPECT_EQ(bankserver.GetBalance(account_number), 9);
+    }
+}
@@ -0,0 +1,306 @@
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+#include "MockBankServer.hpp"
+#include "TraceExpectations.hpp"
+#include "AtmMachine.hpp"
+#include "BankServerTrace.hpp"
+#include "InMemoryBankServer.hpp"
+#include "RecordingBankServer.hpp"
+#include "TraceReplayer.hpp"
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <stdexcept>
+#include <thread>
+
+using ::testing::Invoke;
+using ::testing::NiceMock;
+using ::testing::Return;
+using ::testing::Throw;
+using ::testing::_;
+
+// Every test uses its own trace file
+static std::string trace_path()
+{
+    return ::testing::TempDir() + ::testing::UnitTest::GetInstance()->current_test_info()->name() + ".trace";
+}
+
+//--------------------------------------------------------------------------------------------------
+// RECORDING
+TEST(Trace, RecordsTheCallsOfAnAtmMachine)
+{
+    // Arrange
+    NiceMock<MockBankServer> mock_bankserver;
+    ON_CALL(mock_bankserver, GetBalance(1234)).WillByDefault(Return(2000));
+    ON_CALL(mock_bankserver, GetBalance(5678)).WillByDefault(Return(10));
+
+    // Acts: one withdrawal that is done and one that is not
+    {
+        TraceWriter writer(trace_path());
+        RecordingBankServer recording(&mock_bankserver, &writer);
+        AtmMachine atm_machine(&recording);
+        EXPECT_TRUE(atm_machine.withdraw(1234, 1000));
+        EXPECT_FALSE(atm_machine.withdraw(5678, 1000));
+        EXPECT_EQ(writer.records(), 7u);
+    }
+
+    // Asserts
+    TraceReader trace(trace_path());
+    ASSERT_EQ(trace.size(), 7u);
+    EXPECT_EQ(trace[0].method, TraceMethod::Connect);
+    EXPECT_EQ(trace[1].method, TraceMethod::GetBalance);
+    EXPECT_EQ(trace[1].account_number, 1234);
+    EXPECT_EQ(trace[1].result, 2000);
+    EXPECT_EQ(trace[2].method, TraceMethod::Debit);
+    EXPECT_EQ(trace[2].account_number, 1234);
+    EXPECT_EQ(trace[2].value1, 1000);
+    EXPECT_EQ(trace[3].method, TraceMethod::Disconnect);
+    EXPECT_EQ(trace[5].method, TraceMethod::GetBalance);
+    EXPECT_EQ(trace[5].result, 10);
+    for(std::size_t i = 1; i < trace.size(); ++i)
+    {
+        EXPECT_GE(trace[i].start_ns, trace[i - 1].start_ns);
+        EXPECT_EQ(trace[i].failed, 0);
+    }
+}
+
+TEST(Trace, RecordsTheFailedCalls)
+{
+    // Arrange
+    NiceMock<MockBankServer> mock_bankserver;
+    EXPECT_CALL(mock_bankserver, GetBalance(1234)).WillOnce(Throw(std::runtime_error("timeout")));
+
+    // Acts
+    {
+        TraceWriter writer(trace_path());
+        RecordingBankServer recording(&mock_bankserver, &writer);
+        recording.Connect();
+        EXPECT_THROW(recording.GetBalance(1234), std::runtime_error);
+    }
+
+    // Asserts
+    TraceReader trace(trace_path());
+    ASSERT_EQ(trace.size(), 2u);
+    EXPECT_EQ(trace[1].method, TraceMethod::GetBalance);
+    EXPECT_EQ(trace[1].failed, 1);
+}
+
+TEST(Trace, TraceErrorsDoNotReachTheClient)
+{
+    // Arrange: a trace that can't be written (every flush fails), flushed in every record
+    NiceMock<MockBankServer> mock_bankserver;
+    ON_CALL(mock_bankserver, GetBalance(1234)).WillByDefault(Return(500));
+    EXPECT_CALL(mock_bankserver, Debit(1234, 100)).WillOnce(Throw(TransactionRejected("limit reached")));
+    TraceWriter writer("/dev/full", 1);
+    RecordingBankServer recording(&mock_bankserver, &writer);
+
+    // Acts and Asserts: the results and the errors are the ones of the server
+    EXPECT_EQ(recording.GetBalance(1234), 500);
+    EXPECT_THROW(recording.Debit(1234, 100), TransactionRejected);
+    EXPECT_EQ(recording.TraceErrors(), 2u);
+}
+
+TEST(Trace, TraceErrorsCountTheWholeBlock)
+{
+    // Arrange: a trace that can't be written, flushed every 4 records
+    NiceMock<MockBankServer> mock_bankserver;
+    ON_CALL(mock_bankserver, GetBalance(1234)).WillByDefault(Return(500));
+    TraceWriter writer("/dev/full", 4);
+    RecordingBankServer recording(&mock_bankserver, &writer);
+
+    // Acts: the 4th call flushes the block and fails
+    for(int i = 0; i < 5; ++i)
+    {
+        EXPECT_EQ(recording.GetBalance(1234), 500);
+    }
+
+    // Asserts: the 4 records of the block are lost, only the last one is still buffered
+    EXPECT_EQ(recording.TraceErrors(), 4u);
+    EXPECT_EQ(writer.dropped(), 4u);
+    EXPECT_EQ(writer.records(), 1u);
+    EXPECT_THROW(writer.flush(), TraceWriteError);
+    EXPECT_EQ(writer.dropped(), 5u);
+}
+
+TEST(Trace, InvalidFiles)
+{
+    EXPECT_THROW(TraceReader{trace_path() + ".missing"}, std::runtime_error);
+
+    {
+        std::ofstream file(trace_path(), std::ios::binary);
+        file << "this is not a trace, but it is long enough for a header";
+    }
+    EXPECT_THROW(TraceReader{trace_path()}, std::runtime_error);
+}
+
+TEST(Trace, IncompleteLastRecordIsIgnored)
+{
+    // Arrange: a trace with 2 records, and a half written one (like after a crash)
+    {
+        TraceWriter writer(trace_path());
+        TraceRecord record{};
+        writer.write(record);
+        writer.write(record);
+    }
+    {
+        std::ofstream file(trace_path(), std::ios::binary | std::ios::app);
+        file << "half a record";
+    }
+
+    // Acts and Asserts
+    TraceReader trace(trace_path());
+    EXPECT_EQ(trace.size(), 2u);
+}
+
+//--------------------------------------------------------------------------------------------------
+// REPLAY
+//
+// The trace of a load against an InMemoryBankServer, replayed against another one with the 
+// same initial balances, must give exactly the same results.
+TEST(Trace, ReplayAgainstABankServer)
+{
+    // Arrange: record some withdrawals (some of them without enough money)
+    {
+        InMemoryBankServer bankserver(256);
+        for(int account_number = 0; account_number < 100; ++account_number)
+        {
+            bankserver.OpenAccount(account_number, 500);
+        }
+        TraceWriter writer(trace_path());
+        RecordingBankServer recording(&bankserver, &writer);
+        AtmMachine atm_machine(&recording);
+        for(int i = 0; i < 1000; ++i)
+        {
+            atm_machine.withdraw_with_fee(i % 100, 40 + i % 7, 1);
+        }
+    }
+    TraceReader trace(trace_path());
+
+    // Acts
+    InMemoryBankServer bankserver(256);
+    for(int account_number = 0; account_number < 100; ++account_number)
+    {
+        bankserver.OpenAccount(account_number, 500);
+    }
+    ReplayStats stats = TraceReplayer(trace).replay(bankserver);
+
+    // Asserts
+    EXPECT_EQ(stats.calls, trace.size());
+    EXPECT_EQ(stats.errors, 0u);
+    EXPECT_EQ(stats.mismatches, 0u);
+    std::cout << "Replayed " << stats.calls << " calls at " << static_cast<long>(stats.calls_per_second()) 
+              << " calls/s" << std::endl;
+
+    // Acts: a replay against a server with other balances does not give the same results
+    InMemoryBankServer poor_bankserver(256);
+    EXPECT_GT(TraceReplayer(trace).replay(poor_bankserver).mismatches, 0u);
+}
+
+TEST(Trace, ReplayAgainstAnAtmMachine)
+{
+    // Arrange
+    {
+        NiceMock<MockBankServer> mock_bankserver;
+        ON_CALL(mock_bankserver, GetBalance(_)).WillByDefault(Return(1000));
+        TraceWriter writer(trace_path());
+        RecordingBankServer recording(&mock_bankserver, &writer);
+        AtmMachine atm_machine(&recording);
+        atm_machine.withdraw(1, 100);
+        atm_machine.withdraw(2, 5000);         // rejected: it can't be rebuilt
+        atm_machine.withdraw_with_fee(3, 200, 2);
+    }
+    TraceReader trace(trace_path());
+
+    // Expectations: the ATM gets the same withdrawals
+    MockBankServer mock_bankserver;
+    EXPECT_CALL(mock_bankserver, Connect()).Times(2);
+    EXPECT_CALL(mock_bankserver, Disconnect()).Times(2);
+    EXPECT_CALL(mock_bankserver, GetBalance(_)).WillRepeatedly(Return(1000));
+    EXPECT_CALL(mock_bankserver, Debit(1, 100));
+    EXPECT_CALL(mock_bankserver, DoubleTransaction(3, 200, 2));
+
+    // Acts and Asserts
+    AtmMachine atm_machine(&mock_bankserver);
+    ReplayStats stats = TraceReplayer(trace).replay(atm_machine);
+    EXPECT_EQ(stats.calls, 2u);
+    EXPECT_EQ(stats.mismatches, 0u);
+}
+
+TEST(Trace, ReplayAtTheRecordedSpeed)
+{
+    // Arrange: 3 calls with 20ms between them
+    {
+        NiceMock<MockBankServer> mock_bankserver;
+        TraceWriter writer(trace_path());
+        RecordingBankServer recording(&mock_bankserver, &writer);
+        for(int i = 0; i < 3; ++i)
+        {
+            recording.GetBalance(i);
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        }
+    }
+    TraceReader trace(trace_path());
+
+    // Acts
+    NiceMock<MockBankServer> mock_bankserver;
+    ReplayStats recorded = TraceReplayer(trace, ReplaySpeed::Recorded).replay(mock_bankserver);
+    ReplayStats maximum = TraceReplayer(trace, ReplaySpeed::Maximum).replay(mock_bankserver);
+
+    // Asserts
+    EXPECT_GE(recorded.elapsed, std::chrono::milliseconds(40));
+    EXPECT_LT(maximum.elapsed, std::chrono::milliseconds(40));
+}
+
+TEST(Trace, ReplayAtTheRecordedSpeedOfSeveralThreads)
+{
+    // Arrange: a call that started before the one recorded before it (it finished later)
+    {
+        TraceWriter writer(trace_path());
+        TraceRecord record{};
+        record.method = TraceMethod::GetBalance;
+        record.start_ns = 30000000;
+        writer.write(record);
+        record.start_ns = 10000000;
+        writer.write(record);
+    }
+    TraceReader trace(trace_path());
+
+    // Acts
+    NiceMock<MockBankServer> mock_bankserver;
+    ReplayStats recorded = TraceReplayer(trace, ReplaySpeed::Recorded).replay(mock_bankserver);
+
+    // Asserts: the earliest start is the time zero (no wait of centuries)
+    EXPECT_EQ(recorded.calls, 2u);
+    EXPECT_GE(recorded.elapsed, std::chrono::milliseconds(20));
+    EXPECT_LT(recorded.elapsed, std::chrono::seconds(5));
+}
+
+//--------------------------------------------------------------------------------------------------
+// EXPECTATIONS FROM A TRACE
+//
+// The recorded calls of an AtmMachine become the expectations of a mock, and the same 
+// AtmMachine actions must satisfy them (including a failed call).
+TEST(Trace, MockExpectationsFromATrace)
+{
+    // Arrange: record a session of a "production" server
+    {
+        NiceMock<MockBankServer> production;
+        EXPECT_CALL(production, GetBalance(1234)).WillRepeatedly(Return(1500));
+        EXPECT_CALL(production, GetBalance(5678)).WillOnce(Throw(std::runtime_error("timeout")));
+        TraceWriter writer(trace_path());
+        RecordingBankServer recording(&production, &writer);
+        AtmMachine atm_machine(&recording);
+        atm_machine.withdraw_batch({{1234, 1000}, {1234, 1000}});
+        EXPECT_THROW(atm_machine.withdraw(5678, 10), std::runtime_error);
+    }
+    TraceReader trace(trace_path());
+
+    // Expectations: built from the trace
+    MockBankServer mock_bankserver;
+    expect_trace(mock_bankserver, trace);
+
+    // Acts and Asserts: the same actions, with the same results
+    AtmMachine atm_machine(&mock_bankserver);
+    EXPECT_EQ(atm_machine.withdraw_batch({{1234, 1000}, {1234, 1000}}), std::vector<bool>({true, true}));
+    EXPECT_THROW(atm_machine.withdraw(5678, 10), std::runtime_error);
+}
@@ -0,0 +1,268 @@
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+#include "MockBankServer.hpp"
+#include "InMemoryBankServer.hpp"
+#include "TransferEngine.hpp"
+#include <atomic>
+#include <random>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+using ::testing::InSequence;
+using ::testing::Return;
+using ::testing::Throw;
+using ::testing::_;
+
+//--------------------------------------------------------------------------------------------------
+// SINGLE TRANSFERS
+
+TEST(TransferEngine, DebitAndCredit)
+{
+    // Arrange
+    MockBankServer mock_bankserver;
+
+    // Expectations
+    {
+        InSequence seq;
+        EXPECT_CALL(mock_bankserver, Connect());
+        EXPECT_CALL(mock_bankserver, GetBalance(1234)).WillOnce(Return(2000));
+        EXPECT_CALL(mock_bankserver, Debit(1234, 1000));
+        EXPECT_CALL(mock_bankserver, Credit(5678, 1000));
+        EXPECT_CALL(mock_bankserver, Disconnect());
+    }
+
+    // Acts and Asserts
+    TransferEngine transfer_engine({&mock_bankserver});
+    EXPECT_TRUE(transfer_engine.transfer(1234, 5678, 1000));
+}
+
+// The value and the fee are debited in a single DoubleTransaction()
+TEST(TransferEngine, FeeWithDoubleTransaction)
+{
+    // Arrange
+    MockBankServer mock_bankserver;
+
+    // Expectations
+    {
+        InSequence seq;
+        EXPECT_CALL(mock_bankserver, Connect());
+        EXPECT_CALL(mock_bankserver, GetBalance(1234)).WillOnce(Return(2000));
+        EXPECT_CALL(mock_bankserver, DoubleTransaction(1234, 1000, 2)).WillOnce(Return(998));
+        EXPECT_CALL(mock_bankserver, Credit(5678, 1000));
+        EXPECT_CALL(mock_bankserver, Disconnect());
+    }
+    EXPECT_CALL(mock_bankserver, Debit(_,_)).Times(0);
+
+    // Acts and Asserts
+    TransferEngine transfer_engine({&mock_bankserver});
+    EXPECT_TRUE(transfer_engine.transfer(1234, 5678, 1000, 2));
+}
+
+TEST(TransferEngine, InsufficientFunds)
+{
+    // Arrange
+    MockBankServer mock_bankserver;
+
+    // Expectations: the value is covered, but not the value plus the fee
+    EXPECT_CALL(mock_bankserver, Connect());
+    EXPECT_CALL(mock_bankserver, GetBalance(1234)).WillOnce(Return(1000));
+    EXPECT_CALL(mock_bankserver, DoubleTransaction(_,_,_)).Times(0);
+    EXPECT_CALL(mock_bankserver, Credit(_,_)).Times(0);
+    EXPECT_CALL(mock_bankserver, Disconnect());
+
+    // Acts and Asserts
+    TransferEngine transfer_engine({&mock_bankserver});
+    EXPECT_FALSE(transfer_engine.transfer(1234, 5678, 1000, 2));
+    EXPECT_THROW(transfer_engine.transfer(1234, 1234, 1000), std::invalid_argument);
+}
+
+// A server with the ConditionalDebit capability checks and debits in one call
+TEST(TransferEngine, TryDebit)
+{
+    // Arrange
+    InMemoryBankServer bankserver(64);
+    bankserver.OpenAccount(1234, 1500);
+
+    // Acts and Asserts
+    TransferEngine transfer_engine({&bankserver});
+    EXPECT_TRUE(transfer_engine.transfer(1234, 5678, 1000));
+    EXPECT_FALSE(transfer_engine.transfer(1234, 5678, 1000));
+    EXPECT_EQ(bankserver.GetBalance(1234), 500);
+    EXPECT_EQ(bankserver.GetBalance(5678), 1000);
+}
+
+// The source is already debited when the credit fails: the caller is told explicitly
+TEST(TransferEngine, CreditFailedAfterTheDebit)
+{
+    // Arrange
+    MockBankServer mock_bankserver;
+
+    // Expectations
+    {
+        InSequence seq;
+        EXPECT_CALL(mock_bankserver, Connect());
+        EXPECT_CALL(mock_bankserver, GetBalance(1234)).WillOnce(Return(2000));
+        EXPECT_CALL(mock_bankserver, Debit(1234, 1000));
+        EXPECT_CALL(mock_bankserver, Credit(5678, 1000)).WillOnce(Throw(TransactionRejected("rejected")));
+        EXPECT_CALL(mock_bankserver, Disconnect());
+    }
+
+    // Acts and Asserts
+    TransferEngine transfer_engine({&mock_bankserver});
+    try
+    {
+        transfer_engine.transfer(1234, 5678, 1000);
+        FAIL() << "TransferCreditFailed expected";
+    }
+    catch(const TransferCreditFailed& error)
+    {
+        EXPECT_EQ(error.from_account_number(), 1234);
+        EXPECT_EQ(error.to_account_number(), 5678);
+        EXPECT_EQ(error.value(), 1000);
+        EXPECT_THROW(std::rethrow_exception(error.cause()), TransactionRejected);
+    }
+}
+
+//--------------------------------------------------------------------------------------------------
+// LOCK ORDERING
+//
+// Many threads move money between the same two accounts in both directions. If the locks were
+// taken in the order of the transfer (source first), this would deadlock.
+TEST(TransferEngine, OppositeDirectionsDontDeadlock)
+{
+    // Arrange
+    InMemoryBankServer bankserver(64);
+    AccountLocks account_locks(1024);
+    bankserver.OpenAccount(1, 1000);
+    bankserver.OpenAccount(2, 1000);
+    ASSERT_NE(account_locks.stripe_of(1), account_locks.stripe_of(2));
+
+    // Acts
+    std::atomic<int> done(0);
+    std::vector<std::thread> threads;
+    for(int t = 0; t < 4; ++t)
+    {
+        threads.emplace_back([&, t]()
+        {
+            TransferEngine transfer_engine({&bankserver}, &account_locks);
+            for(int i = 0; i < 10000; ++i)
+            {
+                bool transferred = t % 2 == 0 ? transfer_engine.transfer(1, 2, 7, 1)
+                                              : transfer_engine.transfer(2, 1, 5, 1);
+                if(transferred)
+                {
+                    done++;
+                }
+            }
+        });
+    }
+    for(auto& thread : threads)
+    {
+        thread.join();
+    }
+
+    // Asserts: the money only leaves the accounts through the fees (1 per transfer done)
+    EXPECT_GT(done.load(), 0);
+    EXPECT_GE(bankserver.GetBalance(1), 0);
+    EXPECT_GE(bankserver.GetBalance(2), 0);
+    EXPECT_EQ(bankserver.GetBalance(1) + bankserver.GetBalance(2), 2000 - done.load());
+}
+
+//--------------------------------------------------------------------------------------------------
+// BATCHES
+
+TEST(TransferEngine, PlanWaves)
+{
+    // Arrange
+    MockBankServer mock_bankserver;
+    AccountLocks account_locks(1 << 16);
+    for(int a = 1; a <= 7; ++a)
+    {
+        for(int b = a + 1; b <= 7; ++b)
+        {
+            ASSERT_NE(account_locks.stripe_of(a), account_locks.stripe_of(b));
+        }
+    }
+
+    // Acts
+    TransferEngine transfer_engine({&mock_bankserver}, &account_locks);
+    auto waves = transfer_engine.plan_waves({{1, 2, 10, 0}, {3, 4, 10, 0}, {2, 5, 10, 0}, {6, 7, 10, 0}, {5, 1, 10, 0}});
+
+    // Asserts: an account is used once per wave, and after its previous transfers
+    EXPECT_THAT(waves, ::testing::ElementsAre(0u, 0u, 1u, 0u, 2u));
+}
+
+// The parallel batch gives the same results as the transfers done one after the other, because
+// the order of the transfers of every account is kept
+TEST(TransferEngine, BatchIsLikeSequential)
+{
+    // Arrange: 2000 random transfers between 50 accounts with little money
+    InMemoryBankServer parallel_bankserver(256);
+    InMemoryBankServer sequential_bankserver(256);
+    for(int account_number = 0; account_number < 50; ++account_number)
+    {
+        parallel_bankserver.OpenAccount(account_number, 100);
+        sequential_bankserver.OpenAccount(account_number, 100);
+    }
+    std::mt19937 random(1234);
+    std::uniform_int_distribution<int> account(0, 49);
+    std::vector<TransferRequest> requests;
+    while(requests.size() < 2000)
+    {
+        int from = account(random);
+        int to = account(random);
+        if(from != to)
+        {
+            requests.push_back(TransferRequest{from, to, 1 + from % 40, (to % 3 == 0) ? 1 : 0});
+        }
+    }
+
+    // Acts
+    TransferEngine parallel_engine({&parallel_bankserver, &parallel_bankserver, &parallel_bankserver, &parallel_bankserver});
+    auto results = parallel_engine.transfer_batch(requests);
+    TransferEngine sequential_engine({&sequential_bankserver});
+
+    // Asserts
+    ASSERT_EQ(results.size(), requests.size());
+    int done = 0;
+    for(std::size_t i = 0; i < requests.size(); ++i)
+    {
+        EXPECT_FALSE(results[i].error);
+        EXPECT_EQ(results[i].done, sequential_engine.transfer(requests[i].from_account_number, requests[i].to_account_number,
+                                                              requests[i].value, requests[i].fee)) << "Transfer " << i;
+        done += results[i].done ? 1 : 0;
+    }
+    for(int account_number = 0; account_number < 50; ++account_number)
+    {
+        EXPECT_EQ(parallel_bankserver.GetBalance(account_number), sequential_bankserver.GetBalance(account_number));
+    }
+    EXPECT_GT(done, 0);
+    EXPECT_LT(done, 2000);
+}
+
+TEST(TransferEngine, BatchErrors)
+{
+    // Arrange
+    MockBankServer mock_bankserver;
+
+    // Expectations: one session for the batch, and the error of a transfer does not stop it
+    EXPECT_CALL(mock_bankserver, Connect());
+    EXPECT_CALL(mock_bankserver, GetBalance(_)).WillRepeatedly(Return(2000));
+    EXPECT_CALL(mock_bankserver, Debit(_,_)).Times(3);
+    EXPECT_CALL(mock_bankserver, Credit(_,_)).Times(2);
+    EXPECT_CALL(mock_bankserver, Credit(5678, 20)).WillOnce(Throw(std::runtime_error("timeout")));
+    EXPECT_CALL(mock_bankserver, Disconnect());
+
+    // Acts
+    TransferEngine transfer_engine({&mock_bankserver});
+    auto results = transfer_engine.transfer_batch({{1234, 5678, 10, 0}, {1234, 5678, 20, 0}, {1234, 5678, 30, 0}});
+
+    // Asserts
+    ASSERT_EQ(results.size(), 3u);
+    EXPECT_TRUE(results[0].done);
+    EXPECT_FALSE(results[1].done);
+    EXPECT_TRUE(results[1].debited);
+    EXPECT_THROW(std::rethrow_exception(results[1].error), TransferCreditFailed);
+    EXPECT_TRUE(results[2].done);
+}
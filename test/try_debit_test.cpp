@@ -0,0 +1,142 @@
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+#include "MockBankServer.hpp"
+#include "AtmMachine.hpp"
+#include "CachingBankServer.hpp"
+#include <chrono>
+
+using ::testing::InSequence;
+using ::testing::Return;
+using ::testing::_;
+
+//--------------------------------------------------------------------------------------------------
+// CONDITIONAL DEBIT PATH
+//
+// When the server supports ConditionalDebit, withdraw() must use only TryDebit(): 
+// no GetBalance() and no Debit() at all.
+TEST(TryDebit, UsedWhenSupported)
+{
+    // Arrange
+    MockConditionalDebitBankServer mock_bankserver;
+
+    // Expectations
+    {
+        InSequence seq;
+        EXPECT_CALL(mock_bankserver, Connect());
+        EXPECT_CALL(mock_bankserver, TryDebit(1234, 1000))
+            .WillOnce(Return(TryDebitResult{true, 1000}));
+        EXPECT_CALL(mock_bankserver, Disconnect());
+    }
+    EXPECT_CALL(mock_bankserver, GetBalance(_)).Times(0);
+    EXPECT_CALL(mock_bankserver, Debit(_,_)).Times(0);
+
+    // Acts and Asserts
+    AtmMachine atm_machine(&mock_bankserver);
+    EXPECT_TRUE(atm_machine.withdraw(1234, 1000));
+}
+
+TEST(TryDebit, RejectedByTheServer)
+{
+    // Arrange
+    MockConditionalDebitBankServer mock_bankserver;
+
+    // Expectations: the server says that the balance (999) does not cover it
+    EXPECT_CALL(mock_bankserver, Connect());
+    EXPECT_CALL(mock_bankserver, TryDebit(1234, 1000))
+        .WillOnce(Return(TryDebitResult{false, 999}));
+    EXPECT_CALL(mock_bankserver, Debit(_,_)).Times(0);
+    EXPECT_CALL(mock_bankserver, Disconnect());
+
+    // Acts and Asserts
+    AtmMachine atm_machine(&mock_bankserver);
+    EXPECT_FALSE(atm_machine.withdraw(1234, 1000));
+}
+
+TEST(TryDebit, UsedInBatches)
+{
+    // Arrange
+    MockConditionalDebitBankServer mock_bankserver;
+
+    // Expectations
+    EXPECT_CALL(mock_bankserver, Connect()).Times(1);
+    EXPECT_CALL(mock_bankserver, TryDebit(_,_))
+        .WillOnce(Return(TryDebitResult{true, 500}))
+        .WillOnce(Return(TryDebitResult{false, 500}));
+    EXPECT_CALL(mock_bankserver, Disconnect()).Times(1);
+
+    // Acts and Asserts
+    AtmMachine atm_machine(&mock_bankserver);
+    EXPECT_THAT(atm_machine.withdraw_batch({{1234, 500}, {1234, 1000}}), ::testing::ElementsAre(true, false));
+}
+
+//--------------------------------------------------------------------------------------------------
+// FALLBACK PATH
+//
+// A server that only implements BankServer keeps the old sequence: GetBalance() then Debit()
+TEST(TryDebit, FallbackWhenNotSupported)
+{
+    // Arrange
+    MockBankServer mock_bankserver;
+
+    // Expectations
+    {
+        InSequence seq;
+        EXPECT_CALL(mock_bankserver, Connect());
+        EXPECT_CALL(mock_bankserver, GetBalance(1234))
+            .WillOnce(Return(2000));
+        EXPECT_CALL(mock_bankserver, Debit(1234, 1000));
+        EXPECT_CALL(mock_bankserver, Disconnect());
+    }
+
+    // Acts and Asserts
+    AtmMachine atm_machine(&mock_bankserver);
+    EXPECT_TRUE(atm_machine.withdraw(1234, 1000));
+}
+
+//--------------------------------------------------------------------------------------------------
+// THROUGH A DECORATOR
+//
+// A decorator has the capability of the server it wraps: the AtmMachine still uses TryDebit()
+TEST(TryDebit, ForwardedByTheDecorators)
+{
+    // Arrange
+    MockConditionalDebitBankServer mock_bankserver;
+    CachingBankServer caching(&mock_bankserver, 16, std::chrono::seconds(60));
+
+    // Expectations
+    {
+        InSequence seq;
+        EXPECT_CALL(mock_bankserver, Connect());
+        EXPECT_CALL(mock_bankserver, TryDebit(1234, 1000))
+            .WillOnce(Return(TryDebitResult{true, 1000}));
+        EXPECT_CALL(mock_bankserver, Disconnect());
+    }
+    EXPECT_CALL(mock_bankserver, GetBalance(_)).Times(0);
+    EXPECT_CALL(mock_bankserver, Debit(_,_)).Times(0);
+
+    // Acts and Asserts
+    AtmMachine atm_machine(&caching);
+    EXPECT_TRUE(atm_machine.withdraw(1234, 1000));
+}
+
+TEST(TryDebit, FallbackThroughTheDecorators)
+{
+    // Arrange
+    MockBankServer mock_bankserver;
+    CachingBankServer caching(&mock_bankserver, 16, std::chrono::seconds(60));
+
+    // Expectations
+    {
+        InSequence seq;
+        EXPECT_CALL(mock_bankserver, Connect());
+        EXPECT_CALL(mock_bankserver, GetBalance(1234))
+            .WillOnce(Return(2000));
+        EXPECT_CALL(mock_bankserver, Debit(1234, 1000));
+        EXPECT_CALL(mock_bankserver, Disconnect());
+    }
+
+    // Acts and Asserts
+    EXPECT_EQ(conditional_debit_of(&caching), nullptr);
+    AtmMachine atm_machine(&caching);
+    EXPECT_TRUE(atm_machine.withdraw(1234, 1000));
+}
@@ -0,0 +1,280 @@
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+#include "MockBankServer.hpp"
+#include "AtmMachine.hpp"
+#include "AccountLocks.hpp"
+#include "AtmInstrumentation.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <map>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+using ::testing::AnyNumber;
+using ::testing::NiceMock;
+using ::testing::InSequence;
+using ::testing::Invoke;
+using ::testing::Return;
+using ::testing::_;
+
+//--------------------------------------------------------------------------------------------------
+// ASYNCHRONOUS (PIPELINED) WITHDRAWALS
+//
+// The mock does not complete the operations: it saves the completion callbacks in a list of
+// pending operations, and the test completes them later in the order it wants (out of order). 
+// The mock balances are in a map, so the results depend on the order of the operations.
+class AsyncWithdraw : public ::testing::Test
+{
+    public:
+        void SetUp() override
+        {
+            ON_CALL(m_mock_bankserver, GetBalanceAsync(_,_))
+                .WillByDefault(Invoke([this](int account_number, AsyncBankOperations::BalanceCallback on_balance) 
+                {
+                    m_pending.push_back([this, account_number, on_balance]() 
+                    { 
+                        on_balance(nullptr, m_balances[account_number]); 
+                    });
+                    m_max_pending = std::max(m_max_pending, m_pending.size());
+                }));
+            ON_CALL(m_mock_bankserver, DebitAsync(_,_,_))
+                .WillByDefault(Invoke([this](int account_number, int value, AsyncBankOperations::DebitCallback on_debit) 
+                {
+                    m_pending.push_back([this, account_number, value, on_debit]() 
+                    { 
+                        m_balances[account_number] -= value;
+                        on_debit(nullptr); 
+                    });
+                    m_max_pending = std::max(m_max_pending, m_pending.size());
+                }));
+        }
+
+        // Complete the pending operations, always the newest first (reverse order), until
+        // there is nothing else to complete
+        void complete_newest_first()
+        {
+            while(!m_pending.empty())
+            {
+                auto operation = m_pending.back();
+                m_pending.pop_back();
+                operation();
+            }
+        }
+
+        void withdraw_async(AtmMachine& atm_machine, const std::vector<WithdrawRequest>& requests, std::size_t max_in_flight)
+        {
+            m_results.assign(requests.size(), -1);
+            atm_machine.withdraw_async(requests,
+                [this](std::size_t index, bool result, std::exception_ptr error)
+                {
+                    m_results[index] = result ? 1 : 0;
+                    if(error)
+                    {
+                        m_errors++;
+                    }
+                },
+                [this](std::exception_ptr)
+                {
+                    m_done++;
+                },
+                max_in_flight);
+        }
+
+        NiceMock<MockAsyncBankServer> m_mock_bankserver;
+        std::map<int, int> m_balances;
+        std::vector<std::function<void()>> m_pending;
+        std::size_t m_max_pending = 0;
+        std::vector<int> m_results;
+        int m_errors = 0;
+        int m_done = 0;
+};
+
+TEST_F(AsyncWithdraw, OutOfOrderCompletions)
+{
+    // Arrange: 3 accounts with money, one without
+    m_balances = {{1, 1000}, {2, 1000}, {3, 1000}, {4, 0}};
+
+    // Expectations: one session only, and no synchronous calls at all
+    EXPECT_CALL(m_mock_bankserver, Connect()).Times(1);
+    EXPECT_CALL(m_mock_bankserver, GetBalance(_)).Times(0);
+    EXPECT_CALL(m_mock_bankserver, Debit(_,_)).Times(0);
+    EXPECT_CALL(m_mock_bankserver, GetBalanceAsync(_,_)).Times(4);
+    EXPECT_CALL(m_mock_bankserver, DebitAsync(_,_,_)).Times(3);
+    EXPECT_CALL(m_mock_bankserver, Disconnect()).Times(1);
+
+    // Acts
+    AtmMachine atm_machine(&m_mock_bankserver);
+    withdraw_async(atm_machine, {{1, 500}, {2, 500}, {3, 500}, {4, 500}}, 16);
+
+    // It returns before anything is completed: all the balance requests are in flight
+    EXPECT_EQ(m_pending.size(), 4u);
+    EXPECT_EQ(m_done, 0);
+
+    complete_newest_first();
+
+    // Asserts
+    EXPECT_THAT(m_results, ::testing::ElementsAre(1, 1, 1, 0));
+    EXPECT_EQ(m_balances[1], 500);
+    EXPECT_EQ(m_balances[4], 0);
+    EXPECT_EQ(m_done, 1);
+    EXPECT_EQ(m_errors, 0);
+}
+
+TEST_F(AsyncWithdraw, BoundedQueueDepth)
+{
+    // Arrange
+    for(int account_number = 0; account_number < 100; ++account_number)
+    {
+        m_balances[account_number] = 1000;
+    }
+    std::vector<WithdrawRequest> requests;
+    for(int account_number = 0; account_number < 100; ++account_number)
+    {
+        requests.push_back({account_number, 100});
+    }
+
+    // Acts: no more than 8 operations can be pending at the same time
+    AtmMachine atm_machine(&m_mock_bankserver);
+    withdraw_async(atm_machine, requests, 8);
+    EXPECT_EQ(m_pending.size(), 8u);
+    complete_newest_first();
+
+    // Asserts
+    EXPECT_EQ(m_max_pending, 8u);
+    EXPECT_EQ(std::count(m_results.begin(), m_results.end(), 1), 100);
+    EXPECT_EQ(m_done, 1);
+}
+
+TEST_F(AsyncWithdraw, SameAccountIsNotOverdrawn)
+{
+    // Arrange: only 2 of the 3 withdrawals can be done
+    m_balances = {{1234, 1000}};
+
+    // Acts: even with the completions out of order, the withdrawals of the same account
+    // can't be in flight at the same time
+    AtmMachine atm_machine(&m_mock_bankserver);
+    withdraw_async(atm_machine, {{1234, 400}, {1234, 400}, {1234, 400}}, 16);
+    EXPECT_EQ(m_pending.size(), 1u);
+    complete_newest_first();
+
+    // Asserts: in order, the first two ones
+    EXPECT_THAT(m_results, ::testing::ElementsAre(1, 1, 0));
+    EXPECT_EQ(m_balances[1234], 200);
+}
+
+TEST_F(AsyncWithdraw, ErrorsArePerWithdrawal)
+{
+    // Arrange
+    m_balances = {{1, 1000}, {2, 1000}};
+    EXPECT_CALL(m_mock_bankserver, GetBalanceAsync(_,_))
+        .Times(AnyNumber());                                    // The ON_CALL behaviour
+    EXPECT_CALL(m_mock_bankserver, GetBalanceAsync(2,_))        // But this one fails
+        .WillOnce(Invoke([](int, AsyncBankOperations::BalanceCallback on_balance) 
+        {
+            on_balance(std::make_exception_ptr(std::runtime_error("timeout")), 0);
+        }));
+
+    // Acts
+    AtmMachine atm_machine(&m_mock_bankserver);
+    withdraw_async(atm_machine, {{1, 100}, {2, 100}}, 16);
+    complete_newest_first();
+
+    // Asserts
+    EXPECT_THAT(m_results, ::testing::ElementsAre(1, 0));
+    EXPECT_EQ(m_errors, 1);
+    EXPECT_EQ(m_done, 1);
+}
+
+// The outcomes of the pipelined withdrawals are counted like the synchronous ones
+TEST_F(AsyncWithdraw, OutcomesAreInstrumented)
+{
+    // Arrange
+    m_balances = {{1, 1000}, {2, 0}};
+    AtmInstrumentation instrumentation;
+
+    // Acts
+    AtmMachine atm_machine(&m_mock_bankserver);
+    atm_machine.set_instrumentation(&instrumentation);
+    withdraw_async(atm_machine, {{1, 500}, {1, 500}, {2, 500}}, 16);
+    complete_newest_first();
+
+    // Asserts
+    InstrumentationSnapshot snapshot = instrumentation.snapshot();
+    EXPECT_EQ(snapshot[WithdrawOutcome::Success], ATM_INSTRUMENTATION ? 2u : 0u);
+    EXPECT_EQ(snapshot[WithdrawOutcome::InsufficientFunds], ATM_INSTRUMENTATION ? 1u : 0u);
+}
+
+//--------------------------------------------------------------------------------------------------
+// SYNCHRONOUS SERVERS
+//
+// With a server that is not asynchronous, it works as withdraw_batch()
+TEST(AsyncWithdrawFallback, SynchronousServer)
+{
+    // Arrange
+    MockBankServer mock_bankserver;
+
+    // Expectations
+    {
+        InSequence seq;
+        EXPECT_CALL(mock_bankserver, Connect());
+        EXPECT_CALL(mock_bankserver, GetBalance(1234)).WillOnce(Return(1000));
+        EXPECT_CALL(mock_bankserver, Debit(1234, 1000));
+        EXPECT_CALL(mock_bankserver, GetBalance(5678)).WillOnce(Return(0));
+        EXPECT_CALL(mock_bankserver, Disconnect());
+    }
+
+    // Acts
+    std::vector<int> results(2, -1);
+    bool done = false;
+    AtmMachine atm_machine(&mock_bankserver);
+    atm_machine.withdraw_async({{1234, 1000}, {5678, 1000}},
+        [&results](std::size_t index, bool result, std::exception_ptr) { results[index] = result; },
+        [&done](std::exception_ptr) { done = true; });
+
+    // Asserts
+    EXPECT_THAT(results, ::testing::ElementsAre(1, 0));
+    EXPECT_TRUE(done);
+}
+
+// With account locks, two ATMs withdrawing from the same account at the same time can't both
+// pass the balance check: the withdrawals are done holding the lock of the account (so the
+// asynchronous operations are not used)
+TEST(AsyncWithdrawFallback, AccountLocksAcrossAtms)
+{
+    // Arrange: a slow balance check, so both withdrawals would be checking it at the same time
+    NiceMock<MockAsyncBankServer> mock_bankserver;
+    std::atomic<int> balance(1000);
+    ON_CALL(mock_bankserver, GetBalance(1234)).WillByDefault(Invoke([&balance](int)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        return balance.load();
+    }));
+    ON_CALL(mock_bankserver, Debit(1234, _)).WillByDefault(Invoke([&balance](int, int value) { balance -= value; }));
+
+    // Expectations
+    EXPECT_CALL(mock_bankserver, GetBalanceAsync(_, _)).Times(0);
+    EXPECT_CALL(mock_bankserver, DebitAsync(_, _, _)).Times(0);
+
+    // Acts
+    AccountLocks account_locks;
+    AtmMachine atm_machine1(&mock_bankserver, &account_locks);
+    AtmMachine atm_machine2(&mock_bankserver, &account_locks);
+    std::atomic<int> successes(0);
+    auto withdraw = [&successes](AtmMachine& atm_machine)
+    {
+        atm_machine.withdraw_async({{1234, 700}},
+            [&successes](std::size_t, bool result, std::exception_ptr) { successes += result ? 1 : 0; },
+            nullptr);
+    };
+    std::thread atm1(withdraw, std::ref(atm_machine1));
+    std::thread atm2(withdraw, std::ref(atm_machine2));
+    atm1.join();
+    atm2.join();
+
+    // Asserts
+    EXPECT_EQ(successes, 1);
+    EXPECT_EQ(balance, 300);
+}
\ No newline at end of file
@@ -0,0 +1,116 @@
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+#include "MockBankServer.hpp"
+#include "AtmMachine.hpp"
+
+using ::testing::NiceMock;
+using ::testing::InSequence;
+using ::testing::Invoke;
+using ::testing::Return;
+using ::testing::_;
+
+//--------------------------------------------------------------------------------------------------
+// BATCHED WITHDRAWALS
+//
+// withdraw_batch() must open only one session for all the requests, and it must return
+// the result of every request in the same position it was received.
+TEST(AtmMachineBatch, OneSessionForTheWholeBatch)
+{
+    // Arrange
+    MockBankServer mock_bankserver;
+
+    // Expectations: one Connect() at the beginning, one Disconnect() at the end
+    {
+        InSequence seq;
+        EXPECT_CALL(mock_bankserver, Connect()).Times(1);
+        EXPECT_CALL(mock_bankserver, GetBalance(_)).Times(3).WillRepeatedly(Return(5000));
+        EXPECT_CALL(mock_bankserver, Disconnect()).Times(1);
+    }
+    EXPECT_CALL(mock_bankserver, Debit(_,_)).Times(3);
+
+    // Acts
+    AtmMachine atm_machine(&mock_bankserver);
+    std::vector<bool> results = atm_machine.withdraw_batch({{1234, 1000}, {5678, 2000}, {1234, 500}});
+
+    // Asserts
+    EXPECT_THAT(results, ::testing::ElementsAre(true, true, true));
+}
+
+TEST(AtmMachineBatch, PerItemResults)
+{
+    // Arrange
+    NiceMock<MockBankServer> mock_bankserver;
+    ON_CALL(mock_bankserver, GetBalance(1234)).WillByDefault(Return(5000));
+    ON_CALL(mock_bankserver, GetBalance(5678)).WillByDefault(Return(100));
+
+    // Expectations: the second one has not enough balance, so only 2 debits
+    EXPECT_CALL(mock_bankserver, Debit(1234, 1000)).Times(1);
+    EXPECT_CALL(mock_bankserver, Debit(5678, _)).Times(0);
+    EXPECT_CALL(mock_bankserver, Debit(1234, 4000)).Times(1);
+
+    // Acts
+    AtmMachine atm_machine(&mock_bankserver);
+    std::vector<bool> results = atm_machine.withdraw_batch({{1234, 1000}, {5678, 2000}, {1234, 4000}});
+
+    // Asserts
+    EXPECT_THAT(results, ::testing::ElementsAre(true, false, true));
+}
+
+TEST(AtmMachineBatch, EmptyBatchDoesNotConnect)
+{
+    // Arrange
+    MockBankServer mock_bankserver;
+
+    // Expectations
+    EXPECT_CALL(mock_bankserver, Connect()).Times(0);
+    EXPECT_CALL(mock_bankserver, Disconnect()).Times(0);
+
+    // Acts and Asserts
+    AtmMachine atm_machine(&mock_bankserver);
+    EXPECT_TRUE(atm_machine.withdraw_batch({}).empty());
+}
+
+//--------------------------------------------------------------------------------------------------
+// ROUND-TRIPS PER WITHDRAWAL
+//
+// Let's count every call that reaches the bankserver (every call is a round-trip with a real
+// server) using Invoke() and compare the single-call path with the batched one.
+class RoundTripCounter : public ::testing::Test
+{
+    public:
+        void SetUp() override
+        {
+            m_round_trips = 0;
+            ON_CALL(m_mock_bankserver, Connect).WillByDefault(Invoke([this]() { ++m_round_trips; }));
+            ON_CALL(m_mock_bankserver, Disconnect).WillByDefault(Invoke([this]() { ++m_round_trips; }));
+            ON_CALL(m_mock_bankserver, Debit).WillByDefault(Invoke([this](int, int) { ++m_round_trips; }));
+            ON_CALL(m_mock_bankserver, GetBalance).WillByDefault(Invoke([this](int) { ++m_round_trips; return 1000000; }));
+        }
+
+        NiceMock<MockBankServer> m_mock_bankserver;
+        int m_round_trips;
+        const int m_withdrawals = 100;
+};
+TEST_F(RoundTripCounter, SingleVsBatch)
+{
+    AtmMachine atm_machine(&m_mock_bankserver);
+
+    // Single-call path
+    for(int i = 0; i < m_withdrawals; ++i)
+    {
+        atm_machine.withdraw(1234, 10);
+    }
+    const double single_round_trips = static_cast<double>(m_round_trips) / m_withdrawals;
+
+    // Batched path
+    m_round_trips = 0;
+    std::vector<WithdrawRequest> requests(m_withdrawals, WithdrawRequest{1234, 10});
+    atm_machine.withdraw_batch(requests);
+    const double batch_round_trips = static_cast<double>(m_round_trips) / m_withdrawals;
+
+    std::cout << "Round-trips per withdrawal: single = " << single_round_trips 
+              << ", batch = " << batch_round_trips << std::endl;
+
+    EXPECT_DOUBLE_EQ(single_round_trips, 4.0);              // Connect + GetBalance + Debit + Disconnect
+    EXPECT_DOUBLE_EQ(batch_round_trips, 2.0 + 2.0 / m_withdrawals); // Only GetBalance + Debit per item
+}
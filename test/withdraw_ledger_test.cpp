@@ -0,0 +1,284 @@
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+#include "MockBankServer.hpp"
+#include "AtmMachine.hpp"
+#include "WithdrawLedger.hpp"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include <dirent.h>
+#include <unistd.h>
+
+using ::testing::NiceMock;
+using ::testing::Return;
+using ::testing::Throw;
+using ::testing::_;
+
+// Every test uses its own (empty) ledger directory
+static std::string ledger_directory()
+{
+    std::string directory = ::testing::TempDir() + ::testing::UnitTest::GetInstance()->current_test_info()->name() + ".ledger";
+    if(DIR* dir = ::opendir(directory.c_str()))
+    {
+        while(struct dirent* entry = ::readdir(dir))
+        {
+            std::remove((directory + "/" + entry->d_name).c_str());
+        }
+        ::closedir(dir);
+        ::rmdir(directory.c_str());
+    }
+    return directory;
+}
+
+//--------------------------------------------------------------------------------------------------
+// LEDGER FILES
+TEST(WithdrawLedger, AppendRotateAndScan)
+{
+    // Arrange
+    std::string directory = ledger_directory();
+
+    // Acts: 1000 records in segments of 100
+    {
+        WithdrawLedger ledger(directory, 100);
+        for(int i = 0; i < 1000; ++i)
+        {
+            EXPECT_EQ(ledger.append(LedgerOperation::Withdraw, i, 10 * i, 0, WithdrawOutcome::Success), i + 1u);
+        }
+        EXPECT_EQ(ledger.segments(), 10u);
+    }
+
+    // Asserts
+    LedgerScanner scanner(directory);
+    EXPECT_EQ(scanner.segments().size(), 10u);
+    std::uint64_t expected = 1;
+    std::uint64_t scanned = scanner.scan([&](const LedgerRecord& record)
+    {
+        EXPECT_EQ(record.sequence, expected);
+        EXPECT_EQ(record.account_number, static_cast<int>(expected - 1));
+        EXPECT_EQ(record.value, static_cast<int>(10 * (expected - 1)));
+        EXPECT_EQ(record.operation, LedgerOperation::Withdraw);
+        EXPECT_EQ(static_cast<WithdrawOutcome>(record.outcome), WithdrawOutcome::Success);
+        EXPECT_GT(record.timestamp_ns, 0u);
+        expected++;
+    });
+    EXPECT_EQ(scanned, 1000u);
+
+    // From a sequence: the first segments are skipped
+    EXPECT_EQ(scanner.scan([](const LedgerRecord&) {}, 951), 50u);
+}
+
+// A ledger opened again continues the sequence, in a new segment
+TEST(WithdrawLedger, Reopen)
+{
+    // Arrange
+    std::string directory = ledger_directory();
+    {
+        WithdrawLedger ledger(directory, 100);
+        for(int i = 0; i < 150; ++i)
+        {
+            ledger.append(LedgerOperation::Withdraw, 1234, 1, 0, WithdrawOutcome::Success);
+        }
+    }
+
+    // Acts
+    {
+        WithdrawLedger ledger(directory, 100);
+        EXPECT_EQ(ledger.last_sequence(), 150u);
+        EXPECT_EQ(ledger.append(LedgerOperation::WithdrawWithFee, 1234, 1, 2, WithdrawOutcome::InsufficientFunds), 151u);
+    }
+
+    // Asserts
+    LedgerScanner scanner(directory);
+    EXPECT_EQ(scanner.segments().size(), 3u);
+    EXPECT_EQ(LedgerScanner::first_sequence_of(scanner.segments()[2]), 151u);
+    EXPECT_EQ(scanner.scan([](const LedgerRecord&) {}), 151u);
+}
+
+// Many records, and a single msync() for each group of them
+TEST(WithdrawLedger, GroupCommit)
+{
+    // Arrange
+    std::string directory = ledger_directory();
+    WithdrawLedger ledger(directory, 1 << 16, 4096, std::chrono::microseconds(1000000));
+
+    // Acts
+    for(int i = 0; i < 100000; ++i)
+    {
+        ledger.append(LedgerOperation::Withdraw, i, 1, 0, WithdrawOutcome::Success);
+    }
+    ledger.commit();
+
+    // Asserts
+    EXPECT_EQ(ledger.durable_sequence(), 100000u);
+    EXPECT_LE(ledger.commits(), 100000u / 4096 + 4);
+    EXPECT_EQ(ledger.segments(), 2u);
+}
+
+// After a failed msync() nothing is durable anymore, even if the next ones work (the disk may
+// have dropped the failed pages)
+TEST(WithdrawLedger, FailedCommitIsSticky)
+{
+    // Arrange
+    std::string directory = ledger_directory();
+    std::atomic<bool> failing(false);
+    WithdrawLedger ledger(directory, 2, 4096, std::chrono::microseconds(1000), [&failing](char*, std::size_t)
+    {
+        if(failing)
+        {
+            throw std::runtime_error("disk error");
+        }
+    });
+    ledger.append(LedgerOperation::Withdraw, 1, 100, 0, WithdrawOutcome::Success);
+    ledger.commit();
+
+    // Acts: the failed records fill a segment
+    failing = true;
+    ledger.append(LedgerOperation::Withdraw, 2, 100, 0, WithdrawOutcome::Success);
+    ledger.append(LedgerOperation::Withdraw, 3, 100, 0, WithdrawOutcome::Success);
+    EXPECT_THROW(ledger.commit(), std::runtime_error);
+    failing = false;
+    ledger.append(LedgerOperation::Withdraw, 4, 100, 0, WithdrawOutcome::Success);
+
+    // Asserts
+    EXPECT_THROW(ledger.commit(), std::runtime_error);
+    EXPECT_THROW(ledger.wait_durable(2), std::runtime_error);
+    EXPECT_EQ(ledger.durable_sequence(), 1u);
+    ledger.wait_durable(1);
+}
+
+// The committer creates the next segment before the current one is full, and it is not left
+// in the directory if it is never used
+TEST(WithdrawLedger, NextSegmentIsCreatedInAdvance)
+{
+    // Arrange
+    std::string directory = ledger_directory();
+    {
+        WithdrawLedger ledger(directory, 100);
+
+        // Acts: the first segment is full
+        for(int i = 0; i < 100; ++i)
+        {
+            ledger.append(LedgerOperation::Withdraw, 1234, 1, 0, WithdrawOutcome::Success);
+        }
+
+        // Asserts
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+        while(LedgerScanner(directory).segments().size() < 2 && std::chrono::steady_clock::now() < deadline)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        EXPECT_EQ(LedgerScanner(directory).segments().size(), 2u);
+        EXPECT_EQ(ledger.segments(), 1u);
+    }
+    EXPECT_EQ(LedgerScanner(directory).segments().size(), 1u);
+}
+
+// The threads waiting for the disk at the same time share the msync() calls
+TEST(WithdrawLedger, WaitDurableFromManyThreads)
+{
+    // Arrange
+    std::string directory = ledger_directory();
+    WithdrawLedger ledger(directory);
+
+    // Acts
+    std::vector<std::thread> threads;
+    for(int t = 0; t < 4; ++t)
+    {
+        threads.emplace_back([&]()
+        {
+            for(int i = 0; i < 200; ++i)
+            {
+                std::uint64_t sequence = ledger.append(LedgerOperation::Withdraw, i, 1, 0, WithdrawOutcome::Success);
+                ledger.wait_durable(sequence);
+                EXPECT_GE(ledger.durable_sequence(), sequence);
+            }
+        });
+    }
+    for(auto& thread : threads)
+    {
+        thread.join();
+    }
+
+    // Asserts
+    EXPECT_EQ(ledger.durable_sequence(), 800u);
+    EXPECT_LE(ledger.commits(), 800u);
+}
+
+TEST(WithdrawLedger, NotALedger)
+{
+    EXPECT_THROW(LedgerScanner{ledger_directory()}, std::runtime_error);
+    EXPECT_THROW(LedgerSegment{ledger_directory() + "/ledger-00000000000000000001.log"}, std::runtime_error);
+}
+
+//--------------------------------------------------------------------------------------------------
+// ATM HOOK
+TEST(WithdrawLedger, AtmMachineAppendsEveryOutcome)
+{
+    // Arrange
+    std::string directory = ledger_directory();
+    NiceMock<MockBankServer> mock_bankserver;
+    EXPECT_CALL(mock_bankserver, GetBalance(_))
+        .WillOnce(Return(2000))
+        .WillOnce(Return(0))
+        .WillOnce(Throw(std::runtime_error("timeout")))
+        .WillOnce(Return(2000));
+
+    // Acts
+    {
+        WithdrawLedger ledger(directory);
+        AtmMachine atm_machine(&mock_bankserver);
+        atm_machine.set_ledger(&ledger);
+        EXPECT_TRUE(atm_machine.withdraw(1, 100));
+        EXPECT_FALSE(atm_machine.withdraw(2, 100));
+        EXPECT_THROW(atm_machine.withdraw(3, 100), std::runtime_error);
+        EXPECT_TRUE(atm_machine.withdraw_with_fee(4, 100, 2));
+        ledger.commit();
+        EXPECT_EQ(ledger.durable_sequence(), 4u);
+    }
+
+    // Asserts
+    std::vector<LedgerRecord> records;
+    LedgerScanner(directory).scan([&](const LedgerRecord& record) { records.push_back(record); });
+    ASSERT_EQ(records.size(), 4u);
+    EXPECT_EQ(static_cast<WithdrawOutcome>(records[0].outcome), WithdrawOutcome::Success);
+    EXPECT_EQ(static_cast<WithdrawOutcome>(records[1].outcome), WithdrawOutcome::InsufficientFunds);
+    EXPECT_EQ(static_cast<WithdrawOutcome>(records[2].outcome), WithdrawOutcome::Error);
+    EXPECT_EQ(records[3].operation, LedgerOperation::WithdrawWithFee);
+    EXPECT_EQ(records[3].account_number, 4);
+    EXPECT_EQ(records[3].fee, 2);
+}
+
+// The withdrawal result does not depend on the ledger: a segment that can't be created (too
+// big for the file system) loses the records, and they are counted
+TEST(WithdrawLedger, LedgerErrorsDoNotChangeTheResult)
+{
+    // Arrange
+    std::string directory = ledger_directory();
+    NiceMock<MockBankServer> mock_bankserver;
+    EXPECT_CALL(mock_bankserver, GetBalance(_))
+        .WillOnce(Return(2000))
+        .WillOnce(Throw(std::runtime_error("timeout")));
+    WithdrawLedger ledger(directory, std::numeric_limits<std::size_t>::max() / sizeof(LedgerRecord));
+    AtmMachine atm_machine(&mock_bankserver);
+    atm_machine.set_ledger(&ledger);
+
+    // Acts and Asserts: the result and the error are the ones of the server
+    EXPECT_TRUE(atm_machine.withdraw(1, 100));
+    try
+    {
+        atm_machine.withdraw(2, 100);
+        FAIL() << "The error of the server expected";
+    }
+    catch(const std::runtime_error& e)
+    {
+        EXPECT_STREQ(e.what(), "timeout");
+    }
+    EXPECT_EQ(ledger.append_errors(), 2u);
+    EXPECT_EQ(ledger.last_sequence(), 0u);
+    EXPECT_THROW(ledger.append(LedgerOperation::Withdraw, 3, 100, 0, WithdrawOutcome::Success), std::runtime_error);
+}
\ No newline at end of file
@@ -0,0 +1,94 @@
+#include "BankServerTrace.hpp"
+#include <cstring>
+#include <iostream>
+#include <string>
+
+/*
+    atm_trace tool:
+
+    Works with the traces recorded by RecordingBankServer.
+
+        atm_trace dump <trace>                  Prints every record as text
+        atm_trace gmock <trace> [mock_name]     Prints the MockBankServer expectations of the 
+                                                trace as C++ code, to paste it in a test
+*/
+
+namespace
+{
+    void dump(const TraceReader& trace)
+    {
+        std::cout << "# start_ns duration_ns method account value1 value2 result failed\n";
+        for(const TraceRecord& record : trace)
+        {
+            std::cout << record.start_ns << " " << record.duration_ns << " " << to_string(record.method) << " " 
+                      << record.account_number << " " << record.value1 << " " << record.value2 << " " 
+                      << record.result << " " << static_cast<int>(record.failed) << "\n";
+        }
+    }
+
+    std::string call_of(const TraceRecord& record)
+    {
+        std::string account = std::to_string(record.account_number);
+        switch(record.method)
+        {
+            case TraceMethod::Connect:           return "Connect()";
+            case TraceMethod::Disconnect:        return "Disconnect()";
+            case TraceMethod::Credit:            return "Credit(" + account + ", " + std::to_string(record.value1) + ")";
+            case TraceMethod::Debit:             return "Debit(" + account + ", " + std::to_string(record.value1) + ")";
+            case TraceMethod::DoubleTransaction: return "DoubleTransaction(" + account + ", " + std::to_string(record.value1) 
+                                                        + ", " + std::to_string(record.value2) + ")";
+            case TraceMethod::GetBalance:        return "GetBalance(" + account + ")";
+            default:                             return "Unknown()";
+        }
+    }
+
+    void gmock(const TraceReader& trace, const std::string& mock_name)
+    {
+        std::cout << "    // Expectations generated from a trace (" << trace.size() << " calls)\n"
+                  << "    {\n"
+                  << "        InSequence seq;\n";
+        for(const TraceRecord& record : trace)
+        {
+            std::cout << "        EXPECT_CALL(" << mock_name << ", " << call_of(record) << ")";
+            if(record.failed)
+            {
+                std::cout << "\n            .WillOnce(Throw(std::runtime_error(\"recorded " << to_string(record.method) << " error\")))";
+            }
+            else if(record.method == TraceMethod::GetBalance || record.method == TraceMethod::DoubleTransaction)
+            {
+                std::cout << "\n            .WillOnce(Return(" << record.result << "))";
+            }
+            std::cout << ";\n";
+        }
+        std::cout << "    }\n";
+    }
+}
+
+int main(int argc, char** argv)
+{
+    if(argc < 3 || (std::strcmp(argv[1], "dump") != 0 && std::strcmp(argv[1], "gmock") != 0))
+    {
+        std::cerr << "Usage: " << argv[0] << " dump <trace>\n"
+                  << "       " << argv[0] << " gmock <trace> [mock_name]\n";
+        return 2;
+    }
+
+    try
+    {
+        TraceReader trace(argv[2]);
+        if(std::strcmp(argv[1], "dump") == 0)
+        {
+            dump(trace);
+        }
+        else
+        {
+            gmock(trace, argc > 3 ? argv[3] : "mock_bankserver");
+        }
+    }
+    catch(const std::exception& error)
+    {
+        std::cerr << error.what() << "\n";
+        return 1;
+    }
+    return 0;
+}